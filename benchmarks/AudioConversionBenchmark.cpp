@@ -0,0 +1,97 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This benchmark measures the S16_LE -> FLOAT_PLANAR conversion (the AAC encoder's input)
+ * of 48 kHz stereo periods, done by FFMPEGAudioConverter's kernels and by swr_convert(),
+ * and checks that both of them give the same samples.
+ *
+ * Usage: ./AudioConversionBenchmark [iterations]
+ *
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include "AudioFrameHolder.hpp"
+
+#define SAMPLE_RATE 48000
+// 20 ms
+#define SAMPLES_PER_PERIOD 960
+
+using namespace laav;
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsPerSample(Clock::time_point start, unsigned int iterations)
+{
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    return ns / ((double)iterations * SAMPLES_PER_PERIOD * 2);
+}
+
+static struct SwrContext* allocSwrContext()
+{
+    struct SwrContext* swrContext = swr_alloc();
+    av_opt_set_int(swrContext, "in_channel_count", 2, 0);
+    av_opt_set_int(swrContext, "in_sample_rate", SAMPLE_RATE, 0);
+    av_opt_set_sample_fmt(swrContext, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
+    av_opt_set_int(swrContext, "out_channel_count", 2, 0);
+    av_opt_set_int(swrContext, "out_sample_rate", SAMPLE_RATE, 0);
+    av_opt_set_sample_fmt(swrContext, "out_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+    if (swr_init(swrContext) < 0)
+        printAndThrowUnrecoverableError("swr_init(swrContext)");
+    return swrContext;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+
+    AudioFrame<S16_LE, SAMPLE_RATE, STEREO> period;
+    unsigned int periodSize = SAMPLES_PER_PERIOD * 2 * sizeof(int16_t);
+    ShareableAudioFrameData periodData(new unsigned char[periodSize],
+                                       std::default_delete<unsigned char[]>());
+    period.assignDataSharedPtr(periodData);
+    period.setSize(periodSize);
+    int16_t* samples = (int16_t* )period.data();
+    unsigned int n;
+    for (n = 0; n < SAMPLES_PER_PERIOD * 2; n++)
+        samples[n] = (int16_t)((n * 7919) % 65536 - 32768);
+
+    FFMPEGAudioConverter<S16_LE, SAMPLE_RATE, STEREO, FLOAT_PLANAR, SAMPLE_RATE, STEREO> aConv;
+    struct SwrContext* swrContext = allocSwrContext();
+    float* swrLeft = new float[SAMPLES_PER_PERIOD];
+    float* swrRight = new float[SAMPLES_PER_PERIOD];
+    uint8_t* swrPlanes[2] = {(uint8_t* )swrLeft, (uint8_t* )swrRight};
+    const uint8_t* input = period.data();
+
+    const AudioFrame<FLOAT_PLANAR, SAMPLE_RATE, STEREO>& converted = aConv.convert(period);
+    swr_convert(swrContext, swrPlanes, SAMPLES_PER_PERIOD, &input, SAMPLES_PER_PERIOD);
+    const float* left = (const float* )converted.plane<0>();
+    const float* right = (const float* )converted.plane<1>();
+    bool ok = converted.size<0>() == SAMPLES_PER_PERIOD * sizeof(float);
+    for (n = 0; ok && n < SAMPLES_PER_PERIOD; n++)
+        ok = std::fabs(left[n] - swrLeft[n]) < 1e-6 && std::fabs(right[n] - swrRight[n]) < 1e-6;
+    std::cout << "kernels vs swr_convert: " << (ok ? "OK" : "WRONG") << std::endl;
+
+    Clock::time_point start = Clock::now();
+    for (n = 0; n < iterations; n++)
+        aConv.convert(period);
+    std::cout << "FFMPEGAudioConverter (kernels): " << nsPerSample(start, iterations)
+              << " ns/sample" << std::endl;
+
+    start = Clock::now();
+    for (n = 0; n < iterations; n++)
+    {
+        int outSamplesNum = swr_get_out_samples(swrContext, SAMPLES_PER_PERIOD);
+        swr_convert(swrContext, swrPlanes, outSamplesNum, &input, SAMPLES_PER_PERIOD);
+    }
+    std::cout << "swr_convert:                    " << nsPerSample(start, iterations)
+              << " ns/sample" << std::endl;
+
+    swr_free(&swrContext);
+    delete[] swrLeft;
+    delete[] swrRight;
+    return ok ? 0 : 1;
+}
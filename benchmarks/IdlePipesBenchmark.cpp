@@ -0,0 +1,131 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This benchmark measures the cost of a loop's step for pipes without a new frame, which
+ * is the case of most of the steps when many pipes share a loop (each wakeup is for one
+ * of them). The pipes are:
+ *
+ *   vGrab >> vDec >> vConv >> vEnc >> vFh;
+ *                                     vFh >> vMux;
+ *
+ * with a grabber which never has a frame. The step is run:
+ *
+ *   - through the operators, which propagate the status of the pipe (no exception);
+ *   - with the exceptions that the grabber and the holder threw before (grabNextFrame()
+ *     and get(), which still throw for the users who call them directly), as a reference.
+ *
+ * Both include one run of the events loop per step.
+ *
+ * Usage: ./IdlePipesBenchmark [steps] [numOfPipes]
+ *
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include "ReplayVideoGrabber.hpp"
+
+#define WIDTH 320
+#define HEIGHT 240
+#define FPS 25
+
+using namespace laav;
+
+typedef std::chrono::steady_clock Clock;
+
+struct IdlePipe
+{
+    IdlePipe(SharedEventsCatcher& eventsCatcher) :
+        // No frame is added: the grabber has never a frame to grab
+        vGrab(eventsCatcher, FPS),
+        vEnc(DEFAULT_BITRATE, FPS, H264_ULTRAFAST, H264_DEFAULT_PROFILE)
+    {
+    }
+
+    ReplayVideoGrabber<MJPEG, WIDTH, HEIGHT> vGrab;
+    FFMPEGMJPEGDecoder<WIDTH, HEIGHT> vDec;
+    FFMPEGVideoConverter<YUV422_PLANAR, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT> vConv;
+    FFMPEGH264Encoder<YUV420_PLANAR, WIDTH, HEIGHT> vEnc;
+    VideoFrameHolder<H264, WIDTH, HEIGHT> vFh;
+    FFMPEGVideoMuxer<MPEGTS, H264, WIDTH, HEIGHT> vMux;
+};
+
+template <typename Step>
+static void measure(const std::string& name, unsigned int numOfSteps, unsigned int numOfPipes,
+                    Step step)
+{
+    unsigned int n;
+    for (n = 0; n < numOfSteps / 10; n++)
+        step();
+
+    Clock::time_point start = Clock::now();
+    for (n = 0; n < numOfSteps; n++)
+        step();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    std::cout << std::left << std::setw(26) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << ns / numOfSteps << " ns/step"
+              << std::setw(12) << ns / numOfSteps / numOfPipes << " ns/step per pipe" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int numOfSteps = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned int numOfPipes = argc > 2 ? atoi(argv[2]) : 16;
+    if (numOfPipes == 0)
+        numOfPipes = 1;
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+    std::vector<std::unique_ptr<IdlePipe> > pipes;
+    unsigned int n;
+    for (n = 0; n < numOfPipes; n++)
+        pipes.push_back(std::unique_ptr<IdlePipe>(new IdlePipe(eventsCatcher)));
+
+    std::cout << numOfPipes << " idle pipes, " << numOfSteps << " steps" << std::endl;
+
+    measure("status (operators)", numOfSteps, numOfPipes, [&]
+    {
+        unsigned int p;
+        for (p = 0; p < pipes.size(); p++)
+        {
+            IdlePipe& pipe = *pipes[p];
+            pipe.vGrab >> pipe.vDec >> pipe.vConv >> pipe.vEnc >> pipe.vFh;
+                                                                pipe.vFh >> pipe.vMux;
+        }
+        eventsCatcher->wakeUp();
+        eventsCatcher->catchNextEvent();
+    });
+
+    measure("exceptions (reference)", numOfSteps, numOfPipes, [&]
+    {
+        unsigned int p;
+        for (p = 0; p < pipes.size(); p++)
+        {
+            IdlePipe& pipe = *pipes[p];
+            try
+            {
+                pipe.vGrab.grabNextFrame();
+            }
+            catch (const MediaException& mediaException)
+            {
+                pipe.vDec.mMediaStatusInPipe = mediaException.cause();
+            }
+            pipe.vDec >> pipe.vConv >> pipe.vEnc >> pipe.vFh;
+            try
+            {
+                pipe.vMux.takeMuxableFrame(pipe.vFh.get());
+            }
+            catch (const MediaException& mediaException)
+            {
+                // End of pipe
+            }
+        }
+        eventsCatcher->wakeUp();
+        eventsCatcher->catchNextEvent();
+    });
+
+    return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This benchmark runs the pipe stages without devices: the frames come from
+ * ReplayVideoGrabber (synthetic YUYV frames, and MJPEG frames encoded from them or read
+ * from a file) and ReplayAudioGrabber (a tone), as fast as possible. Each pipe adds a
+ * stage to the previous one (the cost of a stage is the difference), and reports:
+ *
+ *   - frames/s and ns/frame
+ *   - allocations/frame: the malloc() calls (libav, x264 and libevent included) per frame
+ *
+ * The HTTP streamer's fan-out is measured with numOfClients local clients, which read
+ * (and discard) the stream at every step.
+ *
+ * Usage: ./PipeStagesBenchmark [frames] [numOfClients] [/path/to/file.mjpeg]
+ *
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "ReplayAudioGrabber.hpp"
+#include "ReplayVideoGrabber.hpp"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define FPS 25
+#define SAMPLE_RATE 44100
+#define STREAMER_PORT 8089
+
+using namespace laav;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<unsigned long> numOfAllocations(0);
+
+extern "C"
+{
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t numOfElements, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+// All the allocations of the process (libav's ones are memaligned) are counted
+void* malloc(size_t size)
+{
+    numOfAllocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t numOfElements, size_t size)
+{
+    numOfAllocations++;
+    return __libc_calloc(numOfElements, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    numOfAllocations++;
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    numOfAllocations++;
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    numOfAllocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    numOfAllocations++;
+    return __libc_memalign(alignment, size);
+}
+
+}
+
+/*
+ * Runs step() numOfFrames times, after a warm up (the encoders' delay, the first
+ * allocations of the buffers), and prints the measures.
+ */
+template <typename Step>
+static void measure(const std::string& pipeName, unsigned int numOfFrames, Step step)
+{
+    unsigned int n;
+    for (n = 0; n < FPS; n++)
+        step();
+
+    unsigned long allocations = numOfAllocations;
+    Clock::time_point start = Clock::now();
+    for (n = 0; n < numOfFrames; n++)
+        step();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    allocations = numOfAllocations - allocations;
+
+    std::cout << std::left << std::setw(44) << pipeName << std::right << std::fixed
+              << std::setprecision(1) << std::setw(10) << numOfFrames * 1e9 / ns << " frames/s"
+              << std::setw(14) << ns / numOfFrames << " ns/frame"
+              << std::setprecision(2) << std::setw(10) << (double)allocations / numOfFrames
+              << " allocations/frame" << std::endl;
+}
+
+// The MJPEG frames of the synthetic YUYV ones (one loop of them)
+static void addMJPEGFrames(ReplayVideoGrabber<YUYV422_PACKED, WIDTH, HEIGHT>& yuyvGrab,
+                           ReplayVideoGrabber<MJPEG, WIDTH, HEIGHT>& mjpegGrab)
+{
+    AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec)
+        printAndThrowUnrecoverableError("avcodec_find_encoder(AV_CODEC_ID_MJPEG)");
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    codecContext->width = WIDTH;
+    codecContext->height = HEIGHT;
+    codecContext->pix_fmt = AV_PIX_FMT_YUVJ422P;
+    codecContext->time_base = (AVRational){1, FPS};
+    if (avcodec_open2(codecContext, codec, NULL) < 0)
+        printAndThrowUnrecoverableError("avcodec_open2(codecContext, codec, NULL)");
+
+    FFMPEGVideoConverter<YUYV422_PACKED, WIDTH, HEIGHT, YUV422_PLANAR, WIDTH, HEIGHT> vConv;
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUVJ422P;
+    frame->width = WIDTH;
+    frame->height = HEIGHT;
+    frame->linesize[0] = WIDTH;
+    frame->linesize[1] = WIDTH / 2;
+    frame->linesize[2] = WIDTH / 2;
+    AVPacket* packet = av_packet_alloc();
+    unsigned int n;
+    for (n = 0; n < yuyvGrab.numOfFrames(); n++)
+    {
+        VideoFrame<YUV422_PLANAR, WIDTH, HEIGHT>& planarFrame = vConv.convert(yuyvGrab.grabNextFrame());
+        frame->data[0] = planarFrame.plane<0>();
+        frame->data[1] = planarFrame.plane<1>();
+        frame->data[2] = planarFrame.plane<2>();
+        frame->pts = n;
+        if (avcodec_send_frame(codecContext, frame) < 0)
+            printAndThrowUnrecoverableError("avcodec_send_frame(codecContext, frame)");
+        while (avcodec_receive_packet(codecContext, packet) == 0)
+        {
+            mjpegGrab.addFrame(packet->data, packet->size);
+            av_packet_unref(packet);
+        }
+    }
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+}
+
+// The clients' connections can be accepted by the loop only after this call
+static std::vector<int> connectClients(unsigned int numOfClients)
+{
+    std::vector<int> clientsFds;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(STREAMER_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::string request = "GET /stream.ts HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    unsigned int n;
+    for (n = 0; n < numOfClients; n++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr* )&address, sizeof(address)) != 0 ||
+            send(fd, request.c_str(), request.size(), 0) != (ssize_t)request.size())
+            printAndThrowUnrecoverableError("connect() (fake client)");
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        clientsFds.push_back(fd);
+    }
+    return clientsFds;
+}
+
+static unsigned long readClients(const std::vector<int>& clientsFds)
+{
+    static char buffer[64 * 1024];
+    unsigned long bytes = 0;
+    unsigned int n;
+    for (n = 0; n < clientsFds.size(); n++)
+    {
+        ssize_t readBytes;
+        while ((readBytes = recv(clientsFds[n], buffer, sizeof(buffer), 0)) > 0)
+            bytes += readBytes;
+    }
+    return bytes;
+}
+
+// The loop processes the clients' events (connections, writes) without waiting
+static void runEventsLoopOnce(SharedEventsCatcher& eventsCatcher)
+{
+    eventsCatcher->wakeUp();
+    eventsCatcher->catchNextEvent();
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int numOfFrames = argc > 1 ? atoi(argv[1]) : 500;
+    unsigned int numOfClients = argc > 2 ? atoi(argv[2]) : 10;
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    ReplayVideoGrabber<YUYV422_PACKED, WIDTH, HEIGHT> vGrab(eventsCatcher, FPS);
+    ReplayVideoGrabber<MJPEG, WIDTH, HEIGHT> mjpegGrab(eventsCatcher, FPS);
+    if (argc > 3)
+    {
+        if (mjpegGrab.loadFramesFromFile(argv[3]) == 0)
+        {
+            std::cout << "No MJPEG frame in " << argv[3] << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        vGrab.grabNextFrame();
+        addMJPEGFrames(vGrab, mjpegGrab);
+    }
+
+    std::cout << WIDTH << "x" << HEIGHT << ", " << numOfFrames << " frames per pipe" << std::endl;
+
+    measure("YUYV grab", numOfFrames, [&]
+    {
+        vGrab.grabNextFrame();
+    });
+
+    {
+        FFMPEGVideoConverter<YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT> vConv;
+        measure("  >> convert (YUV420)", numOfFrames, [&]
+        {
+            vGrab >> vConv;
+        });
+    }
+
+    {
+        FFMPEGVideoConverter<YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT> vConv;
+        FFMPEGH264Encoder<YUV420_PLANAR, WIDTH, HEIGHT>
+        vEnc(DEFAULT_BITRATE, FPS, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+        measure("  >> convert >> H264 encode", numOfFrames, [&]
+        {
+            vGrab >> vConv >> vEnc;
+        });
+    }
+
+    {
+        FFMPEGVideoConverter<YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT> vConv;
+        FFMPEGH264Encoder<YUV420_PLANAR, WIDTH, HEIGHT>
+        vEnc(DEFAULT_BITRATE, FPS, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+        FFMPEGVideoMuxer<MPEGTS, H264, WIDTH, HEIGHT> vMux(true);
+        measure("  >> convert >> H264 encode >> MPEGTS mux", numOfFrames, [&]
+        {
+            vGrab >> vConv >> vEnc >> vMux;
+        });
+    }
+
+    {
+        FFMPEGVideoConverter<YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT> vConv;
+        FFMPEGH264Encoder<YUV420_PLANAR, WIDTH, HEIGHT>
+        vEnc(DEFAULT_BITRATE, FPS, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+        HTTPVideoStreamer<MPEGTS, H264, WIDTH, HEIGHT>
+        vStream(eventsCatcher, "127.0.0.1", STREAMER_PORT);
+        if (vStream.status() != MEDIA_READY)
+        {
+            std::cout << "The streamer can't listen on port " << STREAMER_PORT << std::endl;
+            return 1;
+        }
+        std::vector<int> clientsFds = connectClients(numOfClients);
+        unsigned int n;
+        for (n = 0; n < 1000 && vStream.clientsStats().size() < numOfClients; n++)
+            runEventsLoopOnce(eventsCatcher);
+        unsigned long streamedBytes = 0;
+        std::ostringstream pipeName;
+        pipeName << "  >> convert >> H264 encode >> stream (" << vStream.clientsStats().size()
+                 << " clients)";
+        measure(pipeName.str(), numOfFrames, [&]
+        {
+            vGrab >> vConv >> vEnc >> vStream;
+            runEventsLoopOnce(eventsCatcher);
+            streamedBytes += readClients(clientsFds);
+        });
+        std::cout << "  (" << streamedBytes / (1024 * 1024) << " MiB read by the clients)" << std::endl;
+        for (n = 0; n < clientsFds.size(); n++)
+            close(clientsFds[n]);
+    }
+
+    measure("MJPEG grab", numOfFrames, [&]
+    {
+        mjpegGrab.grabNextFrame();
+    });
+
+    {
+        FFMPEGMJPEGDecoder<WIDTH, HEIGHT> vDec;
+        measure("  >> decode (YUV422)", numOfFrames, [&]
+        {
+            mjpegGrab >> vDec;
+        });
+    }
+
+    {
+        FFMPEGMJPEGDecoder<WIDTH, HEIGHT> vDec(4);
+        measure("  >> decode (YUV422, 4 frame threads)", numOfFrames, [&]
+        {
+            mjpegGrab >> vDec;
+        });
+    }
+
+    // An AAC frame is 1024 samples per channel
+    ReplayAudioGrabber<S16_LE, SAMPLE_RATE, STEREO> aGrab(eventsCatcher, 1024);
+
+    measure("S16 stereo grab (1024 samples)", numOfFrames, [&]
+    {
+        aGrab.grabNextPeriod();
+    });
+
+    {
+        FFMPEGAudioConverter<S16_LE, SAMPLE_RATE, STEREO, FLOAT_PLANAR, SAMPLE_RATE, STEREO> aConv;
+        FFMPEGADTSAACEncoder<SAMPLE_RATE, STEREO> aEnc;
+        measure("  >> convert (FLOAT_PLANAR) >> AAC encode", numOfFrames, [&]
+        {
+            aGrab >> aConv >> aEnc;
+        });
+    }
+
+    return 0;
+}
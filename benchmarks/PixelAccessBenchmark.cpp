@@ -0,0 +1,138 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This benchmark measures the per-pixel accessors (setPixelAt/pixelAt) of the planar
+ * frames against the plane spans, on a 1280x720 frame, and checks that both of them
+ * read back the written samples.
+ * 
+ * Usage: ./PixelAccessBenchmark [iterations]
+ * 
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "AllVideoCodecsAndFormats.hpp"
+
+#define WIDTH 1280
+#define HEIGHT 720
+
+using namespace laav;
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsPerPixel(Clock::time_point start, unsigned int iterations)
+{
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    return ns / ((double)iterations * WIDTH * HEIGHT);
+}
+
+template <typename VideoFrameFormat>
+static void allocatePlanes(VideoFrame<VideoFrameFormat, WIDTH, HEIGHT>& videoFrame,
+                           unsigned int size0, unsigned int size1, unsigned int size2)
+{
+    ShareableVideoFrameData plane0(new unsigned char[size0], std::default_delete<unsigned char[]>());
+    ShareableVideoFrameData plane1(new unsigned char[size1], std::default_delete<unsigned char[]>());
+    ShareableVideoFrameData plane2(new unsigned char[size2], std::default_delete<unsigned char[]>());
+    videoFrame.template assignSharedPtrForPlane<0>(plane0);
+    videoFrame.template assignSharedPtrForPlane<1>(plane1);
+    videoFrame.template assignSharedPtrForPlane<2>(plane2);
+    videoFrame.template setSize<0>(size0);
+    videoFrame.template setSize<1>(size1);
+    videoFrame.template setSize<2>(size2);
+}
+
+// Each pixel gets different samples, so that a wrong offset is detected
+template <typename VideoFrameFormat>
+static bool checkPixels(VideoFrame<VideoFrameFormat, WIDTH, HEIGHT>& videoFrame,
+                        unsigned int chromaWidthShift, unsigned int chromaHeightShift)
+{
+    YUVPixel pixel;
+    unsigned int x, y;
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+        {
+            unsigned int cx = x >> chromaWidthShift;
+            unsigned int cy = y >> chromaHeightShift;
+            pixel.set(x + y, cx * 3 + cy, cx + cy * 5);
+            videoFrame.setPixelAt(pixel, x, y);
+        }
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++)
+        {
+            unsigned int cx = x >> chromaWidthShift;
+            unsigned int cy = y >> chromaHeightShift;
+            const YUVPixel& readPixel = videoFrame.pixelAt(x, y);
+            if (readPixel.component<0>() != (unsigned char)(x + y) ||
+                readPixel.component<1>() != (unsigned char)(cx * 3 + cy) ||
+                readPixel.component<2>() != (unsigned char)(cx + cy * 5))
+                return false;
+        }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int iterations = argc > 1 ? atoi(argv[1]) : 50;
+
+    VideoFrame<YUV420_PLANAR, WIDTH, HEIGHT> yuv420Frame;
+    allocatePlanes(yuv420Frame, WIDTH * HEIGHT, WIDTH * HEIGHT / 4, WIDTH * HEIGHT / 4);
+    VideoFrame<YUV422_PLANAR, WIDTH, HEIGHT> yuv422Frame;
+    allocatePlanes(yuv422Frame, WIDTH * HEIGHT, WIDTH * HEIGHT / 2, WIDTH * HEIGHT / 2);
+    VideoFrame<YUV444_PLANAR, WIDTH, HEIGHT> yuv444Frame;
+    allocatePlanes(yuv444Frame, WIDTH * HEIGHT, WIDTH * HEIGHT, WIDTH * HEIGHT);
+    VideoFrame<NV_12_PLANAR, WIDTH, HEIGHT> nv12Frame;
+    allocatePlanes(nv12Frame, WIDTH * HEIGHT, WIDTH * HEIGHT / 2, 1);
+    VideoFrame<NV_21_PLANAR, WIDTH, HEIGHT> nv21Frame;
+    allocatePlanes(nv21Frame, WIDTH * HEIGHT, WIDTH * HEIGHT / 2, 1);
+
+    bool ok = true;
+    ok &= checkPixels(yuv420Frame, 1, 1);
+    ok &= checkPixels(yuv422Frame, 1, 0);
+    ok &= checkPixels(yuv444Frame, 0, 0);
+    ok &= checkPixels(nv12Frame, 1, 1);
+    ok &= checkPixels(nv21Frame, 1, 1);
+    std::cout << "pixelAt/setPixelAt read back: " << (ok ? "OK" : "WRONG") << std::endl;
+
+    YUVPixel pixel;
+    pixel.set(149, 43, 21);
+    unsigned int n, x, y;
+
+    Clock::time_point start = Clock::now();
+    for (n = 0; n < iterations; n++)
+        for (y = 0; y < HEIGHT; y++)
+            for (x = 0; x < WIDTH; x++)
+                yuv420Frame.setPixelAt(pixel, x, y);
+    std::cout << "setPixelAt (YUV420):       " << nsPerPixel(start, iterations) << " ns/pixel" << std::endl;
+
+    start = Clock::now();
+    for (n = 0; n < iterations; n++)
+        yuv420Frame.fillRectangle(pixel, 0, 0, WIDTH, HEIGHT);
+    std::cout << "fillRectangle (YUV420):    " << nsPerPixel(start, iterations) << " ns/pixel" << std::endl;
+
+    unsigned long sum = 0;
+    start = Clock::now();
+    for (n = 0; n < iterations; n++)
+        for (y = 0; y < HEIGHT; y++)
+            for (x = 0; x < WIDTH; x++)
+                sum += yuv420Frame.pixelAt(x, y).component<1>();
+    std::cout << "pixelAt (YUV420, U):       " << nsPerPixel(start, iterations) << " ns/pixel" << std::endl;
+
+    // The same reads, through the (vectorizable) span of the U plane
+    VideoPlaneSpan<const unsigned char, WIDTH / 2, HEIGHT / 2> uSpan =
+        static_cast<const VideoFrame<YUV420_PLANAR, WIDTH, HEIGHT>&>(yuv420Frame).planeSpan<1>();
+    start = Clock::now();
+    for (n = 0; n < iterations; n++)
+        for (y = 0; y < HEIGHT; y++)
+        {
+            const unsigned char* row = uSpan.row(y / 2);
+            for (x = 0; x < WIDTH; x++)
+                sum += row[x / 2];
+        }
+    std::cout << "planeSpan rows (YUV420, U): " << nsPerPixel(start, iterations) << " ns/pixel" << std::endl;
+
+    // Prevents the reads from being optimized out
+    std::cout << "(checksum " << sum << ")" << std::endl;
+    return ok ? 0 : 1;
+}
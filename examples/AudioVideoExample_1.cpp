@@ -111,20 +111,27 @@ int main(int argc, char** argv)
 
     while (1)
     {
-        aGrab >> aConv >> aEnc >> aFh;
-                                  aFh >> aStream_1;
-                                  aFh >> aStream_2;
-                                  aFh >> avStream_1;
-                                  aFh >> avStream_2;
-                                  
-        vGrab >> vFh_1;
-                 // H264 sub-pipe
-                 vFh_1 >> vDec >> vConv >> vEnc >> vFh_2;
-                                                   vFh_2 >> vStream_1;
-                                                   vFh_2 >> avStream_1;
-                 // MJPEG sub-pipe
-                 vFh_1 >> vStream_2;
-                 vFh_1 >> avStream_2;
+        // Only the pipes whose grabbers caught an event are executed
+        if (aGrab.isReady())
+        {
+            aGrab >> aConv >> aEnc >> aFh;
+                                      aFh >> aStream_1;
+                                      aFh >> aStream_2;
+                                      aFh >> avStream_1;
+                                      aFh >> avStream_2;
+        }
+
+        if (vGrab.isReady())
+        {
+            vGrab >> vFh_1;
+                     // H264 sub-pipe
+                     vFh_1 >> vDec >> vConv >> vEnc >> vFh_2;
+                                                       vFh_2 >> vStream_1;
+                                                       vFh_2 >> avStream_1;
+                     // MJPEG sub-pipe
+                     vFh_1 >> vStream_2;
+                     vFh_1 >> avStream_2;
+        }
 
         eventsCatcher->catchNextEvent();
     }
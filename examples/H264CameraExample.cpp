@@ -0,0 +1,60 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example grabs H264 video from a V4L camera which encodes it (I.E: an UVC camera
+ * offering the H264 format, see v4l2-ctl --list-formats) and streams it through HTTP
+ * with a MPEGTS container, without decoding and reencoding it. The camera is asked for
+ * an IDR frame when a new viewer has to wait for one.
+ * The stream's address is:
+ *
+ *   http://127.0.0.1:8080/stream.ts
+ *
+ */
+
+#include "V4L2Grabber.hpp"
+
+#define WIDTH 1280
+#define HEIGHT 720
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device [uvc-h264-extension-unit-id]"
+                  << std::endl;
+        return 1;
+    }
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    V4L2Grabber <H264, WIDTH, HEIGHT>
+    vGrab(eventsCatcher, argv[1], 30);
+
+    // For the cameras whose driver doesn't have the V4L2 control for the keyframes
+    if (argc > 2)
+        vGrab.setUVCH264ExtensionUnit(atoi(argv[2]));
+
+    VideoFrameHolder <H264, WIDTH, HEIGHT>
+    vFh;
+
+    HTTPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
+    vStream(eventsCatcher, "127.0.0.1", 8080);
+
+    while (1)
+    {
+        vGrab >> vFh;
+                 vFh >> vStream;
+
+        if (vStream.hasClientsWaitingForKeyFrame())
+            vGrab.forceKeyFrame();
+
+        eventsCatcher->catchNextEvent();
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,56 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example shows how to grab video from a V4L camera,
+ * encode (H264) and stream it as HLS, with fragmented MP4 (CMAF) segments.
+ * The segments never change, so the stream can be served through
+ * HTTP caches / CDNs. The playlist's address is:
+ * 
+ *   http://127.0.0.1:8080/stream.m3u8
+ * 
+ */
+
+#include "V4L2Grabber.hpp"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2) 
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device" << std::endl;
+        return 1;
+    }
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab(eventsCatcher, argv[1]);
+
+    FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
+    vConv;
+
+    // The segments are cut on the keyframes: a GOP of 25 frames at 25 fps
+    // gives 2 seconds segments.
+    FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vEnc(DEFAULT_BITRATE, 25, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+
+    // 2 seconds segments, 6 segments in the playlist
+    HLSVideoStreamer <FMP4, H264, WIDTH, HEIGHT>
+    vStream(eventsCatcher, "127.0.0.1", 8080, 2000, 6);
+
+    while (1)
+    {
+        vGrab >> vConv >> vEnc >> vStream;
+        
+        eventsCatcher->catchNextEvent();
+    }
+    
+    return 0;
+
+}
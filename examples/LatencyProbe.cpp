@@ -0,0 +1,102 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This tool reads the latency traces embedded in a H264/H265 MPEGTS stream (see
+ * FFMPEGVideoEncoder::setLatencyTracing()) and prints, for each frame, the time (ms)
+ * spent in each hop:
+ *
+ *   capture -> encoder: grabbing, conversions and the queues before the encoder
+ *   encoding: the encoder's delay (lookahead, frame threads, hardware queue)
+ *   encoder -> probe: muxing, streaming and network
+ *   total: from the camera's DQBUF to this host
+ *
+ * The clocks of the two hosts must be synchronized (I.E: NTP, PTP). A player adds its own
+ * buffering and decoding time. I.E:
+ *
+ *   ./LatencyProbe http://127.0.0.1:8080/stream.ts
+ *   ./LatencyProbe udp://239.0.0.1:5004
+ *
+ */
+
+#include "FFMPEGCommon.hpp"
+#include "LatencyTraceSEI.hpp"
+
+using namespace laav;
+
+static double toMs(int64_t ns)
+{
+    return ns / 1000000.0;
+}
+
+template <typename Codec>
+static void printTrace(const AVPacket& pkt)
+{
+    LatencyTrace trace;
+    if (!LatencyTraceSEI::read<Codec>(pkt.data, pkt.size, trace))
+        return;
+    struct timespec dateTimeNow;
+    clock_gettime(CLOCK_REALTIME, &dateTimeNow);
+    int64_t nowTs = (int64_t)dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec;
+    std::cout << "capture -> encoder: " << toMs(trace.encoderInputDateTs - trace.captureDateTs)
+              << " encoding: " << toMs(trace.encoderOutputDateTs - trace.encoderInputDateTs)
+              << " encoder -> probe: " << toMs(nowTs - trace.encoderOutputDateTs)
+              << " total: " << toMs(nowTs - trace.captureDateTs)
+              << (pkt.flags & AV_PKT_FLAG_KEY ? " (keyframe)" : "") << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " http://host:port/stream.ts|udp://group:port"
+                  << std::endl;
+        return 1;
+    }
+
+    FFMPEGUtils::registerAll();
+    avformat_network_init();
+
+    AVFormatContext* inputContext = NULL;
+    AVDictionary* options = NULL;
+    // The packets are read as soon as they arrive
+    av_dict_set(&options, "fflags", "nobuffer", 0);
+    if (avformat_open_input(&inputContext, argv[1], NULL, &options) < 0)
+    {
+        std::cout << "Can't open " << argv[1] << std::endl;
+        return 1;
+    }
+    av_dict_free(&options);
+
+    int videoStream = av_find_best_stream(inputContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (videoStream < 0)
+    {
+        std::cout << "The input has no video" << std::endl;
+        return 1;
+    }
+    enum AVCodecID codecId = inputContext->streams[videoStream]->codecpar->codec_id;
+    if (codecId != AV_CODEC_ID_H264 && codecId != AV_CODEC_ID_HEVC)
+    {
+        std::cout << "The input's video isn't H264 or H265" << std::endl;
+        return 1;
+    }
+
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    while (av_read_frame(inputContext, &pkt) >= 0)
+    {
+        if (pkt.stream_index == videoStream)
+        {
+            if (codecId == AV_CODEC_ID_H264)
+                printTrace<H264>(pkt);
+            else
+                printTrace<H265>(pkt);
+        }
+        av_packet_unref(&pkt);
+    }
+
+    avformat_close_input(&inputContext);
+    return 0;
+
+}
@@ -0,0 +1,62 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example grabs video from a V4L camera, encodes (H264) and streams it both
+ * through HTTP (MPEGTS) and to a multicast group (MPEGTS over UDP), with the pipe
+ * fused at compile time by a Pipeline (see Pipeline.hpp): the frames go from a stage
+ * to the next one by reference, the encoded frames feed both the streamers without
+ * a holder, and the pipe stops at once when the camera has no new frame.
+ *
+ *   http://127.0.0.1:8080/stream.ts
+ *   ffplay udp://239.0.0.1:5004
+ *
+ */
+
+#include "V4L2Grabber.hpp"
+#include "Pipeline.hpp"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device" << std::endl;
+        return 1;
+    }
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab(eventsCatcher, argv[1]);
+
+    FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
+    vConv;
+
+    FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vEnc(DEFAULT_BITRATE, 25, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+
+    HTTPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
+    vStream(eventsCatcher, "127.0.0.1", 8080);
+
+    UDPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
+    vUdpStream("239.0.0.1", 5004);
+
+    // Same as: vGrab >> vConv >> vEnc >> vFh; vFh >> vStream; vFh >> vUdpStream;
+    auto vPipe = makePipeline(vGrab, vConv, vEnc, makeFanOut(vStream, vUdpStream));
+
+    while (1)
+    {
+        vPipe.run();
+
+        eventsCatcher->catchNextEvent();
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,82 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example ingests the H264/AAC stream of an IP camera (RTSP), or of a file,
+ * and, without decoding and reencoding it:
+ *
+ * 1) streams it (HTTP-MPEGTS)
+ * 2) records it (MPEGTS, to remux.ts)
+ *
+ * The stream's address is:
+ *
+ *   http://127.0.0.1:8080/stream.ts
+ *
+ * The input's resolution and audio must match the ones below: I.E, for a test file:
+ *
+ *   ffmpeg -f lavfi -i testsrc=size=1280x720:rate=25 -f lavfi -i sine=sample_rate=44100 \
+ *          -ac 2 -c:v libx264 -bf 0 -c:a aac -t 60 test.mp4
+ *
+ */
+
+#include "FFMPEGDemuxerSource.hpp"
+
+#define SAMPLE_RATE 44100
+#define WIDTH 1280
+#define HEIGHT 720
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " rtsp://camera/stream|/path/to/file.mp4"
+                  << std::endl;
+        return 1;
+    }
+
+    std::string url = argv[1];
+    // A file is replayed at the pace of its timestamps, a live stream at the sender's one
+    bool isLive = url.find("://") != std::string::npos;
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    FFMPEGDemuxerSource <H264, WIDTH, HEIGHT, ADTS_AAC, SAMPLE_RATE, STEREO>
+    avSource(eventsCatcher, url, !isLive, {{"rtsp_transport", "tcp"}});
+
+    VideoFrameHolder <H264, WIDTH, HEIGHT>
+    vFh;
+
+    AudioFrameHolder <ADTS_AAC, SAMPLE_RATE, STEREO>
+    aFh;
+
+    FFMPEGAudioVideoMuxer <MPEGTS, H264, WIDTH, HEIGHT, ADTS_AAC, SAMPLE_RATE, STEREO>
+    avMux;
+
+    // The streamer shares avMux with the recording, so frames are muxed only once
+    HTTPAudioVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT, ADTS_AAC, SAMPLE_RATE, STEREO>
+    avStream(eventsCatcher, "127.0.0.1", 8080, avMux);
+
+    avMux.startMuxing("remux.ts");
+
+    while (1)
+    {
+        avSource >> vFh;
+                    vFh >> avMux >> avStream;
+        avSource >> aFh;
+                    aFh >> avMux >> avStream;
+
+        if (avSource.isInUnrecoverableState())
+        {
+            std::cout << "The input isn't H264 " << WIDTH << "x" << HEIGHT << std::endl;
+            return 1;
+        }
+
+        eventsCatcher->catchNextEvent();
+    }
+
+    return 0;
+
+}
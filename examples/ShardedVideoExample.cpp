@@ -0,0 +1,84 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example shows how to spread the events loops over the CPU cores:
+ * each of the two V4L cameras is grabbed and encoded (H264) by its own
+ * shard, and a third shard streams both (HTTP, MPEGTS container).
+ * The streams' addresses are:
+ * 
+ *   http://127.0.0.1:8080/stream.ts
+ *   http://127.0.0.1:8081/stream.ts
+ * 
+ */
+
+#include "V4L2Grabber.hpp"
+#include "FrameRing.hpp"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 3) 
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device1 /path/to/v4l/device2"
+                  << std::endl;
+        return 1;
+    }
+
+    // One thread per shard, pinned to the CPUs 0, 1 and 2
+    EventsShard captureShard1(0), captureShard2(1), streamingShard(2);
+
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab1(captureShard1.eventsCatcher(), argv[1]);
+
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab2(captureShard2.eventsCatcher(), argv[2]);
+
+    VideoFrameHolder <YUYV422_PACKED, WIDTH, HEIGHT> vFh1, vFh2;
+    VideoFrameHolder <H264, WIDTH, HEIGHT> vFh3, vFh4, vFh5, vFh6;
+
+    FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
+    vConv1, vConv2;
+
+    FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vEnc1(DEFAULT_BITRATE, 5, H264_ULTRAFAST, H264_DEFAULT_PROFILE),
+    vEnc2(DEFAULT_BITRATE, 5, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+
+    // Shard boundaries
+    VideoFrameRing <H264, WIDTH, HEIGHT> vEncodedRing1(8), vEncodedRing2(8);
+
+    HTTPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
+    vStream1(streamingShard.eventsCatcher(), "127.0.0.1", 8080),
+    vStream2(streamingShard.eventsCatcher(), "127.0.0.1", 8081);
+
+    vEncodedRing1.wakeUpOnPush(streamingShard);
+    vEncodedRing2.wakeUpOnPush(streamingShard);
+
+    // From now on, each node is accessed only by the thread of its shard
+    captureShard1.start([&]()
+    {
+        vGrab1 >> vFh1 >> vConv1 >> vEnc1 >> vFh3 >> vEncodedRing1;
+    });
+
+    captureShard2.start([&]()
+    {
+        vGrab2 >> vFh2 >> vConv2 >> vEnc2 >> vFh4 >> vEncodedRing2;
+    });
+
+    streamingShard.start([&]()
+    {
+        vEncodedRing1 >> vFh5 >> vStream1;
+        vEncodedRing2 >> vFh6 >> vStream2;
+    });
+
+    while (1)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    
+    return 0;
+
+}
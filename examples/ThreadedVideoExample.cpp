@@ -0,0 +1,71 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example shows how to grab video from a V4L camera and
+ * encode (H264) it in a worker thread, so that the main loop
+ * only grabs and streams (HTTP, MPEGTS container).
+ * The stream's address is:
+ * 
+ *   http://127.0.0.1:8080/stream.ts
+ * 
+ */
+
+#include "V4L2Grabber.hpp"
+#include "FrameRing.hpp"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2) 
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device" << std::endl;
+        return 1;
+    }
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    // Zero-copy: the grabbed frames must stay valid while the worker converts them, and
+    // their buffers are given back to the driver by the worker, when it releases them
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab(eventsCatcher, argv[1], 0, true);
+
+    VideoFrameHolder <YUYV422_PACKED, WIDTH, HEIGHT> vFh1, vFh2;
+    VideoFrameHolder <H264, WIDTH, HEIGHT> vFh3, vFh4;
+
+    // Thread boundaries
+    VideoFrameRing <YUYV422_PACKED, WIDTH, HEIGHT> vGrabbedRing(2);
+    VideoFrameRing <H264, WIDTH, HEIGHT> vEncodedRing(8);
+
+    FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
+    vConv;
+
+    FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vEnc(DEFAULT_BITRATE, 5, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+
+    HTTPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
+    vStream(eventsCatcher, "127.0.0.1", 8080);
+
+    // The converter and the encoder are accessed only by the worker's thread
+    PipeWorker vWorker([&]()
+    {
+        vGrabbedRing >> vFh2 >> vConv >> vEnc >> vFh3 >> vEncodedRing;
+    });
+    vGrabbedRing.wakeUpOnPush(vWorker);
+
+    while (1)
+    {
+        vGrab >> vFh1 >> vGrabbedRing;
+        vEncodedRing >> vFh4 >> vStream;
+
+        eventsCatcher->catchNextEvent();
+    }
+    
+    return 0;
+
+}
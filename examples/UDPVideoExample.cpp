@@ -0,0 +1,62 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example shows how to grab video from a V4L camera, encode (H264) and
+ * stream it (MPEGTS over RTP) to a multicast group, so that any number of
+ * viewers on the LAN cost a single stream:
+ *
+ *   ffplay rtp://239.0.0.1:5004
+ *
+ */
+
+#include "V4L2Grabber.hpp"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device" << std::endl;
+        return 1;
+    }
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab(eventsCatcher, argv[1]);
+
+    FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
+    vConv;
+
+    // The viewers which join the group start decoding at the next keyframe
+    FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vEnc(DEFAULT_BITRATE, 25, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+
+    // RTP, TTL 1 (the LAN only)
+    UDPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
+    vStream("239.0.0.1", 5004, true, 1);
+    // Falls back to sendmmsg() if the kernel doesn't support it
+    vStream.setSegmentationOffload(true);
+
+    if (vStream.status() != MEDIA_READY)
+    {
+        std::cerr << "UDPVideoStreamer: " << strerror(vStream.getErrno()) << std::endl;
+        return 1;
+    }
+
+    while (1)
+    {
+        vGrab >> vConv >> vEnc >> vStream;
+
+        eventsCatcher->catchNextEvent();
+    }
+
+    return 0;
+
+}
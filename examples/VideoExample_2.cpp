@@ -22,14 +22,32 @@
  * 
  *   (stop recording)
  *   curl --data "stopRecording=yes" http://127.0.0.1:8081/commands
+ *
+ *   (change the encoder's bitrate, while streaming)
+ *   curl --data "bitrate=500000" http://127.0.0.1:8081/commands
+ *
+ *   (force a keyframe)
+ *   curl --data "keyFrame=yes" http://127.0.0.1:8081/commands
  * 
  *   (exit the main loop)
  *   curl --data "stop=yes" http://127.0.0.1:8081/commands
  * 
+ * The metrics of the pipe's stages (frames, drops, latencies, clients' backlog) are
+ * served, as Prometheus text, by a HTTPMetricsServer:
+ *
+ *   curl http://127.0.0.1:8082/metrics
+ *
+ * A half-size JPEG snapshot of the latest frame (encoded on demand, and cached for
+ * 2 seconds) is served by a HTTPSnapshotServer:
+ *
+ *   curl http://127.0.0.1:8083/snapshot.jpg -o snapshot.jpg
+ *
  */
 
 #include "V4L2Grabber.hpp"
 #include "HTTPCommandsReceiver.hpp"
+#include "HTTPMetricsServer.hpp"
+#include "HTTPSnapshotServer.hpp"
 
 #define WIDTH 640
 #define HEIGHT 480
@@ -58,19 +76,29 @@ int main(int argc, char** argv)
     FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
     vConv;
 
+    VideoFrameHolder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vFh3;
+
     FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
-    vEnc(DEFAULT_BITRATE, 5, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
+    vEnc(1000000, 5, H264_ULTRAFAST, H264_DEFAULT_PROFILE);
 
     VideoFrameHolder <H264, WIDTH, HEIGHT>
     vFh2;
     
     FFMPEGVideoMuxer <MPEGTS, H264, WIDTH, HEIGHT> vMux;
     
+    // The streamer shares vMux with the recording, so frames are muxed only once
     HTTPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT>
-    vStream(eventsCatcher, addr, 8080);
+    vStream(eventsCatcher, addr, 8080, vMux);
 
     HTTPCommandsReceiver
     commandsReceiver(eventsCatcher, addr, 8081);
+
+    HTTPMetricsServer
+    metricsServer(eventsCatcher, addr, 8082);
+
+    HTTPSnapshotServer <YUV420_PLANAR, WIDTH, HEIGHT>
+    vSnapshot(eventsCatcher, addr, 8083, 2000, WIDTH/2, HEIGHT/2);
     
     /*
      * Create a green YUV pixel;
@@ -92,6 +120,10 @@ int main(int argc, char** argv)
                 vMux.startMuxing(cmds["startRecording"]);
             else if (cmds.find("stopRecording") != cmds.end())
                 vMux.stopMuxing();
+            else if (cmds.find("bitrate") != cmds.end())
+                vEnc.setBitrate(std::stoul(cmds["bitrate"]));
+            else if (cmds.find("keyFrame") != cmds.end())
+                vEnc.forceKeyFrame();
             
             commandsReceiver.clearCommands();
         }         
@@ -101,31 +133,25 @@ int main(int argc, char** argv)
 
         /* 
          * Draw a green rectangle on holded frames.
-         * The try/catch block ensures that frames are accessed
+         * The check ensures that frames are accessed
          * only when they are actually available (-> event caught) 
-         * on the pipe
+         * on the pipe (vFh1.get() would throw otherwise)
          */
-        try
+        if (vFh1.hasFrameInPipe())
         {
             VideoFrame<YUYV422_PACKED, WIDTH, HEIGHT>& grabbedFrame = vFh1.get();
-            unsigned int i;
-            for (i = WIDTH/4; i < (WIDTH - WIDTH/4); i++)
-            {
-                grabbedFrame.setPixelAt(pix, i, HEIGHT/4);
-                grabbedFrame.setPixelAt(pix, i, HEIGHT - HEIGHT/4);                
-            }
-            for (i = HEIGHT/4; i < (HEIGHT - HEIGHT/4); i++)
-            {
-                grabbedFrame.setPixelAt(pix, WIDTH/4, i);
-                grabbedFrame.setPixelAt(pix, WIDTH - WIDTH/4, i);                
-            }            
-        } 
-        catch (const MediaException& me) {}
-
-        // Complete the video pipe (encode, stream and mux to file)
-        vFh1 >> vConv >> vEnc >> vFh2;
-                                 vFh2 >> vMux;        
-                                 vFh2 >> vStream;
+            // Bulk operations: whole rows are written at once (see VideoPlaneSpan.hpp)
+            grabbedFrame.fillRectangle(pix, WIDTH/4, HEIGHT/4, WIDTH/2, 1);
+            grabbedFrame.fillRectangle(pix, WIDTH/4, HEIGHT - HEIGHT/4, WIDTH/2, 1);
+            grabbedFrame.fillRectangle(pix, WIDTH/4, HEIGHT/4, 1, HEIGHT/2);
+            grabbedFrame.fillRectangle(pix, WIDTH - WIDTH/4, HEIGHT/4, 1, HEIGHT/2);
+        }
+
+        // Complete the video pipe (encode, stream and mux to file, keep the snapshot)
+        vFh1 >> vConv >> vFh3;
+                         vFh3 >> vEnc >> vFh2;
+                                         vFh2 >> vMux >> vStream;
+                         vFh3 >> vSnapshot;
         
         eventsCatcher->catchNextEvent();
     }
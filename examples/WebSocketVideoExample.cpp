@@ -0,0 +1,59 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ * This example shows how to grab video from a V4L camera, encode (H264) and
+ * stream it to the browsers with a low latency: the stream is fragmented MP4, with
+ * a fragment per frame, sent over WebSocket and played through MSE. Open
+ * WebSocketPlayer.html (in this directory) with a browser, or point any MSE player
+ * fed by WebSocket to:
+ *
+ *   ws://127.0.0.1:8080/stream.mp4
+ *
+ * The new clients start from the GOP cached by the streamer; the shorter the GOP,
+ * the smaller is the backlog that the player has to skip on joining.
+ *
+ */
+
+#include "V4L2Grabber.hpp"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+using namespace laav;
+
+int main(int argc, char** argv)
+{
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " /path/to/v4l/device" << std::endl;
+        return 1;
+    }
+
+    SharedEventsCatcher eventsCatcher = EventsManager::createSharedEventsCatcher();
+
+    V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT>
+    vGrab(eventsCatcher, argv[1]);
+
+    FFMPEGVideoConverter <YUYV422_PACKED, WIDTH, HEIGHT, YUV420_PLANAR, WIDTH, HEIGHT>
+    vConv;
+
+    // Neither B-frames (baseline) nor lookahead: each frame is encoded as soon as it's grabbed
+    FFMPEGH264Encoder <YUV420_PLANAR, WIDTH, HEIGHT>
+    vEnc(DEFAULT_BITRATE, 25, H264_ULTRAFAST, H264_BASELINE, DEFAULT_ENCODER_THREADS,
+         true, 0);
+
+    HTTPVideoStreamer <FMP4, H264, WIDTH, HEIGHT>
+    vStream(eventsCatcher, "127.0.0.1", 8080);
+
+    while (1)
+    {
+        vGrab >> vConv >> vEnc >> vStream;
+
+        eventsCatcher->catchNextEvent();
+    }
+
+    return 0;
+
+}
@@ -17,6 +17,66 @@ class ADTS_AAC {};
 template <unsigned int audioSampleRate, enum AudioChannels audioChannels>
 class AudioFrame<ADTS_AAC, audioSampleRate, audioChannels> : public EncodedAudioFrame<ADTS_AAC> {};
 
+/*
+ * Writes the (7 bytes, without CRC) ADTS header of each AAC frame, as the "adts" muxer
+ * does, from the encoder's AudioSpecificConfig (ISO 14496-3, the codec's extradata).
+ */
+class ADTSHeaderWriter
+{
+
+public:
+
+    static const unsigned int headerSize = 7;
+    // frame_length has 13 bits
+    static const unsigned int maxFrameSize = 8191;
+
+    ADTSHeaderWriter() :
+        mFixedBits2(0),
+        mFixedBits3(0)
+    {
+    }
+
+    // Returns false if the configuration can't be carried by ADTS
+    bool configure(const unsigned char* audioSpecificConfig, unsigned int size)
+    {
+        if (!audioSpecificConfig || size < 2)
+            return false;
+        unsigned int objectType = audioSpecificConfig[0] >> 3;
+        unsigned int samplingFrequencyIndex = ((audioSpecificConfig[0] & 0x07) << 1) |
+                                              (audioSpecificConfig[1] >> 7);
+        unsigned int channelConfiguration = (audioSpecificConfig[1] >> 3) & 0x0F;
+        // profile (2 bits) = objectType - 1; no explicit frequencies
+        if (objectType < 1 || objectType > 4 || samplingFrequencyIndex > 12 ||
+            channelConfiguration > 7)
+            return false;
+        mFixedBits2 = ((objectType - 1) << 6) | (samplingFrequencyIndex << 2) |
+                      (channelConfiguration >> 2);
+        mFixedBits3 = (channelConfiguration & 0x03) << 6;
+        return true;
+    }
+
+    // payloadSize + headerSize must be <= maxFrameSize
+    void write(unsigned char* header, unsigned int payloadSize) const
+    {
+        unsigned int frameSize = payloadSize + headerSize;
+        header[0] = 0xFF;
+        // syncword, MPEG-4, layer 0, no CRC
+        header[1] = 0xF1;
+        header[2] = mFixedBits2;
+        header[3] = mFixedBits3 | (frameSize >> 11);
+        header[4] = (frameSize >> 3) & 0xFF;
+        // buffer fullness 0x7FF (VBR), one raw data block
+        header[5] = ((frameSize & 0x07) << 5) | 0x1F;
+        header[6] = 0xFC;
+    }
+
+private:
+
+    unsigned char mFixedBits2;
+    unsigned char mFixedBits3;
+
+};
+
 }
 
 #endif // ADTSAACFRAME_HPP_INCLUDED
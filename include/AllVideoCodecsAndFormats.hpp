@@ -13,8 +13,16 @@
 #include "YUV444PlanarFrame.hpp"
 #include "NV12_PlanarFrame.hpp"
 #include "NV21_PlanarFrame.hpp"
+#include "DMABufFrame.hpp"
 
 #include "FFMPEGH264Encoder.hpp"
+#include "FFMPEGH265Encoder.hpp"
+#include "FFMPEGHWH264Encoder.hpp"
+#include "FFMPEGHWH265Encoder.hpp"
 #include "FFMPEGMJPEGDecoder.hpp"
+#include "FFMPEGMultiVideoConverter.hpp"
+#include "MotionDetector.hpp"
+#include "VideoCompositor.hpp"
+#include "VideoFrameDecimator.hpp"
 
 #endif // ALLVIDEOCODECSANDFORMATS_HPP_INCLUDED
@@ -14,12 +14,17 @@ extern "C"
 #include <alsa/asoundlib.h>
 }
 
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include "AllAudioCodecsAndFormats.hpp"
 #include "Common.hpp"
+#include "DeviceBringUp.hpp"
 #include "EventsManager.hpp"
 #include "AudioFrameHolder.hpp"
+#include "AudioMixer.hpp"
+#include "AudioClock.hpp"
+#include "UserParams.hpp"
 
 namespace laav
 {
@@ -45,17 +50,41 @@ enum AlsaDeviceError
 {
     ALSA_NO_ERROR,
     SET_SND_PCM_ACCESS_RW_INTERLEAVED_ERROR,
+    SET_SND_PCM_ACCESS_MMAP_INTERLEAVED_ERROR,
     NOT_POLLABLE_DEVICE_ERROR,
     SET_SND_PCM_FORMAT_ERROR,
     SET_AUDIO_CHANNELS_ERROR,
     SET_SAMPLE_RATE_ERROR,
     SET_PERIOD_SIZE_ERROR,
+    SET_BUFFER_SIZE_ERROR,
     SET_PCM_HW_PARAMS_ERROR,
+    SET_PCM_SW_PARAMS_ERROR,
     SND_PCM_START_ERROR,
     ALSA_DEV_DISCONNECTED,
     ALSA_OPEN_DEVICE_ERROR
 };
 
+/*
+ * The grabber wakes up (and outputs a frame) once per periodsPerWakeup periods: with small
+ * periods (low latency) and periodsPerWakeup > 1, the device (I.E: an USB microphone) is
+ * read in batches, with less wakeups and less calls per sample. With maxLatencyMs > 0 the
+ * period is chosen so that a batch lasts (at most) maxLatencyMs, I.E:
+ *
+ *   // 20 ms per wakeup, 4 periods of 5 ms each, read without copies
+ *   AlsaGrabber <S16_LE, 48000, MONO> aGrab(eventsCatcher, "plughw:U0x46d0x819",
+ *                                            0, 4, ALSA_MMAP_ACCESS, 20);
+ *
+ * The frames are timestamped with the capture time of their first sample, measured by the
+ * device (snd_pcm_htimestamp, when available) and drift-corrected (see
+ * AudioClockDriftCorrector), not with the time they are grabbed at.
+ *
+ * With ALSA_MMAP_ACCESS, the grabbed frame points to the device's ring buffer, and it's
+ * valid until the next grab (like the V4L2 mmap buffers, and like the ALSA_RW_ACCESS
+ * buffer, which the next grab overwrites).
+ *
+ * As with V4L2Grabber, the device is opened, configured and started by a thread (see
+ * DeviceBringUp.hpp): the constructor and the reconnections don't block the loop.
+ */
 template <typename CodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
 class AlsaGrabber : public EventsProducer
 {
@@ -63,15 +92,28 @@ class AlsaGrabber : public EventsProducer
 public:
 
     AlsaGrabber(SharedEventsCatcher eventsCatcher,
-                const std::string& devName, snd_pcm_uframes_t samplesPerPeriod = 0):
+                const std::string& devName, snd_pcm_uframes_t samplesPerPeriod = 0,
+                unsigned int periodsPerWakeup = 1, enum AlsaAccessMode accessMode = ALSA_RW_ACCESS,
+                unsigned int maxLatencyMs = 0):
         EventsProducer::EventsProducer(eventsCatcher),
         mAlsaError(ALSA_NO_ERROR),
         mStatus(DEV_INITIALIZING),
         mErrno(0),
         mUnrecoverableState(false),
+        mCapturedRawAudioDataPtr(NULL),
         mPollFds(NULL),
+        mReconnectionInterval(250),
+        mMaxReconnectionInterval(8000),
+        mReconnectionDelay(250),
         mDevName(devName),
-        mSamplesAvaible(false)
+        mSamplesAvaible(false),
+        mAccessMode(accessMode),
+        mMaxLatencyMs(maxLatencyMs),
+        mPeriodsPerWakeup(periodsPerWakeup == 0 ? 1 : periodsPerWakeup),
+        mMmapOffset(0),
+        mMmapFrames(0),
+        mDeviceTimestamps(false),
+        mClockDriftCorrector(audioSampleRate)
     {
 
         snd_lib_error_set_handler(dontPrintErrors);
@@ -81,16 +123,23 @@ public:
         else
             mSamplesPerPeriod = samplesPerPeriod;
 
-        if (openDevice())
+        if (maxLatencyMs != 0)
         {
-            configureDevice();
-            if (!mUnrecoverableState)
-                startCapturing();
+            snd_pcm_uframes_t maxSamplesPerPeriod =
+            (snd_pcm_uframes_t)audioSampleRate * maxLatencyMs / 1000 / mPeriodsPerWakeup;
+            if (maxSamplesPerPeriod == 0)
+                maxSamplesPerPeriod = 1;
+            if (samplesPerPeriod == 0 || mSamplesPerPeriod > maxSamplesPerPeriod)
+                mSamplesPerPeriod = maxSamplesPerPeriod;
         }
+
+        makePollable(mBringUp.notificationFd());
+        bringUpDevice();
     }
 
     ~AlsaGrabber()
     {
+        mBringUp.waitForCompletion();
         closeDevice();
         snd_config_update_free_global();
     }
@@ -100,69 +149,81 @@ public:
      */
     AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>& grabNextPeriod()
     {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *grabbedAudioFrame;
+    }
+
+    /*
+     * As grabNextPeriod(), but returns NULL instead of throwing when there are no new
+     * samples (which is the case of most of the loop's steps): the operators use it.
+     */
+    AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* pollNextPeriod()
+    {
+        // The bring-up's thread owns the device
+        if (mBringUp.inProgress())
+            return NULL;
+
         if (mUnrecoverableState)
         {
-            throw MediaException(MEDIA_NO_DATA);
+            return NULL;
         }
 
         if (mPollFds == NULL)
         {
-            if (openDevice())
-            {
-                configureDevice();
-                if (!mUnrecoverableState)
-                    startCapturing();
-            }
-            else
-                throw MediaException(MEDIA_NO_DATA);
+            // The device is reopened by timeoutCallBack()
+            reconnectLater();
+            return NULL;
         }
 
-        if (mSamplesAvaible)
-        {
-            if (snd_pcm_state(mAlsaDevHandle) == SND_PCM_STATE_DISCONNECTED)
-            {
-                closeDevice();
-                mStatus = DEV_DISCONNECTED;
-                mAlsaError = ALSA_DEV_DISCONNECTED;
-                mErrno = errno;
-                throw MediaException(MEDIA_NO_DATA);
-            }
-            else
-            {
-                mAlsaError = ALSA_NO_ERROR;
-                mErrno = 0;
-                mStatus = DEV_CAN_GRAB;
-            }
-
-            observeEventsOn(mPollFds[0].fd);
-            snd_pcm_uframes_t availableSamples = snd_pcm_avail(mAlsaDevHandle);
-            if (availableSamples > mSamplesPerPeriod)
-                availableSamples = mSamplesPerPeriod;
-            mCapturedRawAudioFrame.setSize(availableSamples * 2 * (audioChannels + 1));
-            mCapturedRawAudioFrame.setTimestampsToNow();
-            int ret = snd_pcm_readi(mAlsaDevHandle, mCapturedRawAudioDataPtr, availableSamples);
-            if (ret == -EBADFD || ret == -EPIPE || ret == -ESTRPIPE)
-            {
-                throw MediaException(MEDIA_NO_DATA);
-            }
+        if (!mSamplesAvaible)
+            return NULL;
 
-            mSamplesAvaible = false;
+        if (snd_pcm_state(mAlsaDevHandle) == SND_PCM_STATE_DISCONNECTED)
+        {
+            closeDevice();
+            mStatus = DEV_DISCONNECTED;
+            mAlsaError = ALSA_DEV_DISCONNECTED;
+            mErrno = errno;
+            reconnectLater();
+            return NULL;
         }
         else
         {
-            throw MediaException(MEDIA_NO_DATA);
+            mAlsaError = ALSA_NO_ERROR;
+            mErrno = 0;
+            mStatus = DEV_CAN_GRAB;
         }
 
-        return mCapturedRawAudioFrame;
+        observeEventsOn(mPollFds[0].fd);
+        mSamplesAvaible = false;
+        bool samplesGrabbed;
+        if (mAccessMode == ALSA_MMAP_ACCESS)
+            samplesGrabbed = mapNextSamples();
+        else
+            samplesGrabbed = readNextSamples();
+        if (!samplesGrabbed)
+            return NULL;
+
+        return &mCapturedRawAudioFrame;
     }
 
     AudioFrameHolder<CodecOrFormat, audioSampleRate, audioChannels>&
     operator >>
     (AudioFrameHolder<CodecOrFormat, audioSampleRate, audioChannels>& audioFrameHolder)
     {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioFrameHolder;
+        }
         try
         {
-            audioFrameHolder.hold(grabNextPeriod());
+            audioFrameHolder.hold(*grabbedAudioFrame);
             audioFrameHolder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -177,9 +238,16 @@ public:
     operator >>
     (FFMPEGAudioEncoder<CodecOrFormat, AudioCodec, audioSampleRate, audioChannels>& audioEncoder)
     {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioEncoder;
+        }
         try
         {
-            audioEncoder.encode(grabNextPeriod());
+            audioEncoder.encode(*grabbedAudioFrame);
             audioEncoder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& e)
@@ -199,9 +267,16 @@ public:
                           ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
                           audioConverter)
     {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioConverter;
+        }
         try
         {
-            audioConverter.convert(grabNextPeriod());
+            audioConverter.convert(*grabbedAudioFrame);
             audioConverter.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -211,6 +286,29 @@ public:
         return audioConverter;
     }
 
+    AudioMixerInput<CodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioMixerInput<CodecOrFormat, audioSampleRate, audioChannels>& audioMixerInput)
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioMixerInput.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioMixerInput;
+        }
+        try
+        {
+            audioMixerInput.take(*grabbedAudioFrame);
+            audioMixerInput.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioMixerInput.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioMixerInput;
+    }
+
     enum AlsaDeviceError getAlsaError() const
     {
         return mAlsaError;
@@ -232,6 +330,9 @@ public:
         case SET_SND_PCM_ACCESS_RW_INTERLEAVED_ERROR:
             ret = "SET_SND_PCM_ACCESS_RW_INTERLEAVED_ERROR";
             break;
+        case SET_SND_PCM_ACCESS_MMAP_INTERLEAVED_ERROR:
+            ret = "SET_SND_PCM_ACCESS_MMAP_INTERLEAVED_ERROR";
+            break;
         case NOT_POLLABLE_DEVICE_ERROR:
             ret = "NOT_POLLABLE_DEVICE_ERROR";
             break;
@@ -247,9 +348,15 @@ public:
         case SET_PERIOD_SIZE_ERROR:
             ret = "SET_PERIOD_SIZE_ERROR";
             break;
+        case SET_BUFFER_SIZE_ERROR:
+            ret = "SET_BUFFER_SIZE_ERROR";
+            break;
         case SET_PCM_HW_PARAMS_ERROR:
             ret = "SET_PCM_HW_PARAMS_ERROR";
             break;
+        case SET_PCM_SW_PARAMS_ERROR:
+            ret = "SET_PCM_SW_PARAMS_ERROR";
+            break;
         case SND_PCM_START_ERROR:
             ret = "SND_PCM_START_ERROR";
             break;
@@ -273,8 +380,199 @@ public:
         return mUnrecoverableState;
     }
 
+    // See V4L2Grabber::setReconnectionInterval()
+    void setReconnectionInterval(unsigned int milliseconds, unsigned int maxMilliseconds = 8000)
+    {
+        mReconnectionInterval = milliseconds;
+        mMaxReconnectionInterval = maxMilliseconds < milliseconds ? milliseconds : maxMilliseconds;
+        mReconnectionDelay = milliseconds;
+    }
+
+    // The actual values (set by the device), valid once the device is configured (status())
+    snd_pcm_uframes_t samplesPerPeriod() const
+    {
+        return mSamplesPerPeriod;
+    }
+
+    unsigned int periodsPerWakeup() const
+    {
+        return mPeriodsPerWakeup;
+    }
+
+    // See AudioClockDriftCorrector::driftPpm()
+    double clockDriftPpm() const
+    {
+        return mClockDriftCorrector.driftPpm();
+    }
+
 private:
 
+    snd_pcm_uframes_t samplesPerWakeup() const
+    {
+        return mSamplesPerPeriod * mPeriodsPerWakeup;
+    }
+
+    // After an overrun (or a suspend), the device is restarted and the samples are lost
+    void recoverFrom(int error)
+    {
+        if (snd_pcm_recover(mAlsaDevHandle, error, 1) != 0)
+        {
+            closeDevice();
+            mStatus = DEV_DISCONNECTED;
+            mAlsaError = ALSA_DEV_DISCONNECTED;
+            mErrno = -error;
+            reconnectLater();
+        }
+        else
+            snd_pcm_start(mAlsaDevHandle);
+        mClockDriftCorrector.reset();
+    }
+
+    /*
+     * The capture time of the oldest available sample (the next one to be grabbed), on the
+     * av_gettime_relative() clock. To be called right after snd_pcm_avail[_update]().
+     */
+    int64_t oldestSampleCaptureTimestamp(snd_pcm_uframes_t availableSamples)
+    {
+        snd_htimestamp_t deviceTimestamp;
+        if (mDeviceTimestamps &&
+            snd_pcm_htimestamp(mAlsaDevHandle, &availableSamples, &deviceTimestamp) == 0 &&
+            (deviceTimestamp.tv_sec != 0 || deviceTimestamp.tv_nsec != 0))
+            return (int64_t)deviceTimestamp.tv_sec * 1000000 + deviceTimestamp.tv_nsec / 1000 -
+                   (int64_t)availableSamples * 1000000 / audioSampleRate;
+        return av_gettime_relative() - (int64_t)availableSamples * 1000000 / audioSampleRate;
+    }
+
+    // Returns false if no sample was read
+    bool readNextSamples()
+    {
+        snd_pcm_sframes_t availableSamples = snd_pcm_avail(mAlsaDevHandle);
+        if (availableSamples < 0)
+        {
+            recoverFrom(availableSamples);
+            return false;
+        }
+        if (availableSamples == 0)
+            return false;
+        int64_t captureTimestamp = oldestSampleCaptureTimestamp(availableSamples);
+        if ((snd_pcm_uframes_t)availableSamples > samplesPerWakeup())
+            availableSamples = samplesPerWakeup();
+        snd_pcm_sframes_t readSamples =
+        snd_pcm_readi(mAlsaDevHandle, mCapturedRawAudioDataPtr, availableSamples);
+        if (readSamples < 0)
+        {
+            recoverFrom(readSamples);
+            return false;
+        }
+        mCapturedRawAudioFrame.setSize(snd_pcm_frames_to_bytes(mAlsaDevHandle, readSamples));
+        mCapturedRawAudioFrame.
+        setCaptureTimestamp(mClockDriftCorrector.correct(captureTimestamp, readSamples));
+        return true;
+    }
+
+    /*
+     * The previously mapped samples are given back to the device here, so the frame
+     * points to them until the next grab. Returns false if no sample was mapped.
+     */
+    bool mapNextSamples()
+    {
+        if (mMmapFrames != 0)
+        {
+            snd_pcm_sframes_t committedSamples =
+            snd_pcm_mmap_commit(mAlsaDevHandle, mMmapOffset, mMmapFrames);
+            mMmapFrames = 0;
+            mCapturedRawAudioFrame.setSize(0);
+            if (committedSamples < 0)
+            {
+                recoverFrom(committedSamples);
+                return false;
+            }
+        }
+
+        snd_pcm_sframes_t availableSamples = snd_pcm_avail_update(mAlsaDevHandle);
+        if (availableSamples < 0)
+        {
+            recoverFrom(availableSamples);
+            return false;
+        }
+        if (availableSamples == 0)
+            return false;
+        int64_t captureTimestamp = oldestSampleCaptureTimestamp(availableSamples);
+
+        const snd_pcm_channel_area_t* areas;
+        // Less samples than the available ones, when they wrap around the ring buffer
+        mMmapFrames = (snd_pcm_uframes_t)availableSamples > samplesPerWakeup() ?
+                      samplesPerWakeup() : availableSamples;
+        int ret = snd_pcm_mmap_begin(mAlsaDevHandle, &areas, &mMmapOffset, &mMmapFrames);
+        if (ret < 0)
+        {
+            mMmapFrames = 0;
+            recoverFrom(ret);
+            return false;
+        }
+        if (mMmapFrames == 0)
+            return false;
+
+        // Interleaved: all the channels share the first area
+        unsigned char* samples = (unsigned char*)areas[0].addr + areas[0].first / 8 +
+                                 mMmapOffset * (areas[0].step / 8);
+        auto freeNothing = [](unsigned char* samples)
+        {
+        };
+        ShareableAudioFrameData mappedSamples(samples, freeNothing);
+        mCapturedRawAudioFrame.assignDataSharedPtr(mappedSamples);
+        mCapturedRawAudioFrame.setSize(snd_pcm_frames_to_bytes(mAlsaDevHandle, mMmapFrames));
+        mCapturedRawAudioFrame.
+        setCaptureTimestamp(mClockDriftCorrector.correct(captureTimestamp, mMmapFrames));
+        return true;
+    }
+
+    bool openAndStartDevice()
+    {
+        if (!openDevice())
+            return false;
+        configureDevice();
+        if (!mUnrecoverableState)
+            startCapturing();
+        return !mUnrecoverableState;
+    }
+
+    // The blocking calls of openAndStartDevice() are made by the bring-up's thread
+    void bringUpDevice()
+    {
+        mBringUp.start([this]() { return openAndStartDevice(); });
+        observeEventsOn(mBringUp.notificationFd());
+    }
+
+    // Called from the loop's thread, when the bring-up's thread is over
+    void deviceBroughtUp(bool deviceCanGrab)
+    {
+        if (!deviceCanGrab)
+        {
+            reconnectLater();
+            return;
+        }
+        mReconnectionDelay = mReconnectionInterval;
+        makePollable(mPollFds[0].fd);
+        observeEventsOn(mPollFds[0].fd);
+    }
+
+    void reconnectLater()
+    {
+        if (mUnrecoverableState || mBringUp.inProgress() || thereIsTimeoutPending())
+            return;
+        observeTimeout(mReconnectionDelay);
+        mReconnectionDelay = mReconnectionDelay * 2 > mMaxReconnectionInterval ?
+                             mMaxReconnectionInterval : mReconnectionDelay * 2;
+    }
+
+    void timeoutCallBack()
+    {
+        if (mPollFds != NULL || mUnrecoverableState || mBringUp.inProgress())
+            return;
+        bringUpDevice();
+    }
+
     static void dontPrintErrors(const char *file, int line, const char *function, int err, const char *fmt, ...)
     {
     }
@@ -300,8 +598,8 @@ private:
         }
 
         mPollFds = (pollfd* )malloc(sizeof(struct pollfd) * count);
+        // Made pollable by deviceBroughtUp(), from the loop's thread
         snd_pcm_poll_descriptors(mAlsaDevHandle, mPollFds, count);
-        makePollable(mPollFds[0].fd);
         mAlsaError = ALSA_NO_ERROR;
         mErrno = 0;
         return true;
@@ -313,9 +611,13 @@ private:
         unsigned int val;
         snd_pcm_hw_params_alloca(&mHWparams);
         snd_pcm_hw_params_any(mAlsaDevHandle, mHWparams);
-        if (snd_pcm_hw_params_set_access(mAlsaDevHandle, mHWparams, SND_PCM_ACCESS_RW_INTERLEAVED) != 0)
+        snd_pcm_access_t access = mAccessMode == ALSA_MMAP_ACCESS ?
+                                  SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED;
+        if (snd_pcm_hw_params_set_access(mAlsaDevHandle, mHWparams, access) != 0)
         {
-            mAlsaError = SET_SND_PCM_ACCESS_RW_INTERLEAVED_ERROR;
+            mAlsaError = mAccessMode == ALSA_MMAP_ACCESS ?
+                         SET_SND_PCM_ACCESS_MMAP_INTERLEAVED_ERROR :
+                         SET_SND_PCM_ACCESS_RW_INTERLEAVED_ERROR;
             mErrno = errno;
             mUnrecoverableState = true;
             return false;
@@ -361,8 +663,26 @@ private:
             << periodSize << ", which differs from wanted period size: "
             << mSamplesPerPeriod << "\n";
 
+        // The device's period can be bigger than the wanted one: a wakeup still lasts
+        // (about) maxLatencyMs
+        if (mMaxLatencyMs != 0 && periodSize > mSamplesPerPeriod)
+        {
+            unsigned int periodsPerWakeup = mSamplesPerPeriod * mPeriodsPerWakeup / periodSize;
+            mPeriodsPerWakeup = periodsPerWakeup == 0 ? 1 : periodsPerWakeup;
+        }
         mSamplesPerPeriod = periodSize;
 
+        // Room for the periods captured while the previous batch is being processed
+        snd_pcm_uframes_t bufferSize = mSamplesPerPeriod *
+                                       (mPeriodsPerWakeup * 2 > 4 ? mPeriodsPerWakeup * 2 : 4);
+        if (snd_pcm_hw_params_set_buffer_size_near(mAlsaDevHandle, mHWparams, &bufferSize) != 0)
+        {
+            mAlsaError = SET_BUFFER_SIZE_ERROR;
+            mErrno = errno;
+            mUnrecoverableState = true;
+            return false;
+        }
+
         // write the params to the driver
         if (snd_pcm_hw_params(mAlsaDevHandle, mHWparams) < 0)
         {
@@ -371,12 +691,39 @@ private:
             mUnrecoverableState = true;
             return false;
         }
-         // 2 bytes per sample * num  of channels
-        unsigned int periodBufferSize = mSamplesPerPeriod * 2 * (audioChannels + 1);
-        // TODO: manage out of memory error?
-        mCapturedRawAudioDataPtr = new unsigned char[periodBufferSize*2]();
-        fillAudioFrame(mCapturedRawAudioFrame);
-        observeEventsOn(mPollFds[0].fd);
+
+        // The device is pollable once per batch
+        snd_pcm_sw_params_t* swParams;
+        snd_pcm_sw_params_alloca(&swParams);
+        if (snd_pcm_sw_params_current(mAlsaDevHandle, swParams) < 0 ||
+            snd_pcm_sw_params_set_avail_min(mAlsaDevHandle, swParams, samplesPerWakeup()) < 0)
+        {
+            mAlsaError = SET_PCM_SW_PARAMS_ERROR;
+            mErrno = errno;
+            mUnrecoverableState = true;
+            return false;
+        }
+        // The devices' timestamps are used only if they are on the monotonic clock
+        mDeviceTimestamps =
+        snd_pcm_sw_params_set_tstamp_mode(mAlsaDevHandle, swParams, SND_PCM_TSTAMP_ENABLE) == 0 &&
+        snd_pcm_sw_params_set_tstamp_type(mAlsaDevHandle, swParams,
+                                          SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0;
+        mClockDriftCorrector.reset();
+        if (snd_pcm_sw_params(mAlsaDevHandle, swParams) < 0)
+        {
+            mAlsaError = SET_PCM_SW_PARAMS_ERROR;
+            mErrno = errno;
+            mUnrecoverableState = true;
+            return false;
+        }
+
+        if (mAccessMode == ALSA_RW_ACCESS)
+        {
+            // TODO: manage out of memory error?
+            mCapturedRawAudioDataPtr =
+            new unsigned char[snd_pcm_frames_to_bytes(mAlsaDevHandle, samplesPerWakeup())]();
+            fillAudioFrame(mCapturedRawAudioFrame);
+        }
         mStatus = DEV_CONFIGURED;
         mAlsaError = ALSA_NO_ERROR;
         mErrno = 0;
@@ -405,6 +752,9 @@ private:
     {
         if (mPollFds != NULL)
         {
+            // The mapped samples are gone with the device
+            mMmapFrames = 0;
+            mCapturedRawAudioFrame.setSize(0);
             free(mPollFds);
             mPollFds = NULL;
             snd_pcm_close(mAlsaDevHandle);
@@ -415,34 +765,53 @@ private:
 
     void fillAudioFrame(PackedRawAudioFrame& rawAudioFrame)
     {
-        unsigned int periodBufferSize = mSamplesPerPeriod * 2 * (audioChannels + 1);
-        auto freePeriodDataMemory = [periodBufferSize] (unsigned char* audioFrameDataPtr)
+        auto freePeriodDataMemory = [] (unsigned char* audioFrameDataPtr)
         {
             delete [] audioFrameDataPtr;
         };
         ShareableAudioFrameData shareablePeriodData(mCapturedRawAudioDataPtr, freePeriodDataMemory);
         rawAudioFrame.assignDataSharedPtr(shareablePeriodData);
-        rawAudioFrame.setSize(periodBufferSize);
+        rawAudioFrame.setSize(snd_pcm_frames_to_bytes(mAlsaDevHandle, samplesPerWakeup()));
     }
 
     void eventCallBack(int fd, enum EventType eventType)
     {
+        if (fd == mBringUp.notificationFd())
+        {
+            dontObserveEventsOn(fd);
+            deviceBroughtUp(mBringUp.complete());
+            return;
+        }
         mSamplesAvaible = true;
         dontObserveEventsOn(mPollFds[0].fd);
     }
 
-    enum AlsaDeviceError mAlsaError;
-    enum DeviceStatus mStatus;
-    int mErrno;
-    bool mUnrecoverableState;
+    // Also written by the bring-up's thread, while the loop can read them
+    std::atomic<enum AlsaDeviceError> mAlsaError;
+    std::atomic<enum DeviceStatus> mStatus;
+    std::atomic<int> mErrno;
+    std::atomic<bool> mUnrecoverableState;
     unsigned char* mCapturedRawAudioDataPtr;
     AudioFrame<CodecOrFormat, audioSampleRate, audioChannels> mCapturedRawAudioFrame;
     snd_pcm_hw_params_t* mHWparams;
     snd_pcm_t* mAlsaDevHandle;
     struct pollfd* mPollFds;
+    unsigned int mReconnectionInterval;
+    unsigned int mMaxReconnectionInterval;
+    unsigned int mReconnectionDelay;
     std::string mDevName;
     bool mSamplesAvaible;
     snd_pcm_uframes_t mSamplesPerPeriod;
+    enum AlsaAccessMode mAccessMode;
+    unsigned int mMaxLatencyMs;
+    unsigned int mPeriodsPerWakeup;
+    // The samples mapped by the last grab (ALSA_MMAP_ACCESS)
+    snd_pcm_uframes_t mMmapOffset;
+    snd_pcm_uframes_t mMmapFrames;
+    bool mDeviceTimestamps;
+    AudioClockDriftCorrector mClockDriftCorrector;
+    // Last member: its thread is joined before the others are destroyed
+    DeviceBringUp mBringUp;
 };
 
 }
@@ -0,0 +1,447 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef ASYNCFILEWRITER_HPP_INCLUDED
+#define ASYNCFILEWRITER_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Common.hpp"
+
+extern "C"
+{
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+}
+
+namespace laav
+{
+
+/*
+ * What write() does when all the batches are queued and the disk is still busy
+ */
+enum FullQueuePolicy
+{
+    // The oldest queued batch is discarded (the events loop never waits for the disk)
+    DROP_OLDEST_BATCH,
+    // write() waits until a batch has been written (nothing is lost)
+    STALL_UNTIL_WRITTEN
+};
+
+/*
+ * File written by a dedicated thread (requires -pthread): the data is gathered in large
+ * aligned batches, which are queued (bounded queue) and written by the thread, so that
+ * a busy disk can't stall the events loop. The thread is started by open() and stopped
+ * by close(), which writes the pending data and flushes it to the disk.
+ */
+class AsyncFileWriter
+{
+
+public:
+
+    AsyncFileWriter() :
+        mBatchSize(1024 * 1024),
+        mMaxQueuedBatches(16),
+        mRequestedBatchSize(1024 * 1024),
+        mRequestedMaxQueuedBatches(16),
+        mFullQueuePolicy(DROP_OLDEST_BATCH),
+        mFsyncIntervalMs(5000),
+        mDirectIO(false),
+        mOpenFlags(0),
+        mFd(-1),
+        mOpen(false),
+        mCurrentBatch(NULL),
+        mCurrentBatchSize(0),
+        mStop(false),
+        mDroppedBytes(0),
+        mWriteErrno(0)
+    {
+    }
+
+    ~AsyncFileWriter()
+    {
+        close();
+        freeBatches();
+    }
+
+    /*
+     * The following settings are applied by the next open() (the batching of the open file
+     * doesn't change: its batches are already allocated with its size).
+     * batchSize must be a multiple of 4096 when directIO is set; directIO (O_DIRECT)
+     * bypasses the page cache, so that the recordings don't evict the data served from it.
+     * fsyncIntervalMs == 0 disables the periodic fsync (close() still performs it).
+     */
+    void setBatching(size_t batchSize, unsigned int maxQueuedBatches)
+    {
+        mRequestedBatchSize = batchSize;
+        mRequestedMaxQueuedBatches = maxQueuedBatches;
+    }
+
+    void setFullQueuePolicy(enum FullQueuePolicy policy)
+    {
+        mFullQueuePolicy = policy;
+    }
+
+    void setFsyncInterval(unsigned int fsyncIntervalMs)
+    {
+        mFsyncIntervalMs = fsyncIntervalMs;
+    }
+
+    void setDirectIO(bool directIO)
+    {
+        mDirectIO = directIO;
+    }
+
+    bool open(const std::string& fileName)
+    {
+        close();
+        if (mRequestedBatchSize == 0 || mRequestedMaxQueuedBatches == 0 ||
+            (mDirectIO && mRequestedBatchSize % ALIGNMENT != 0))
+            printAndThrowUnrecoverableError("Invalid AsyncFileWriter batching");
+        // The thread is stopped: the batches of the previous size can be released
+        if (mRequestedBatchSize != mBatchSize)
+            freeBatches();
+        mBatchSize = mRequestedBatchSize;
+        mMaxQueuedBatches = mRequestedMaxQueuedBatches;
+        mOpenFlags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        if (mDirectIO)
+            mOpenFlags |= O_DIRECT;
+#endif
+        mFd = ::open(fileName.c_str(), mOpenFlags, 0644);
+        if (mFd == -1)
+        {
+            mWriteErrno = errno;
+            return false;
+        }
+        mOpen = true;
+        mWriteErrno = 0;
+        mDroppedBytes = 0;
+        mStop = false;
+        mCurrentBatch = takeFreeBatch();
+        mCurrentBatchSize = 0;
+        mThread = std::thread(&AsyncFileWriter::run, this);
+        return true;
+    }
+
+    bool is_open() const
+    {
+        return mOpen;
+    }
+
+    /*
+     * The data written from now on goes to a new file. Unlike close() + open(), the call
+     * doesn't wait for the disk: the current file is synced and closed by the thread, after
+     * its queued batches (the errors are reported by writeErrno()).
+     */
+    bool switchTo(const std::string& fileName)
+    {
+        // After closeLater(), the thread (and the batches) are reused
+        if (!mOpen && mThread.joinable())
+        {
+            mOpen = true;
+            mCurrentBatch = takeFreeBatch();
+            mCurrentBatchSize = 0;
+            queueBatch(NULL, 0, fileName);
+            return true;
+        }
+        if (!mOpen)
+            return open(fileName);
+        if (mCurrentBatchSize != 0)
+        {
+            queueBatch(mCurrentBatch, mCurrentBatchSize, "");
+            mCurrentBatch = takeFreeBatch();
+            mCurrentBatchSize = 0;
+        }
+        queueBatch(NULL, 0, fileName);
+        return true;
+    }
+
+    // Called by the events loop's thread: the data is copied into the current batch
+    void write(const char* data, size_t size)
+    {
+        if (!mOpen)
+            return;
+        while (size > 0)
+        {
+            size_t toCopy = std::min(size, mBatchSize - mCurrentBatchSize);
+            memcpy(mCurrentBatch + mCurrentBatchSize, data, toCopy);
+            mCurrentBatchSize += toCopy;
+            data += toCopy;
+            size -= toCopy;
+            if (mCurrentBatchSize == mBatchSize)
+            {
+                queueBatch(mCurrentBatch, mCurrentBatchSize, "");
+                mCurrentBatch = takeFreeBatch();
+                mCurrentBatchSize = 0;
+            }
+        }
+    }
+
+    /*
+     * Like switchTo(), the call doesn't wait for the disk: the file is synced and closed by
+     * the thread, after its queued batches. The thread stops with the next open() or close().
+     */
+    void closeLater()
+    {
+        if (!mOpen)
+            return;
+        queueCurrentBatch();
+        queueBatch(NULL, 0, "");
+        mOpen = false;
+    }
+
+    // Blocks until all the data is written and synced to the disk
+    void close()
+    {
+        if (mOpen)
+            queueCurrentBatch();
+        if (!mThread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mBatchQueued.notify_one();
+        mThread.join();
+        if (mFd != -1)
+            ::close(mFd);
+        mFd = -1;
+        mOpen = false;
+    }
+
+    // Bytes discarded by DROP_OLDEST_BATCH since open()
+    unsigned long droppedBytes() const
+    {
+        return mDroppedBytes.load();
+    }
+
+    // errno of the last failed write (0 if none)
+    int writeErrno() const
+    {
+        return mWriteErrno.load();
+    }
+
+private:
+
+    static const size_t ALIGNMENT = 4096;
+
+    struct Batch
+    {
+        // NULL: switch to nextFileName (empty: only close the current file)
+        char* data;
+        size_t size;
+        std::string nextFileName;
+    };
+
+    void queueCurrentBatch()
+    {
+        if (mCurrentBatchSize != 0)
+            queueBatch(mCurrentBatch, mCurrentBatchSize, "");
+        else
+            giveBackBatch(mCurrentBatch);
+        mCurrentBatch = NULL;
+        mCurrentBatchSize = 0;
+    }
+
+    char* takeFreeBatch()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mFreeBatches.empty())
+        {
+            char* batch = mFreeBatches.back();
+            mFreeBatches.pop_back();
+            return batch;
+        }
+        void* batch = NULL;
+        if (posix_memalign(&batch, ALIGNMENT, mBatchSize) != 0)
+            printAndThrowUnrecoverableError("posix_memalign(...)");
+        mAllocatedBatches.push_back((char* )batch);
+        return (char* )batch;
+    }
+
+    void giveBackBatch(char* batch)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFreeBatches.push_back(batch);
+    }
+
+    void freeBatches()
+    {
+        unsigned int n;
+        for (n = 0; n < mAllocatedBatches.size(); n++)
+            free(mAllocatedBatches[n]);
+        mAllocatedBatches.clear();
+        mFreeBatches.clear();
+    }
+
+    void queueBatch(char* data, size_t size, const std::string& nextFileName)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mQueuedBatches.size() >= mMaxQueuedBatches && data)
+        {
+            if (mFullQueuePolicy == STALL_UNTIL_WRITTEN)
+                mBatchWritten.wait(lock, [this] { return mQueuedBatches.size() < mMaxQueuedBatches; });
+            else
+            {
+                // The files' switches are never dropped
+                std::deque<Batch>::iterator it = mQueuedBatches.begin();
+                while (it != mQueuedBatches.end() && !it->data)
+                    ++it;
+                if (it != mQueuedBatches.end())
+                {
+                    mDroppedBytes += it->size;
+                    mFreeBatches.push_back(it->data);
+                    mQueuedBatches.erase(it);
+                }
+            }
+        }
+        Batch batch = {data, size, nextFileName};
+        mQueuedBatches.push_back(batch);
+        lock.unlock();
+        mBatchQueued.notify_one();
+    }
+
+    void run()
+    {
+        std::chrono::steady_clock::time_point lastFsync = std::chrono::steady_clock::now();
+        while (1)
+        {
+            Batch batch;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mBatchQueued.wait_for(lock, std::chrono::milliseconds(1000),
+                                      [this] { return !mQueuedBatches.empty() || mStop; });
+                if (mQueuedBatches.empty())
+                {
+                    if (mStop)
+                        break;
+                    lock.unlock();
+                    fsyncIfNeeded(lastFsync);
+                    continue;
+                }
+                batch = mQueuedBatches.front();
+                mQueuedBatches.pop_front();
+            }
+            if (batch.data)
+            {
+                writeBatch(batch);
+                giveBackBatch(batch.data);
+            }
+            else
+                switchFile(batch.nextFileName);
+            mBatchWritten.notify_one();
+            fsyncIfNeeded(lastFsync);
+        }
+        if (mFd != -1)
+            fsync(mFd);
+    }
+
+    void switchFile(const std::string& fileName)
+    {
+        if (mFd != -1)
+        {
+            fsync(mFd);
+            ::close(mFd);
+            mFd = -1;
+        }
+        if (fileName.empty())
+            return;
+        mFd = ::open(fileName.c_str(), mOpenFlags, 0644);
+        if (mFd == -1)
+            mWriteErrno = errno;
+    }
+
+    void writeBatch(const Batch& batch)
+    {
+        if (mFd == -1)
+            return;
+#ifdef O_DIRECT
+        int directFlags = -1;
+        if (mDirectIO && batch.size % ALIGNMENT != 0)
+        {
+            /*
+             * Last (partial) batch: O_DIRECT would refuse it. The file description keeps
+             * the flags, so they're restored after the write: nothing must depend on which
+             * batch was written last
+             */
+            directFlags = fcntl(mFd, F_GETFL);
+            if (directFlags != -1)
+                fcntl(mFd, F_SETFL, directFlags & ~O_DIRECT);
+        }
+#endif
+        size_t written = 0;
+        while (written < batch.size)
+        {
+            ssize_t ret = ::write(mFd, batch.data + written, batch.size - written);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                mWriteErrno = errno;
+                break;
+            }
+            written += ret;
+        }
+#ifdef O_DIRECT
+        if (directFlags != -1)
+            fcntl(mFd, F_SETFL, directFlags);
+#endif
+    }
+
+    void fsyncIfNeeded(std::chrono::steady_clock::time_point& lastFsync)
+    {
+        if (mFsyncIntervalMs == 0 || mFd == -1)
+            return;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - lastFsync >= std::chrono::milliseconds(mFsyncIntervalMs))
+        {
+            fdatasync(mFd);
+            lastFsync = now;
+        }
+    }
+
+    // The batching of the open file (the one of all the allocated batches)
+    size_t mBatchSize;
+    unsigned int mMaxQueuedBatches;
+    // Set by setBatching(), applied by open()
+    size_t mRequestedBatchSize;
+    unsigned int mRequestedMaxQueuedBatches;
+    enum FullQueuePolicy mFullQueuePolicy;
+    unsigned int mFsyncIntervalMs;
+    bool mDirectIO;
+    int mOpenFlags;
+    // Owned by the thread while the file is open
+    int mFd;
+    bool mOpen;
+    char* mCurrentBatch;
+    size_t mCurrentBatchSize;
+    std::deque<Batch> mQueuedBatches;
+    std::vector<char* > mFreeBatches;
+    std::vector<char* > mAllocatedBatches;
+    bool mStop;
+    std::atomic<unsigned long> mDroppedBytes;
+    std::atomic<int> mWriteErrno;
+    std::mutex mMutex;
+    std::condition_variable mBatchQueued;
+    std::condition_variable mBatchWritten;
+    std::thread mThread;
+
+};
+
+}
+
+#endif // ASYNCFILEWRITER_HPP_INCLUDED
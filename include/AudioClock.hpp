@@ -0,0 +1,101 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef AUDIOCLOCK_HPP_INCLUDED
+#define AUDIOCLOCK_HPP_INCLUDED
+
+#include <cmath>
+#include <cstdint>
+
+namespace laav
+{
+
+/*
+ * Smooths the capture timestamps of an audio device with a delay-locked loop (a second
+ * order PLL, see F. Adriaensen, "Using a DLL to filter time"): the device's sample clock
+ * and the monotonic clock never run at exactly the same speed, and the measured capture
+ * times (I.E: snd_pcm_htimestamp) carry the wakeup jitter. The loop tracks the actual
+ * duration of a sample on the monotonic clock, so the corrected timestamps advance by
+ * the number of captured samples, follow the (slow) drift of the device and stay
+ * aligned with the video ones. A gap bigger than resyncThreshold microseconds (I.E: an
+ * overrun) restarts the loop.
+ */
+class AudioClockDriftCorrector
+{
+
+public:
+
+    AudioClockDriftCorrector(unsigned int sampleRate, double bandwidthHz = 0.1,
+                             int64_t resyncThreshold = 100000) :
+        mNominalSampleDuration(1000000.0 / sampleRate),
+        mBandwidthHz(bandwidthHz),
+        mResyncThreshold(resyncThreshold),
+        mLocked(false),
+        mSampleDuration(0),
+        mNextTimestamp(0),
+        mNumOfSamples(0)
+    {
+    }
+
+    /*
+     * measuredTimestamp: the capture time of the first of numOfSamples contiguous samples
+     * (microseconds). Returns the corrected one.
+     */
+    int64_t correct(int64_t measuredTimestamp, unsigned int numOfSamples)
+    {
+        double error = measuredTimestamp - mNextTimestamp;
+        if (!mLocked || std::fabs(error) > mResyncThreshold)
+        {
+            mLocked = true;
+            mSampleDuration = mNominalSampleDuration;
+            mNextTimestamp = measuredTimestamp + numOfSamples * mSampleDuration;
+            mNumOfSamples = numOfSamples;
+            return measuredTimestamp;
+        }
+
+        // The loop's gains depend on the duration of the interval since the last update
+        double omega = 2 * M_PI * mBandwidthHz * mNumOfSamples * mSampleDuration / 1000000.0;
+        double timestamp = mNextTimestamp + std::sqrt(2.0) * omega * error;
+        mSampleDuration += omega * omega * error / mNumOfSamples;
+        // The devices' clocks are far better than 1%: anything else is a measurement error
+        if (mSampleDuration > mNominalSampleDuration * 1.01)
+            mSampleDuration = mNominalSampleDuration * 1.01;
+        if (mSampleDuration < mNominalSampleDuration * 0.99)
+            mSampleDuration = mNominalSampleDuration * 0.99;
+        mNextTimestamp = timestamp + numOfSamples * mSampleDuration;
+        mNumOfSamples = numOfSamples;
+        return (int64_t)timestamp;
+    }
+
+    void reset()
+    {
+        mLocked = false;
+    }
+
+    // How much faster (> 0) or slower than nominal the device's sample clock runs
+    double driftPpm() const
+    {
+        if (!mLocked)
+            return 0;
+        return (mNominalSampleDuration / mSampleDuration - 1) * 1000000;
+    }
+
+private:
+
+    double mNominalSampleDuration;
+    double mBandwidthHz;
+    int64_t mResyncThreshold;
+    bool mLocked;
+    // On the monotonic clock, in microseconds
+    double mSampleDuration;
+    double mNextTimestamp;
+    unsigned int mNumOfSamples;
+
+};
+
+}
+
+#endif // AUDIOCLOCK_HPP_INCLUDED
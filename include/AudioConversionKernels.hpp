@@ -0,0 +1,372 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef AUDIOCONVERSIONKERNELS_HPP_INCLUDED
+#define AUDIOCONVERSIONKERNELS_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LAAV_X86_KERNELS
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LAAV_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+namespace laav
+{
+
+class S16_LE;
+class FLOAT_PACKED;
+class FLOAT_PLANAR;
+
+/*
+ * Same-rate, same-channels conversion of numOfSamples (per channel) interleaved samples:
+ * dst[0] is the output (packed formats) or its first plane, dst[1] the second plane
+ * (planar stereo formats), as in swr_convert().
+ */
+typedef void (*AudioConversionKernel)(const uint8_t* src, uint8_t* const dst[2],
+                                      unsigned int numOfSamples, unsigned int numOfChannels);
+
+/*
+ * Hand-written kernels for the conversions which don't need any resampling (I.E: the
+ * S16_LE samples of a microphone to the FLOAT_PLANAR ones of the AAC encoder), used by
+ * FFMPEGAudioConverter instead of swr_convert(). The kernel is chosen at compile time by
+ * the formats, its SIMD version at runtime, once (AVX2 or SSE2 on x86, NEON on ARM); the
+ * scalar one handles the remaining samples. The S16 samples are scaled by 1/32768, as
+ * libswresample does.
+ */
+struct AudioConversionKernels
+{
+
+    // NULL if there's no kernel for the formats: swr_convert() must be used
+    template <typename InputFormat, typename OutputFormat>
+    static AudioConversionKernel select()
+    {
+        return NULL;
+    }
+
+    static void s16ToFloat(const uint8_t* src, uint8_t* const dst[2],
+                           unsigned int numOfSamples, unsigned int numOfChannels)
+    {
+        static const S16ToFloatKernel kernel = selectS16ToFloatKernel();
+        kernel((const int16_t* )src, (float* )dst[0], numOfSamples * numOfChannels);
+    }
+
+    static void s16ToFloatPlanar(const uint8_t* src, uint8_t* const dst[2],
+                                 unsigned int numOfSamples, unsigned int numOfChannels)
+    {
+        static const S16ToFloatStereoKernel kernel = selectS16ToFloatStereoKernel();
+        if (numOfChannels == 1)
+            s16ToFloat(src, dst, numOfSamples, numOfChannels);
+        else
+            kernel((const int16_t* )src, (float* )dst[0], (float* )dst[1], numOfSamples);
+    }
+
+    static void floatToFloatPlanar(const uint8_t* src, uint8_t* const dst[2],
+                                   unsigned int numOfSamples, unsigned int numOfChannels)
+    {
+        static const FloatStereoKernel kernel = selectFloatStereoKernel();
+        if (numOfChannels == 1)
+            memcpy(dst[0], src, numOfSamples * sizeof(float));
+        else
+            kernel((const float* )src, (float* )dst[0], (float* )dst[1], numOfSamples);
+    }
+
+private:
+
+    typedef void (*S16ToFloatKernel)(const int16_t* src, float* dst, unsigned int numOfValues);
+
+    // Interleaved stereo to 2 planes
+    typedef void (*S16ToFloatStereoKernel)(const int16_t* src, float* left, float* right,
+                                           unsigned int numOfSamples);
+
+    typedef void (*FloatStereoKernel)(const float* src, float* left, float* right,
+                                      unsigned int numOfSamples);
+
+    static S16ToFloatKernel selectS16ToFloatKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &s16ToFloatAVX2;
+        return &s16ToFloatSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &s16ToFloatNEON;
+#else
+        return &s16ToFloatScalar;
+#endif
+    }
+
+    static S16ToFloatStereoKernel selectS16ToFloatStereoKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &s16ToFloatStereoAVX2;
+        return &s16ToFloatStereoSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &s16ToFloatStereoNEON;
+#else
+        return &s16ToFloatStereoScalar;
+#endif
+    }
+
+    static FloatStereoKernel selectFloatStereoKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &floatStereoAVX2;
+        return &floatStereoSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &floatStereoNEON;
+#else
+        return &floatStereoScalar;
+#endif
+    }
+
+    // Values [fromN, numOfValues)
+    static void s16ToFloatTail(const int16_t* src, float* dst,
+                               unsigned int fromN, unsigned int numOfValues)
+    {
+        unsigned int n;
+        for (n = fromN; n < numOfValues; n++)
+            dst[n] = src[n] * (1.0f / 32768.0f);
+    }
+
+    static void s16ToFloatScalar(const int16_t* src, float* dst, unsigned int numOfValues)
+    {
+        s16ToFloatTail(src, dst, 0, numOfValues);
+    }
+
+    static void s16ToFloatStereoTail(const int16_t* src, float* left, float* right,
+                                     unsigned int fromN, unsigned int numOfSamples)
+    {
+        unsigned int n;
+        for (n = fromN; n < numOfSamples; n++)
+        {
+            left[n] = src[2 * n] * (1.0f / 32768.0f);
+            right[n] = src[2 * n + 1] * (1.0f / 32768.0f);
+        }
+    }
+
+    static void s16ToFloatStereoScalar(const int16_t* src, float* left, float* right,
+                                       unsigned int numOfSamples)
+    {
+        s16ToFloatStereoTail(src, left, right, 0, numOfSamples);
+    }
+
+    static void floatStereoTail(const float* src, float* left, float* right,
+                                unsigned int fromN, unsigned int numOfSamples)
+    {
+        unsigned int n;
+        for (n = fromN; n < numOfSamples; n++)
+        {
+            left[n] = src[2 * n];
+            right[n] = src[2 * n + 1];
+        }
+    }
+
+    static void floatStereoScalar(const float* src, float* left, float* right,
+                                  unsigned int numOfSamples)
+    {
+        floatStereoTail(src, left, right, 0, numOfSamples);
+    }
+
+#ifdef LAAV_X86_KERNELS
+
+    // The 16 bit values are sign-extended to 32 bits by unpacking them with themselves
+    __attribute__((target("sse2")))
+    static void s16ToFloatSSE2(const int16_t* src, float* dst, unsigned int numOfValues)
+    {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        unsigned int n;
+        for (n = 0; n + 8 <= numOfValues; n += 8)
+        {
+            __m128i values = _mm_loadu_si128((const __m128i* )(src + n));
+            __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+            __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+            _mm_storeu_ps(dst + n, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+            _mm_storeu_ps(dst + n + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+        }
+        s16ToFloatTail(src, dst, n, numOfValues);
+    }
+
+    __attribute__((target("avx2")))
+    static void s16ToFloatAVX2(const int16_t* src, float* dst, unsigned int numOfValues)
+    {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+        unsigned int n;
+        for (n = 0; n + 16 <= numOfValues; n += 16)
+        {
+            __m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i* )(src + n)));
+            __m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i* )(src + n + 8)));
+            _mm256_storeu_ps(dst + n, _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale));
+            _mm256_storeu_ps(dst + n + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale));
+        }
+        s16ToFloatTail(src, dst, n, numOfValues);
+    }
+
+    // 4 samples per iteration: [L0 R0 L1 R1] [L2 R2 L3 R3] -> [L0 L1 L2 L3] [R0 R1 R2 R3]
+    __attribute__((target("sse2")))
+    static void s16ToFloatStereoSSE2(const int16_t* src, float* left, float* right,
+                                     unsigned int numOfSamples)
+    {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        unsigned int n;
+        for (n = 0; n + 4 <= numOfSamples; n += 4)
+        {
+            __m128i values = _mm_loadu_si128((const __m128i* )(src + 2 * n));
+            __m128 low = _mm_mul_ps(_mm_cvtepi32_ps(
+                                    _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16)), scale);
+            __m128 high = _mm_mul_ps(_mm_cvtepi32_ps(
+                                     _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16)), scale);
+            _mm_storeu_ps(left + n, _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(right + n, _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        s16ToFloatStereoTail(src, left, right, n, numOfSamples);
+    }
+
+    // The 128 bit lanes mixed by shuffle_ps are reordered by permute4x64
+    __attribute__((target("avx2")))
+    static __m256 evenFloats(__m256 low, __m256 high)
+    {
+        __m256 even = _mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+        return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), 0xD8));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256 oddFloats(__m256 low, __m256 high)
+    {
+        __m256 odd = _mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+        return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(odd), 0xD8));
+    }
+
+    // 8 samples per iteration
+    __attribute__((target("avx2")))
+    static void s16ToFloatStereoAVX2(const int16_t* src, float* left, float* right,
+                                     unsigned int numOfSamples)
+    {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+        unsigned int n;
+        for (n = 0; n + 8 <= numOfSamples; n += 8)
+        {
+            __m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i* )(src + 2 * n)));
+            __m256i high =
+            _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i* )(src + 2 * n + 8)));
+            __m256 lowFloats = _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale);
+            __m256 highFloats = _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale);
+            _mm256_storeu_ps(left + n, evenFloats(lowFloats, highFloats));
+            _mm256_storeu_ps(right + n, oddFloats(lowFloats, highFloats));
+        }
+        s16ToFloatStereoTail(src, left, right, n, numOfSamples);
+    }
+
+    __attribute__((target("sse2")))
+    static void floatStereoSSE2(const float* src, float* left, float* right,
+                                unsigned int numOfSamples)
+    {
+        unsigned int n;
+        for (n = 0; n + 4 <= numOfSamples; n += 4)
+        {
+            __m128 low = _mm_loadu_ps(src + 2 * n);
+            __m128 high = _mm_loadu_ps(src + 2 * n + 4);
+            _mm_storeu_ps(left + n, _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(right + n, _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        floatStereoTail(src, left, right, n, numOfSamples);
+    }
+
+    __attribute__((target("avx2")))
+    static void floatStereoAVX2(const float* src, float* left, float* right,
+                                unsigned int numOfSamples)
+    {
+        unsigned int n;
+        for (n = 0; n + 8 <= numOfSamples; n += 8)
+        {
+            __m256 low = _mm256_loadu_ps(src + 2 * n);
+            __m256 high = _mm256_loadu_ps(src + 2 * n + 8);
+            _mm256_storeu_ps(left + n, evenFloats(low, high));
+            _mm256_storeu_ps(right + n, oddFloats(low, high));
+        }
+        floatStereoTail(src, left, right, n, numOfSamples);
+    }
+
+#endif // LAAV_X86_KERNELS
+
+#ifdef LAAV_NEON_KERNELS
+
+    static void s16ToFloatNEON(const int16_t* src, float* dst, unsigned int numOfValues)
+    {
+        unsigned int n;
+        for (n = 0; n + 8 <= numOfValues; n += 8)
+        {
+            int16x8_t values = vld1q_s16(src + n);
+            vst1q_f32(dst + n, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(values))),
+                                           1.0f / 32768.0f));
+            vst1q_f32(dst + n + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(values))),
+                                               1.0f / 32768.0f));
+        }
+        s16ToFloatTail(src, dst, n, numOfValues);
+    }
+
+    // vld2 splits L and R
+    static void s16ToFloatStereoNEON(const int16_t* src, float* left, float* right,
+                                     unsigned int numOfSamples)
+    {
+        unsigned int n;
+        for (n = 0; n + 4 <= numOfSamples; n += 4)
+        {
+            int16x4x2_t samples = vld2_s16(src + 2 * n);
+            vst1q_f32(left + n, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(samples.val[0])),
+                                            1.0f / 32768.0f));
+            vst1q_f32(right + n, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(samples.val[1])),
+                                             1.0f / 32768.0f));
+        }
+        s16ToFloatStereoTail(src, left, right, n, numOfSamples);
+    }
+
+    static void floatStereoNEON(const float* src, float* left, float* right,
+                                unsigned int numOfSamples)
+    {
+        unsigned int n;
+        for (n = 0; n + 4 <= numOfSamples; n += 4)
+        {
+            float32x4x2_t samples = vld2q_f32(src + 2 * n);
+            vst1q_f32(left + n, samples.val[0]);
+            vst1q_f32(right + n, samples.val[1]);
+        }
+        floatStereoTail(src, left, right, n, numOfSamples);
+    }
+
+#endif // LAAV_NEON_KERNELS
+
+};
+
+template <>
+AudioConversionKernel AudioConversionKernels::select<S16_LE, FLOAT_PACKED>()
+{
+    return &s16ToFloat;
+}
+
+template <>
+AudioConversionKernel AudioConversionKernels::select<S16_LE, FLOAT_PLANAR>()
+{
+    return &s16ToFloatPlanar;
+}
+
+template <>
+AudioConversionKernel AudioConversionKernels::select<FLOAT_PACKED, FLOAT_PLANAR>()
+{
+    return &floatToFloatPlanar;
+}
+
+}
+
+#endif // AUDIOCONVERSIONKERNELS_HPP_INCLUDED
@@ -12,6 +12,12 @@
 namespace laav
 {
 
+template <typename CodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class AudioFrameRing;
+
+template <typename PCMSoundFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class AudioMixerInput;
+
 template <typename CodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
 class AudioFrameHolder
 {
@@ -33,11 +39,20 @@ public:
      */
     AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>& get()
     {
-        if (mMediaStatusInPipe != MEDIA_READY || isFrameEmpty(mAudioFrame))
+        if (!hasFrameInPipe())
             throw MediaException(MEDIA_NO_DATA);
         return mAudioFrame;
     }
 
+    /*
+     * Whether get() would return the frame: the operators check it before going on, so
+     * that the steps of the loop without a new frame don't throw (and unwind) anything
+     */
+    bool hasFrameInPipe() const
+    {
+        return mMediaStatusInPipe == MEDIA_READY && !isFrameEmpty(mAudioFrame);
+    }
+
     template <typename ConvertedPCMSoundFormat, unsigned int convertedAudioSampleRate,
               enum AudioChannels convertedAudioChannels>
     FFMPEGAudioConverter<CodecOrFormat, audioSampleRate, audioChannels,
@@ -47,9 +62,14 @@ public:
                           ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
      audioConverter)
     {
+        if (!hasFrameInPipe())
+        {
+            audioConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioConverter;
+        }
         try
         {
-            audioConverter.convert(get());
+            audioConverter.convert(mAudioFrame);
             audioConverter.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -68,9 +88,11 @@ public:
                            VideoCodec, width, height,
                            CodecOrFormat, audioSampleRate, audioChannels>& audioVideoMuxer)
     {
+        if (!hasFrameInPipe())
+            return audioVideoMuxer;
         try
         {
-            audioVideoMuxer.takeMuxableFrame(get());
+            audioVideoMuxer.takeMuxableFrame(mAudioFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -89,9 +111,11 @@ public:
                             VideoCodec, width, height,
                             CodecOrFormat, audioSampleRate, audioChannels>& httpAudioVideoStreamer)
     {
+        if (!hasFrameInPipe())
+            return httpAudioVideoStreamer;
         try
         {
-            httpAudioVideoStreamer.takeStreamableFrame(get());
+            httpAudioVideoStreamer.takeStreamableFrame(mAudioFrame);
             httpAudioVideoStreamer.streamMuxedData();
         }
         catch (const MediaException& mediaException)
@@ -107,9 +131,14 @@ public:
     operator >>
     (FFMPEGAudioEncoder<CodecOrFormat, AudioCodec, audioSampleRate, audioChannels>& audioEncoder)
     {
+        if (!hasFrameInPipe())
+        {
+            audioEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioEncoder;
+        }
         try
         {
-            audioEncoder.encode(get());
+            audioEncoder.encode(mAudioFrame);
             audioEncoder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& e)
@@ -124,9 +153,11 @@ public:
     operator >>
     (HTTPAudioStreamer<Container, CodecOrFormat, audioSampleRate, audioChannels>& httpAudioStreamer)
     {
+        if (!hasFrameInPipe())
+            return httpAudioStreamer;
         try
         {
-            httpAudioStreamer.takeStreamableFrame(get());
+            httpAudioStreamer.takeStreamableFrame(mAudioFrame);
             httpAudioStreamer.sendMuxedData();
         }
         catch (const MediaException& mediaException)
@@ -142,9 +173,11 @@ public:
     operator >>
     (FFMPEGAudioMuxer<Container, CodecOrFormat, audioSampleRate, audioChannels>& audioMuxer)
     {
+        if (!hasFrameInPipe())
+            return audioMuxer;
         try
         {
-            audioMuxer.takeMuxableFrame(get());
+            audioMuxer.takeMuxableFrame(mAudioFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -154,6 +187,45 @@ public:
         return audioMuxer;
     }
 
+    AudioMixerInput<CodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioMixerInput<CodecOrFormat, audioSampleRate, audioChannels>& audioMixerInput)
+    {
+        if (!hasFrameInPipe())
+        {
+            audioMixerInput.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioMixerInput;
+        }
+        try
+        {
+            audioMixerInput.take(mAudioFrame);
+            audioMixerInput.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioMixerInput.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioMixerInput;
+    }
+
+    // End of a pipe segment: the frame will be taken by another thread's segment
+    AudioFrameRing<CodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioFrameRing<CodecOrFormat, audioSampleRate, audioChannels>& audioFrameRing)
+    {
+        if (!hasFrameInPipe())
+            return audioFrameRing;
+        try
+        {
+            audioFrameRing.push(mAudioFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the ring is at the end of the pipe segment
+        }
+        return audioFrameRing;
+    }
+
     enum MediaStatus mMediaStatusInPipe;
 
 private:
@@ -0,0 +1,674 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef AUDIOMIXER_HPP_INCLUDED
+#define AUDIOMIXER_HPP_INCLUDED
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "AudioConversionKernels.hpp"
+#include "AudioFrameHolder.hpp"
+
+namespace laav
+{
+
+template <typename PCMSoundFormat>
+struct PCMSample;
+
+template <>
+struct PCMSample<S16_LE>
+{
+    typedef int16_t Type;
+};
+
+template <>
+struct PCMSample<FLOAT_PACKED>
+{
+    typedef float Type;
+};
+
+template <>
+struct PCMSample<FLOAT_PLANAR>
+{
+    typedef float Type;
+};
+
+/*
+ * acc += gain * src, for n samples: the S16 sums saturate (a plain saturating add when
+ * gain is 1), the float ones don't (the encoders clip them). The SIMD version is chosen
+ * at runtime, once, as in AudioConversionKernels.
+ */
+struct AudioMixingKernels
+{
+
+    static void mix(int16_t* acc, const int16_t* src, float gain, unsigned int n)
+    {
+        static const S16Kernel addKernel = selectS16AddKernel();
+        static const S16ScaledKernel scaledAddKernel = selectS16ScaledAddKernel();
+        if (gain == 1)
+            addKernel(acc, src, n);
+        else
+            scaledAddKernel(acc, src, gain, n);
+    }
+
+    static void mix(float* acc, const float* src, float gain, unsigned int n)
+    {
+        static const FloatScaledKernel scaledAddKernel = selectFloatScaledAddKernel();
+        scaledAddKernel(acc, src, gain, n);
+    }
+
+private:
+
+    typedef void (*S16Kernel)(int16_t* acc, const int16_t* src, unsigned int n);
+    typedef void (*S16ScaledKernel)(int16_t* acc, const int16_t* src, float gain, unsigned int n);
+    typedef void (*FloatScaledKernel)(float* acc, const float* src, float gain, unsigned int n);
+
+    static S16Kernel selectS16AddKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &s16AddAVX2;
+        return &s16AddSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &s16AddNEON;
+#else
+        return &s16AddScalar;
+#endif
+    }
+
+    static S16ScaledKernel selectS16ScaledAddKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        return &s16ScaledAddSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &s16ScaledAddNEON;
+#else
+        return &s16ScaledAddScalar;
+#endif
+    }
+
+    static FloatScaledKernel selectFloatScaledAddKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &floatScaledAddAVX2;
+        return &floatScaledAddSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &floatScaledAddNEON;
+#else
+        return &floatScaledAddScalar;
+#endif
+    }
+
+    static int16_t saturate(int32_t value)
+    {
+        if (value > 32767)
+            return 32767;
+        if (value < -32768)
+            return -32768;
+        return value;
+    }
+
+    // Samples [fromN, n)
+    static void s16AddTail(int16_t* acc, const int16_t* src, unsigned int fromN, unsigned int n)
+    {
+        unsigned int i;
+        for (i = fromN; i < n; i++)
+            acc[i] = saturate((int32_t)acc[i] + src[i]);
+    }
+
+    static void s16AddScalar(int16_t* acc, const int16_t* src, unsigned int n)
+    {
+        s16AddTail(acc, src, 0, n);
+    }
+
+    static void s16ScaledAddTail(int16_t* acc, const int16_t* src, float gain,
+                                 unsigned int fromN, unsigned int n)
+    {
+        unsigned int i;
+        for (i = fromN; i < n; i++)
+            acc[i] = saturate((int32_t)lrintf(acc[i] + src[i] * gain));
+    }
+
+    static void s16ScaledAddScalar(int16_t* acc, const int16_t* src, float gain, unsigned int n)
+    {
+        s16ScaledAddTail(acc, src, gain, 0, n);
+    }
+
+    static void floatScaledAddTail(float* acc, const float* src, float gain,
+                                   unsigned int fromN, unsigned int n)
+    {
+        unsigned int i;
+        for (i = fromN; i < n; i++)
+            acc[i] += src[i] * gain;
+    }
+
+    static void floatScaledAddScalar(float* acc, const float* src, float gain, unsigned int n)
+    {
+        floatScaledAddTail(acc, src, gain, 0, n);
+    }
+
+#ifdef LAAV_X86_KERNELS
+
+    __attribute__((target("sse2")))
+    static void s16AddSSE2(int16_t* acc, const int16_t* src, unsigned int n)
+    {
+        unsigned int i;
+        for (i = 0; i + 8 <= n; i += 8)
+        {
+            __m128i sum = _mm_adds_epi16(_mm_loadu_si128((const __m128i* )(acc + i)),
+                                         _mm_loadu_si128((const __m128i* )(src + i)));
+            _mm_storeu_si128((__m128i* )(acc + i), sum);
+        }
+        s16AddTail(acc, src, i, n);
+    }
+
+    __attribute__((target("avx2")))
+    static void s16AddAVX2(int16_t* acc, const int16_t* src, unsigned int n)
+    {
+        unsigned int i;
+        for (i = 0; i + 16 <= n; i += 16)
+        {
+            __m256i sum = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i* )(acc + i)),
+                                            _mm256_loadu_si256((const __m256i* )(src + i)));
+            _mm256_storeu_si256((__m256i* )(acc + i), sum);
+        }
+        s16AddTail(acc, src, i, n);
+    }
+
+    // In float (rounded to nearest as lrintf), then saturated back to 16 bits by packs
+    __attribute__((target("sse2")))
+    static void s16ScaledAddSSE2(int16_t* acc, const int16_t* src, float gain, unsigned int n)
+    {
+        const __m128 gains = _mm_set1_ps(gain);
+        unsigned int i;
+        for (i = 0; i + 8 <= n; i += 8)
+        {
+            __m128i accValues = _mm_loadu_si128((const __m128i* )(acc + i));
+            __m128i srcValues = _mm_loadu_si128((const __m128i* )(src + i));
+            __m128 accLow = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(accValues, accValues), 16));
+            __m128 accHigh = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(accValues, accValues), 16));
+            __m128 srcLow = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(srcValues, srcValues), 16));
+            __m128 srcHigh = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(srcValues, srcValues), 16));
+            __m128i low = _mm_cvtps_epi32(_mm_add_ps(accLow, _mm_mul_ps(srcLow, gains)));
+            __m128i high = _mm_cvtps_epi32(_mm_add_ps(accHigh, _mm_mul_ps(srcHigh, gains)));
+            _mm_storeu_si128((__m128i* )(acc + i), _mm_packs_epi32(low, high));
+        }
+        s16ScaledAddTail(acc, src, gain, i, n);
+    }
+
+    __attribute__((target("sse2")))
+    static void floatScaledAddSSE2(float* acc, const float* src, float gain, unsigned int n)
+    {
+        const __m128 gains = _mm_set1_ps(gain);
+        unsigned int i;
+        for (i = 0; i + 4 <= n; i += 4)
+            _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                              _mm_mul_ps(_mm_loadu_ps(src + i), gains)));
+        floatScaledAddTail(acc, src, gain, i, n);
+    }
+
+    __attribute__((target("avx2")))
+    static void floatScaledAddAVX2(float* acc, const float* src, float gain, unsigned int n)
+    {
+        const __m256 gains = _mm256_set1_ps(gain);
+        unsigned int i;
+        for (i = 0; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                                    _mm256_mul_ps(_mm256_loadu_ps(src + i), gains)));
+        floatScaledAddTail(acc, src, gain, i, n);
+    }
+
+#endif // LAAV_X86_KERNELS
+
+#ifdef LAAV_NEON_KERNELS
+
+    static void s16AddNEON(int16_t* acc, const int16_t* src, unsigned int n)
+    {
+        unsigned int i;
+        for (i = 0; i + 8 <= n; i += 8)
+            vst1q_s16(acc + i, vqaddq_s16(vld1q_s16(acc + i), vld1q_s16(src + i)));
+        s16AddTail(acc, src, i, n);
+    }
+
+    static void s16ScaledAddNEON(int16_t* acc, const int16_t* src, float gain, unsigned int n)
+    {
+        unsigned int i;
+        for (i = 0; i + 4 <= n; i += 4)
+        {
+            float32x4_t sum = vmlaq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(acc + i))),
+                                          vcvtq_f32_s32(vmovl_s16(vld1_s16(src + i))), gain);
+            // vcvtq truncates: rounded to nearest as lrintf (ties apart)
+            sum = vaddq_f32(sum, vbslq_f32(vcltq_f32(sum, vdupq_n_f32(0)),
+                                           vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)));
+            vst1_s16(acc + i, vqmovn_s32(vcvtq_s32_f32(sum)));
+        }
+        s16ScaledAddTail(acc, src, gain, i, n);
+    }
+
+    static void floatScaledAddNEON(float* acc, const float* src, float gain, unsigned int n)
+    {
+        unsigned int i;
+        for (i = 0; i + 4 <= n; i += 4)
+            vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), vld1q_f32(src + i), gain));
+        floatScaledAddTail(acc, src, gain, i, n);
+    }
+
+#endif // LAAV_NEON_KERNELS
+
+};
+
+/*
+ * An input of an AudioMixer: the samples piped into it are queued, with the capture
+ * time of the first queued one, until the mixer takes them.
+ */
+template <typename PCMSoundFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class AudioMixerInput
+{
+
+    template <typename Format, unsigned int sampleRate, enum AudioChannels channels,
+              unsigned int numOfInputs>
+    friend class AudioMixer;
+
+public:
+
+    static const unsigned int numOfPlanes =
+    std::is_base_of<Planar2RawAudioFrame,
+                    AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels> >::value ?
+    audioChannels + 1 : 1;
+    // Of each plane
+    static const unsigned int bytesPerSample =
+    sizeof(typename PCMSample<PCMSoundFormat>::Type) * (audioChannels + 1) / numOfPlanes;
+
+    AudioMixerInput() :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mGain(1),
+        mFirstSampleTimestamp(AV_NOPTS_VALUE),
+        mMaxQueuedSamples(audioSampleRate)
+    {
+    }
+
+    void take(const AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>& audioFrame)
+    {
+        unsigned int numOfSamples = planeSize(audioFrame) / bytesPerSample;
+        if (numOfSamples == 0)
+            throw MediaException(MEDIA_NO_DATA);
+        if (queuedSamples() == 0)
+            mFirstSampleTimestamp = audioFrame.monotonicTimestamp();
+        unsigned int n;
+        for (n = 0; n < numOfPlanes; n++)
+        {
+            const unsigned char* samples = plane(audioFrame, n);
+            mQueuedSamples[n].insert(mQueuedSamples[n].end(), samples,
+                                     samples + numOfSamples * bytesPerSample);
+        }
+        // Nobody mixes them (I.E: the other inputs are gone): the oldest ones are dropped
+        if (queuedSamples() > mMaxQueuedSamples)
+            drop(queuedSamples() - mMaxQueuedSamples);
+    }
+
+    // 1: unchanged
+    void setGain(float gain)
+    {
+        mGain = gain;
+    }
+
+    float gain() const
+    {
+        return mGain;
+    }
+
+    unsigned int queuedSamples() const
+    {
+        return mQueuedSamples[0].size() / bytesPerSample;
+    }
+
+    // TODO: private with friend grabber, converter, holder
+    enum MediaStatus mMediaStatusInPipe;
+
+private:
+
+    static unsigned int planeSize(const PackedRawAudioFrame& audioFrame)
+    {
+        return audioFrame.size();
+    }
+
+    static unsigned int planeSize(const Planar2RawAudioFrame& audioFrame)
+    {
+        return audioFrame.size<0>();
+    }
+
+    static const unsigned char* plane(const PackedRawAudioFrame& audioFrame, unsigned int n)
+    {
+        return audioFrame.data();
+    }
+
+    static const unsigned char* plane(const Planar2RawAudioFrame& audioFrame, unsigned int n)
+    {
+        return n == 0 ? audioFrame.plane<0>() : audioFrame.plane<1>();
+    }
+
+    // The oldest numOfSamples
+    void drop(unsigned int numOfSamples)
+    {
+        if (numOfSamples > queuedSamples())
+            numOfSamples = queuedSamples();
+        unsigned int n;
+        for (n = 0; n < numOfPlanes; n++)
+            mQueuedSamples[n].erase(mQueuedSamples[n].begin(),
+                                    mQueuedSamples[n].begin() + numOfSamples * bytesPerSample);
+        if (mFirstSampleTimestamp != AV_NOPTS_VALUE)
+            mFirstSampleTimestamp += (int64_t)numOfSamples * 1000000 / audioSampleRate;
+    }
+
+    float mGain;
+    std::vector<unsigned char> mQueuedSamples[numOfPlanes];
+    // microseconds, AV_NOPTS_VALUE if unknown
+    int64_t mFirstSampleTimestamp;
+    unsigned int mMaxQueuedSamples;
+
+};
+
+/*
+ * Mixes numOfInputs streams (I.E: the microphones of a room) into one, with a gain per
+ * input (see AudioMixerInput::setGain()), I.E:
+ *
+ *   AudioMixer <S16_LE, SAMPLE_RATE, MONO, 2> aMixer;
+ *   aMixer.input(1).setGain(0.5);
+ *   ...
+ *   aGrab1 >> aMixer.input(0);
+ *   aGrab2 >> aMixer.input(1);
+ *   aMixer >> aEnc >> aStream;
+ *
+ * The inputs are aligned by the capture time of their samples (see
+ * AudioClockDriftCorrector): the late samples are dropped, and an input which starts
+ * later gets some silence first. The misalignments below alignmentToleranceMs are
+ * ignored (the inputs are mixed as contiguous streams). Each mix outputs the samples
+ * that all the inputs have; an input without samples is waited for maxWaitMs at most,
+ * then it's mixed as silence (I.E: a disconnected microphone).
+ */
+template <typename PCMSoundFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels,
+          unsigned int numOfInputs>
+class AudioMixer
+{
+
+    static_assert(numOfInputs >= 1, "AudioMixer needs at least an input");
+
+    typedef typename PCMSample<PCMSoundFormat>::Type Sample;
+    typedef AudioMixerInput<PCMSoundFormat, audioSampleRate, audioChannels> Input;
+
+public:
+
+    AudioMixer(unsigned int maxWaitMs = 100, unsigned int alignmentToleranceMs = 5) :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mMaxWaitSamples(audioSampleRate * maxWaitMs / 1000),
+        mAlignmentToleranceSamples(audioSampleRate * alignmentToleranceMs / 1000),
+        mOutputStartTimestamp(AV_NOPTS_VALUE),
+        mOutputSamples(0),
+        mMaxMixedSamples(0)
+    {
+    }
+
+    Input& input(unsigned int n)
+    {
+        if (n >= numOfInputs)
+            printAndThrowUnrecoverableError("input(n): n >= numOfInputs");
+        return mInputs[n];
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>& mix()
+    {
+        AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>* mixedAudioFrame =
+        pollMixedFrame();
+        if (!mixedAudioFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *mixedAudioFrame;
+    }
+
+    // As mix(), but returns NULL instead of throwing while waiting for the inputs
+    AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>* pollMixedFrame()
+    {
+        int64_t nextTimestamp = nextOutputTimestamp();
+        if (nextTimestamp == AV_NOPTS_VALUE)
+        {
+            // The first mix starts from the oldest input sample
+            unsigned int n;
+            for (n = 0; n < numOfInputs; n++)
+                if (mInputs[n].queuedSamples() != 0 &&
+                    mInputs[n].mFirstSampleTimestamp != AV_NOPTS_VALUE &&
+                    (nextTimestamp == AV_NOPTS_VALUE ||
+                     mInputs[n].mFirstSampleTimestamp < nextTimestamp))
+                    nextTimestamp = mInputs[n].mFirstSampleTimestamp;
+        }
+
+        unsigned int silences[numOfInputs];
+        unsigned int numOfSamples = 0;
+        unsigned int maxAvailableSamples = 0;
+        bool someInputIsEmpty = false;
+        unsigned int n;
+        for (n = 0; n < numOfInputs; n++)
+        {
+            silences[n] = align(mInputs[n], nextTimestamp);
+            unsigned int availableSamples = silences[n] + mInputs[n].queuedSamples();
+            if (mInputs[n].queuedSamples() == 0)
+            {
+                someInputIsEmpty = true;
+                continue;
+            }
+            if (numOfSamples == 0 || availableSamples < numOfSamples)
+                numOfSamples = availableSamples;
+            if (availableSamples > maxAvailableSamples)
+                maxAvailableSamples = availableSamples;
+        }
+        if (numOfSamples == 0 || (someInputIsEmpty && maxAvailableSamples < mMaxWaitSamples))
+            return NULL;
+
+        prepareMixedAudioFrame(mMixedAudioFrame, numOfSamples);
+        unsigned int plane;
+        for (plane = 0; plane < Input::numOfPlanes; plane++)
+        {
+            Sample* mixedSamples = (Sample* )mMixedSamples[plane].get();
+            memset(mixedSamples, 0, numOfSamples * Input::bytesPerSample);
+            for (n = 0; n < numOfInputs; n++)
+            {
+                Input& input = mInputs[n];
+                if (input.queuedSamples() == 0 || silences[n] >= numOfSamples)
+                    continue;
+                unsigned int inputSamples = numOfSamples - silences[n];
+                unsigned int valuesPerSample = Input::bytesPerSample / sizeof(Sample);
+                AudioMixingKernels::mix(mixedSamples + silences[n] * valuesPerSample,
+                                        (const Sample* )&input.mQueuedSamples[plane][0],
+                                        input.mGain, inputSamples * valuesPerSample);
+            }
+        }
+        for (n = 0; n < numOfInputs; n++)
+            if (silences[n] < numOfSamples)
+                mInputs[n].drop(numOfSamples - silences[n]);
+
+        if (nextTimestamp != AV_NOPTS_VALUE)
+        {
+            if (mOutputStartTimestamp == AV_NOPTS_VALUE)
+            {
+                mOutputStartTimestamp = nextTimestamp;
+                mOutputSamples = 0;
+            }
+            mMixedAudioFrame.setCaptureTimestamp(nextTimestamp);
+        }
+        else
+            mMixedAudioFrame.setTimestampsToNow();
+        mOutputSamples += numOfSamples;
+        return &mMixedAudioFrame;
+    }
+
+    template <typename AudioCodec>
+    FFMPEGAudioEncoder<PCMSoundFormat, AudioCodec, audioSampleRate, audioChannels>&
+    operator >>
+    (FFMPEGAudioEncoder<PCMSoundFormat, AudioCodec, audioSampleRate, audioChannels>& audioEncoder)
+    {
+        AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>* mixedAudioFrame =
+        pollMixedFrame();
+        if (!mixedAudioFrame)
+        {
+            audioEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioEncoder;
+        }
+        try
+        {
+            audioEncoder.encode(*mixedAudioFrame);
+            audioEncoder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioEncoder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioEncoder;
+    }
+
+    template <typename ConvertedPCMSoundFormat,
+              unsigned int convertedAudioSampleRate,
+              enum AudioChannels convertedAudioChannels>
+    FFMPEGAudioConverter<PCMSoundFormat, audioSampleRate, audioChannels,
+                         ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
+    operator >>
+    (FFMPEGAudioConverter<PCMSoundFormat, audioSampleRate, audioChannels,
+                          ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
+                          audioConverter)
+    {
+        AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>* mixedAudioFrame =
+        pollMixedFrame();
+        if (!mixedAudioFrame)
+        {
+            audioConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioConverter;
+        }
+        try
+        {
+            audioConverter.convert(*mixedAudioFrame);
+            audioConverter.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioConverter.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioConverter;
+    }
+
+    AudioFrameHolder<PCMSoundFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioFrameHolder<PCMSoundFormat, audioSampleRate, audioChannels>& audioFrameHolder)
+    {
+        AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>* mixedAudioFrame =
+        pollMixedFrame();
+        if (!mixedAudioFrame)
+        {
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioFrameHolder;
+        }
+        try
+        {
+            audioFrameHolder.hold(*mixedAudioFrame);
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioFrameHolder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioFrameHolder;
+    }
+
+    // TODO: private with friend encoder, converter
+    enum MediaStatus mMediaStatusInPipe;
+
+private:
+
+    int64_t nextOutputTimestamp() const
+    {
+        if (mOutputStartTimestamp == AV_NOPTS_VALUE)
+            return AV_NOPTS_VALUE;
+        return mOutputStartTimestamp + (int64_t)mOutputSamples * 1000000 / audioSampleRate;
+    }
+
+    /*
+     * Drops the input's samples older than nextTimestamp, or returns the number of silent
+     * samples before them (they are newer).
+     */
+    unsigned int align(Input& input, int64_t nextTimestamp)
+    {
+        if (input.queuedSamples() == 0 || nextTimestamp == AV_NOPTS_VALUE ||
+            input.mFirstSampleTimestamp == AV_NOPTS_VALUE)
+            return 0;
+        int64_t offset = (input.mFirstSampleTimestamp - nextTimestamp) * audioSampleRate / 1000000;
+        if (offset < -(int64_t)mAlignmentToleranceSamples)
+        {
+            input.drop(-offset);
+            return 0;
+        }
+        if (offset > (int64_t)mAlignmentToleranceSamples)
+            return offset;
+        return 0;
+    }
+
+    void prepareMixedAudioFrame(PackedRawAudioFrame& audioFrame, unsigned int numOfSamples)
+    {
+        allocateMixedSamples(numOfSamples);
+        audioFrame.assignDataSharedPtr(mMixedSamples[0]);
+        audioFrame.setSize(numOfSamples * Input::bytesPerSample);
+    }
+
+    void prepareMixedAudioFrame(Planar2RawAudioFrame& audioFrame, unsigned int numOfSamples)
+    {
+        allocateMixedSamples(numOfSamples);
+        audioFrame.assignSharedPtrForPlane<0>(mMixedSamples[0]);
+        audioFrame.setSize<0>(numOfSamples * Input::bytesPerSample);
+        if (Input::numOfPlanes > 1)
+        {
+            audioFrame.assignSharedPtrForPlane<1>(mMixedSamples[Input::numOfPlanes - 1]);
+            audioFrame.setSize<1>(numOfSamples * Input::bytesPerSample);
+        }
+    }
+
+    // The samples are reused by the next mix, unless someone still shares them
+    void allocateMixedSamples(unsigned int numOfSamples)
+    {
+        auto freeSamples = [](unsigned char* samples)
+        {
+            delete[] samples;
+        };
+        unsigned int plane;
+        for (plane = 0; plane < Input::numOfPlanes; plane++)
+            if (numOfSamples > mMaxMixedSamples || !mMixedSamples[plane] ||
+                mMixedSamples[plane].use_count() > 2)
+                mMixedSamples[plane] =
+                ShareableAudioFrameData(new unsigned char[(numOfSamples > mMaxMixedSamples ?
+                                                           numOfSamples : mMaxMixedSamples) *
+                                                          Input::bytesPerSample],
+                                        freeSamples);
+        if (numOfSamples > mMaxMixedSamples)
+            mMaxMixedSamples = numOfSamples;
+    }
+
+    Input mInputs[numOfInputs];
+    unsigned int mMaxWaitSamples;
+    unsigned int mAlignmentToleranceSamples;
+    // Of the first mixed sample (microseconds)
+    int64_t mOutputStartTimestamp;
+    uint64_t mOutputSamples;
+    AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels> mMixedAudioFrame;
+    ShareableAudioFrameData mMixedSamples[2];
+    unsigned int mMaxMixedSamples;
+
+};
+
+}
+
+#endif // AUDIOMIXER_HPP_INCLUDED
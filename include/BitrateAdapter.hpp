@@ -0,0 +1,122 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef BITRATEADAPTER_HPP_INCLUDED
+#define BITRATEADAPTER_HPP_INCLUDED
+
+#include <map>
+#include <string>
+#include <vector>
+#include "HTTPStreamer.hpp"
+
+namespace laav
+{
+
+/*
+ * Adapts an encoder's bitrate (see FFMPEGVideoEncoder::setBitrate()) to the connections
+ * of a streamer's clients (see HTTPStreamer::clientsStats()): once per interval, the
+ * bitrate is decreased by 25% if a client is congested (it dropped media, or more than
+ * congestionBytes are queued on its connection), otherwise it's increased by 5% of
+ * maxBitrate. The clients waiting for a keyframe (after being skipped) get an IDR
+ * frame immediately. I.E:
+ *
+ *   BitrateAdapter bitrateAdapter(300000, 2000000);
+ *   while (1)
+ *   {
+ *       vGrab >> vConv >> vEnc >> vStream;
+ *       bitrateAdapter.adapt(vEnc, vStream.clientsStats());
+ *       eventsCatcher->catchNextEvent();
+ *   }
+ *
+ * The slowest client drives the bitrate: the ones which stall are disconnected anyway
+ * (see HTTPStreamer::setClientsBackpressure()).
+ */
+class BitrateAdapter
+{
+
+public:
+
+    BitrateAdapter(unsigned int minBitrate, unsigned int maxBitrate,
+                   unsigned int intervalMs = 1000, size_t congestionBytes = 512 * 1024) :
+        mMinBitrate(minBitrate),
+        mMaxBitrate(maxBitrate),
+        mBitrate(maxBitrate),
+        mIntervalMs(intervalMs),
+        mCongestionBytes(congestionBytes),
+        mLastAdaptationTime(0)
+    {
+        if (minBitrate > maxBitrate)
+            printAndThrowUnrecoverableError("minBitrate > maxBitrate");
+    }
+
+    // Can be called at each iteration of the main loop: it does something once per interval
+    template <typename Encoder>
+    void adapt(Encoder& encoder, const std::vector<HTTPClientStats>& clientsStats)
+    {
+        int64_t now = av_gettime_relative();
+        if (mLastAdaptationTime != 0 && now - mLastAdaptationTime < (int64_t)mIntervalMs * 1000)
+            return;
+        if (mLastAdaptationTime == 0)
+            encoder.setBitrate(mBitrate);
+        mLastAdaptationTime = now;
+
+        bool congested = false;
+        bool clientsWaitForKeyFrame = false;
+        std::map<std::string, unsigned long> droppedGroupsOfChunks;
+        unsigned int n;
+        for (n = 0; n < clientsStats.size(); n++)
+        {
+            const HTTPClientStats& clientStats = clientsStats[n];
+            std::string client = clientStats.address + ":" + std::to_string(clientStats.port);
+            droppedGroupsOfChunks[client] = clientStats.droppedGroupsOfChunks;
+            std::map<std::string, unsigned long>::const_iterator previous =
+            mDroppedGroupsOfChunks.find(client);
+            if (clientStats.queuedBytes > mCongestionBytes ||
+                (previous != mDroppedGroupsOfChunks.end() ?
+                 clientStats.droppedGroupsOfChunks > previous->second :
+                 clientStats.droppedGroupsOfChunks > 0))
+                congested = true;
+            if (clientStats.waitingForKeyFrame)
+                clientsWaitForKeyFrame = true;
+        }
+        // The disconnected clients are forgotten
+        mDroppedGroupsOfChunks.swap(droppedGroupsOfChunks);
+
+        unsigned int bitrate = mBitrate;
+        if (congested)
+            bitrate = std::max(mMinBitrate, mBitrate - mBitrate / 4);
+        else
+            bitrate = std::min(mMaxBitrate, mBitrate + mMaxBitrate / 20);
+        if (bitrate != mBitrate)
+        {
+            mBitrate = bitrate;
+            encoder.setBitrate(mBitrate);
+        }
+        if (clientsWaitForKeyFrame)
+            encoder.forceKeyFrame();
+    }
+
+    unsigned int bitrate() const
+    {
+        return mBitrate;
+    }
+
+private:
+
+    unsigned int mMinBitrate;
+    unsigned int mMaxBitrate;
+    unsigned int mBitrate;
+    unsigned int mIntervalMs;
+    size_t mCongestionBytes;
+    int64_t mLastAdaptationTime;
+    // Per client ("address:port"), at the previous adaptation
+    std::map<std::string, unsigned long> mDroppedGroupsOfChunks;
+
+};
+
+}
+
+#endif // BITRATEADAPTER_HPP_INCLUDED
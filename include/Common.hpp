@@ -7,6 +7,9 @@
 #ifndef COMMON_HPP_INCLUDED
 #define COMMON_HPP_INCLUDED
 
+#include <iostream>
+#include <stdexcept>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <vector>
@@ -37,11 +40,18 @@ void printAndThrowUnrecoverableError_(const std::string& error, const std::runti
 
 #endif
 
+// Default depths of the encoders' frames rings and of the muxers' packets queues, which
+// can be set per instance (setEncodedFrameBufferSize(), setPacketsQueueSize())
 unsigned int encodedVideoFrameBufferSize = 100;
 unsigned int encodedAudioFrameBufferSize = 100;
+// Size of the muxers' AVIO buffers, and of the chunks they flush (see MuxedChunksPool.hpp).
+// It must be set before constructing the muxers
+unsigned int muxerAVIOBufferSize = 4096;
 
 unsigned int DEFAULT_BITRATE = -1;
 unsigned int DEFAULT_GOPSIZE = -1;
+unsigned int DEFAULT_ENCODER_THREADS = -1;
+unsigned int DEFAULT_LOOKAHEAD = -1;
 
 enum MediaStatus {MEDIA_READY, MEDIA_NOT_READY, MEDIA_BUFFERING, MEDIA_NO_DATA};
 
@@ -123,6 +133,8 @@ typedef std::shared_ptr<unsigned char> ShareableMuxedData;
 
 class MPEGTS {};
 class MATROSKA {};
+// Fragmented MP4 (CMAF), I.E: for HLS, see HLSVideoStreamer
+class FMP4 {};
 
 enum AudioChannels {MONO, STEREO};
 
@@ -0,0 +1,49 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef DMABUFFRAME_HPP_INCLUDED
+#define DMABUFFRAME_HPP_INCLUDED
+
+#include "Frame.hpp"
+
+namespace laav
+{
+
+// I.E: DMABUF<NV_12_PLANAR> is a NV12 frame exported as a dma-buf
+template <typename RawVideoFrameFormat>
+class DMABUF {};
+
+template <typename CodecOrFormat>
+struct IsDMABUF
+{
+    static const bool value = false;
+};
+
+template <typename RawVideoFrameFormat>
+struct IsDMABUF<DMABUF<RawVideoFrameFormat> >
+{
+    static const bool value = true;
+    typedef RawVideoFrameFormat Format;
+};
+
+template <typename RawVideoFrameFormat, unsigned int width_, unsigned int height_>
+class VideoFrame<DMABUF<RawVideoFrameFormat>, width_, height_> :
+public VideoFrameBase<width_, height_>,
+public DMABufRawVideoFrame
+{
+
+public:
+
+    VideoFrame<DMABUF<RawVideoFrameFormat>, width_, height_>() :
+        DMABufRawVideoFrame(width_, height_)
+    {
+    }
+
+};
+
+}
+
+#endif // DMABUFFRAME_HPP_INCLUDED
@@ -0,0 +1,122 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef DEVICEBRINGUP_HPP_INCLUDED
+#define DEVICEBRINGUP_HPP_INCLUDED
+
+#include <functional>
+#include <thread>
+#include "Common.hpp"
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace laav
+{
+
+/*
+ * Runs the blocking part of a device's bring-up (open, configuration, buffers
+ * allocation, start) on its own thread (requires -pthread), so that the devices of a
+ * loop are brought up in parallel and a reconnecting device never stalls the loop.
+ * The end of each bring-up is signaled on notificationFd(), which the owner observes
+ * from the loop's thread; then complete() returns the result, I.E:
+ *
+ *   makePollable(mBringUp.notificationFd());
+ *   mBringUp.start([this]() { return openAndStartDevice(); });
+ *   observeEventsOn(mBringUp.notificationFd());
+ *   ...
+ *   void eventCallBack(int fd, enum EventType eventType)
+ *   {
+ *       if (fd == mBringUp.notificationFd())
+ *       {
+ *           dontObserveEventsOn(fd);
+ *           bool deviceCanGrab = mBringUp.complete();
+ *           ...
+ *
+ * Meanwhile, the owner must not touch what the bring-up function touches, nor make
+ * the device pollable: the events containers are handled by the loop's thread only.
+ */
+class DeviceBringUp
+{
+
+public:
+
+    DeviceBringUp() :
+        mInProgress(false),
+        mSucceeded(false)
+    {
+        if (pipe(mNotificationPipe) != 0)
+            printAndThrowUnrecoverableError("pipe(mNotificationPipe)");
+        fcntl(mNotificationPipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(mNotificationPipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    ~DeviceBringUp()
+    {
+        waitForCompletion();
+        close(mNotificationPipe[0]);
+        close(mNotificationPipe[1]);
+    }
+
+    DeviceBringUp(const DeviceBringUp&) = delete;
+    DeviceBringUp& operator=(const DeviceBringUp&) = delete;
+
+    int notificationFd() const
+    {
+        return mNotificationPipe[0];
+    }
+
+    bool inProgress() const
+    {
+        return mInProgress;
+    }
+
+    void start(const std::function<bool()>& bringUp)
+    {
+        waitForCompletion();
+        mInProgress = true;
+        mSucceeded = false;
+        mThread = std::thread([this, bringUp]()
+        {
+            mSucceeded = bringUp();
+            char byte = 0;
+            if (write(mNotificationPipe[1], &byte, 1) < 0) {}
+        });
+    }
+
+    // To be called when notificationFd() is readable: returns the bring-up's result
+    bool complete()
+    {
+        char bytes[8];
+        while (read(mNotificationPipe[0], bytes, sizeof(bytes)) > 0) {}
+        waitForCompletion();
+        return mSucceeded;
+    }
+
+    // Blocks until the running bring-up (if any) ends, I.E: before closing the device
+    void waitForCompletion()
+    {
+        // After the join, all the bring-up's writes are visible to this thread
+        if (mThread.joinable())
+            mThread.join();
+        mInProgress = false;
+    }
+
+private:
+
+    bool mInProgress;
+    bool mSucceeded;
+    int mNotificationPipe[2];
+    std::thread mThread;
+
+};
+
+}
+
+#endif // DEVICEBRINGUP_HPP_INCLUDED
@@ -10,6 +10,7 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <stdint.h>
 
 extern "C"
 {
@@ -36,18 +37,64 @@ class EventsCatcher
 
 public:
 
-    void catchNextEvent()
+    // Bit of the readiness mask set when the loop is woken up by wakeUp()
+    static const uint64_t WAKE_UP_BIT = 1ULL << 63;
+
+    /*!
+     *  \brief Waits for the next events and returns the mask of the producers which
+     *         caught them (see EventsProducer::readinessBit()). I.E:
+     *
+     *   while (1)
+     *   {
+     *       if (aGrab.isReady())
+     *           aGrab >> aEnc >> aStream;
+     *       if (vGrab.isReady())
+     *           vGrab >> vConv >> vEnc >> vStream;
+     *       eventsCatcher->catchNextEvent();
+     *   }
+     */
+    uint64_t catchNextEvent()
     {
+        mReadyProducersMask = 0;
         if (mObservedEvents > 0)
             event_base_loop(mEventBase, EVLOOP_ONCE);
         else
+        {
             // PREVENTS CPU OVERLOAD WHEN THERE'S A LOOP WITHOUT FDS
-            // TODO make portable
-            sleep(1);
+            // (the wait can be interrupted by wakeUp())
+            struct timeval idleTimeout = {1, 0};
+            evtimer_add(mIdleTimeoutEventContainer, &idleTimeout);
+            event_base_loop(mEventBase, EVLOOP_ONCE);
+            evtimer_del(mIdleTimeoutEventContainer);
+        }
+        return mReadyProducersMask;
+    }
+
+    // Mask returned by the last catchNextEvent() call
+    uint64_t readyProducersMask() const
+    {
+        return mReadyProducersMask;
+    }
+
+    /*!
+     *  \brief Makes the catchNextEvent() call currently blocked (if any) return.
+     *
+     *  It is the only thread safe method: it can be called by the threads which
+     *  don't run this catcher's loop (I.E: see EventsShard.hpp).
+     */
+    void wakeUp()
+    {
+        char byte = 0;
+        // If the pipe is full, the loop is going to be woken up anyway
+        if (write(mWakeUpPipe[1], &byte, 1) < 0) {}
     }
 
     ~EventsCatcher()
     {
+        event_free(mIdleTimeoutEventContainer);
+        event_free(mWakeUpEventContainer);
+        close(mWakeUpPipe[0]);
+        close(mWakeUpPipe[1]);
         event_base_free(mEventBase);
         event_config_free(mEventBaseConfig);
     }
@@ -55,7 +102,10 @@ public:
 private:
 
     EventsCatcher():
-        mObservedEvents(0)
+        mObservedEvents(0),
+        mNumOfProducers(0),
+        // Before the first catch, all the pipes must run
+        mReadyProducersMask(~0ULL)
     {
         ignoreSigpipe();
         event_init();
@@ -64,6 +114,28 @@ private:
             printAndThrowUnrecoverableError
             ("event_config_require_features(mEventBaseConfig, EV_FEATURE_FDS) < 0");
         mEventBase = event_base_new_with_config(mEventBaseConfig);
+
+        if (pipe(mWakeUpPipe) != 0)
+            printAndThrowUnrecoverableError("pipe(mWakeUpPipe)");
+        fcntl(mWakeUpPipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(mWakeUpPipe[1], F_SETFL, O_NONBLOCK);
+        // Not counted in mObservedEvents: a loop without devices and sockets has nothing to catch
+        mWakeUpEventContainer = event_new(mEventBase, mWakeUpPipe[0], EV_READ | EV_PERSIST,
+                                          EventsCatcher::libeventWakeUpCallback, this);
+        event_add(mWakeUpEventContainer, NULL);
+        mIdleTimeoutEventContainer = evtimer_new(mEventBase,
+                                                 EventsCatcher::libeventIdleTimeoutCallback, NULL);
+    }
+
+    static void libeventWakeUpCallback(evutil_socket_t fd, short what, void *arg)
+    {
+        char bytes[64];
+        while (read(fd, bytes, sizeof(bytes)) > 0) {}
+        static_cast<EventsCatcher* >(arg)->markAsReady(WAKE_UP_BIT);
+    }
+
+    static void libeventIdleTimeoutCallback(evutil_socket_t fd, short what, void *arg)
+    {
     }
 
     struct event_base* libeventEventBase()
@@ -81,24 +153,62 @@ private:
         mObservedEvents--;
     }
 
+    // More than 63 producers share the bits: a pipe may run without data, which is harmless
+    uint64_t assignReadinessBit()
+    {
+        return 1ULL << (mNumOfProducers++ % 63);
+    }
+
+    void markAsReady(uint64_t readinessBit)
+    {
+        mReadyProducersMask |= readinessBit;
+    }
+
     unsigned int mObservedEvents;
+    unsigned int mNumOfProducers;
+    uint64_t mReadyProducersMask;
     struct event_base* mEventBase;
     struct event_config* mEventBaseConfig;
+    int mWakeUpPipe[2];
+    struct event* mWakeUpEventContainer;
+    struct event* mIdleTimeoutEventContainer;
 
 };
 
 class EventsProducer
 {
 
+public:
+
+    // Bit set in the mask returned by EventsCatcher::catchNextEvent() when this producer catches an event
+    uint64_t readinessBit() const
+    {
+        return mReadinessBit;
+    }
+
+    // True if the producer caught an event during the last EventsCatcher::catchNextEvent() call
+    bool isReady() const
+    {
+        return (mEventsCatcher->readyProducersMask() & mReadinessBit) != 0;
+    }
+
 protected:
 
     EventsProducer(std::shared_ptr<EventsCatcher> eventsCatcher):
-        mEventsCatcher(eventsCatcher)
+        mEventsCatcher(eventsCatcher),
+        mReadinessBit(eventsCatcher->assignReadinessBit()),
+        mTimeoutEventContainer(NULL)
     {
     }
 
     ~EventsProducer()
     {
+        if (mTimeoutEventContainer)
+        {
+            dontObserveTimeout();
+            event_free(mTimeoutEventContainer);
+        }
+
         using Iter = std::vector<struct event* >::iterator;
         for (Iter it = mObservedEventContainers.begin();
              it != mObservedEventContainers.end(); ++it)
@@ -128,6 +238,14 @@ protected:
 
     void makePollable(int fd)
     {
+        // I.E: the device has been reopened and got the same fd
+        std::map<int, struct event* >::iterator it = mObservedEventContainers2.find(fd);
+        if (it != mObservedEventContainers2.end())
+        {
+            if (thereAreEventsPendingOn(fd))
+                dontObserveEventsOn(fd);
+            event_free(it->second);
+        }
         struct event* eventContainer;
         eventContainer = event_new(mEventsCatcher.get()->libeventEventBase(), fd,
                                    EV_READ | EV_WRITE | EV_PERSIST,
@@ -135,6 +253,7 @@ protected:
         mObservedEventContainers2[fd] = eventContainer;
     }
 
+    // location == "": all the requests (whatever their path) are passed to hTTPConnectionCallBack()
     bool makeHTTPServerPollable(const std::string& address, const std::string& location, int port)
     {
         struct evhttp* httpEventContainer = evhttp_new(mEventsCatcher.get()->libeventEventBase());
@@ -143,8 +262,10 @@ protected:
             evhttp_free(httpEventContainer);
             return false;
         }
-        if (evhttp_set_cb(httpEventContainer, location.c_str(),
-            libEventHTTPConnectionCallBack, this) != 0)
+        if (location.empty())
+            evhttp_set_gencb(httpEventContainer, libEventHTTPConnectionCallBack, this);
+        else if (evhttp_set_cb(httpEventContainer, location.c_str(),
+                 libEventHTTPConnectionCallBack, this) != 0)
             printAndThrowUnrecoverableError
             ("evhttp_set_cb(...)");
         
@@ -165,6 +286,36 @@ protected:
         mEventsCatcher->decrementObservedEvents();
     }
 
+    /*!
+     *  \brief timeoutCallBack() will be called (once) after the given interval, unless
+     *         dontObserveTimeout() is called before. The loop doesn't sleep meanwhile,
+     *         I.E: a device can be reopened as soon as the interval expires.
+     */
+    void observeTimeout(unsigned int milliseconds)
+    {
+        if (!mTimeoutEventContainer)
+            mTimeoutEventContainer = evtimer_new(mEventsCatcher->libeventEventBase(),
+                                                 EventsProducer::libeventTimeoutCallback, this);
+        dontObserveTimeout();
+        struct timeval timeout = {milliseconds / 1000, (milliseconds % 1000) * 1000};
+        evtimer_add(mTimeoutEventContainer, &timeout);
+        mEventsCatcher->incrementObservedEvents();
+    }
+
+    void dontObserveTimeout()
+    {
+        if (!thereIsTimeoutPending())
+            return;
+        evtimer_del(mTimeoutEventContainer);
+        mEventsCatcher->decrementObservedEvents();
+    }
+
+    bool thereIsTimeoutPending()
+    {
+        return mTimeoutEventContainer &&
+               evtimer_pending(mTimeoutEventContainer, NULL) != 0;
+    }
+
     // TODO: implement or remove??
     void observeHTTPEventsOn(std::string address, int port)
     {
@@ -188,6 +339,10 @@ protected:
     {
     }
 
+    virtual void timeoutCallBack()
+    {
+    }
+
     virtual void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
                                         struct evhttp_connection* connection)
     {
@@ -202,6 +357,7 @@ private:
     static void libeventCallback(evutil_socket_t fd, short what, void *arg)
     {
         EventsProducer* producer = static_cast<EventsProducer* >(arg);
+        producer->markAsReady();
         if (what == EV_READ)
         {
             producer->eventCallBack(fd, EVENT_READ);
@@ -216,9 +372,19 @@ private:
         }
     }
 
+    static void libeventTimeoutCallback(evutil_socket_t fd, short what, void *arg)
+    {
+        EventsProducer* producer = static_cast<EventsProducer* >(arg);
+        // The timeout isn't pending anymore
+        producer->mEventsCatcher->decrementObservedEvents();
+        producer->markAsReady();
+        producer->timeoutCallBack();
+    }
+
     static void libEventHTTPConnectionCallBack(struct evhttp_request* clientRequest, void *arg)
     {
         EventsProducer* producer = static_cast<EventsProducer* >(arg);
+        producer->markAsReady();
         evhttp_connection_set_closecb
         (clientRequest->evcon, producer->libEventHTTPDisconnectionCallBack, producer);
         producer->hTTPConnectionCallBack(clientRequest, clientRequest->evcon);
@@ -227,13 +393,21 @@ private:
     static void libEventHTTPDisconnectionCallBack(struct evhttp_connection* evcon, void *arg)
     {
         EventsProducer* producer = static_cast<EventsProducer* >(arg);
+        producer->markAsReady();
         producer->hTTPDisconnectionCallBack(evcon);
     }
 
+    void markAsReady()
+    {
+        mEventsCatcher->markAsReady(mReadinessBit);
+    }
+
     std::map<int, struct evhttp*> mObservedHTTPEventContainers;
     std::map<int, struct event*> mObservedEventContainers2;
     std::vector<struct event*> mObservedEventContainers;
     std::shared_ptr<EventsCatcher> mEventsCatcher;
+    uint64_t mReadinessBit;
+    struct event* mTimeoutEventContainer;
 
 };
 
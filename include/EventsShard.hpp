@@ -0,0 +1,126 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef EVENTSSHARD_HPP_INCLUDED
+#define EVENTSSHARD_HPP_INCLUDED
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "Common.hpp"
+#include "EventsManager.hpp"
+
+#ifdef LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace laav
+{
+
+/*
+ * Events loop with its own EventsCatcher, running on a dedicated thread (requires
+ * -pthread), optionally pinned to a CPU. The devices and the streamers are assigned
+ * to a shard by constructing them with its catcher, I.E:
+ *
+ *   EventsShard shard0(0), shard1(1);
+ *   V4L2Grabber <YUYV422_PACKED, WIDTH, HEIGHT> vGrab(shard0.eventsCatcher(), "/dev/video0");
+ *   HTTPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT> vStream(shard1.eventsCatcher(), ...);
+ *
+ *   vRing.wakeUpOnPush(shard1);
+ *   shard0.start([&]() { vGrab >> vFh1 >> vConv >> vEnc >> vFh2 >> vRing; });
+ *   shard1.start([&]() { vRing >> vFh3 >> vStream; });
+ *
+ * The frames are handed across shards only through the rings of FrameRing.hpp; after
+ * start(), the nodes of a shard must be accessed only by the shard's thread.
+ */
+class EventsShard
+{
+
+public:
+
+    // cpu < 0: the thread is not pinned
+    EventsShard(int cpu = -1) :
+        mEventsCatcher(EventsManager::createSharedEventsCatcher()),
+        mCpu(cpu),
+        mStop(false)
+    {
+    }
+
+    ~EventsShard()
+    {
+        stop();
+    }
+
+    SharedEventsCatcher eventsCatcher() const
+    {
+        return mEventsCatcher;
+    }
+
+    /*!
+     *  \exception If the shard has already been started or if the thread can't be pinned
+     *             to the CPU.
+     *
+     *  The pipe is executed before catching each event.
+     */
+    void start(const std::function<void()>& pipe)
+    {
+        if (mThread.joinable())
+            printAndThrowUnrecoverableError("EventsShard already started");
+        mPipe = pipe;
+        mStop = false;
+        mThread = std::thread(&EventsShard::run, this);
+#ifdef LINUX
+        if (mCpu >= 0)
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(mCpu, &cpuSet);
+            if (pthread_setaffinity_np(mThread.native_handle(), sizeof(cpu_set_t), &cpuSet) != 0)
+            {
+                stop();
+                printAndThrowUnrecoverableError("pthread_setaffinity_np(...)");
+            }
+        }
+#endif
+    }
+
+    void stop()
+    {
+        mStop = true;
+        mEventsCatcher->wakeUp();
+        if (mThread.joinable())
+            mThread.join();
+    }
+
+    // Thread safe: the pipe will be executed once more, even if no events are caught
+    void wakeUp()
+    {
+        mEventsCatcher->wakeUp();
+    }
+
+private:
+
+    void run()
+    {
+        while (!mStop)
+        {
+            mPipe();
+            mEventsCatcher->catchNextEvent();
+        }
+    }
+
+    SharedEventsCatcher mEventsCatcher;
+    int mCpu;
+    std::atomic<bool> mStop;
+    std::function<void()> mPipe;
+    std::thread mThread;
+
+};
+
+}
+
+#endif // EVENTSSHARD_HPP_INCLUDED
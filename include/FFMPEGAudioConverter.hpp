@@ -15,11 +15,15 @@ extern "C"
 }
 
 #include "AllAudioCodecsAndFormats.hpp"
+#include "AudioConversionKernels.hpp"
 #include "Frame.hpp"
 
 namespace laav
 {
 
+template <typename PCMSoundFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class AudioMixerInput;
+
 template <typename InputPCMSoundFormat,
           unsigned int inputAudioSampleRate,
           enum AudioChannels inputAudioChannels,
@@ -32,53 +36,32 @@ class FFMPEGAudioConverter
 public:
 
     FFMPEGAudioConverter() :
-        mMediaStatusInPipe(MEDIA_NOT_READY)
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mSwrContext(NULL),
+        mConversionKernel(NULL)
     {
         static_assert(inputAudioSampleRate == convertedAudioSampleRate,
         "In and out samplerates must be equal (TODO: implement the case they are different");
-        mSwrContext = swr_alloc();
-        if (!mSwrContext)
-            printAndThrowUnrecoverableError("(mSwrContext = swr_alloc();)");
 
-        av_opt_set_int(mSwrContext,
-                       "in_channel_count", (inputAudioChannels + 1), 0);
-        av_opt_set_int(mSwrContext,
-                       "in_sample_rate", inputAudioSampleRate, 0);
-        av_opt_set_sample_fmt(mSwrContext,
-                              "in_sample_fmt",
-                              FFMPEGUtils::translateSampleFormat<InputPCMSoundFormat>(), 0);
-        av_opt_set_int(mSwrContext,
-                       "out_channel_count", (convertedAudioChannels + 1), 0);
-        av_opt_set_int(mSwrContext,
-                       "out_sample_rate", convertedAudioSampleRate, 0);
-        av_opt_set_sample_fmt(mSwrContext,
-                              "out_sample_fmt",
-                              FFMPEGUtils::translateSampleFormat<ConvertedPCMSoundFormat>(), 0);
-        int ret;
-        // initialize the converting context
-        if ((ret = swr_init(mSwrContext)) < 0)
-            printAndThrowUnrecoverableError("swr_init(mSwrContext)");
+        // A kernel can't change the number of channels
+        if (inputAudioChannels == convertedAudioChannels)
+            mConversionKernel =
+            AudioConversionKernels::select<InputPCMSoundFormat, ConvertedPCMSoundFormat>();
+        if (!mConversionKernel)
+            initSwrContext();
 
         mConvertedLibAVFrame = av_frame_alloc();
         if (!mConvertedLibAVFrame)
             printAndThrowUnrecoverableError("mConvertedLibAVFrame = av_frame_alloc()");
-
-        mConvertedLibAVFrame->format = FFMPEGUtils::translateSampleFormat<ConvertedPCMSoundFormat>();
-        mConvertedLibAVFrame->channel_layout = convertedAudioChannels + 1 == 1 ?
-            AV_CH_LAYOUT_MONO : AV_CH_LAYOUT_STEREO;
-        mConvertedLibAVFrame->sample_rate = convertedAudioSampleRate;
-        // TODO: use a global variable?
-        mConvertedLibAVFrame->nb_samples = 10000;
-        if (av_frame_get_buffer(mConvertedLibAVFrame, 0) < 0)
-            printAndThrowUnrecoverableError("av_frame_get_buffer(mConvertedLibAVFrame, 0)");
-
-        fillConvertedAudioFrame(mConvertedAudioFrame);
+        // TODO: use a global variable? (more samples are allocated when needed)
+        allocateConvertedSamples(10000);
     }
 
     ~FFMPEGAudioConverter()
     {
         av_frame_free(&mConvertedLibAVFrame);
-        swr_free(&mSwrContext);
+        if (mSwrContext)
+            swr_free(&mSwrContext);
     }
 
     /*!
@@ -91,16 +74,37 @@ public:
         if (isFrameEmpty(inputAudioFrame))
             throw MediaException(MEDIA_NO_DATA);
 
-        int inputSamplesNum = inputAudioFrame.size() / (2 * (inputAudioChannels + 1));
-        int outSamplesNum = swr_get_out_samples(mSwrContext, inputSamplesNum );
+        int bytesPerInputSample =
+        av_get_bytes_per_sample(FFMPEGUtils::translateSampleFormat<InputPCMSoundFormat>());
+        int inputSamplesNum = inputAudioFrame.size() / (bytesPerInputSample * (inputAudioChannels + 1));
         const unsigned char* inputData = inputAudioFrame.data();
-        int ret = swr_convert(mSwrContext, mConvertedLibAVFrame->data,
-                              outSamplesNum, (const uint8_t **)&inputData, inputSamplesNum);
-        if (ret < 0)
-            printAndThrowUnrecoverableError("swr_convert(...)");
+        int outSamplesNum = inputSamplesNum;
+        int64_t resamplerDelay = 0;
+        if (mConversionKernel)
+        {
+            if (inputSamplesNum > mConvertedLibAVFrame->nb_samples)
+                allocateConvertedSamples(inputSamplesNum);
+            mConversionKernel(inputData, mConvertedLibAVFrame->data, inputSamplesNum,
+                              inputAudioChannels + 1);
+        }
+        else
+        {
+            outSamplesNum = swr_get_out_samples(mSwrContext, inputSamplesNum);
+            if (outSamplesNum > mConvertedLibAVFrame->nb_samples)
+                allocateConvertedSamples(outSamplesNum);
+            // The output starts with the samples buffered by the resampler
+            resamplerDelay = swr_get_delay(mSwrContext, 1000000);
+            outSamplesNum = swr_convert(mSwrContext, mConvertedLibAVFrame->data, outSamplesNum,
+                                        (const uint8_t **)&inputData, inputSamplesNum);
+            if (outSamplesNum < 0)
+                printAndThrowUnrecoverableError("swr_convert(...)");
+        }
 
         convert1(mConvertedAudioFrame, outSamplesNum);
-        mConvertedAudioFrame.setTimestampsToNow();
+        mConvertedAudioFrame.copyTimestampsFrom(inputAudioFrame);
+        if (inputAudioFrame.monotonicTimestamp() != AV_NOPTS_VALUE)
+            mConvertedAudioFrame.setCaptureTimestamp(inputAudioFrame.monotonicTimestamp() -
+                                                     resamplerDelay);
         return mConvertedAudioFrame;
     }
 
@@ -197,11 +201,76 @@ public:
         return audioEncoder;
     }
 
+    AudioMixerInput<ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
+    operator >>
+    (AudioMixerInput<ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
+     audioMixerInput)
+    {
+        if (mMediaStatusInPipe == MEDIA_READY)
+            audioMixerInput.mMediaStatusInPipe = MEDIA_READY;
+        else
+        {
+            audioMixerInput.mMediaStatusInPipe = mMediaStatusInPipe;
+            mMediaStatusInPipe = MEDIA_READY;
+            return audioMixerInput;
+        }
+        try
+        {
+            audioMixerInput.take(mConvertedAudioFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioMixerInput.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioMixerInput;
+    }
+
     // TODO: private with friend framer, decoder
     enum MediaStatus mMediaStatusInPipe;
 
 private:
 
+    // swresample is used for the conversions without a kernel
+    void initSwrContext()
+    {
+        mSwrContext = swr_alloc();
+        if (!mSwrContext)
+            printAndThrowUnrecoverableError("(mSwrContext = swr_alloc();)");
+
+        av_opt_set_int(mSwrContext,
+                       "in_channel_count", (inputAudioChannels + 1), 0);
+        av_opt_set_int(mSwrContext,
+                       "in_sample_rate", inputAudioSampleRate, 0);
+        av_opt_set_sample_fmt(mSwrContext,
+                              "in_sample_fmt",
+                              FFMPEGUtils::translateSampleFormat<InputPCMSoundFormat>(), 0);
+        av_opt_set_int(mSwrContext,
+                       "out_channel_count", (convertedAudioChannels + 1), 0);
+        av_opt_set_int(mSwrContext,
+                       "out_sample_rate", convertedAudioSampleRate, 0);
+        av_opt_set_sample_fmt(mSwrContext,
+                              "out_sample_fmt",
+                              FFMPEGUtils::translateSampleFormat<ConvertedPCMSoundFormat>(), 0);
+        int ret;
+        // initialize the converting context
+        if ((ret = swr_init(mSwrContext)) < 0)
+            printAndThrowUnrecoverableError("swr_init(mSwrContext)");
+    }
+
+    // The converted frame points to the new samples
+    void allocateConvertedSamples(int numOfSamples)
+    {
+        av_frame_unref(mConvertedLibAVFrame);
+        mConvertedLibAVFrame->format = FFMPEGUtils::translateSampleFormat<ConvertedPCMSoundFormat>();
+        mConvertedLibAVFrame->channel_layout = convertedAudioChannels + 1 == 1 ?
+            AV_CH_LAYOUT_MONO : AV_CH_LAYOUT_STEREO;
+        mConvertedLibAVFrame->sample_rate = convertedAudioSampleRate;
+        mConvertedLibAVFrame->nb_samples = numOfSamples;
+        if (av_frame_get_buffer(mConvertedLibAVFrame, 0) < 0)
+            printAndThrowUnrecoverableError("av_frame_get_buffer(mConvertedLibAVFrame, 0)");
+        fillConvertedAudioFrame(mConvertedAudioFrame);
+    }
+
     bool isFrameEmpty(const PackedRawAudioFrame& audioFrame) const
     {
         return audioFrame.size() == 0;
@@ -212,34 +281,33 @@ private:
         return audioFrame.size<0>() == 0;
     }
 
-    void fillConvertedAudioFrame(Planar2RawAudioFrame& rawAudioFrame)
+    /*
+     * The planes keep their own reference to the buffers of mConvertedLibAVFrame: when it's
+     * reallocated, the frames which still point to the old samples keep them alive.
+     */
+    ShareableAudioFrameData shareConvertedPlane(unsigned int plane)
     {
-        auto freeNothing = [](unsigned char* buffer)
-        {
-            /*av_freep(&buffer); */
-        };
-
-        ShareableAudioFrameData convertedAudioFrameShData0 =
-        ShareableAudioFrameData(mConvertedLibAVFrame->data[0], freeNothing);
+        AVBufferRef* bufferRef = av_buffer_ref(mConvertedLibAVFrame->buf[plane]);
+        if (!bufferRef)
+            printAndThrowUnrecoverableError("av_buffer_ref(mConvertedLibAVFrame->buf[plane])");
+        return ShareableAudioFrameData(mConvertedLibAVFrame->data[plane],
+                                       [bufferRef](unsigned char* buffer) mutable
+                                       {
+                                           av_buffer_unref(&bufferRef);
+                                       });
+    }
 
+    void fillConvertedAudioFrame(Planar2RawAudioFrame& rawAudioFrame)
+    {
+        ShareableAudioFrameData convertedAudioFrameShData0 = shareConvertedPlane(0);
         rawAudioFrame.assignSharedPtrForPlane<0>(convertedAudioFrameShData0);
-
-        ShareableAudioFrameData convertedAudioFrameShData1 =
-
-        ShareableAudioFrameData(mConvertedLibAVFrame->data[1], freeNothing);
+        ShareableAudioFrameData convertedAudioFrameShData1 = shareConvertedPlane(1);
         rawAudioFrame.assignSharedPtrForPlane<1>(convertedAudioFrameShData1);
     }
 
     void fillConvertedAudioFrame(PackedRawAudioFrame& rawAudioFrame)
     {
-        auto freeNothing = [](unsigned char* buffer)
-        {
-            /*av_freep(&buffer); */
-        };
-
-        ShareableAudioFrameData convertedAudioFrameShData =
-        ShareableAudioFrameData(mConvertedLibAVFrame->data[0], freeNothing);
-
+        ShareableAudioFrameData convertedAudioFrameShData = shareConvertedPlane(0);
         rawAudioFrame.assignDataSharedPtr(convertedAudioFrameShData);
     }
 
@@ -270,6 +338,7 @@ private:
     AVFrame* mInputLibAVFrame;
     AVFrame* mConvertedLibAVFrame;
     struct SwrContext* mSwrContext;
+    AudioConversionKernel mConversionKernel;
 
 };
 
@@ -15,6 +15,7 @@ extern "C"
 #include <libavutil/opt.h>
 }
 
+#include <algorithm>
 #include "FFMPEGCommon.hpp"
 #include "HTTPAudioVideoStreamer.hpp"
 #include "HTTPAudioStreamer.hpp"
@@ -34,126 +35,64 @@ public:
 
     /*!
      *  \exception MediaException(MEDIA_NO_DATA)
+     *
+     *  The raw frame can contain any number of samples (I.E: several periods per device
+     *  wakeup): they fill the encoder's frames (frame_size samples each), and each filled
+     *  frame is encoded. See numOfNewEncodedFrames().
      */
     void encode(const AudioFrame<PCMSoundFormat, audioSampleRate, audioChannels>& rawAudioFrame)
     {
         if (isFrameEmpty(rawAudioFrame))
             throw MediaException(MEDIA_NO_DATA);
 
+        mNumOfNewEncodedFrames = 0;
         unsigned int bufferSize = mRawInputLibAVFrame->linesize[0];
         unsigned int periodSize = getPeriodSize(rawAudioFrame);
-
-        if ((mRawInputLibAVFrameBufferOffset + periodSize) >= bufferSize)
+        unsigned int periodOffset = 0;
+        while (periodOffset < periodSize)
         {
-
+            if (mRawInputLibAVFrameBufferOffset == 0)
+                storeCaptureTimestamps(rawAudioFrame, periodOffset);
+            unsigned int len = std::min(bufferSize - mRawInputLibAVFrameBufferOffset,
+                                        periodSize - periodOffset);
             copyRawAudioFrameDataToLibAVFrameData(mRawInputLibAVFrameBufferOffset,
-                                                  rawAudioFrame,
-                                                  (bufferSize - mRawInputLibAVFrameBufferOffset));
-
-            if (mEncodingStartTime == 0)
-                mEncodingStartTime = av_rescale_q(av_gettime_relative(),
-                                                  AV_TIME_BASE_Q,
-                                                  mAudioEncoderCodecContext->time_base);
-
-            int64_t monotonicNow = av_rescale_q(av_gettime_relative(), AV_TIME_BASE_Q,
-                                                mAudioEncoderCodecContext->time_base);
-
-            mEncodingCurrTime = monotonicNow;// - mEncodingStartTime;
-
-            this->mRawInputLibAVFrame->pts = mEncodingCurrTime;
-
-            int ret = avcodec_send_frame(this->mAudioEncoderCodecContext, this->mRawInputLibAVFrame);
-            if (ret == AVERROR(EAGAIN))
-                return;
-            else if (ret != 0)
-                printAndThrowUnrecoverableError("avcodec_send_frame(...)");
-
-            struct timespec dateTimeNow;
-            // TODO ifdef linux
-            clock_gettime(CLOCK_REALTIME, &dateTimeNow);
-
-            mEncodingDateTs[mEncodedAVPacketBufferOffset] =
-            dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec;
-
-            mEncodingMonotonicTs[mEncodedAVPacketBufferOffset] = monotonicNow;
-            AVPacket& currPkt = mEncodedAudioPktBuffer[mEncodedAVPacketBufferOffset];
-
-            int ret2 = avcodec_receive_packet(this->mAudioEncoderCodecContext, &currPkt);
-
-            // Buffering
-            if (ret2 == AVERROR(EAGAIN))
-            {
-                mEncodedAVPacketBufferOffset =
-                (mEncodedAVPacketBufferOffset + 1) % mEncodedAudioFrameBuffer.size();
-
-                return;
-            }
-            else if (ret2 != 0)
-                printAndThrowUnrecoverableError("avcodec_receive_packet(...)");
-            else
+                                                  rawAudioFrame, periodOffset, len);
+            periodOffset += len;
+            mRawInputLibAVFrameBufferOffset += len;
+            if (mRawInputLibAVFrameBufferOffset == bufferSize)
             {
-
-                AudioFrame<AudioCodec, audioSampleRate, audioChannels>& currFrame =
-                mEncodedAudioFrameBuffer[mEncodedAudioFrameBufferOffset];
-
-                AVPacket& encodedPkt = mEncodedAudioPktBuffer[mEncodedAudioFrameBufferOffset];
-                if (FFMPEGUtils::translateCodec<AudioCodec>() == AV_CODEC_ID_AAC)
-                {
-                    if (!mAdtsHeaderWritten)
-                    {
-                        if (avformat_write_header(mAdtsMuxerContext, NULL) < 0)
-                            printAndThrowUnrecoverableError("avformat_write_header(...)");
-
-                        mAdtsHeaderWritten = true;
-                    }
-                    mEncodedFrameForAdtsMuxer = &currFrame;
-                    int64_t pts = av_rescale_q(encodedPkt.pts, mAudioEncoderCodecContext->time_base,
-                                               mAdtsMuxerContext->streams[0]->time_base);
-
-                    encodedPkt.pts = encodedPkt.dts = pts;
-                    if (av_write_frame(mAdtsMuxerContext, &encodedPkt) < 0)
-                        printAndThrowUnrecoverableError("av_write_frame(...)");
-                }
-                else
-                {
-                    fillEncodedAudioFrame(currFrame, encodedPkt);
-                }
-
-                currFrame.setMonotonicTimestamp(mEncodingMonotonicTs[mEncodedAudioFrameBufferOffset]);
-                currFrame.setDateTimestamp(mEncodingDateTs[mEncodedAudioFrameBufferOffset]);
-                currFrame.mLibAVFlags = encodedPkt.flags;
-                //av_packet_unref(&encodedPkt);
-
-                if (mEncodedAudioFrameBufferOffset + 1 == mEncodedAudioFrameBuffer.size())
-                {
-                    mFillingEncodedAudioFrameBuffer = false;
-                }
-
-                mEncodedAudioFrameBufferOffset =
-                (mEncodedAudioFrameBufferOffset + 1) % mEncodedAudioFrameBuffer.size();
-
-                mEncodedAVPacketBufferOffset =
-                (mEncodedAVPacketBufferOffset + 1) % mEncodedAudioFrameBuffer.size();
-
-                if ((mRawInputLibAVFrameBufferOffset + periodSize) % bufferSize != 0)
-                {
-                    copyRawAudioFrameDataToLibAVFrameData
-                    (0, rawAudioFrame, (mRawInputLibAVFrameBufferOffset + periodSize) % bufferSize);
-                }
-
-                mFillingEncodedAudioFrame = false;
+                mRawInputLibAVFrameBufferOffset = 0;
+                encodeLibAVFrame();
             }
         }
-        else
-        {
-            mFillingEncodedAudioFrame = true;
-            copyRawAudioFrameDataToLibAVFrameData(mRawInputLibAVFrameBufferOffset,
-                                                  rawAudioFrame, periodSize);
-        }
+        mFillingEncodedAudioFrame = (mNumOfNewEncodedFrames == 0);
+    }
 
-        mRawInputLibAVFrameBufferOffset = (mRawInputLibAVFrameBufferOffset + periodSize) % bufferSize;
+    /*
+     * The frames output by the last encode() call (none while the encoder's frame is
+     * being filled, more than one for long raw frames). The muxers and the streamers take
+     * all of them.
+     */
+    unsigned int numOfNewEncodedFrames() const
+    {
+        return mNumOfNewEncodedFrames;
+    }
+
+    // n = 0: the oldest of the new frames
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    AudioFrame<AudioCodec, audioSampleRate, audioChannels>& newEncodedFrame(unsigned int n)
+    {
+        if (n >= mNumOfNewEncodedFrames)
+            throw MediaException(MEDIA_NO_DATA);
+        return mEncodedAudioFrameBuffer[(mEncodedAudioFrameBuffer.size() +
+                                         mEncodedAudioFrameBufferOffset -
+                                         mNumOfNewEncodedFrames + n) %
+                                        mEncodedAudioFrameBuffer.size()];
     }
 
+    // The holder takes the last frame only (see numOfNewEncodedFrames())
     AudioFrameHolder<AudioCodec, audioSampleRate, audioChannels>&
     operator >> (AudioFrameHolder<AudioCodec, audioSampleRate, audioChannels>& audioFrameHolder)
     {
@@ -165,6 +104,13 @@ public:
             mMediaStatusInPipe = MEDIA_READY;
             return audioFrameHolder;
         }
+        // The raw frames shorter than the encoder's ones (I.E: small ALSA periods) don't
+        // output anything most of the times: that's not worth an exception
+        if (mFillingEncodedAudioFrame)
+        {
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_BUFFERING;
+            return audioFrameHolder;
+        }
         try
         {
             audioFrameHolder.hold(lastEncodedFrame());
@@ -196,7 +142,9 @@ public:
         }
         try
         {
-            audioVideoMuxer.takeMuxableFrame(lastEncodedFrame());
+            unsigned int n;
+            for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                audioVideoMuxer.takeMuxableFrame(newEncodedFrame(n));
         }
         catch (const MediaException& mediaException)
         {
@@ -222,7 +170,9 @@ public:
         {
             try
             {
-                httpAudioVideoStreamer.takeStreamableFrame(lastEncodedFrame());
+                unsigned int n;
+                for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                    httpAudioVideoStreamer.takeStreamableFrame(newEncodedFrame(n));
                 httpAudioVideoStreamer.streamMuxedData();
             }
             catch (const MediaException& mediaException)
@@ -248,7 +198,9 @@ public:
         {
             try
             {
-                httpAudioStreamer.takeStreamableFrame(lastEncodedFrame());
+                unsigned int n;
+                for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                    httpAudioStreamer.takeStreamableFrame(newEncodedFrame(n));
                 httpAudioStreamer.sendMuxedData();
             }
             catch (const MediaException& mediaException)
@@ -274,7 +226,9 @@ public:
         {
             try
             {
-                audioMuxer.takeMuxableFrame(lastEncodedFrame());
+                unsigned int n;
+                for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                    audioMuxer.takeMuxableFrame(newEncodedFrame(n));
             }
             catch (const MediaException& mediaException)
             {
@@ -324,6 +278,24 @@ public:
         return mEncodedAudioFrameBuffer.size();
     }
 
+    /*
+     * The number of the last encoded frames kept by this encoder (see encodedFrame()), which
+     * also bounds the frames output by one encode() call. Default: encodedAudioFrameBufferSize.
+     * The frames reference the encoded data, which is freed as soon as nobody (this buffer,
+     * the muxers' queues, the frame rings...) holds it anymore. It resets the buffer.
+     */
+    void setEncodedFrameBufferSize(unsigned int size)
+    {
+        if (size == 0)
+            printAndThrowUnrecoverableError("size == 0");
+        AudioFrame<AudioCodec, audioSampleRate, audioChannels> encodedAudioFrame;
+        encodedAudioFrame.setMonotonicTimeBase(mAudioEncoderCodecContext->time_base);
+        mEncodedAudioFrameBuffer.assign(size, encodedAudioFrame);
+        mFillingEncodedAudioFrameBuffer = true;
+        mEncodedAudioFrameBufferOffset = 0;
+        mNumOfNewEncodedFrames = 0;
+    }
+
     // TODO: private with friend converter, decoder, encoder
     enum MediaStatus mMediaStatusInPipe;
 
@@ -331,17 +303,18 @@ protected:
 
     FFMPEGAudioEncoder():
         mMediaStatusInPipe(MEDIA_NOT_READY),
-        mEncodingCurrTime(0),
-        mCounter(0),
-        mEncodingStartTime(0),
+        mLastInputPts(AV_NOPTS_VALUE),
+        mCaptureTimestamp(AV_NOPTS_VALUE),
+        mCaptureDateTimestamp(-1),
+        mBytesPerRawSample(1),
+        mDateMinusMonotonicTs(0),
         mFillingEncodedAudioFrameBuffer(true),
         mFillingEncodedAudioFrame(true),
         mRawInputLibAVFrameBufferOffset(0),
         mEncodedAudioFrameBufferOffset(0),
-        mEncodedAVPacketBufferOffset(0)
+        mNumOfNewEncodedFrames(0)
     {
-        av_register_all();
-        avcodec_register_all();
+        FFMPEGUtils::registerAll();
         mAudioCodec = avcodec_find_encoder(FFMPEGUtils::translateCodec<AudioCodec>() );
         if (mAudioCodec == NULL)
             printAndThrowUnrecoverableError("avcodec_find_encoder(...)");
@@ -382,86 +355,121 @@ protected:
         // Allocate frame buffer
         if (av_frame_get_buffer(mRawInputLibAVFrame, 0) < 0)
             printAndThrowUnrecoverableError("av_frame_get_buffer(mRawInputLibAVFrame, 0)");
-
-        unsigned int i;
-        for (i = 0; i < encodedAudioFrameBufferSize; i++)
-        {
-            AVPacket encodedAudioPkt;
-            encodedAudioPkt.size = 0;
-            mEncodedAudioPktBuffer.push_back(encodedAudioPkt);
-            av_init_packet(&mEncodedAudioPktBuffer[i]);
-            AudioFrame<AudioCodec, audioSampleRate, audioChannels> encodedAudioFrame;
-            encodedAudioFrame.setMonotonicTimeBase(mAudioEncoderCodecContext->time_base);
-            mEncodedAudioFrameBuffer.push_back(encodedAudioFrame);
-            mEncodingMonotonicTs.push_back(AV_NOPTS_VALUE);
-            mEncodingDateTs.push_back(-1);
-        }
-
-        // AAC ENCODER needs the ADTS header. FFMPEG wants a muxer for making the header.
-        if (FFMPEGUtils::translateCodec<AudioCodec>() == AV_CODEC_ID_AAC)
-        {
-
-            mAdtsMuxerFormat = av_guess_format("adts", NULL, NULL);
-            if (!mAdtsMuxerFormat)
-                printAndThrowUnrecoverableError("mAdtsMuxerFormat = av_guess_format(\"adts\" ...)");
-
-            mAdtsMuxerFormat->audio_codec = AV_CODEC_ID_AAC;
-
-            avformat_alloc_output_context2(&mAdtsMuxerContext, mAdtsMuxerFormat, "dummy", NULL);
-            if (!mAdtsMuxerContext)
-                printAndThrowUnrecoverableError("avformat_alloc_output_context2(...)");
-
-            size_t adtsMuxerAVIOContextBufferSize = 4096;
-            mAdtsMuxerAVIOContextBuffer = (uint8_t* )av_malloc(adtsMuxerAVIOContextBufferSize);
-            if (!mAdtsMuxerAVIOContextBuffer)
-                printAndThrowUnrecoverableError("mAdtsMuxerAVIOContextBuffer = (uint8_t* )...");
-
-            mAdtsMuxerAVIOContext = avio_alloc_context(mAdtsMuxerAVIOContextBuffer,
-                                                       adtsMuxerAVIOContextBufferSize, 1, this,
-                                                       NULL, &writeAdtsFrame, NULL);
-            if (!mAdtsMuxerAVIOContext)
-                printAndThrowUnrecoverableError("mAdtsMuxerAVIOContext = avio_alloc_context(...)");
-
-            mAdtsMuxerContext->pb = mAdtsMuxerAVIOContext;
-            mAdtsAudioStream = avformat_new_stream(mAdtsMuxerContext, NULL);
-            if (!mAdtsAudioStream)
-                printAndThrowUnrecoverableError("mAdtsAudioStream = avformat_new_stream(...)");
-
-            mAdtsAudioStream->id = mAdtsMuxerContext->nb_streams - 1;
-            avcodec_parameters_from_context(mAdtsAudioStream->codecpar, mAudioEncoderCodecContext);
-            mAdtsHeaderWritten = false;
-            unsigned int i;
-            for (i = 0; i < encodedAudioFrameBufferSize; i++)
-            {
-                mAudioDataPtrs.push_back(new unsigned char[4096]);
-            }
-        }
-
+        mBytesPerRawSample = av_get_bytes_per_sample(mAudioEncoderCodecContext->sample_fmt);
+        if (!av_sample_fmt_is_planar(mAudioEncoderCodecContext->sample_fmt))
+            mBytesPerRawSample *= mAudioEncoderCodecContext->channels;
+
+        av_init_packet(&mEncodedAudioPkt);
+        mEncodedAudioPkt.data = NULL;
+        mEncodedAudioPkt.size = 0;
+        setEncodedFrameBufferSize(encodedAudioFrameBufferSize);
+
+        // The ADTS header of the AAC frames is made from the encoder's AudioSpecificConfig
+        if (FFMPEGUtils::translateCodec<AudioCodec>() == AV_CODEC_ID_AAC &&
+            !mADTSHeaderWriter.configure(mAudioEncoderCodecContext->extradata,
+                                         mAudioEncoderCodecContext->extradata_size))
+            printAndThrowUnrecoverableError("mADTSHeaderWriter.configure(...)");
     }
 
     ~FFMPEGAudioEncoder()
     {
-        unsigned int q;
-        for (q = 0; q < mEncodedAudioPktBuffer.size(); q++)
-            av_packet_unref(&mEncodedAudioPktBuffer[q]);
+        av_packet_unref(&mEncodedAudioPkt);
         av_frame_free(&mRawInputLibAVFrame);
         avcodec_free_context(&mAudioEncoderCodecContext);
+    }
 
-        if (FFMPEGUtils::translateCodec<AudioCodec>() == AV_CODEC_ID_AAC)
+    AVCodecContext* mAudioEncoderCodecContext;
+
+private:
+
+    // Of the first sample of the encoder's frame, which starts at rawAudioFrameOffset
+    void storeCaptureTimestamps(const Frame& rawAudioFrame, unsigned int rawAudioFrameOffset)
+    {
+        mCaptureTimestamp = rawAudioFrame.monotonicTimestamp();
+        mCaptureDateTimestamp = rawAudioFrame.dateTimestamp();
+        if (mCaptureTimestamp == AV_NOPTS_VALUE)
+            return;
+        int64_t samplesOffsetDuration = (int64_t)(rawAudioFrameOffset / mBytesPerRawSample) *
+                                        1000000 / audioSampleRate;
+        mCaptureTimestamp += samplesOffsetDuration;
+        if (mCaptureDateTimestamp != -1)
+            mCaptureDateTimestamp += samplesOffsetDuration * 1000;
+    }
+
+    void encodeLibAVFrame()
+    {
+        // The capture time travels through the encoder's delay as the frame's pts
+        int64_t captureTimestamp = mCaptureTimestamp;
+        int64_t captureDateTimestamp = mCaptureDateTimestamp;
+        if (captureTimestamp == AV_NOPTS_VALUE)
         {
-            av_write_trailer(mAdtsMuxerContext);
-            av_free(mAdtsMuxerAVIOContextBuffer);
-            avformat_free_context(mAdtsMuxerContext);
-            av_free(mAdtsMuxerAVIOContext);
-            unsigned int i;
-            for (i = 0; i < encodedAudioFrameBufferSize; i++)
-                delete[](mAudioDataPtrs[i]);
+            captureTimestamp = av_gettime_relative();
+            captureDateTimestamp = -1;
         }
+        if (captureDateTimestamp == -1)
+        {
+            struct timespec dateTimeNow;
+            // TODO ifdef linux
+            clock_gettime(CLOCK_REALTIME, &dateTimeNow);
+            captureDateTimestamp = dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec -
+                                   (av_gettime_relative() - captureTimestamp) * 1000;
+        }
+        int64_t pts = av_rescale_q(captureTimestamp, AV_TIME_BASE_Q,
+                                   mAudioEncoderCodecContext->time_base);
+        if (mLastInputPts != AV_NOPTS_VALUE && pts <= mLastInputPts)
+            pts = mLastInputPts + 1;
+        mLastInputPts = pts;
+        mDateMinusMonotonicTs = captureDateTimestamp -
+                                av_rescale_q(pts, mAudioEncoderCodecContext->time_base,
+                                             (AVRational){1, 1000000000});
+        mRawInputLibAVFrame->pts = pts;
+
+        int ret = avcodec_send_frame(mAudioEncoderCodecContext, mRawInputLibAVFrame);
+        if (ret == AVERROR(EAGAIN))
+        {
+            receiveEncodedPackets();
+            ret = avcodec_send_frame(mAudioEncoderCodecContext, mRawInputLibAVFrame);
+        }
+        if (ret != 0)
+            printAndThrowUnrecoverableError("avcodec_send_frame(...)");
+        receiveEncodedPackets();
     }
 
-    AVCodecContext* mAudioEncoderCodecContext;
+    void receiveEncodedPackets()
+    {
+        while (mNumOfNewEncodedFrames < mEncodedAudioFrameBuffer.size())
+        {
+            AVPacket& encodedPkt = mEncodedAudioPkt;
+            int ret = avcodec_receive_packet(mAudioEncoderCodecContext, &encodedPkt);
+            if (ret == AVERROR(EAGAIN))
+                return;
+            else if (ret != 0)
+                printAndThrowUnrecoverableError("avcodec_receive_packet(...)");
 
-private:
+            AudioFrame<AudioCodec, audioSampleRate, audioChannels>& currFrame =
+            mEncodedAudioFrameBuffer[mEncodedAudioFrameBufferOffset];
+            if (FFMPEGUtils::translateCodec<AudioCodec>() == AV_CODEC_ID_AAC)
+                fillADTSAudioFrame(currFrame, encodedPkt);
+            else
+                fillEncodedAudioFrame(currFrame, encodedPkt);
+
+            currFrame.setMonotonicTimestamp(encodedPkt.pts);
+            currFrame.setDateTimestamp(av_rescale_q(encodedPkt.pts,
+                                                    mAudioEncoderCodecContext->time_base,
+                                                    (AVRational){1, 1000000000}) +
+                                       mDateMinusMonotonicTs);
+            currFrame.mLibAVFlags = encodedPkt.flags;
+            // The frame holds its own reference (or copy) of the packet's data
+            av_packet_unref(&encodedPkt);
+
+            if (mEncodedAudioFrameBufferOffset + 1 == mEncodedAudioFrameBuffer.size())
+                mFillingEncodedAudioFrameBuffer = false;
+
+            mEncodedAudioFrameBufferOffset =
+            (mEncodedAudioFrameBufferOffset + 1) % mEncodedAudioFrameBuffer.size();
+            mNumOfNewEncodedFrames++;
+        }
+    }
 
     bool isFrameEmpty(const PackedRawAudioFrame& audioFrame) const
     {
@@ -480,16 +488,17 @@ private:
 
     void copyRawAudioFrameDataToLibAVFrameData(unsigned int libAVFrameBufferOffset,
                                                const Planar2RawAudioFrame& rawAudioFrame,
+                                               unsigned int rawAudioFrameOffset,
                                                unsigned int len)
     {
         unsigned int channels = audioChannels + 1;
 
         memcpy(mRawInputLibAVFrame->data[0] + libAVFrameBufferOffset,
-               rawAudioFrame.plane<0>(), len);
+               rawAudioFrame.plane<0>() + rawAudioFrameOffset, len);
 
         if (channels == 2)
             memcpy(mRawInputLibAVFrame->data[1] + libAVFrameBufferOffset,
-                   rawAudioFrame.plane<1>(), len);
+                   rawAudioFrame.plane<1>() + rawAudioFrameOffset, len);
     }
 
     unsigned int getPeriodSize(const PackedRawAudioFrame& rawAudioFrame)
@@ -499,71 +508,85 @@ private:
 
     void copyRawAudioFrameDataToLibAVFrameData(unsigned int libAVFrameBufferOffset,
                                                const PackedRawAudioFrame& rawAudioFrame,
+                                               unsigned int rawAudioFrameOffset,
                                                unsigned int len)
     {
-        memcpy(mRawInputLibAVFrame->data[0] + libAVFrameBufferOffset, rawAudioFrame.data(), len);
+        memcpy(mRawInputLibAVFrame->data[0] + libAVFrameBufferOffset,
+               rawAudioFrame.data() + rawAudioFrameOffset, len);
     }
 
+    /*
+     * The frame shares a reference to the packet's (refcounted) buffer: it stays valid
+     * as long as someone holds it, even after the frames' ring has been reused.
+     */
     void fillEncodedAudioFrame(EncodedAudioFrame<AudioCodec>& encodedAudioFrame,
                                const AVPacket& encodedAvPacket)
     {
-        auto freeNothing = [](unsigned char* buffer) {  };
-        ShareableAudioFrameData mAudioData = ShareableAudioFrameData(encodedAvPacket.data, freeNothing);
-        encodedAudioFrame.assignDataSharedPtr(mAudioData);
+        AVPacket* packetReference = av_packet_clone(&encodedAvPacket);
+        if (!packetReference)
+            printAndThrowUnrecoverableError("packetReference = av_packet_clone(...)");
+        auto unrefPacket = [packetReference](unsigned char* buffer)
+        {
+            AVPacket* packetToFree = packetReference;
+            av_packet_free(&packetToFree);
+        };
+        ShareableAudioFrameData audioData(packetReference->data, unrefPacket);
+        encodedAudioFrame.assignDataSharedPtr(audioData);
         encodedAudioFrame.setSize(encodedAvPacket.size);
     }
 
+    // ADTS header + the packet's payload, in a buffer of the encoders' shared pool
+    void fillADTSAudioFrame(EncodedAudioFrame<AudioCodec>& encodedAudioFrame,
+                            const AVPacket& encodedAvPacket)
+    {
+        unsigned int frameSize = ADTSHeaderWriter::headerSize + encodedAvPacket.size;
+        if (frameSize > ADTSHeaderWriter::maxFrameSize)
+            printAndThrowUnrecoverableError("frameSize > ADTSHeaderWriter::maxFrameSize");
+        AVBufferRef* buffer = av_buffer_pool_get(aDTSFramesPool());
+        if (!buffer)
+            printAndThrowUnrecoverableError("buffer = av_buffer_pool_get(...)");
+        mADTSHeaderWriter.write(buffer->data, encodedAvPacket.size);
+        memcpy(buffer->data + ADTSHeaderWriter::headerSize, encodedAvPacket.data,
+               encodedAvPacket.size);
+        auto giveBackBuffer = [buffer](unsigned char* data)
+        {
+            AVBufferRef* bufferToUnref = buffer;
+            av_buffer_unref(&bufferToUnref);
+        };
+        ShareableAudioFrameData audioData(buffer->data, giveBackBuffer);
+        encodedAudioFrame.assignDataSharedPtr(audioData);
+        encodedAudioFrame.setSize(frameSize);
+    }
+
+    // Shared by all the AAC encoders (I.E: one per microphone), never freed
+    static AVBufferPool* aDTSFramesPool()
+    {
+        static AVBufferPool* pool = av_buffer_pool_init(ADTSHeaderWriter::maxFrameSize, NULL);
+        if (!pool)
+            printAndThrowUnrecoverableError("pool = av_buffer_pool_init(...)");
+        return pool;
+    }
+
     AVCodec* mAudioCodec;
-    int64_t mEncodingCurrTime;
-    int mCounter;
-    int64_t mEncodingStartTime;
+    int64_t mLastInputPts;
+    // Of the libav frame being filled (see storeCaptureTimestamps())
+    int64_t mCaptureTimestamp;
+    int64_t mCaptureDateTimestamp;
+    // In a plane of the raw frames
+    unsigned int mBytesPerRawSample;
+    // ns - ns: the date of a packet is computed from its (monotonic) pts
+    int64_t mDateMinusMonotonicTs;
     bool mFillingEncodedAudioFrameBuffer;
     bool mFillingEncodedAudioFrame;
     unsigned int mRawInputLibAVFrameBufferOffset;
     std::vector<AudioFrame<AudioCodec, audioSampleRate, audioChannels> > mEncodedAudioFrameBuffer;
-    std::vector<AVPacket> mEncodedAudioPktBuffer;
-    std::vector<int64_t> mEncodingMonotonicTs;
-    std::vector<int64_t> mEncodingDateTs;
+    // Receives the encoded packets, whose data is then referenced by the frames
+    AVPacket mEncodedAudioPkt;
     unsigned int mEncodedAudioFrameBufferOffset;
-    unsigned int mEncodedAVPacketBufferOffset;
+    unsigned int mNumOfNewEncodedFrames;
     AVFrame* mRawInputLibAVFrame;
 
-    // NEEDED FOR AAC ENCODER (ADTS CONTAINER)
-    AVFormatContext* mAdtsMuxerContext;
-    uint8_t* mAdtsMuxerAVIOContextBuffer;
-    AVOutputFormat* mAdtsMuxerFormat;
-    AVIOContext* mAdtsMuxerAVIOContext;
-    AVStream* mAdtsAudioStream;
-    bool mAdtsHeaderWritten;
-    // TODO: use a vector for other encoders too?
-    std::vector<unsigned char* > mAudioDataPtrs;
-
-    static int writeAdtsFrame (void* opaque, uint8_t* muxedDataSink, int chunkSize)
-    {
-
-        if (chunkSize == 0)
-            return 0;
-        // TODO: static cast?
-
-        FFMPEGAudioEncoder<PCMSoundFormat, AudioCodec, audioSampleRate, audioChannels>* audioEncoder =
-        (FFMPEGAudioEncoder<PCMSoundFormat, AudioCodec, audioSampleRate, audioChannels>* )opaque;
-
-        auto freeNothing = [](unsigned char* buffer) {  };
-
-        memcpy(audioEncoder->mAudioDataPtrs[audioEncoder->mEncodedAudioFrameBufferOffset],
-               muxedDataSink, chunkSize);
-
-        ShareableAudioFrameData mAudioData = ShareableAudioFrameData
-        (audioEncoder->mAudioDataPtrs[audioEncoder->mEncodedAudioFrameBufferOffset], freeNothing);
-
-        audioEncoder->mEncodedFrameForAdtsMuxer->assignDataSharedPtr(mAudioData);
-        audioEncoder->mEncodedFrameForAdtsMuxer->setSize(chunkSize);
-
-        return chunkSize;
-
-    }
-
-    AudioFrame<AudioCodec, audioSampleRate, audioChannels>* mEncodedFrameForAdtsMuxer;
+    ADTSHeaderWriter mADTSHeaderWriter;
 
 };
 
@@ -59,18 +59,7 @@ protected:
 
         avcodec_parameters_from_context(mAudioStream->codecpar, mAudioCodecContext);
 
-        unsigned int i;
-        for (i = 1; i < encodedAudioFrameBufferSize; i++)
-        {
-            AVPacket audioPkt;
-            this->mAudioAVPktsToMux.push_back(audioPkt);
-        }
-
-        for (i = 1; i < encodedAudioFrameBufferSize; i++)
-        {
-            av_init_packet(&this->mAudioAVPktsToMux[i]);
-            this->mAudioAVPktsToMux[i].pts = AV_NOPTS_VALUE;
-        }
+        this->resetPacketsRing(this->mAudioAVPktsToMux, encodedAudioFrameBufferSize);
 
         if (startMuxingSoon)
             this->startMuxing();
@@ -90,8 +79,6 @@ protected:
         if (isFrameEmpty(audioFrameToMux))
             throw MediaException(MEDIA_NO_DATA);
 
-        FFMPEGMuxerCommonImpl<Container>::mAudioReady = true;
-
         int64_t pts =
         av_rescale_q (audioFrameToMux.monotonicTimestamp(), mAudioCodecContext->time_base,
         this->mMuxerContext->streams[this->mAudioStreamIndex]->time_base);
@@ -99,9 +86,8 @@ protected:
         this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset].pts = pts;
         this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset].dts = pts;
         this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset].stream_index = this->mAudioStreamIndex;
-        // TODO: static cast?
-        this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset].data = (uint8_t* )audioFrameToMux.data();
-        this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset].size = audioFrameToMux.size();
+        this->referenceFrameData(this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset],
+                                 audioFrameToMux.dataSharedPtr(), audioFrameToMux.size());
         this->mAudioAVPktsToMux[this->mAudioAVPktsToMuxOffset].flags = audioFrameToMux.mLibAVFlags;
 
         this->mAudioAVPktsToMuxOffset =
@@ -110,6 +96,8 @@ protected:
         if (this->mDoMux)
         {
             this->mMuxedChunks.newGroupOfChunks = false;
+            this->mMuxedChunks.groupOfChunksId++;
+            this->mMuxedChunks.groupHasKeyFrame = false;
             this->muxNextUsefulFrameFromBuffer(true);
         }
     }
@@ -150,14 +138,6 @@ public:
         this->mMuxAudio = true;
         FFMPEGMuxerCommonImpl<Container>::mAudioStreamIndex = 0;
         FFMPEGMuxerCommonImpl<Container>::completeMuxerInitialization();
-        auto freeNothing = [](unsigned char* buffer) {  };
-        mMuxedAudioChunks.resize(FFMPEGMuxerCommonImpl<Container>::mMuxedChunks.data.size());
-        unsigned int n;
-        for (n = 0; n < mMuxedAudioChunks.size(); n++)
-        {
-            ShareableMuxedData shMuxedData(this->mMuxedChunks.data[n].ptr, freeNothing);
-            mMuxedAudioChunks[n].assignDataSharedPtr(shMuxedData);
-        }
     }
 
     void takeMuxableFrame(const AudioFrame<AudioCodecOrFormat,
@@ -176,11 +156,7 @@ public:
     {
         if (FFMPEGMuxerCommonImpl<Container>::mMuxedChunks.offset != 0)
         {
-            unsigned int n;
-            for (n = 0; n < FFMPEGMuxerCommonImpl<Container>::mMuxedChunks.offset; n++)
-            {
-                mMuxedAudioChunks[n].setSize(this->mMuxedChunks.data[n].size);
-            }
+            this->wrapMuxedChunks(mMuxedAudioChunks);
             return mMuxedAudioChunks;
         }
         else
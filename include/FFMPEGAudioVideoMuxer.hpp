@@ -13,6 +13,11 @@
 namespace laav
 {
 
+template <typename Container,
+          typename VideoCodecOrFormat, unsigned int width, unsigned int height,
+          typename AudioCodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class HTTPAudioVideoStreamer;
+
 template <typename Container,
           typename VideoCodecOrFormat,
           unsigned int width,
@@ -45,15 +50,6 @@ public:
         this->mMuxAudio = true;
         this->mMuxVideo = true;
         FFMPEGMuxerCommonImpl<Container>::completeMuxerInitialization();
-        auto freeNothing = [](unsigned char* buffer) {  };
-
-        mMuxedAudioVideoChunks.resize(this->mMuxedChunks.data.size());
-        unsigned int n;
-        for (n = 0; n < mMuxedAudioVideoChunks.size(); n++)
-        {
-            ShareableMuxedData shMuxedData(this->mMuxedChunks.data[n].ptr, freeNothing);
-            mMuxedAudioVideoChunks[n].assignDataSharedPtr(shMuxedData);
-        }
     }
 
     /*!
@@ -65,11 +61,7 @@ public:
     {
         if (this->mMuxedChunks.newGroupOfChunks)
         {
-            unsigned int n;
-            for (n = 0; n < this->mMuxedChunks.offset; n++)
-            {
-                mMuxedAudioVideoChunks[n].setSize(this->mMuxedChunks.data[n].size);
-            }
+            this->wrapMuxedChunks(mMuxedAudioVideoChunks);
             return mMuxedAudioVideoChunks;
         }
         else
@@ -83,6 +75,19 @@ public:
         return this->mMuxedChunks.offset;
     }
 
+    // Streams the chunks muxed in this pipe's step through a streamer which shares the muxer
+    HTTPAudioVideoStreamer<Container,
+                           VideoCodecOrFormat, width, height,
+                           AudioCodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (HTTPAudioVideoStreamer<Container,
+                            VideoCodecOrFormat, width, height,
+                            AudioCodecOrFormat, audioSampleRate, audioChannels>& httpAudioVideoStreamer)
+    {
+        httpAudioVideoStreamer.streamMuxedData();
+        return httpAudioVideoStreamer;
+    }
+
     void takeMuxableFrame(const AudioFrame<AudioCodecOrFormat,
                           audioSampleRate, audioChannels>& audioFrameToMux)
     {
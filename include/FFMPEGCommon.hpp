@@ -16,6 +16,8 @@
 #include "NV21_PlanarFrame.hpp"
 #include "MJPEGFrame.hpp"
 #include "H264Frame.hpp"
+#include "H265Frame.hpp"
+#include "DMABufFrame.hpp"
 #include "MP2Frame.hpp"
 #include "FloatPackedFrame.hpp"
 #include "FloatPlanarFrame.hpp"
@@ -30,12 +32,40 @@ extern "C"
 #include <libavutil/timestamp.h>
 }
 
+/*
+ * FFmpeg >= 3.2 is supported; the features which need a newer version are compiled only
+ * when it's available.
+ */
+// DMABUF frames (AV_PIX_FMT_DRM_PRIME, hwcontext_drm.h): FFmpeg 3.4
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(55, 78, 100)
+#define LAAV_FFMPEG_DRM_PRIME
+#endif
+// AV_FRAME_DATA_REGIONS_OF_INTEREST: FFmpeg 4.2
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(56, 31, 100)
+#define LAAV_FFMPEG_REGIONS_OF_INTEREST
+#endif
+// movflags +frag_every_frame: FFmpeg 4.0
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 12, 100)
+#define LAAV_FFMPEG_FRAG_EVERY_FRAME
+#endif
+
 namespace laav
 {
 
 struct FFMPEGUtils
 {
 
+    // Since FFmpeg 4.0 the (de)muxers and the codecs are registered (and the calls deprecated)
+    static void registerAll()
+    {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+        av_register_all();
+#endif
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 10, 100)
+        avcodec_register_all();
+#endif
+    }
+
     template <typename T>
     static AVPixelFormat translatePixelFormat();
 
@@ -48,6 +78,10 @@ struct FFMPEGUtils
     template <typename T>
     static const char* translateContainer();
 
+    // fourcc of the DRM_FORMAT_* (drm_fourcc.h) describing a DMABUF frame's layout
+    template <typename T>
+    static uint32_t translateDRMFormat();
+
 };
 
 template <>
@@ -80,6 +114,38 @@ AVPixelFormat FFMPEGUtils::translatePixelFormat<NV_21_PLANAR>()
 {
     return AV_PIX_FMT_NV21;
 }
+#ifdef LAAV_FFMPEG_DRM_PRIME
+template <>
+AVPixelFormat FFMPEGUtils::translatePixelFormat<DMABUF<YUYV422_PACKED> >()
+{
+    return AV_PIX_FMT_DRM_PRIME;
+}
+template <>
+AVPixelFormat FFMPEGUtils::translatePixelFormat<DMABUF<NV_12_PLANAR> >()
+{
+    return AV_PIX_FMT_DRM_PRIME;
+}
+template <>
+AVPixelFormat FFMPEGUtils::translatePixelFormat<DMABUF<YUV420_PLANAR> >()
+{
+    return AV_PIX_FMT_DRM_PRIME;
+}
+#endif
+template <>
+uint32_t FFMPEGUtils::translateDRMFormat<DMABUF<YUYV422_PACKED> >()
+{
+    return 'Y' | ('U' << 8) | ('Y' << 16) | ((uint32_t)'V' << 24);
+}
+template <>
+uint32_t FFMPEGUtils::translateDRMFormat<DMABUF<NV_12_PLANAR> >()
+{
+    return 'N' | ('V' << 8) | ('1' << 16) | ((uint32_t)'2' << 24);
+}
+template <>
+uint32_t FFMPEGUtils::translateDRMFormat<DMABUF<YUV420_PLANAR> >()
+{
+    return 'Y' | ('U' << 8) | ('1' << 16) | ((uint32_t)'2' << 24);
+}
 template <>
 AVSampleFormat FFMPEGUtils::translateSampleFormat<FLOAT_PACKED>()
 {
@@ -102,6 +168,11 @@ enum AVCodecID FFMPEGUtils::translateCodec<H264>()
     return AV_CODEC_ID_H264;
 }
 template <>
+enum AVCodecID FFMPEGUtils::translateCodec<H265>()
+{
+    return AV_CODEC_ID_HEVC;
+}
+template <>
 enum AVCodecID FFMPEGUtils::translateCodec<MJPEG>()
 {
     return AV_CODEC_ID_MJPEG;
@@ -132,6 +203,11 @@ const char* FFMPEGUtils::translateContainer<MATROSKA>()
 {
     return "matroska";
 }
+template <>
+const char* FFMPEGUtils::translateContainer<FMP4>()
+{
+    return "mp4";
+}
 
 int convertToFFMPEGProfile(enum H264Profiles profile)
 {
@@ -191,6 +267,31 @@ int convertToFFMPEGProfile(enum H264Profiles profile)
     return ret;
 }
 
+int convertToFFMPEGProfile(enum H265Profiles profile)
+{
+    int ret = -1;
+    switch(profile)
+    {
+    case (H265_DEFAULT_PROFILE):
+        break;
+    case (H265_MAIN):
+        ret = FF_PROFILE_HEVC_MAIN;
+        break;
+    case (H265_MAIN_10):
+        ret = FF_PROFILE_HEVC_MAIN_10;
+        break;
+    case (H265_MAIN_STILL_PICTURE):
+        ret = FF_PROFILE_HEVC_MAIN_STILL_PICTURE;
+        break;
+    case (H265_REXT):
+        ret = FF_PROFILE_HEVC_REXT;
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
 int convertToFFMPEGProfile(enum AACProfiles profile)
 {
     int ret = -1;
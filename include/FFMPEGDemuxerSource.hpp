@@ -0,0 +1,572 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGDEMUXERSOURCE_HPP_INCLUDED
+#define FFMPEGDEMUXERSOURCE_HPP_INCLUDED
+
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AllVideoCodecsAndFormats.hpp"
+#include "AllAudioCodecsAndFormats.hpp"
+#include "Common.hpp"
+#include "EventsManager.hpp"
+#include "VideoFrameHolder.hpp"
+#include "AudioFrameHolder.hpp"
+
+namespace laav
+{
+
+/*
+ * Source of the already encoded frames of a network stream or of a file (anything libavformat
+ * can open, I.E: an IP camera's RTSP stream), so that they can be remuxed and streamed without
+ * being decoded and reencoded. I.E:
+ *
+ *   FFMPEGDemuxerSource <H264, WIDTH, HEIGHT> src(eventsCatcher, "rtsp://camera/stream",
+ *                                                 false, {{"rtsp_transport", "tcp"}});
+ *   ...
+ *   src >> vFh;
+ *   src >> aFh;
+ *   vFh >> avStream;
+ *   aFh >> avStream;
+ *
+ * The frames are rewritten as the encoders' ones (H264: Annex B, with the SPS and PPS before
+ * each keyframe; AAC: ADTS), and the input's missing audio stream (or the one with another
+ * sample rate or channels) is ignored. They are timestamped on the capture clock, by their
+ * decoding time (the muxers don't carry a separate presentation time, so the inputs with
+ * B-frames aren't supported).
+ *
+ * The input is read in non-blocking mode: when it has no data, the source is polled again
+ * after the poll interval, through a timeout of the events loop. The protocols which don't
+ * support the non-blocking mode block the loop until the next packet (for the stall timeout
+ * at most, through the interrupt callback), and so does opening the input (for the open
+ * timeout at most). At the end of the input, on errors, and after the stall timeout without
+ * packets, the input is reopened after the reconnection interval (I.E: a file is replayed).
+ * realTime: the frames are emitted at the pace of their timestamps, otherwise as soon as they
+ * are read (which is the pace of the sender, for the live inputs).
+ */
+template <typename VideoCodec, unsigned int width, unsigned int height,
+          typename AudioCodec = ADTS_AAC, unsigned int audioSampleRate = 44100,
+          enum AudioChannels audioChannels = STEREO>
+class FFMPEGDemuxerSource : public EventsProducer
+{
+
+    static_assert(std::is_same<VideoCodec, H264>::value,
+                  "FFMPEGDemuxerSource supports the H264 video only");
+    static_assert(std::is_same<AudioCodec, ADTS_AAC>::value,
+                  "FFMPEGDemuxerSource supports the AAC audio only");
+
+public:
+
+    // options: the ones of the input's protocol and format (I.E: {"rtsp_transport", "tcp"})
+    FFMPEGDemuxerSource(SharedEventsCatcher eventsCatcher, const std::string& url,
+                        bool realTime = false,
+                        const std::map<std::string, std::string>& options =
+                        std::map<std::string, std::string>()) :
+        EventsProducer::EventsProducer(eventsCatcher),
+        mURL(url),
+        mOptions(options),
+        mRealTime(realTime),
+        mFormatContext(NULL),
+        mVideoStreamIndex(-1),
+        mAudioStreamIndex(-1),
+        mADTSConfigured(false),
+        mStatus(DEV_INITIALIZING),
+        mLibAVError(0),
+        mUnrecoverableState(false),
+        mReconnectionInterval(2000),
+        mOpenTimeout(5000),
+        mStallTimeout(5000),
+        mPollInterval(10),
+        mIODeadline(0),
+        mLastPacketTime(0),
+        mTimestampsOffset(AV_NOPTS_VALUE),
+        mWakeUpTime(0)
+    {
+    }
+
+    ~FFMPEGDemuxerSource()
+    {
+        closeInput();
+    }
+
+    VideoFrameHolder<VideoCodec, width, height>&
+    operator >>
+    (VideoFrameHolder<VideoCodec, width, height>& videoFrameHolder)
+    {
+        VideoFrame<VideoCodec, width, height>* demuxedVideoFrame = pollNextVideoFrame();
+        if (!demuxedVideoFrame)
+        {
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoFrameHolder;
+        }
+        try
+        {
+            videoFrameHolder.hold(*demuxedVideoFrame);
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoFrameHolder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoFrameHolder;
+    }
+
+    AudioFrameHolder<AudioCodec, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioFrameHolder<AudioCodec, audioSampleRate, audioChannels>& audioFrameHolder)
+    {
+        AudioFrame<AudioCodec, audioSampleRate, audioChannels>* demuxedAudioFrame =
+        pollNextAudioFrame();
+        if (!demuxedAudioFrame)
+        {
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioFrameHolder;
+        }
+        try
+        {
+            audioFrameHolder.hold(*demuxedAudioFrame);
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioFrameHolder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioFrameHolder;
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    VideoFrame<VideoCodec, width, height>& grabNextVideoFrame()
+    {
+        VideoFrame<VideoCodec, width, height>* demuxedVideoFrame = pollNextVideoFrame();
+        if (!demuxedVideoFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *demuxedVideoFrame;
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    AudioFrame<AudioCodec, audioSampleRate, audioChannels>& grabNextAudioFrame()
+    {
+        AudioFrame<AudioCodec, audioSampleRate, audioChannels>* demuxedAudioFrame =
+        pollNextAudioFrame();
+        if (!demuxedAudioFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *demuxedAudioFrame;
+    }
+
+    // As grabNextVideoFrame(), but returns NULL instead of throwing (see V4L2Grabber)
+    VideoFrame<VideoCodec, width, height>* pollNextVideoFrame()
+    {
+        DemuxedPacket demuxedPacket;
+        if (!popDuePacket(mVideoPackets, demuxedPacket))
+            return NULL;
+        bool filled = fillVideoFrame(demuxedPacket, mDemuxedVideoFrame);
+        av_packet_free(&demuxedPacket.pkt);
+        return filled ? &mDemuxedVideoFrame : NULL;
+    }
+
+    // As grabNextAudioFrame(), but returns NULL instead of throwing
+    AudioFrame<AudioCodec, audioSampleRate, audioChannels>* pollNextAudioFrame()
+    {
+        DemuxedPacket demuxedPacket;
+        if (!popDuePacket(mAudioPackets, demuxedPacket))
+            return NULL;
+        bool filled = fillAudioFrame(demuxedPacket, mDemuxedAudioFrame);
+        av_packet_free(&demuxedPacket.pkt);
+        return filled ? &mDemuxedAudioFrame : NULL;
+    }
+
+    enum DeviceStatus status() const
+    {
+        return mStatus;
+    }
+
+    // The last libav error (I.E: AVERROR(ECONNREFUSED), AVERROR_EOF), 0 if none
+    int getLibAVError() const
+    {
+        return mLibAVError;
+    }
+
+    // I.E: the input has no H264 stream, or its resolution isn't width x height
+    bool isInUnrecoverableState() const
+    {
+        return mUnrecoverableState;
+    }
+
+    // Interval between two attempts to reopen the input
+    void setReconnectionInterval(unsigned int milliseconds)
+    {
+        mReconnectionInterval = milliseconds;
+    }
+
+    void setOpenTimeout(unsigned int milliseconds)
+    {
+        mOpenTimeout = milliseconds;
+    }
+
+    void setStallTimeout(unsigned int milliseconds)
+    {
+        mStallTimeout = milliseconds;
+    }
+
+    void setPollInterval(unsigned int milliseconds)
+    {
+        mPollInterval = milliseconds;
+    }
+
+private:
+
+    struct DemuxedPacket
+    {
+        AVPacket* pkt;
+        int64_t captureTimestamp;
+    };
+
+    // The packets of a stream which isn't piped are dropped after these ones
+    static const unsigned int maxQueuedPackets = 64;
+    static const unsigned int maxReadsPerPoll = 16;
+    // Beyond it, the input's timestamps are synced again to the capture clock (I.E: a replay)
+    static const int64_t maxTimestampsDrift = 1000000;
+
+    bool popDuePacket(std::deque<DemuxedPacket>& packets, DemuxedPacket& demuxedPacket)
+    {
+        if (mUnrecoverableState)
+            return false;
+        if (!mFormatContext)
+        {
+            // The first time, the input is opened by the first poll (not by the constructor,
+            // so that the setters apply), then by timeoutCallBack()
+            if (mStatus != DEV_INITIALIZING || !openInput())
+            {
+                reconnectLater();
+                return false;
+            }
+        }
+        if (packets.empty())
+            readPackets(packets);
+        if (packets.empty())
+            return false;
+
+        int64_t now = av_gettime_relative();
+        if (mRealTime && packets.front().captureTimestamp > now)
+        {
+            wakeUpAt(packets.front().captureTimestamp);
+            return false;
+        }
+        demuxedPacket = packets.front();
+        packets.pop_front();
+        // The loop mustn't wait for an event while there are queued packets
+        if (!packets.empty())
+            wakeUpAt(mRealTime ? packets.front().captureTimestamp : now);
+        return true;
+    }
+
+    // Reads until there is a packet of the wanted stream, or the input has no data now
+    void readPackets(std::deque<DemuxedPacket>& wantedPackets)
+    {
+        unsigned int n;
+        for (n = 0; n < maxReadsPerPoll && mFormatContext && wantedPackets.empty(); n++)
+        {
+            AVPacket* pkt = av_packet_alloc();
+            if (!pkt)
+                printAndThrowUnrecoverableError("pkt = av_packet_alloc()");
+            mIODeadline = av_gettime_relative() + (int64_t)mStallTimeout * 1000;
+            int ret = av_read_frame(mFormatContext, pkt);
+            mIODeadline = 0;
+            if (ret == AVERROR(EAGAIN))
+            {
+                av_packet_free(&pkt);
+                if (av_gettime_relative() - mLastPacketTime > (int64_t)mStallTimeout * 1000)
+                    disconnect(AVERROR(ETIMEDOUT));
+                break;
+            }
+            else if (ret < 0)
+            {
+                av_packet_free(&pkt);
+                disconnect(ret);
+                break;
+            }
+            mLastPacketTime = av_gettime_relative();
+
+            if (pkt->stream_index == mVideoStreamIndex && pkt->size > 0)
+                queuePacket(mVideoPackets, pkt);
+            else if (pkt->stream_index == mAudioStreamIndex && pkt->size > 0)
+                queuePacket(mAudioPackets, pkt);
+            else
+                av_packet_free(&pkt);
+        }
+        if (mFormatContext && wantedPackets.empty())
+            wakeUpAt(av_gettime_relative() + (int64_t)mPollInterval * 1000);
+    }
+
+    void queuePacket(std::deque<DemuxedPacket>& packets, AVPacket* pkt)
+    {
+        if (packets.size() == maxQueuedPackets)
+        {
+            av_packet_free(&packets.front().pkt);
+            packets.pop_front();
+        }
+        DemuxedPacket demuxedPacket;
+        demuxedPacket.pkt = pkt;
+        demuxedPacket.captureTimestamp = captureTimestampOf(pkt);
+        packets.push_back(demuxedPacket);
+    }
+
+    int64_t captureTimestampOf(const AVPacket* pkt)
+    {
+        int64_t now = av_gettime_relative();
+        int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+        if (ts == AV_NOPTS_VALUE)
+            return now;
+        ts = av_rescale_q(ts, mFormatContext->streams[pkt->stream_index]->time_base,
+                          AV_TIME_BASE_Q);
+        // The same offset for both the streams, so that they stay in sync
+        if (mTimestampsOffset == AV_NOPTS_VALUE ||
+            ts + mTimestampsOffset > now + maxTimestampsDrift ||
+            ts + mTimestampsOffset < now - maxTimestampsDrift)
+            mTimestampsOffset = now - ts;
+        return ts + mTimestampsOffset;
+    }
+
+    // The buffer of the packet is used as it is, when possible
+    bool fillVideoFrame(DemuxedPacket& demuxedPacket,
+                        VideoFrame<VideoCodec, width, height>& videoFrame)
+    {
+        AVPacket* pkt = demuxedPacket.pkt;
+        bool keyFrame = pkt->flags & AV_PKT_FLAG_KEY;
+        ShareableVideoFrameData frameData;
+        unsigned int frameSize;
+        if (mAnnexBWriter.isPassthrough(pkt->data, pkt->size, keyFrame))
+        {
+            frameData = packetData(demuxedPacket);
+            frameSize = pkt->size;
+        }
+        else
+        {
+            std::shared_ptr<std::vector<unsigned char> > annexBPacket =
+            std::make_shared<std::vector<unsigned char> >();
+            if (!mAnnexBWriter.write(pkt->data, pkt->size, keyFrame, *annexBPacket) ||
+                annexBPacket->empty())
+                return false;
+            frameData = ShareableVideoFrameData(annexBPacket, &(*annexBPacket)[0]);
+            frameSize = annexBPacket->size();
+        }
+        videoFrame.assignDataSharedPtr(frameData);
+        videoFrame.setSize(frameSize);
+        videoFrame.mLibAVFlags = keyFrame ? AV_PKT_FLAG_KEY : 0;
+        videoFrame.setCaptureTimestamp(demuxedPacket.captureTimestamp);
+        return true;
+    }
+
+    bool fillAudioFrame(DemuxedPacket& demuxedPacket,
+                        AudioFrame<AudioCodec, audioSampleRate, audioChannels>& audioFrame)
+    {
+        AVPacket* pkt = demuxedPacket.pkt;
+        ShareableAudioFrameData frameData;
+        unsigned int frameSize;
+        // I.E: the AAC of a MPEGTS input
+        if (pkt->size >= 2 && pkt->data[0] == 0xFF && (pkt->data[1] & 0xF6) == 0xF0)
+        {
+            frameData = packetData(demuxedPacket);
+            frameSize = pkt->size;
+        }
+        else
+        {
+            frameSize = pkt->size + ADTSHeaderWriter::headerSize;
+            if (!mADTSConfigured || frameSize > ADTSHeaderWriter::maxFrameSize)
+                return false;
+            auto freeFrameData = [](unsigned char* frameData)
+            {
+                delete[] frameData;
+            };
+            frameData = ShareableAudioFrameData(new unsigned char[frameSize], freeFrameData);
+            mADTSHeaderWriter.write(frameData.get(), pkt->size);
+            memcpy(frameData.get() + ADTSHeaderWriter::headerSize, pkt->data, pkt->size);
+        }
+        audioFrame.assignDataSharedPtr(frameData);
+        audioFrame.setSize(frameSize);
+        audioFrame.mLibAVFlags = AV_PKT_FLAG_KEY;
+        audioFrame.setCaptureTimestamp(demuxedPacket.captureTimestamp);
+        return true;
+    }
+
+    // The frame takes the ownership of the packet (which is freed with the last frame using it)
+    std::shared_ptr<unsigned char> packetData(DemuxedPacket& demuxedPacket)
+    {
+        AVPacket* pkt = demuxedPacket.pkt;
+        demuxedPacket.pkt = NULL;
+        auto freePacket = [pkt](unsigned char*) mutable
+        {
+            av_packet_free(&pkt);
+        };
+        return std::shared_ptr<unsigned char>(pkt->data, freePacket);
+    }
+
+    bool openInput()
+    {
+        mFormatContext = avformat_alloc_context();
+        if (!mFormatContext)
+            printAndThrowUnrecoverableError("mFormatContext = avformat_alloc_context()");
+        mFormatContext->interrupt_callback.callback = FFMPEGDemuxerSource::libavInterruptCallback;
+        mFormatContext->interrupt_callback.opaque = this;
+
+        AVDictionary* options = NULL;
+        std::map<std::string, std::string>::const_iterator it;
+        for (it = mOptions.begin(); it != mOptions.end(); ++it)
+            av_dict_set(&options, it->first.c_str(), it->second.c_str(), 0);
+        mIODeadline = av_gettime_relative() + (int64_t)mOpenTimeout * 1000;
+        // On failure, the context is freed
+        int ret = avformat_open_input(&mFormatContext, mURL.c_str(), NULL, &options);
+        av_dict_free(&options);
+        if (ret >= 0)
+            ret = avformat_find_stream_info(mFormatContext, NULL);
+        mIODeadline = 0;
+        if (ret < 0)
+        {
+            closeInput();
+            mLibAVError = ret;
+            mStatus = OPEN_DEV_ERROR;
+            return false;
+        }
+
+        if (!findStreams())
+        {
+            closeInput();
+            mStatus = CONFIGURE_DEV_ERROR;
+            mUnrecoverableState = true;
+            return false;
+        }
+        mFormatContext->flags |= AVFMT_FLAG_NONBLOCK;
+        mLastPacketTime = av_gettime_relative();
+        mTimestampsOffset = AV_NOPTS_VALUE;
+        mStatus = DEV_CAN_GRAB;
+        return true;
+    }
+
+    bool findStreams()
+    {
+        mVideoStreamIndex = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_VIDEO,
+                                                -1, -1, NULL, 0);
+        if (mVideoStreamIndex < 0)
+            return false;
+        AVCodecParameters* videoParams = mFormatContext->streams[mVideoStreamIndex]->codecpar;
+        if (videoParams->codec_id != FFMPEGUtils::translateCodec<VideoCodec>() ||
+            (videoParams->width != 0 && videoParams->width != (int)width) ||
+            (videoParams->height != 0 && videoParams->height != (int)height) ||
+            !mAnnexBWriter.configure(videoParams->extradata, videoParams->extradata_size))
+            return false;
+
+        mAudioStreamIndex = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_AUDIO,
+                                                -1, mVideoStreamIndex, NULL, 0);
+        if (mAudioStreamIndex >= 0)
+        {
+            AVCodecParameters* audioParams = mFormatContext->streams[mAudioStreamIndex]->codecpar;
+            if (audioParams->codec_id != FFMPEGUtils::translateCodec<AudioCodec>() ||
+                audioParams->sample_rate != (int)audioSampleRate ||
+                audioParams->channels != (audioChannels == MONO ? 1 : 2))
+                mAudioStreamIndex = -1;
+            else
+                mADTSConfigured = mADTSHeaderWriter.configure(audioParams->extradata,
+                                                              audioParams->extradata_size);
+        }
+        return true;
+    }
+
+    void closeInput()
+    {
+        clearPackets(mVideoPackets);
+        clearPackets(mAudioPackets);
+        avformat_close_input(&mFormatContext);
+        mVideoStreamIndex = -1;
+        mAudioStreamIndex = -1;
+        mADTSConfigured = false;
+    }
+
+    void clearPackets(std::deque<DemuxedPacket>& packets)
+    {
+        while (!packets.empty())
+        {
+            av_packet_free(&packets.front().pkt);
+            packets.pop_front();
+        }
+    }
+
+    void disconnect(int libAVError)
+    {
+        closeInput();
+        mLibAVError = libAVError;
+        mStatus = DEV_DISCONNECTED;
+        reconnectLater();
+    }
+
+    void reconnectLater()
+    {
+        if (!mUnrecoverableState)
+            wakeUpAt(av_gettime_relative() + (int64_t)mReconnectionInterval * 1000);
+    }
+
+    // The pending timeout is kept if it expires before
+    void wakeUpAt(int64_t time)
+    {
+        if (thereIsTimeoutPending() && mWakeUpTime <= time)
+            return;
+        int64_t now = av_gettime_relative();
+        observeTimeout(time > now ? (time - now + 999) / 1000 : 0);
+        mWakeUpTime = time;
+    }
+
+    void timeoutCallBack()
+    {
+        // Otherwise, the pipe's step (which follows the wakeup) polls the input
+        if (!mFormatContext && !mUnrecoverableState && !openInput())
+            reconnectLater();
+    }
+
+    static int libavInterruptCallback(void* opaque)
+    {
+        FFMPEGDemuxerSource* source = static_cast<FFMPEGDemuxerSource* >(opaque);
+        return source->mIODeadline != 0 && av_gettime_relative() > source->mIODeadline;
+    }
+
+    std::string mURL;
+    std::map<std::string, std::string> mOptions;
+    bool mRealTime;
+    AVFormatContext* mFormatContext;
+    int mVideoStreamIndex;
+    int mAudioStreamIndex;
+    H264AnnexBWriter mAnnexBWriter;
+    ADTSHeaderWriter mADTSHeaderWriter;
+    bool mADTSConfigured;
+    enum DeviceStatus mStatus;
+    int mLibAVError;
+    bool mUnrecoverableState;
+    unsigned int mReconnectionInterval;
+    unsigned int mOpenTimeout;
+    unsigned int mStallTimeout;
+    unsigned int mPollInterval;
+    // Checked by the interrupt callback (microseconds), 0 outside of the I/O calls
+    int64_t mIODeadline;
+    int64_t mLastPacketTime;
+    // From the input's timestamps to the capture clock
+    int64_t mTimestampsOffset;
+    int64_t mWakeUpTime;
+    std::deque<DemuxedPacket> mVideoPackets;
+    std::deque<DemuxedPacket> mAudioPackets;
+    VideoFrame<VideoCodec, width, height> mDemuxedVideoFrame;
+    AudioFrame<AudioCodec, audioSampleRate, audioChannels> mDemuxedAudioFrame;
+
+};
+
+}
+
+#endif // FFMPEGDEMUXERSOURCE_HPP_INCLUDED
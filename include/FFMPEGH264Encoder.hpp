@@ -23,8 +23,21 @@ public:
         this->completeEncoderInitialization();
     }
 
+    /*
+     * numOfThreads: 0 lets x264 choose. The frame threads (default) add one frame of delay
+     * each, the sliced ones don't, but they compress a bit worse.
+     * lookaheadFrames: the frames analyzed by the rate control before encoding one (the
+     * presets' default is 10-60; 0 for the lowest latency).
+     * maxBitrate, vbvBufferSize: the VBV (bits), needed for changing it while encoding
+     * (see setBitrate()).
+     */
     FFMPEGH264Encoder(unsigned int bitrate, unsigned int gopSize,
-                      enum H264Presets preset, enum H264Profiles profile)
+                      enum H264Presets preset, enum H264Profiles profile,
+                      unsigned int numOfThreads = DEFAULT_ENCODER_THREADS,
+                      bool slicedThreads = false,
+                      unsigned int lookaheadFrames = DEFAULT_LOOKAHEAD,
+                      unsigned int maxBitrate = DEFAULT_BITRATE,
+                      unsigned int vbvBufferSize = DEFAULT_BITRATE)
     {
         if (bitrate != DEFAULT_BITRATE)
             this->mVideoEncoderCodecContext->bit_rate = bitrate;
@@ -35,6 +48,17 @@ public:
                        "preset", convertToFFMPEGPreset(preset), 0);
         if (profile != H264_DEFAULT_PROFILE)
             this->mVideoEncoderCodecContext->profile = convertToFFMPEGProfile(profile);
+        if (numOfThreads != DEFAULT_ENCODER_THREADS)
+            this->mVideoEncoderCodecContext->thread_count = numOfThreads;
+        this->mVideoEncoderCodecContext->thread_type = slicedThreads ? FF_THREAD_SLICE :
+                                                                      FF_THREAD_FRAME;
+        if (lookaheadFrames != DEFAULT_LOOKAHEAD)
+            av_opt_set_int(this->mVideoEncoderCodecContext->priv_data,
+                           "rc-lookahead", lookaheadFrames, 0);
+        if (maxBitrate != DEFAULT_BITRATE)
+            this->mVideoEncoderCodecContext->rc_max_rate = maxBitrate;
+        if (vbvBufferSize != DEFAULT_BITRATE)
+            this->mVideoEncoderCodecContext->rc_buffer_size = vbvBufferSize;
         this->completeEncoderInitialization();
     }
 
@@ -0,0 +1,84 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGH265ENCODER_HPP_INCLUDED
+#define FFMPEGH265ENCODER_HPP_INCLUDED
+
+#include <sstream>
+#include "FFMPEGVideoEncoder.hpp"
+#include "UserParams.hpp"
+
+namespace laav
+{
+
+/*
+ * HEVC encoder (libx265): about the same quality as FFMPEGH264Encoder with a lower
+ * bitrate, at the cost of more CPU. The VPS, SPS and PPS are repeated before each
+ * keyframe, so that the new viewers (and the segments of the recordings) can start
+ * decoding from any of them. libx265 keeps the initial rate control (see setBitrate()).
+ */
+template <typename RawVideoFrameFormat, unsigned int width, unsigned int height>
+class FFMPEGH265Encoder: public FFMPEGVideoEncoder<RawVideoFrameFormat, H265, width, height>
+{
+public:
+
+    FFMPEGH265Encoder()
+    {
+        setX265Params(DEFAULT_ENCODER_THREADS, DEFAULT_LOOKAHEAD);
+        this->completeEncoderInitialization();
+    }
+
+    /*
+     * numOfThreads: the threads of x265's pool (0 lets x265 choose).
+     * lookaheadFrames: the frames analyzed by the rate control before encoding one (the
+     * presets' default is 5-60; 0 for the lowest latency).
+     * maxBitrate, vbvBufferSize: the VBV (bits).
+     */
+    FFMPEGH265Encoder(unsigned int bitrate, unsigned int gopSize,
+                      enum H264Presets preset, enum H265Profiles profile,
+                      unsigned int numOfThreads = DEFAULT_ENCODER_THREADS,
+                      unsigned int lookaheadFrames = DEFAULT_LOOKAHEAD,
+                      unsigned int maxBitrate = DEFAULT_BITRATE,
+                      unsigned int vbvBufferSize = DEFAULT_BITRATE)
+    {
+        if (bitrate != DEFAULT_BITRATE)
+            this->mVideoEncoderCodecContext->bit_rate = bitrate;
+        if (gopSize != DEFAULT_GOPSIZE)
+            this->mVideoEncoderCodecContext->gop_size = gopSize;
+        if (preset != H264_DEFAULT_PRESET)
+            av_opt_set(this->mVideoEncoderCodecContext->priv_data,
+                       "preset", convertToFFMPEGPreset(preset), 0);
+        if (profile != H265_DEFAULT_PROFILE)
+            this->mVideoEncoderCodecContext->profile = convertToFFMPEGProfile(profile);
+        if (maxBitrate != DEFAULT_BITRATE)
+            this->mVideoEncoderCodecContext->rc_max_rate = maxBitrate;
+        if (vbvBufferSize != DEFAULT_BITRATE)
+            this->mVideoEncoderCodecContext->rc_buffer_size = vbvBufferSize;
+        setX265Params(numOfThreads, lookaheadFrames);
+        this->completeEncoderInitialization();
+    }
+
+private:
+
+    // The options of x265 which libavcodec doesn't map, I.E: "repeat-headers=1:pools=4"
+    void setX265Params(unsigned int numOfThreads, unsigned int lookaheadFrames)
+    {
+        std::ostringstream x265Params;
+        x265Params << "repeat-headers=1";
+        if (numOfThreads != DEFAULT_ENCODER_THREADS)
+            x265Params << ":pools=" << numOfThreads;
+        if (lookaheadFrames != DEFAULT_LOOKAHEAD)
+            x265Params << ":rc-lookahead=" << lookaheadFrames;
+        if (av_opt_set(this->mVideoEncoderCodecContext->priv_data,
+                       "x265-params", x265Params.str().c_str(), 0) < 0)
+            printAndThrowUnrecoverableError("av_opt_set(..., \"x265-params\", ...)");
+    }
+
+};
+
+}
+
+#endif // FFMPEGH265ENCODER_HPP_INCLUDED
@@ -0,0 +1,51 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGHWH264ENCODER_HPP_INCLUDED
+#define FFMPEGHWH264ENCODER_HPP_INCLUDED
+
+#include "FFMPEGHWVideoEncoder.hpp"
+
+namespace laav
+{
+
+/*
+ * Same as FFMPEGH264Encoder, but the encoding is done by the device selected by Backend.
+ * Raw frames are uploaded to the device's surfaces. DMABUF frames (VAAPI only) are
+ * imported without copying them.
+ * I.E:
+ *
+ *   FFMPEGHWH264Encoder<NV_12_PLANAR, WIDTH, HEIGHT, VAAPI> encoder("/dev/dri/renderD128");
+ *   FFMPEGHWH264Encoder<DMABUF<NV_12_PLANAR>, WIDTH, HEIGHT, VAAPI> encoder;
+ *   FFMPEGHWH264Encoder<YUV420_PLANAR, WIDTH, HEIGHT, NVENC> encoder;
+ */
+template <typename RawVideoFrameFormat, unsigned int width, unsigned int height, typename Backend>
+class FFMPEGHWH264Encoder: public FFMPEGHWVideoEncoder<RawVideoFrameFormat, H264,
+                                                       width, height, Backend>
+{
+
+public:
+
+    // device: I.E: "/dev/dri/renderD128" for VAAPI, "0" (GPU index) for NVENC,
+    // empty for the default one. numOfSurfaces: see FFMPEGHWVideoEncoder
+    FFMPEGHWH264Encoder(const std::string& device = "",
+                        unsigned int bitrate = DEFAULT_BITRATE,
+                        unsigned int gopSize = DEFAULT_GOPSIZE,
+                        enum H264Profiles profile = H264_DEFAULT_PROFILE,
+                        unsigned int numOfSurfaces = 0) :
+        FFMPEGHWVideoEncoder<RawVideoFrameFormat, H264, width, height, Backend>
+        (device, bitrate, gopSize, numOfSurfaces)
+    {
+        if (profile != H264_DEFAULT_PROFILE)
+            this->mVideoEncoderCodecContext->profile = convertToFFMPEGProfile(profile);
+        this->completeEncoderInitialization();
+    }
+
+};
+
+}
+
+#endif // FFMPEGHWH264ENCODER_HPP_INCLUDED
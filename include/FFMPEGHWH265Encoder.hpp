@@ -0,0 +1,49 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGHWH265ENCODER_HPP_INCLUDED
+#define FFMPEGHWH265ENCODER_HPP_INCLUDED
+
+#include "FFMPEGHWVideoEncoder.hpp"
+
+namespace laav
+{
+
+/*
+ * Same as FFMPEGH265Encoder, but the encoding is done by the device selected by Backend
+ * (see FFMPEGHWH264Encoder). The devices repeat the VPS, SPS and PPS before the keyframes
+ * by themselves.
+ * I.E:
+ *
+ *   FFMPEGHWH265Encoder<NV_12_PLANAR, WIDTH, HEIGHT, VAAPI> encoder("/dev/dri/renderD128");
+ */
+template <typename RawVideoFrameFormat, unsigned int width, unsigned int height, typename Backend>
+class FFMPEGHWH265Encoder: public FFMPEGHWVideoEncoder<RawVideoFrameFormat, H265,
+                                                       width, height, Backend>
+{
+
+public:
+
+    // device: I.E: "/dev/dri/renderD128" for VAAPI, "0" (GPU index) for NVENC,
+    // empty for the default one. numOfSurfaces: see FFMPEGHWVideoEncoder
+    FFMPEGHWH265Encoder(const std::string& device = "",
+                        unsigned int bitrate = DEFAULT_BITRATE,
+                        unsigned int gopSize = DEFAULT_GOPSIZE,
+                        enum H265Profiles profile = H265_DEFAULT_PROFILE,
+                        unsigned int numOfSurfaces = 0) :
+        FFMPEGHWVideoEncoder<RawVideoFrameFormat, H265, width, height, Backend>
+        (device, bitrate, gopSize, numOfSurfaces)
+    {
+        if (profile != H265_DEFAULT_PROFILE)
+            this->mVideoEncoderCodecContext->profile = convertToFFMPEGProfile(profile);
+        this->completeEncoderInitialization();
+    }
+
+};
+
+}
+
+#endif // FFMPEGHWH265ENCODER_HPP_INCLUDED
@@ -0,0 +1,275 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGHWVIDEOENCODER_HPP_INCLUDED
+#define FFMPEGHWVIDEOENCODER_HPP_INCLUDED
+
+#include "FFMPEGVideoEncoder.hpp"
+#include "UserParams.hpp"
+extern "C"
+{
+#include <libavutil/hwcontext.h>
+}
+
+namespace laav
+{
+
+// Hardware encoding backends
+class VAAPI {};
+class V4L2_M2M {};
+class NVENC {};
+
+struct FFMPEGHWUtils
+{
+
+    template <typename EncodedVideoFrameCodec, typename Backend>
+    static const char* encoderName();
+
+    template <typename Backend>
+    static enum AVHWDeviceType translateDeviceType();
+
+    template <typename Backend>
+    static AVPixelFormat translateHWPixelFormat();
+
+    // Format of the frames uploaded to (or imported by) the device
+    template <typename RawVideoFrameFormat>
+    static AVPixelFormat translateSWPixelFormat()
+    {
+        return FFMPEGUtils::translatePixelFormat<RawVideoFrameFormat>();
+    }
+
+};
+
+template <>
+const char* FFMPEGHWUtils::encoderName<H264, VAAPI>()
+{
+    return "h264_vaapi";
+}
+template <>
+const char* FFMPEGHWUtils::encoderName<H264, V4L2_M2M>()
+{
+    return "h264_v4l2m2m";
+}
+template <>
+const char* FFMPEGHWUtils::encoderName<H264, NVENC>()
+{
+    return "h264_nvenc";
+}
+template <>
+const char* FFMPEGHWUtils::encoderName<H265, VAAPI>()
+{
+    return "hevc_vaapi";
+}
+template <>
+const char* FFMPEGHWUtils::encoderName<H265, V4L2_M2M>()
+{
+    return "hevc_v4l2m2m";
+}
+template <>
+const char* FFMPEGHWUtils::encoderName<H265, NVENC>()
+{
+    return "hevc_nvenc";
+}
+template <>
+enum AVHWDeviceType FFMPEGHWUtils::translateDeviceType<VAAPI>()
+{
+    return AV_HWDEVICE_TYPE_VAAPI;
+}
+// The M2M encoder takes system memory frames: it doesn't need a device context
+template <>
+enum AVHWDeviceType FFMPEGHWUtils::translateDeviceType<V4L2_M2M>()
+{
+    return AV_HWDEVICE_TYPE_NONE;
+}
+template <>
+enum AVHWDeviceType FFMPEGHWUtils::translateDeviceType<NVENC>()
+{
+    return AV_HWDEVICE_TYPE_CUDA;
+}
+template <>
+AVPixelFormat FFMPEGHWUtils::translateHWPixelFormat<VAAPI>()
+{
+    return AV_PIX_FMT_VAAPI;
+}
+template <>
+AVPixelFormat FFMPEGHWUtils::translateHWPixelFormat<V4L2_M2M>()
+{
+    return AV_PIX_FMT_NONE;
+}
+template <>
+AVPixelFormat FFMPEGHWUtils::translateHWPixelFormat<NVENC>()
+{
+    return AV_PIX_FMT_CUDA;
+}
+template <>
+AVPixelFormat FFMPEGHWUtils::translateSWPixelFormat<DMABUF<YUYV422_PACKED> >()
+{
+    return AV_PIX_FMT_YUYV422;
+}
+template <>
+AVPixelFormat FFMPEGHWUtils::translateSWPixelFormat<DMABUF<NV_12_PLANAR> >()
+{
+    return AV_PIX_FMT_NV12;
+}
+template <>
+AVPixelFormat FFMPEGHWUtils::translateSWPixelFormat<DMABUF<YUV420_PLANAR> >()
+{
+    return AV_PIX_FMT_YUV420P;
+}
+
+/*
+ * The encoders of EncodedVideoFrameCodec done by the device selected by Backend (see
+ * FFMPEGHWH264Encoder and FFMPEGHWH265Encoder). Raw frames are uploaded to the device's
+ * surfaces (packed ones too, I.E: YUYV from the V4L2 cameras, if the device accepts them:
+ * VAAPI does, NVENC doesn't). DMABUF frames (VAAPI only) are imported without copying them.
+ * The subclasses set the codec's own options, then call completeEncoderInitialization().
+ */
+template <typename RawVideoFrameFormat, typename EncodedVideoFrameCodec,
+          unsigned int width, unsigned int height, typename Backend>
+class FFMPEGHWVideoEncoder: public FFMPEGVideoEncoder<RawVideoFrameFormat, EncodedVideoFrameCodec,
+                                                      width, height>
+{
+
+    static_assert(!IsDMABUF<RawVideoFrameFormat>::value || std::is_same<Backend, VAAPI>::value,
+                  "DMABUF frames can be imported only by the VAAPI backend");
+
+public:
+
+    ~FFMPEGHWVideoEncoder()
+    {
+        av_frame_free(&mHWLibAVFrame);
+        av_buffer_unref(&mHWFramesContext);
+        av_buffer_unref(&mHWDeviceContext);
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     *  \exception MediaException(MEDIA_BUFFERING) (the device's queue is being filled)
+     */
+    void encode(const VideoFrame<RawVideoFrameFormat, width, height>& inputRawVideoFrame)
+    {
+        this->mNumOfNewEncodedFrames = 0;
+        this->fillLibAVFrame(inputRawVideoFrame);
+        if (!mHWFramesContext)
+        {
+            this->doEncode(this->mInputLibAVFrame, inputRawVideoFrame);
+            return;
+        }
+
+        av_frame_unref(mHWLibAVFrame);
+        transferToHWFrame(inputRawVideoFrame);
+        this->doEncode(mHWLibAVFrame, inputRawVideoFrame);
+    }
+
+protected:
+
+    /*
+     * numOfSurfaces: the device's surfaces where the frames are uploaded. 0: enough for the
+     * frames which the encoder can hold (see defaultNumOfSurfaces()).
+     */
+    FFMPEGHWVideoEncoder(const std::string& device, unsigned int bitrate, unsigned int gopSize,
+                         unsigned int numOfSurfaces) :
+        FFMPEGVideoEncoder<RawVideoFrameFormat, EncodedVideoFrameCodec, width, height>
+        (FFMPEGHWUtils::encoderName<EncodedVideoFrameCodec, Backend>()),
+        mHWDeviceContext(NULL),
+        mHWFramesContext(NULL),
+        mHWLibAVFrame(NULL)
+    {
+        if (bitrate != DEFAULT_BITRATE)
+            this->mVideoEncoderCodecContext->bit_rate = bitrate;
+        if (gopSize != DEFAULT_GOPSIZE)
+            this->mVideoEncoderCodecContext->gop_size = gopSize;
+
+        if (FFMPEGHWUtils::translateDeviceType<Backend>() != AV_HWDEVICE_TYPE_NONE)
+            initHWContexts(device, numOfSurfaces ? numOfSurfaces : defaultNumOfSurfaces());
+        else
+            this->mVideoEncoderCodecContext->pix_fmt =
+            FFMPEGHWUtils::translateSWPixelFormat<RawVideoFrameFormat>();
+    }
+
+private:
+
+    /*
+     * The encoder keeps the frames whose packets haven't been taken yet (at most the encoded
+     * frames' buffer: if it's resized by setEncodedFrameBufferSize() after the construction,
+     * numOfSurfaces must be given) and the ones reordered for the B-frames, plus the frame
+     * being uploaded and the one being encoded
+     */
+    unsigned int defaultNumOfSurfaces() const
+    {
+        return this->encodedFrameBufferSize() + this->mVideoEncoderCodecContext->max_b_frames + 2;
+    }
+
+    void initHWContexts(const std::string& device, unsigned int numOfSurfaces)
+    {
+        if (av_hwdevice_ctx_create(&mHWDeviceContext,
+                                   FFMPEGHWUtils::translateDeviceType<Backend>(),
+                                   device.empty() ? NULL : device.c_str(), NULL, 0) < 0)
+            printAndThrowUnrecoverableError("av_hwdevice_ctx_create(...)");
+
+        mHWFramesContext = av_hwframe_ctx_alloc(mHWDeviceContext);
+        if (!mHWFramesContext)
+            printAndThrowUnrecoverableError("mHWFramesContext = av_hwframe_ctx_alloc(...)");
+
+        AVHWFramesContext* framesContext = (AVHWFramesContext* )mHWFramesContext->data;
+        framesContext->format = FFMPEGHWUtils::translateHWPixelFormat<Backend>();
+        framesContext->sw_format = FFMPEGHWUtils::translateSWPixelFormat<RawVideoFrameFormat>();
+        framesContext->width = width;
+        framesContext->height = height;
+        framesContext->initial_pool_size = numOfSurfaces;
+        if (av_hwframe_ctx_init(mHWFramesContext) < 0)
+            printAndThrowUnrecoverableError("av_hwframe_ctx_init(...)");
+
+        this->mVideoEncoderCodecContext->pix_fmt = framesContext->format;
+        this->mVideoEncoderCodecContext->hw_frames_ctx = av_buffer_ref(mHWFramesContext);
+        if (!this->mVideoEncoderCodecContext->hw_frames_ctx)
+            printAndThrowUnrecoverableError("mVideoEncoderCodecContext->hw_frames_ctx = av_buffer_ref(...)");
+
+        mHWLibAVFrame = av_frame_alloc();
+        if (!mHWLibAVFrame)
+            printAndThrowUnrecoverableError("mHWLibAVFrame = av_frame_alloc()");
+    }
+
+    void transferToHWFrame(const Planar3RawVideoFrame& inputRawVideoFrame)
+    {
+        uploadToHWFrame();
+    }
+
+    void transferToHWFrame(const PackedRawVideoFrame& inputRawVideoFrame)
+    {
+        uploadToHWFrame();
+    }
+
+    void uploadToHWFrame()
+    {
+        if (av_hwframe_get_buffer(mHWFramesContext, mHWLibAVFrame, 0) < 0)
+            printAndThrowUnrecoverableError("av_hwframe_get_buffer(...)");
+        if (av_hwframe_transfer_data(mHWLibAVFrame, this->mInputLibAVFrame, 0) < 0)
+            printAndThrowUnrecoverableError("av_hwframe_transfer_data(...)");
+    }
+
+#ifdef LAAV_FFMPEG_DRM_PRIME
+    void transferToHWFrame(const DMABufRawVideoFrame& inputRawVideoFrame)
+    {
+        // The mapped surface holds a reference to the dma-buf until the encoder releases it
+        mHWLibAVFrame->format = FFMPEGHWUtils::translateHWPixelFormat<Backend>();
+        mHWLibAVFrame->hw_frames_ctx = av_buffer_ref(mHWFramesContext);
+        if (!mHWLibAVFrame->hw_frames_ctx)
+            printAndThrowUnrecoverableError("mHWLibAVFrame->hw_frames_ctx = av_buffer_ref(...)");
+        if (av_hwframe_map(mHWLibAVFrame, this->mInputLibAVFrame, AV_HWFRAME_MAP_READ) < 0)
+            printAndThrowUnrecoverableError("av_hwframe_map(...)");
+    }
+#endif
+
+    AVBufferRef* mHWDeviceContext;
+    AVBufferRef* mHWFramesContext;
+    AVFrame* mHWLibAVFrame;
+
+};
+
+}
+
+#endif // FFMPEGHWVIDEOENCODER_HPP_INCLUDED
@@ -7,6 +7,11 @@
 #ifndef FFMPEGMJPEGDECODER_HPP_INCLUDED
 #define FFMPEGMJPEGDECODER_HPP_INCLUDED
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "FFMPEGCommon.hpp"
 #include "FFMPEGVideoConverter.hpp"
 
@@ -22,81 +27,127 @@ extern "C"
 namespace laav
 {
 
-template <unsigned int width, unsigned int height>
+/*
+ * Decodes the MJPEG frames to YUV422_PLANAR, optionally scaled down by 2, 4 or 8 during the
+ * decoding itself (I.E: for preview streams, without a separate downscale converter).
+ *
+ * With DECODER_FRAME_THREADS and numOfThreads > 1, the frames are decoded in parallel by
+ * numOfThreads decoders, each one in its own thread: decode() returns the frame of the
+ * packet given numOfThreads - 1 calls before, and throws MediaException(MEDIA_BUFFERING)
+ * until the pipeline is full. With DECODER_SLICE_THREADS, a single decoder uses
+ * numOfThreads threads for each frame (if Libav's MJPEG decoder supports it).
+ */
+template <unsigned int width, unsigned int height, unsigned int scaleDenominator = 1>
 class FFMPEGMJPEGDecoder
 {
 
+    static_assert(scaleDenominator == 1 || scaleDenominator == 2 ||
+                  scaleDenominator == 4 || scaleDenominator == 8,
+                  "The MJPEG frames can be scaled by 1/2, 1/4 or 1/8 only");
+
 public:
 
-    FFMPEGMJPEGDecoder() :
-        mMediaStatusInPipe(MEDIA_NOT_READY)
+    static const unsigned int decodedWidth = (width + scaleDenominator - 1) / scaleDenominator;
+    static const unsigned int decodedHeight = (height + scaleDenominator - 1) / scaleDenominator;
+
+    FFMPEGMJPEGDecoder(unsigned int numOfThreads = 1,
+                       enum VideoDecoderThreading threading = DECODER_FRAME_THREADS) :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mPipelined(threading == DECODER_FRAME_THREADS && numOfThreads > 1),
+        mNextContext(0),
+        mNumOfQueuedPackets(0),
+        mStop(false)
     {
-        av_register_all();
-        avcodec_register_all();
+        FFMPEGUtils::registerAll();
 
         mVideoCodec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
         if (!mVideoCodec)
             printAndThrowUnrecoverableError("mVideoCodec = avcodec_find_decoder(AV_CODEC_ID_MJPEG)");
 
-        mVideoDecoderCodecContext = avcodec_alloc_context3(mVideoCodec);
-        if (!mVideoDecoderCodecContext)
-            printAndThrowUnrecoverableError("");
-        mVideoDecoderCodecContext->codec_id = AV_CODEC_ID_MJPEG;
-        mVideoDecoderCodecContext->width = width;
-        mVideoDecoderCodecContext->height = height;
-        mVideoDecoderCodecContext->time_base = AV_TIME_BASE_Q;
-        mVideoDecoderCodecContext->color_range = AVCOL_RANGE_JPEG;
+        unsigned int numOfContexts = mPipelined ? numOfThreads : 1;
+        unsigned int n;
+        for (n = 0; n < numOfContexts; n++)
+            mContexts.push_back(std::unique_ptr<DecoderContext>(
+                openDecoderContext(mPipelined ? 1 : std::max(numOfThreads, 1u))));
 
-        if (avcodec_open2(mVideoDecoderCodecContext, mVideoCodec, NULL) < 0)
-            printAndThrowUnrecoverableError("avcodec_open2(...)");
-
-        mDecodedLibAVFrame = av_frame_alloc();
-        if (!mDecodedLibAVFrame)
-            printAndThrowUnrecoverableError("mDecodedLibAVFrame = av_frame_alloc()");
+        if (mPipelined)
+        {
+            for (n = 0; n < numOfContexts; n++)
+                mContexts[n]->thread = std::thread(&FFMPEGMJPEGDecoder::runDecoderThread, this,
+                                                   mContexts[n].get());
+        }
 
         setDecodedFrameSizes(mDecodedVideoFrame);
     }
 
     ~FFMPEGMJPEGDecoder()
     {
-        av_frame_free(&mDecodedLibAVFrame);
-        avcodec_free_context(&mVideoDecoderCodecContext);
+        if (mPipelined)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStop = true;
+            }
+            mPacketQueued.notify_all();
+            unsigned int n;
+            for (n = 0; n < mContexts.size(); n++)
+                mContexts[n]->thread.join();
+        }
+        unsigned int n;
+        for (n = 0; n < mContexts.size(); n++)
+        {
+            av_frame_free(&mContexts[n]->decodedLibAVFrame);
+            avcodec_free_context(&mContexts[n]->codecContext);
+        }
     }
 
     /*!
      *  \exception MediaException(MEDIA_NO_DATA)
+     *  \exception MediaException(MEDIA_BUFFERING) (pipelined decoding, until the pipeline is full)
      */
-    VideoFrame<YUV422_PLANAR, width, height>& decode(const EncodedVideoFrame& encodedVideoFrame)
+    VideoFrame<YUV422_PLANAR, decodedWidth, decodedHeight>&
+    decode(const VideoFrame<MJPEG, width, height>& encodedVideoFrame)
     {
-        AVPacket tempPkt;
-        av_init_packet(&tempPkt);
-
-        tempPkt.data = (uint8_t* )encodedVideoFrame.data();
-        tempPkt.size = encodedVideoFrame.size();
-
-        int ret = avcodec_send_packet(mVideoDecoderCodecContext, &tempPkt);
-        // TODO separate send and receive errors? Doesn't seem necessary here...
-        ret = avcodec_receive_frame(mVideoDecoderCodecContext, mDecodedLibAVFrame);
-        if (ret != 0)
+        if (!mPipelined)
         {
-            throw MediaException(MEDIA_NO_DATA);
+            DecoderContext& decoderContext = *mContexts[0];
+            takePacket(decoderContext, encodedVideoFrame);
+            if (!decodePacket(decoderContext))
+                throw MediaException(MEDIA_NO_DATA);
+            fillDecodedFrame(decoderContext);
+            return mDecodedVideoFrame;
         }
 
-        auto freeNothing = [](unsigned char* buffer) {  };
-
-        mDecodedLibAVFrameData0 = ShareableVideoFrameData(mDecodedLibAVFrame->data[0], freeNothing);
-        mDecodedLibAVFrameData1 = ShareableVideoFrameData(mDecodedLibAVFrame->data[1], freeNothing);
-        mDecodedLibAVFrameData2 = ShareableVideoFrameData(mDecodedLibAVFrame->data[2], freeNothing);
-        fillDecodedFrame(mDecodedVideoFrame);
-        av_packet_unref(&tempPkt);
+        DecoderContext& decoderContext = *mContexts[mNextContext];
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mFrameDecoded.wait(lock, [&] { return !decoderContext.packetQueued; });
+            takePacket(decoderContext, encodedVideoFrame);
+            decoderContext.packetQueued = true;
+        }
+        mPacketQueued.notify_all();
+        mNextContext = (mNextContext + 1) % mContexts.size();
+        mNumOfQueuedPackets++;
+        if (mNumOfQueuedPackets < mContexts.size())
+            throw MediaException(MEDIA_BUFFERING);
 
+        // The oldest packet is the one of the next context to be used
+        DecoderContext& oldestDecoderContext = *mContexts[mNextContext];
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mFrameDecoded.wait(lock, [&] { return !oldestDecoderContext.packetQueued; });
+        }
+        mNumOfQueuedPackets--;
+        if (!oldestDecoderContext.frameDecoded)
+            throw MediaException(MEDIA_NO_DATA);
+        fillDecodedFrame(oldestDecoderContext);
         return mDecodedVideoFrame;
     }
 
     template <typename EncodedVideoFrameCodec_>
-    VideoEncoder<YUV422_PLANAR, EncodedVideoFrameCodec_, width, height>&
+    VideoEncoder<YUV422_PLANAR, EncodedVideoFrameCodec_, decodedWidth, decodedHeight>&
     operator >>
-    (VideoEncoder<YUV422_PLANAR, EncodedVideoFrameCodec_, width, height>& videoEncoder)
+    (VideoEncoder<YUV422_PLANAR, EncodedVideoFrameCodec_, decodedWidth, decodedHeight>& videoEncoder)
     {
         if (mMediaStatusInPipe == MEDIA_READY)
             videoEncoder.mMediaStatusInPipe = MEDIA_READY;
@@ -118,10 +169,10 @@ public:
     }
 
     template <typename ConvertedVideoFrameFormat, unsigned int outputWidth, unsigned int outputheight>
-    FFMPEGVideoConverter<YUV422_PLANAR, width, height,
+    FFMPEGVideoConverter<YUV422_PLANAR, decodedWidth, decodedHeight,
                          ConvertedVideoFrameFormat, outputWidth, outputheight >&
     operator >>
-    (FFMPEGVideoConverter<YUV422_PLANAR, width, height,
+    (FFMPEGVideoConverter<YUV422_PLANAR, decodedWidth, decodedHeight,
                           ConvertedVideoFrameFormat, outputWidth, outputheight >& videoConverter)
     {
         if (mMediaStatusInPipe == MEDIA_READY)
@@ -145,9 +196,9 @@ public:
         return videoConverter;
     }
 
-    VideoFrameHolder<YUV422_PLANAR, width, height>&
+    VideoFrameHolder<YUV422_PLANAR, decodedWidth, decodedHeight>&
     operator >>
-    (VideoFrameHolder<YUV422_PLANAR, width, height>& videoFrameHolder)
+    (VideoFrameHolder<YUV422_PLANAR, decodedWidth, decodedHeight>& videoFrameHolder)
     {
         if (mMediaStatusInPipe == MEDIA_READY)
             videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
@@ -173,27 +224,145 @@ public:
 
 private:
 
-    void fillDecodedFrame(Planar3RawVideoFrame& decodedFrame)
+    struct DecoderContext
     {
-        decodedFrame.assignSharedPtrForPlane<0>(mDecodedLibAVFrameData0);
-        decodedFrame.assignSharedPtrForPlane<1>(mDecodedLibAVFrameData1);
-        decodedFrame.assignSharedPtrForPlane<2>(mDecodedLibAVFrameData2);
+        AVCodecContext* codecContext;
+        AVFrame* decodedLibAVFrame;
+        // Copied: the grabber's buffer is given back to the device in the meantime
+        std::vector<uint8_t> packetData;
+        unsigned int packetSize;
+        int64_t monotonicTimestamp;
+        int64_t dateTimestamp;
+        // Set by decode(), cleared by the decoder's thread when the frame is decoded
+        bool packetQueued;
+        bool frameDecoded;
+        std::thread thread;
+    };
+
+    DecoderContext* openDecoderContext(unsigned int numOfThreads)
+    {
+        DecoderContext* decoderContext = new DecoderContext();
+        decoderContext->packetSize = 0;
+        decoderContext->monotonicTimestamp = 0;
+        decoderContext->dateTimestamp = 0;
+        decoderContext->packetQueued = false;
+        decoderContext->frameDecoded = false;
+
+        AVCodecContext* codecContext = avcodec_alloc_context3(mVideoCodec);
+        if (!codecContext)
+            printAndThrowUnrecoverableError("codecContext = avcodec_alloc_context3(mVideoCodec)");
+        codecContext->codec_id = AV_CODEC_ID_MJPEG;
+        codecContext->width = width;
+        codecContext->height = height;
+        codecContext->time_base = AV_TIME_BASE_Q;
+        codecContext->color_range = AVCOL_RANGE_JPEG;
+        codecContext->thread_count = numOfThreads;
+        codecContext->thread_type = FF_THREAD_SLICE;
+
+        AVDictionary* opts = NULL;
+        // I.E: 1/4 -> lowres=2: the IDCT outputs 2x2 pixels for each 8x8 block
+        if (scaleDenominator > 1)
+            av_dict_set_int(&opts, "lowres",
+                            scaleDenominator == 2 ? 1 : scaleDenominator == 4 ? 2 : 3, 0);
+        int ret = avcodec_open2(codecContext, mVideoCodec, &opts);
+        av_dict_free(&opts);
+        if (ret < 0)
+            printAndThrowUnrecoverableError("avcodec_open2(...)");
+        decoderContext->codecContext = codecContext;
+
+        decoderContext->decodedLibAVFrame = av_frame_alloc();
+        if (!decoderContext->decodedLibAVFrame)
+            printAndThrowUnrecoverableError("decodedLibAVFrame = av_frame_alloc()");
+        return decoderContext;
+    }
+
+    void takePacket(DecoderContext& decoderContext,
+                    const VideoFrame<MJPEG, width, height>& encodedVideoFrame)
+    {
+        unsigned int size = encodedVideoFrame.size();
+        if (decoderContext.packetData.size() < size + AV_INPUT_BUFFER_PADDING_SIZE)
+            decoderContext.packetData.resize(size + AV_INPUT_BUFFER_PADDING_SIZE);
+        memcpy(&decoderContext.packetData[0], encodedVideoFrame.data(), size);
+        memset(&decoderContext.packetData[size], 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        decoderContext.packetSize = size;
+        decoderContext.monotonicTimestamp = encodedVideoFrame.monotonicTimestamp();
+        decoderContext.dateTimestamp = encodedVideoFrame.dateTimestamp();
+    }
+
+    bool decodePacket(DecoderContext& decoderContext)
+    {
+        AVPacket tempPkt;
+        av_init_packet(&tempPkt);
+        tempPkt.data = &decoderContext.packetData[0];
+        tempPkt.size = decoderContext.packetSize;
+
+        AVFrame* decodedLibAVFrame = decoderContext.decodedLibAVFrame;
+        if (avcodec_send_packet(decoderContext.codecContext, &tempPkt) != 0 ||
+            avcodec_receive_frame(decoderContext.codecContext, decodedLibAVFrame) != 0)
+            return false;
+        // I.E: a corrupted frame, or a camera which switched to 4:2:0
+        return decodedLibAVFrame->width == (int)decodedWidth &&
+               decodedLibAVFrame->height == (int)decodedHeight &&
+               (decodedLibAVFrame->format == AV_PIX_FMT_YUVJ422P ||
+                decodedLibAVFrame->format == AV_PIX_FMT_YUV422P);
+    }
+
+    void runDecoderThread(DecoderContext* decoderContext)
+    {
+        while (1)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mPacketQueued.wait(lock, [&] { return decoderContext->packetQueued || mStop; });
+                if (mStop)
+                    return;
+            }
+            bool frameDecoded = decodePacket(*decoderContext);
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                decoderContext->frameDecoded = frameDecoded;
+                decoderContext->packetQueued = false;
+            }
+            mFrameDecoded.notify_all();
+        }
+    }
+
+    void fillDecodedFrame(DecoderContext& decoderContext)
+    {
+        auto freeNothing = [](unsigned char* buffer) {  };
+
+        AVFrame* decodedLibAVFrame = decoderContext.decodedLibAVFrame;
+        mDecodedLibAVFrameData0 = ShareableVideoFrameData(decodedLibAVFrame->data[0], freeNothing);
+        mDecodedLibAVFrameData1 = ShareableVideoFrameData(decodedLibAVFrame->data[1], freeNothing);
+        mDecodedLibAVFrameData2 = ShareableVideoFrameData(decodedLibAVFrame->data[2], freeNothing);
+        mDecodedVideoFrame.template assignSharedPtrForPlane<0>(mDecodedLibAVFrameData0);
+        mDecodedVideoFrame.template assignSharedPtrForPlane<1>(mDecodedLibAVFrameData1);
+        mDecodedVideoFrame.template assignSharedPtrForPlane<2>(mDecodedLibAVFrameData2);
+        // The grabbing time of the packet (which can be some frames old, if pipelined)
+        mDecodedVideoFrame.setMonotonicTimestamp(decoderContext.monotonicTimestamp);
+        mDecodedVideoFrame.setDateTimestamp(decoderContext.dateTimestamp);
     }
 
     void setDecodedFrameSizes(Planar3RawVideoFrame& decodedFrame)
     {
-        int size0 = av_image_get_linesize(AV_PIX_FMT_YUVJ422P, width, 0);
-        int size1 = av_image_get_linesize(AV_PIX_FMT_YUVJ422P, width, 1);
-        int size2 = av_image_get_linesize(AV_PIX_FMT_YUVJ422P, width, 2);
-        decodedFrame.setSize<0>(size0 * height);
-        decodedFrame.setSize<1>(size1 * height);
-        decodedFrame.setSize<2>(size2 * height);
+        int size0 = av_image_get_linesize(AV_PIX_FMT_YUVJ422P, decodedWidth, 0);
+        int size1 = av_image_get_linesize(AV_PIX_FMT_YUVJ422P, decodedWidth, 1);
+        int size2 = av_image_get_linesize(AV_PIX_FMT_YUVJ422P, decodedWidth, 2);
+        decodedFrame.setSize<0>(size0 * decodedHeight);
+        decodedFrame.setSize<1>(size1 * decodedHeight);
+        decodedFrame.setSize<2>(size2 * decodedHeight);
     }
 
-    AVCodecContext* mVideoDecoderCodecContext;
     AVCodec* mVideoCodec;
-    AVFrame* mDecodedLibAVFrame;
-    VideoFrame< YUV422_PLANAR, width, height > mDecodedVideoFrame;
+    bool mPipelined;
+    std::vector<std::unique_ptr<DecoderContext> > mContexts;
+    unsigned int mNextContext;
+    unsigned int mNumOfQueuedPackets;
+    bool mStop;
+    std::mutex mMutex;
+    std::condition_variable mPacketQueued;
+    std::condition_variable mFrameDecoded;
+    VideoFrame< YUV422_PLANAR, decodedWidth, decodedHeight > mDecodedVideoFrame;
     ShareableVideoFrameData mDecodedLibAVFrameData0; // packed/plane0
     ShareableVideoFrameData mDecodedLibAVFrameData1; // plane1
     ShareableVideoFrameData mDecodedLibAVFrameData2; // plane2
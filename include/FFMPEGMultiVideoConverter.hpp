@@ -0,0 +1,185 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGMULTIVIDEOCONVERTER_HPP_INCLUDED
+#define FFMPEGMULTIVIDEOCONVERTER_HPP_INCLUDED
+
+#include "FFMPEGVideoConverter.hpp"
+
+namespace laav
+{
+
+template <unsigned int width_, unsigned int height_>
+struct VideoResolution
+{
+    static const unsigned int width = width_;
+    static const unsigned int height = height_;
+};
+
+/*
+ * Converts each frame to several resolutions (I.E: an ABR ladder), from the biggest to the
+ * smallest one: each output is scaled from the previous (smaller) one, instead of
+ * reading the whole input frame again. The resolutions must be in decreasing order
+ * (checked at compile time). Each output is piped by its resolution, I.E:
+ *
+ *   FFMPEGMultiVideoConverter <YUYV422_PACKED, 1920, 1080, YUV420_PLANAR,
+ *                              VideoResolution<1920, 1080>,
+ *                              VideoResolution<1280, 720>,
+ *                              VideoResolution<640, 360> > vLadder;
+ *
+ *   vGrab >> vFh >> vLadder;
+ *   vLadder >> vEnc1080 >> vStream1080;
+ *   vLadder >> vEnc720 >> vStream720;
+ *   vLadder >> vEnc360 >> vStream360;
+ */
+template <typename InputVideoFrameFormat,
+          unsigned int inputWidth,
+          unsigned int inputHeigth,
+          typename ConvertedVideoFrameFormat,
+          typename... OutputResolutions>
+class FFMPEGMultiVideoConverter;
+
+// The smallest output
+template <typename InputVideoFrameFormat,
+          unsigned int inputWidth,
+          unsigned int inputHeigth,
+          typename ConvertedVideoFrameFormat,
+          typename OutputResolution>
+class FFMPEGMultiVideoConverter<InputVideoFrameFormat, inputWidth, inputHeigth,
+                                ConvertedVideoFrameFormat, OutputResolution>
+{
+
+public:
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void convert(const VideoFrame<InputVideoFrameFormat, inputWidth, inputHeigth>& inputVideoFrame)
+    {
+        mConverter.convert(inputVideoFrame);
+        mConverter.mMediaStatusInPipe = MEDIA_READY;
+    }
+
+    // See FFMPEGVideoConverter::setSlices(): applied to all the outputs
+    void setSlices(unsigned int numOfSlices)
+    {
+        mConverter.setSlices(numOfSlices);
+    }
+
+    void setMediaStatusInPipe(enum MediaStatus mediaStatus)
+    {
+        mConverter.mMediaStatusInPipe = mediaStatus;
+    }
+
+    VideoFrameHolder<ConvertedVideoFrameFormat,
+                     OutputResolution::width, OutputResolution::height>&
+    operator >>
+    (VideoFrameHolder<ConvertedVideoFrameFormat,
+                      OutputResolution::width, OutputResolution::height>& videoFrameHolder)
+    {
+        return mConverter >> videoFrameHolder;
+    }
+
+    template <typename EncodedVideoFrameCodec>
+    VideoEncoder<ConvertedVideoFrameFormat, EncodedVideoFrameCodec,
+                 OutputResolution::width, OutputResolution::height>&
+    operator >>
+    (VideoEncoder<ConvertedVideoFrameFormat, EncodedVideoFrameCodec,
+                  OutputResolution::width, OutputResolution::height>& videoEncoder)
+    {
+        return mConverter >> videoEncoder;
+    }
+
+private:
+
+    FFMPEGVideoConverter<InputVideoFrameFormat, inputWidth, inputHeigth, ConvertedVideoFrameFormat,
+                         OutputResolution::width, OutputResolution::height> mConverter;
+
+};
+
+template <typename InputVideoFrameFormat,
+          unsigned int inputWidth,
+          unsigned int inputHeigth,
+          typename ConvertedVideoFrameFormat,
+          typename OutputResolution,
+          typename... SmallerOutputResolutions>
+class FFMPEGMultiVideoConverter<InputVideoFrameFormat, inputWidth, inputHeigth,
+                                ConvertedVideoFrameFormat,
+                                OutputResolution, SmallerOutputResolutions...> :
+public FFMPEGMultiVideoConverter<ConvertedVideoFrameFormat,
+                                 OutputResolution::width, OutputResolution::height,
+                                 ConvertedVideoFrameFormat, SmallerOutputResolutions...>
+{
+
+    typedef FFMPEGMultiVideoConverter<ConvertedVideoFrameFormat,
+                                      OutputResolution::width, OutputResolution::height,
+                                      ConvertedVideoFrameFormat, SmallerOutputResolutions...>
+    SmallerOutputsConverter;
+
+public:
+
+    using SmallerOutputsConverter::operator>>;
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void convert(const VideoFrame<InputVideoFrameFormat, inputWidth, inputHeigth>& inputVideoFrame)
+    {
+        SmallerOutputsConverter::convert(convertAndGet(inputVideoFrame));
+    }
+
+    void setSlices(unsigned int numOfSlices)
+    {
+        mConverter.setSlices(numOfSlices);
+        SmallerOutputsConverter::setSlices(numOfSlices);
+    }
+
+    void setMediaStatusInPipe(enum MediaStatus mediaStatus)
+    {
+        mConverter.mMediaStatusInPipe = mediaStatus;
+        SmallerOutputsConverter::setMediaStatusInPipe(mediaStatus);
+    }
+
+    VideoFrameHolder<ConvertedVideoFrameFormat,
+                     OutputResolution::width, OutputResolution::height>&
+    operator >>
+    (VideoFrameHolder<ConvertedVideoFrameFormat,
+                      OutputResolution::width, OutputResolution::height>& videoFrameHolder)
+    {
+        return mConverter >> videoFrameHolder;
+    }
+
+    template <typename EncodedVideoFrameCodec>
+    VideoEncoder<ConvertedVideoFrameFormat, EncodedVideoFrameCodec,
+                 OutputResolution::width, OutputResolution::height>&
+    operator >>
+    (VideoEncoder<ConvertedVideoFrameFormat, EncodedVideoFrameCodec,
+                  OutputResolution::width, OutputResolution::height>& videoEncoder)
+    {
+        return mConverter >> videoEncoder;
+    }
+
+private:
+
+    const VideoFrame<ConvertedVideoFrameFormat,
+                     OutputResolution::width, OutputResolution::height>&
+    convertAndGet(const VideoFrame<InputVideoFrameFormat, inputWidth, inputHeigth>& inputVideoFrame)
+    {
+        const VideoFrame<ConvertedVideoFrameFormat,
+                         OutputResolution::width, OutputResolution::height>&
+        convertedVideoFrame = mConverter.convert(inputVideoFrame);
+        mConverter.mMediaStatusInPipe = MEDIA_READY;
+        return convertedVideoFrame;
+    }
+
+    FFMPEGVideoConverter<InputVideoFrameFormat, inputWidth, inputHeigth, ConvertedVideoFrameFormat,
+                         OutputResolution::width, OutputResolution::height> mConverter;
+
+};
+
+}
+
+#endif // FFMPEGMULTIVIDEOCONVERTER_HPP_INCLUDED
@@ -8,6 +8,11 @@
 #define FFMPEGMUXER_HPP_INCLUDED
 
 #include "FFMPEGCommon.hpp"
+#include "MuxedChunksPool.hpp"
+#include "MuxedDataSink.hpp"
+#include "FMP4InitSegmentSplitter.hpp"
+#include "AsyncFileWriter.hpp"
+#include "SegmentedRecorder.hpp"
 
 extern "C"
 {
@@ -19,6 +24,8 @@ extern "C"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <type_traits>
 
 namespace laav
 {
@@ -34,18 +41,33 @@ class FFMPEGMuxerCommonImpl
               unsigned int audioSampleRate, enum AudioChannels audioChannels>
     friend class HTTPAudioStreamer;
 
+    template <typename Container_,
+              typename VideoCodecOrFormat, unsigned int width, unsigned int height,
+              typename AudioCodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+    friend class HTTPAudioVideoStreamer;
+
 public:
 
     bool startMuxing(const std::string& outputFilename = "")
     {
         if (isMuxing())
-            return false;
+        {
+            // The muxer is shared with some HTTP streamers: start recording
+            // without restarting the muxing of their stream
+            if (outputFilename.empty() || isRecording())
+                return false;
+            if (!mMuxedChunks.muxedFile.open(outputFilename))
+                return false;
+            openRecordingOutput();
+            mWriteToFile = true;
+            return true;
+        }
         mDoMux = true;
         mLastMuxedAudioFrameOffset = mAudioAVPktsToMuxOffset;
         mLastMuxedVideoFrameOffset = mVideoAVPktsToMuxOffset;
         if (!outputFilename.empty())
         {
-            mMuxedChunks.muxedFile.open(outputFilename, std::ios::trunc);
+            mMuxedChunks.muxedFile.open(outputFilename);
             mWriteToFile = true;
         }
         else
@@ -57,9 +79,21 @@ public:
     {
         if (!isMuxing())
             return false;
+        if (mNumOfStreamers != 0 || mMuxedChunks.segmentedRecorder.isActive())
+        {
+            // Still needed by the HTTP streamers (or by the segmented recording / pre-roll):
+            // only stop recording
+            if (!isRecording())
+                return false;
+            closeRecordingOutput();
+            mMuxedChunks.muxedFile.close();
+            mWriteToFile = false;
+            return true;
+        }
         mDoMux = false;
         writeTrailer();
         mTrailerWritten = true;
+        closeRecordingOutput();
         if (mMuxedChunks.muxedFile.is_open())
             mMuxedChunks.muxedFile.close();
         mWriteToFile = false;
@@ -76,11 +110,162 @@ public:
         return mMuxedChunks.muxedFile.is_open();
     }
 
+    /*
+     * The longest time that the packets of a stream wait for the ones of the other
+     * stream, if it lags (I.E: the audio of a stalled camera, the video when the mic is
+     * unplugged), before being muxed anyway. Default: 500 ms
+     */
+    void setMaxInterleaveDelay(unsigned int maxInterleaveDelayMs)
+    {
+        mMaxInterleaveDelayUs = (int64_t)maxInterleaveDelayMs * 1000;
+    }
+
+    /*
+     * The number of packets per stream which can wait to be interleaved with the ones of
+     * the other stream (see setMaxInterleaveDelay()): when the queue is full, its oldest
+     * packets are muxed anyway. Default: encodedVideoFrameBufferSize/encodedAudioFrameBufferSize.
+     * The queued packets reference the data of their frames, so the size bounds the encoded
+     * data kept alive by a lagging stream. It drops the queued packets.
+     */
+    void setPacketsQueueSize(unsigned int numOfPackets)
+    {
+        // One slot is always empty, in order to tell a full queue from an empty one
+        if (numOfPackets < 2)
+            printAndThrowUnrecoverableError("numOfPackets < 2");
+        if (mMuxAudio)
+            resetPacketsRing(mAudioAVPktsToMux, numOfPackets);
+        if (mMuxVideo)
+            resetPacketsRing(mVideoAVPktsToMux, numOfPackets);
+        mAudioAVPktsToMuxOffset = mLastMuxedAudioFrameOffset = 0;
+        mVideoAVPktsToMuxOffset = mLastMuxedVideoFrameOffset = 0;
+    }
+
+    /*
+     * Records the stream in rolling files, cut on the first keyframe after segmentDurationMs
+     * (or maxSegmentBytes, if != 0), without writing new headers/trailers. fileNamePattern
+     * contains the segment's index as one integer conversion, I.E: "/rec/cam1_%05d.ts"
+     * (see SegmentedRecorder::start()): existing files aren't overwritten.
+     * The data kept by setPreRoll() is written at the beginning of the first segment.
+     * Only MPEGTS streams (with video) can be segmented like that.
+     */
+    bool startSegmentedRecording(const std::string& fileNamePattern,
+                                 unsigned int segmentDurationMs, size_t maxSegmentBytes = 0)
+    {
+        static_assert(std::is_same<Container, MPEGTS>::value,
+                      "Segmented recording is supported only for MPEGTS");
+        if (!mMuxedChunks.segmentedRecorder.start(fileNamePattern, segmentDurationMs,
+                                                  maxSegmentBytes))
+            return false;
+        if (!isMuxing())
+            startMuxing();
+        return true;
+    }
+
+    bool stopSegmentedRecording()
+    {
+        if (!mMuxedChunks.segmentedRecorder.isRecording())
+            return false;
+        mMuxedChunks.segmentedRecorder.stop();
+        if (mNumOfStreamers == 0 && !isRecording() && !mMuxedChunks.segmentedRecorder.isActive())
+            stopMuxing();
+        return true;
+    }
+
+    bool isRecordingSegments() const
+    {
+        return mMuxedChunks.segmentedRecorder.isRecording();
+    }
+
+    /*
+     * Keeps the last preRollMs of muxed data in memory (from a keyframe onward), so that a
+     * recording started by an event (I.E: motion) includes what preceded it. The muxing goes
+     * on while the pre-roll is enabled; preRollMs == 0 disables it.
+     */
+    void setPreRoll(unsigned int preRollMs)
+    {
+        static_assert(std::is_same<Container, MPEGTS>::value,
+                      "Pre-roll is supported only for MPEGTS");
+        mMuxedChunks.segmentedRecorder.setPreRoll(preRollMs);
+        if (preRollMs != 0 && !isMuxing())
+            startMuxing();
+        else if (preRollMs == 0 && mNumOfStreamers == 0 && !isRecording() &&
+                 !mMuxedChunks.segmentedRecorder.isActive())
+            stopMuxing();
+    }
+
+    size_t preRollBytes() const
+    {
+        return mMuxedChunks.segmentedRecorder.preRollBytes();
+    }
+
+    // The segments' writer: see recordingFile()
+    AsyncFileWriter& segmentsFile()
+    {
+        return mMuxedChunks.segmentedRecorder.file();
+    }
+
+    /*
+     * The recordings are written by a dedicated thread: its batching, queue policy and
+     * fsync interval can be set before startMuxing(outputFilename)
+     */
+    AsyncFileWriter& recordingFile()
+    {
+        return mMuxedChunks.muxedFile;
+    }
+
+    // For FMP4 streams: the init segment (ftyp + moov), available after the first fragment
     const std::string& header() const
     {
         return mMuxedChunks.header;
     }
 
+    // Changes every time a new frame is muxed, so that the consumers which share
+    // the muxer can tell whether the muxed chunks have already been consumed
+    unsigned long groupOfChunksId() const
+    {
+        return mMuxedChunks.groupOfChunksId;
+    }
+
+    /*
+     * Contiguous output mode: the muxed data is passed to the sink as soon as it is
+     * flushed by the AVIO context, and the muxed chunks stay empty (the recording to file,
+     * if any, goes on). sink == NULL restores the chunks mode. The sink must be unset (or the
+     * muxer destroyed) before the sink is destroyed.
+     */
+    void setMuxedDataSink(MuxedDataSink* sink)
+    {
+        mMuxedChunks.sink = sink;
+    }
+
+    // True if the last group of chunks can be decoded without the previous ones
+    // (I.E: it contains a video keyframe, or there's no video at all)
+    bool groupOfChunksHasKeyFrame() const
+    {
+        return !mMuxVideo || mMuxedChunks.groupHasKeyFrame;
+    }
+
+    /*
+     * Low latency FMP4 streams (I.E: played by the browsers through MSE): each video frame
+     * gets its own fragment (moof + mdat), instead of one fragment per GOP. The fragment of
+     * a frame is written when the next frame is muxed, which gives its duration, so the
+     * groups of chunks lag one frame behind the muxed frames. Needs FFmpeg >= 4.0.
+     */
+    void setFragmentEveryFrame(bool fragmentEveryFrame)
+    {
+        static_assert(std::is_same<Container, FMP4>::value,
+                      "Only FMP4 streams are fragmented");
+#ifdef LAAV_FFMPEG_FRAG_EVERY_FRAME
+        if (av_opt_set(mMuxerContext->priv_data, "movflags",
+                       fragmentEveryFrame ? "+frag_every_frame" : "-frag_every_frame", 0) < 0)
+            printAndThrowUnrecoverableError("av_opt_set(...)");
+#else
+        if (fragmentEveryFrame)
+            printAndThrowUnrecoverableError("+frag_every_frame (FFmpeg >= 4.0)");
+#endif
+        mFragmentEveryFrame = fragmentEveryFrame;
+        mPendingFragmentHasKeyFrame = false;
+    }
+
 protected:
 
     FFMPEGMuxerCommonImpl():
@@ -89,19 +274,22 @@ protected:
         mDoMux(false),
         mHeaderWritten(false),
         mTrailerWritten(false),
-        mAudioReady(false),
-        mVideoReady(false),
         mLastMuxedAudioFrameOffset(0),
         mAudioAVPktsToMuxOffset(0),
         mLastMuxedVideoFrameOffset(0),
         mVideoAVPktsToMuxOffset(0),
         mAudioStreamIndex(1),
         mVideoStreamIndex(0),
+        mNumOfStreamers(0),
+        mMaxInterleaveDelayUs(500000),
+        mFragmentEveryFrame(false),
+        mPendingFragmentHasKeyFrame(false),
+        mRecordingContext(NULL),
+        mRecordingAVIOContext(NULL),
+        mRecordingHeaderWritten(false),
         mWriteToFile(false)
     {
-        av_register_all();
-        // TODO: is the following line really necessary?
-        avcodec_register_all();
+        FFMPEGUtils::registerAll();
 
         AVOutputFormat* muxerFormat =
         av_guess_format(FFMPEGUtils::translateContainer<Container>(), NULL, NULL);
@@ -112,23 +300,21 @@ protected:
         avformat_alloc_output_context2(&mMuxerContext, muxerFormat, "dummy", NULL);
         if (!mMuxerContext)
             printAndThrowUnrecoverableError("avformat_alloc_output_context2(...)");
-        // TODO: fixed value?
-        size_t muxerAVIOContextBufferSize = 4096;
+        size_t muxerAVIOContextBufferSize = muxerAVIOBufferSize;
         mMuxerAVIOContextBuffer = (uint8_t* )av_malloc(muxerAVIOContextBufferSize);
-        if (!mMuxerContext)
+        if (!mMuxerAVIOContextBuffer)
             printAndThrowUnrecoverableError("(uint8_t* )av_malloc(...)");
-        // TODO: fixed value?
-        mMuxedChunks.data.resize(5000);
+
+        // The chunks are taken from the pool on demand, see writeMuxedChunk()
+        mMuxedChunks.pool = MuxedChunksPool::sharedPool(muxerAVIOContextBufferSize);
         mMuxedChunks.offset = 0;
+        mMuxedChunks.sink = NULL;
 
         mMuxedChunks.newGroupOfChunks = false;
-
-        unsigned int n;
-        for (n = 0; n < mMuxedChunks.data.size(); n++)
-        {
-            mMuxedChunks.data[n].ptr = (uint8_t* )av_malloc(4096);
-            mMuxedChunks.data[n].size = 0;
-        }
+        mMuxedChunks.groupOfChunksId = 0;
+        mMuxedChunks.groupHasKeyFrame = false;
+        mMuxedChunks.headerComplete = false;
+        mMuxedChunks.fileHasOwnMuxer = false;
 
         mMuxerAVIOContext = avio_alloc_context(mMuxerAVIOContextBuffer, muxerAVIOContextBufferSize,
                                                1, &mMuxedChunks, NULL, &writeMuxedChunk, NULL);
@@ -138,87 +324,290 @@ protected:
 
         mMuxerContext->pb = mMuxerAVIOContext;
 
-        // TODO: improve design. First packets for audio and video
-        // are set here in order to obtain a reference in muxNextUsefulFrameFromBuffer
-        // in case one of the two media is not set
-        AVPacket audioPkt;
-        mAudioAVPktsToMux.push_back(audioPkt);
-        av_init_packet(&mAudioAVPktsToMux[0]);
-        mAudioAVPktsToMux[0].pts = AV_NOPTS_VALUE;
-        AVPacket videoPkt;
-        mVideoAVPktsToMux.push_back(videoPkt);
-        av_init_packet(&mVideoAVPktsToMux[0]);
-        mVideoAVPktsToMux[0].pts = AV_NOPTS_VALUE;
+        // The first packets for audio and video are set here, so that the packets' ring
+        // of a media which isn't muxed isn't empty either
+        resetPacketsRing(mAudioAVPktsToMux, 1);
+        resetPacketsRing(mVideoAVPktsToMux, 1);
     }
 
-    void muxNextUsefulFrameFromBuffer(bool resetChunks)
+    // Drops the queued packets (and their references)
+    void resetPacketsRing(std::vector<AVPacket>& pkts, unsigned int numOfPackets)
     {
-        AVPacket& audioPktToMux = mAudioAVPktsToMux[mLastMuxedAudioFrameOffset];
-        AVPacket& videoPktToMux = mVideoAVPktsToMux[mLastMuxedVideoFrameOffset];
-
-        if (!mVideoReady && mMuxVideo)
+        unsigned int i;
+        for (i = 0; i < pkts.size(); i++)
+            av_buffer_unref(&pkts[i].buf);
+        pkts.resize(numOfPackets);
+        for (i = 0; i < pkts.size(); i++)
         {
-            return;
+            av_init_packet(&pkts[i]);
+            pkts[i].data = NULL;
+            pkts[i].size = 0;
+            pkts[i].pts = AV_NOPTS_VALUE;
         }
-        if (!mAudioReady && mMuxAudio)
+    }
+
+    /*
+     * The queued packet references the data of its frame until it's muxed, so that the
+     * frame's producer (I.E: an encoder with a short frames' ring) can recycle the frame
+     * meanwhile, without a copy of the data
+     */
+    void referenceFrameData(AVPacket& pkt, const std::shared_ptr<unsigned char>& data,
+                            unsigned int size)
+    {
+        auto releaseData = [](void* opaque, uint8_t* data)
         {
-            return;
-        }
+            delete (std::shared_ptr<unsigned char>* )opaque;
+        };
+        av_buffer_unref(&pkt.buf);
+        pkt.buf = av_buffer_create(data.get(), size, releaseData,
+                                   new std::shared_ptr<unsigned char>(data),
+                                   AV_BUFFER_FLAG_READONLY);
+        if (!pkt.buf)
+            printAndThrowUnrecoverableError("pkt.buf = av_buffer_create(...)");
+        pkt.data = data.get();
+        pkt.size = size;
+    }
 
-        if ( (audioPktToMux.pts < videoPktToMux.pts && mMuxAudio) ||
-             ((videoPktToMux.pts ==  AV_NOPTS_VALUE) && mMuxAudio && !mMuxVideo)
-           )
+    /*
+     * Muxes the buffered packets in pts order (across the streams), as long as both the
+     * streams have packets. When only one of them has packets, they wait for the other
+     * stream until they span mMaxInterleaveDelayUs: then the oldest ones are muxed anyway,
+     * so that a stalled (or stopped) stream doesn't freeze the muxed output, nor delay the
+     * other one by more than that. The packets are written as they are (av_write_frame),
+     * without copying their data, which they stop referencing once muxed.
+     */
+    void muxNextUsefulFrameFromBuffer(bool resetChunks)
+    {
+        while (true)
         {
-            if (mLastMuxedAudioFrameOffset != mAudioAVPktsToMuxOffset)
+            bool hasAudio = mMuxAudio &&
+                            mLastMuxedAudioFrameOffset != mAudioAVPktsToMuxOffset;
+            bool hasVideo = mMuxVideo &&
+                            mLastMuxedVideoFrameOffset != mVideoAVPktsToMuxOffset;
+            if (!hasAudio && !hasVideo)
+                return;
+
+            AVPacket& audioPktToMux = mAudioAVPktsToMux[mLastMuxedAudioFrameOffset];
+            AVPacket& videoPktToMux = mVideoAVPktsToMux[mLastMuxedVideoFrameOffset];
+            bool muxAudio;
+            if (hasAudio && hasVideo)
+                muxAudio = av_compare_ts(audioPktToMux.pts,
+                                         mMuxerContext->streams[mAudioStreamIndex]->time_base,
+                                         videoPktToMux.pts,
+                                         mMuxerContext->streams[mVideoStreamIndex]->time_base) < 0;
+            else if (!mMuxAudio || !mMuxVideo)
+                muxAudio = hasAudio;
+            else
             {
-                if (resetChunks)
-                {
-                    mMuxedChunks.offset = 0;
-                }
+                muxAudio = hasAudio;
+                if (muxAudio && !lagExceeded(mAudioAVPktsToMux, mLastMuxedAudioFrameOffset,
+                                             mAudioAVPktsToMuxOffset, mAudioStreamIndex))
+                    return;
+                if (!muxAudio && !lagExceeded(mVideoAVPktsToMux, mLastMuxedVideoFrameOffset,
+                                              mVideoAVPktsToMuxOffset, mVideoStreamIndex))
+                    return;
+            }
 
-                if (!this->mHeaderWritten)
-                {
-                    this->writeHeader();
-                }
+            if (resetChunks)
+            {
+                mMuxedChunks.offset = 0;
+                resetChunks = false;
+            }
 
+            if (!this->mHeaderWritten)
+            {
+                this->writeHeader();
+            }
+
+            if (muxAudio)
+            {
                 if (audioPktToMux.size != 0)
+                {
+                    recordPacket(audioPktToMux, false);
                     if (av_write_frame(this->mMuxerContext, &audioPktToMux) < 0)
                         printAndThrowUnrecoverableError("av_write_frame(...)");
+                }
+                av_buffer_unref(&audioPktToMux.buf);
 
                 mLastMuxedAudioFrameOffset =
                 (mLastMuxedAudioFrameOffset + 1) % mAudioAVPktsToMux.size();
-
-                muxNextUsefulFrameFromBuffer(false);
             }
-        }
-        else if (mMuxVideo)
-        {
-            if (mLastMuxedVideoFrameOffset != mVideoAVPktsToMuxOffset)
+            else
             {
-                if (resetChunks)
-                {
-                    mMuxedChunks.offset = 0;
-                }
-
-                if (!this->mHeaderWritten)
-                {
-                    this->writeHeader();
-                }
-
+                bool keyFrame = (videoPktToMux.flags & AV_PKT_FLAG_KEY) != 0;
+                // With a fragment per frame, the keyframe's fragment is already cut by the
+                // muxer, which is needed only by the sinks that are notified of the boundary
+                if (keyFrame &&
+                    ((std::is_same<Container, FMP4>::value && !mFragmentEveryFrame) ||
+                     mMuxedChunks.segmentedRecorder.isActive() ||
+                     (mMuxedChunks.sink && mMuxedChunks.sink->cutsOnKeyFrames())))
+                    cutOnKeyFrame(videoPktToMux);
+
+                recordPacket(videoPktToMux, keyFrame);
                 if (av_write_frame(this->mMuxerContext, &videoPktToMux) < 0)
                     printAndThrowUnrecoverableError("av_write_frame(...)");
+                av_buffer_unref(&videoPktToMux.buf);
+                if (mFragmentEveryFrame)
+                {
+                    // The group gets the fragment of the previous frame
+                    avio_flush(mMuxerContext->pb);
+                    if (mPendingFragmentHasKeyFrame)
+                        mMuxedChunks.groupHasKeyFrame = true;
+                    mPendingFragmentHasKeyFrame = keyFrame;
+                }
+                else if (keyFrame)
+                    mMuxedChunks.groupHasKeyFrame = true;
 
                 mLastMuxedVideoFrameOffset =
                 (mLastMuxedVideoFrameOffset + 1) % mVideoAVPktsToMux.size();
-
-                muxNextUsefulFrameFromBuffer(false);
             }
         }
     }
 
+    /*
+     * Whether the packets buffered for a stream (while the other one has none) can't wait
+     * anymore: they span the max interleave delay, or they're about to be overwritten by
+     * the new ones
+     */
+    bool lagExceeded(const std::vector<AVPacket>& pkts, unsigned int firstOffset,
+                     unsigned int endOffset, unsigned int streamIndex) const
+    {
+        unsigned int numOfPkts = (endOffset + pkts.size() - firstOffset) % pkts.size();
+        if (numOfPkts + 1 >= pkts.size())
+            return true;
+        const AVPacket& lastPkt = pkts[(endOffset + pkts.size() - 1) % pkts.size()];
+        int64_t span = av_rescale_q(lastPkt.pts - pkts[firstOffset].pts,
+                                    mMuxerContext->streams[streamIndex]->time_base,
+                                    AV_TIME_BASE_Q);
+        return span >= mMaxInterleaveDelayUs;
+    }
+
+    // Called by the HTTP streamers when they get their first client / lose their last one,
+    // so that the muxing is stopped only when nobody (streamers or recording) needs it
+    void startMuxingForStreamer()
+    {
+        mNumOfStreamers++;
+        startMuxing();
+    }
+
+    void stopMuxingForStreamer()
+    {
+        if (mNumOfStreamers == 0)
+            return;
+        mNumOfStreamers--;
+        if (mNumOfStreamers == 0 && !isRecording())
+            stopMuxing();
+    }
+
+    /*
+     * The keyframe will start a new GOP of the segmented recording / a new segment of the
+     * sink: MPEGTS streams resend their tables before it, FMP4 ones close the current
+     * fragment (moof + mdat) so that the next one begins with the keyframe.
+     */
+    void cutOnKeyFrame(const AVPacket& keyFramePkt)
+    {
+        if (std::is_same<Container, FMP4>::value)
+            av_write_frame(mMuxerContext, NULL);
+        avio_flush(mMuxerContext->pb);
+        mMuxedChunks.segmentedRecorder.keyFrameBoundary();
+        if (mMuxedChunks.sink && mMuxedChunks.sink->cutsOnKeyFrames())
+            mMuxedChunks.sink->keyFrameBoundary
+            (av_rescale_q(keyFramePkt.pts, mMuxerContext->streams[keyFramePkt.stream_index]->time_base,
+                          AV_TIME_BASE_Q));
+        if (std::is_same<Container, MPEGTS>::value)
+            av_opt_set(mMuxerContext->priv_data, "mpegts_flags", "+resend_headers", 0);
+    }
+
+    /*
+     * A recording started while the muxer is shared (see startMuxing()) has its own muxer
+     * context, with the same streams, so that the file gets its own header and trailer
+     * (I.E: the MATROSKA/MP4 indexes), and it begins with the next video keyframe
+     */
+    void openRecordingOutput()
+    {
+        avformat_alloc_output_context2(&mRecordingContext, mMuxerContext->oformat, NULL, NULL);
+        if (!mRecordingContext)
+            printAndThrowUnrecoverableError("avformat_alloc_output_context2(...)");
+        unsigned int n;
+        for (n = 0; n < mMuxerContext->nb_streams; n++)
+        {
+            AVStream* stream = avformat_new_stream(mRecordingContext, NULL);
+            if (!stream)
+                printAndThrowUnrecoverableError("stream = avformat_new_stream(...)");
+            if (avcodec_parameters_copy(stream->codecpar, mMuxerContext->streams[n]->codecpar) < 0)
+                printAndThrowUnrecoverableError("avcodec_parameters_copy(...)");
+            stream->time_base = mMuxerContext->streams[n]->time_base;
+        }
+        uint8_t* recordingAVIOContextBuffer = (uint8_t* )av_malloc(muxerAVIOBufferSize);
+        if (!recordingAVIOContextBuffer)
+            printAndThrowUnrecoverableError("(uint8_t* )av_malloc(...)");
+        mRecordingAVIOContext = avio_alloc_context(recordingAVIOContextBuffer, muxerAVIOBufferSize,
+                                                   1, &mMuxedChunks.muxedFile, NULL,
+                                                   &writeRecordedChunk, NULL);
+        if (!mRecordingAVIOContext)
+            printAndThrowUnrecoverableError("mRecordingAVIOContext = avio_alloc_context(...)");
+        mRecordingContext->pb = mRecordingAVIOContext;
+        mRecordingHeaderWritten = false;
+        mMuxedChunks.fileHasOwnMuxer = true;
+    }
+
+    // Writes the trailer (if the recording began) and releases the recording's context
+    void closeRecordingOutput()
+    {
+        if (!mRecordingContext)
+            return;
+        if (mRecordingHeaderWritten)
+            av_write_trailer(mRecordingContext);
+        avio_flush(mRecordingAVIOContext);
+        av_freep(&mRecordingAVIOContext->buffer);
+        av_freep(&mRecordingAVIOContext);
+        avformat_free_context(mRecordingContext);
+        mRecordingContext = NULL;
+        mRecordingHeaderWritten = false;
+        mMuxedChunks.fileHasOwnMuxer = false;
+    }
+
+    // The packet's data is referenced (not copied) by the recording's context
+    void recordPacket(const AVPacket& pkt, bool videoKeyFrame)
+    {
+        if (!mRecordingContext)
+            return;
+        if (!mRecordingHeaderWritten)
+        {
+            if (mMuxVideo && !videoKeyFrame)
+                return;
+            AVDictionary* options = NULL;
+            if (std::is_same<Container, FMP4>::value)
+                av_dict_set(&options, "movflags",
+                            "frag_keyframe+empty_moov+delay_moov+default_base_moof", 0);
+            int ret = avformat_write_header(mRecordingContext, &options);
+            av_dict_free(&options);
+            if (ret < 0)
+                printAndThrowUnrecoverableError("avformat_write_header(...)");
+            mRecordingHeaderWritten = true;
+        }
+        AVPacket recordedPkt;
+        av_init_packet(&recordedPkt);
+        if (av_packet_ref(&recordedPkt, &pkt) < 0)
+            printAndThrowUnrecoverableError("av_packet_ref(...)");
+        av_packet_rescale_ts(&recordedPkt, mMuxerContext->streams[pkt.stream_index]->time_base,
+                             mRecordingContext->streams[pkt.stream_index]->time_base);
+        if (av_write_frame(mRecordingContext, &recordedPkt) < 0)
+            printAndThrowUnrecoverableError("av_write_frame(...)");
+        av_packet_unref(&recordedPkt);
+    }
+
     void completeMuxerInitialization()
     {
-        if (avformat_init_output(this->mMuxerContext, NULL) < 0)
+        AVDictionary* options = NULL;
+        // The fragments are cut by cutOnKeyFrame(); the moov is written with the first
+        // fragment, when the H264 parameters (taken from the first keyframe) are known
+        if (std::is_same<Container, FMP4>::value)
+            av_dict_set(&options, "movflags",
+                        "frag_custom+empty_moov+delay_moov+default_base_moof", 0);
+        int ret = avformat_init_output(this->mMuxerContext, &options);
+        av_dict_free(&options);
+        if (ret < 0)
             printAndThrowUnrecoverableError("avformat_init_output(...)");
     }
 
@@ -254,27 +643,50 @@ protected:
     ~FFMPEGMuxerCommonImpl()
     {
         writeTrailer();
+        closeRecordingOutput();
         if (mMuxedChunks.muxedFile.is_open())
             mMuxedChunks.muxedFile.close();
+        mMuxedChunks.segmentedRecorder.stop();
         av_free(mMuxerAVIOContextBuffer);
         unsigned int n;
         for (n = 0; n < mMuxedChunks.data.size(); n++)
         {
-            av_free(mMuxedChunks.data[n].ptr);
+            mMuxedChunks.pool->giveBackBlock(mMuxedChunks.data[n].ptr);
         }
+        resetPacketsRing(mAudioAVPktsToMux, 0);
+        resetPacketsRing(mVideoAVPktsToMux, 0);
         avformat_free_context(mMuxerContext);
         av_free(mMuxerAVIOContext);
 
     }
 
+    /*
+     * Wraps (without copying) the chunks muxed in the last group into muxedChunks, which
+     * grows together with the chunks arena
+     */
+    template <typename MuxedDataType>
+    void wrapMuxedChunks(std::vector<MuxedDataType>& muxedChunks)
+    {
+        auto freeNothing = [](unsigned char* buffer) {  };
+        unsigned int n;
+        for (n = muxedChunks.size(); n < mMuxedChunks.data.size(); n++)
+        {
+            muxedChunks.push_back(MuxedDataType());
+            ShareableMuxedData shMuxedData(mMuxedChunks.data[n].ptr, freeNothing);
+            muxedChunks[n].assignDataSharedPtr(shMuxedData);
+        }
+        for (n = 0; n < mMuxedChunks.offset; n++)
+        {
+            muxedChunks[n].setSize(mMuxedChunks.data[n].size);
+        }
+    }
+
     bool mMuxAudio;
     bool mMuxVideo;
     AVFormatContext* mMuxerContext;
     bool mDoMux;
     bool mHeaderWritten;
     bool mTrailerWritten;
-    bool mAudioReady;
-    bool mVideoReady;
     unsigned int mLastMuxedAudioFrameOffset;
     unsigned int mAudioAVPktsToMuxOffset;
     std::vector<AVPacket> mAudioAVPktsToMux;
@@ -285,7 +697,16 @@ protected:
     uint8_t* mMuxerAVIOContextBuffer;
     unsigned int mAudioStreamIndex;
     unsigned int mVideoStreamIndex;
+    unsigned int mNumOfStreamers;
+    int64_t mMaxInterleaveDelayUs;
+    bool mFragmentEveryFrame;
+    // Whether the fragment which the muxer is holding (see setFragmentEveryFrame()) is a keyframe's
+    bool mPendingFragmentHasKeyFrame;
     ShareableMuxedData mMuxedData;
+    // The recording started while the muxer was shared (see openRecordingOutput())
+    AVFormatContext* mRecordingContext;
+    AVIOContext* mRecordingAVIOContext;
+    bool mRecordingHeaderWritten;
 
     struct MuxedDataChunk
     {
@@ -296,10 +717,21 @@ protected:
     struct MuxedChunks
     {
         bool newGroupOfChunks;
+        unsigned long groupOfChunksId;
+        bool groupHasKeyFrame;
         unsigned int offset;
+        // Blocks taken from the pool, kept (and reused by the next groups) until the
+        // muxer's destruction
         std::vector<struct MuxedDataChunk> data;
-        std::ofstream muxedFile;
+        std::shared_ptr<MuxedChunksPool> pool;
+        MuxedDataSink* sink;
+        SegmentedRecorder segmentedRecorder;
+        AsyncFileWriter muxedFile;
         std::string header;
+        bool headerComplete;
+        // The recording file is written by its own muxer context, not with the chunks
+        bool fileHasOwnMuxer;
+        FMP4InitSegmentSplitter initSegmentSplitter;
     } mMuxedChunks;
 
 private:
@@ -310,25 +742,85 @@ private:
     {
         // TODO: static cast
         struct MuxedChunks* muxedChunks = ( struct MuxedChunks* )opaque;
-        memcpy(muxedChunks->data[muxedChunks->offset].ptr, muxedDataSink, chunkSize);
 
-        if (muxedChunks->header.empty())
+        if (!muxedChunks->headerComplete)
+            takeHeaderData(muxedChunks, muxedDataSink, chunkSize);
+
+        if (muxedChunks->sink)
         {
-            muxedChunks->header.assign ((const char* )muxedDataSink, chunkSize);
+            if (chunkSize != 0 && !muxedChunks->sink->writeMuxedData(muxedDataSink, chunkSize))
+                return AVERROR(EIO);
+            recordMuxedChunk(muxedChunks, muxedDataSink, chunkSize);
+            return chunkSize;
         }
 
-        muxedChunks->data[muxedChunks->offset].size = chunkSize;
+        // The AVIO context flushes at most its buffer's size, which is the blocks' size: the
+        // loop is only a guard
+        size_t blockSize = muxedChunks->pool->blockSize();
+        int writtenSize = 0;
+        do
+        {
+            if (muxedChunks->offset == muxedChunks->data.size())
+            {
+                struct MuxedDataChunk newChunk;
+                newChunk.ptr = muxedChunks->pool->takeBlock();
+                newChunk.size = 0;
+                muxedChunks->data.push_back(newChunk);
+            }
+            size_t size = std::min((size_t)(chunkSize - writtenSize), blockSize);
+            memcpy(muxedChunks->data[muxedChunks->offset].ptr, muxedDataSink + writtenSize, size);
+            muxedChunks->data[muxedChunks->offset].size = size;
+            muxedChunks->offset++;
+            writtenSize += size;
+        }
+        while (writtenSize < chunkSize);
+
+        recordMuxedChunk(muxedChunks, muxedDataSink, chunkSize);
+
+        return chunkSize;
+    }
+
+    /*
+     * The header is the first chunk, except for the FMP4 streams, whose moov is written with
+     * the first fragment (and can span several chunks): their header is the init segment
+     */
+    static void takeHeaderData(struct MuxedChunks* muxedChunks,
+                               const uint8_t* muxedDataSink, int chunkSize)
+    {
+        if (!std::is_same<Container, FMP4>::value)
+        {
+            muxedChunks->header.assign((const char* )muxedDataSink, chunkSize);
+            muxedChunks->headerComplete = !muxedChunks->header.empty();
+            return;
+        }
+        if (!muxedChunks->initSegmentSplitter.take(muxedDataSink, chunkSize))
+            return;
+        const std::vector<uint8_t>& initSegment = muxedChunks->initSegmentSplitter.initSegment();
+        muxedChunks->header.assign(initSegment.begin(), initSegment.end());
+        muxedChunks->initSegmentSplitter.releaseFragmentsData();
+        muxedChunks->headerComplete = true;
+    }
+
+    // Flags the new group of chunks and writes the chunk to the recording file, if any
+    static void recordMuxedChunk(struct MuxedChunks* muxedChunks,
+                                      uint8_t* muxedDataSink, int chunkSize)
+    {
         if (chunkSize != 0)
         {
             muxedChunks->newGroupOfChunks = true;
-            if (muxedChunks->muxedFile.is_open())
+            if (muxedChunks->segmentedRecorder.isActive())
+                muxedChunks->segmentedRecorder.write(muxedDataSink, chunkSize);
+            if (muxedChunks->muxedFile.is_open() && !muxedChunks->fileHasOwnMuxer)
             {
                 std::streamsize dataSize = chunkSize;
                 muxedChunks->muxedFile.write((const char* )muxedDataSink, dataSize);
             }
         }
-        muxedChunks->offset++;
+    }
 
+    static int writeRecordedChunk(void* opaque, uint8_t* recordedData, int chunkSize)
+    {
+        ((AsyncFileWriter* )opaque)->write((const char* )recordedData, chunkSize);
         return chunkSize;
     }
 
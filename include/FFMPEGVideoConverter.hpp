@@ -12,15 +12,22 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 }
 #include "AllVideoCodecsAndFormats.hpp"
 #include "Frame.hpp"
 #include "FFMPEGCommon.hpp"
 #include "FFMPEGVideoEncoder.hpp"
+#include "FFMPEGVideoFramePool.hpp"
+#include "VideoConversionKernels.hpp"
+#include "SliceWorkers.hpp"
 
 namespace laav
 {
 
+template <typename RawVideoFrameFormat, unsigned int width, unsigned int height>
+class MotionDetector;
+
 template <typename InputVideoFrameFormat,
           unsigned int inputWidth,
           unsigned int inputHeigth,
@@ -33,7 +40,8 @@ class FFMPEGVideoConverter
 public:
 
     FFMPEGVideoConverter():
-        mMediaStatusInPipe(MEDIA_NOT_READY)
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mConversionKernel(NULL)
     {
         static_assert( ((inputWidth >= outputWidth) && (inputHeigth >= outputHeigth)),
                        "(inputWidth <= outputWidth) && (inputHeigth <= outputHeigth) == false");
@@ -42,7 +50,7 @@ public:
         AVPixelFormat convFmt = FFMPEGUtils::translatePixelFormat<ConvertedVideoFrameFormat>();
         AVPixelFormat inFmt   = FFMPEGUtils::translatePixelFormat<InputVideoFrameFormat>();
 
-        av_register_all();
+        FFMPEGUtils::registerAll();
         mInputLibAVFrame = av_frame_alloc();
 
         if (!mInputLibAVFrame)
@@ -86,36 +94,23 @@ public:
         mConvertedLibAVFrame->format = convFmt;
         mConvertedLibAVFrame->width  = outputWidth;
         mConvertedLibAVFrame->height = outputHeigth;
-        if (av_image_alloc(mConvertedLibAVFrame->data, mConvertedLibAVFrame->linesize,
-                           outputWidth, outputHeigth, convFmt, 1) < 0)
-            printAndThrowUnrecoverableError("av_image_alloc(...)");
-
-        auto freeLibAVFrameBuffer = [](unsigned char* buffer)
-        {
-            av_freep(&buffer);
-        };
-        // Use freeNothing for planes 1,2b ecause
-        // they will automatically be freed by freeLibAVFrameBuffer;
-        auto freeNothing = [](unsigned char* buffer) {  };
-
-        mConvertedLibAVFrameData0 =
-        ShareableVideoFrameData(mConvertedLibAVFrame->data[0], freeLibAVFrameBuffer);
-
-        mConvertedLibAVFrameData1 =
-        ShareableVideoFrameData(mConvertedLibAVFrame->data[1], freeNothing);
-
-        mConvertedLibAVFrameData2 =
-        ShareableVideoFrameData(mConvertedLibAVFrame->data[2], freeNothing);
+        // The planes are pointed to a fresh buffer of mConvertedFramesPool by each convert()
 
         mSwscaleContext = sws_getContext(inputWidth, inputHeigth, inFmt, outputWidth, outputHeigth,
                                          convFmt, SWS_BILINEAR, NULL, NULL, NULL);
         if (!mSwscaleContext)
             printAndThrowUnrecoverableError("(mSwscaleContext = sws_getContext(...");
-        mapConvertedFrameToLibAVFrame(mConvertedVideoFrame);
+        // No scaling: the formats' own kernel (if any) is used instead of sws_scale(...)
+        if (inputWidth == outputWidth && inputHeigth == outputHeigth)
+            mConversionKernel =
+            VideoConversionKernels::select<InputVideoFrameFormat, ConvertedVideoFrameFormat>();
     }
 
     /*!
      *  \exception MediaException(MEDIA_NO_DATA)
+     *
+     *  Each frame is converted into a fresh (pooled) buffer: the previously converted
+     *  frames stay valid as long as someone (I.E: an encoder's lookahead) shares them.
      */
     VideoFrame<ConvertedVideoFrameFormat, outputWidth, outputHeigth>&
     convert(const VideoFrame<InputVideoFrameFormat, inputWidth, inputHeigth>& inputVideoFrame)
@@ -123,14 +118,70 @@ public:
         if (isFrameEmpty(inputVideoFrame))
             throw MediaException(MEDIA_NO_DATA);
 
+        mConvertedFramesPool.assignFreshBuffer(mConvertedLibAVFrame, mConvertedVideoFrame);
         specializedConvert(inputVideoFrame);
-        mConvertedVideoFrame.setTimestampsToNow();
+        mConvertedVideoFrame.copyTimestampsFrom(inputVideoFrame);
         setSizeOfConvertedFrame(mConvertedVideoFrame);
         return mConvertedVideoFrame;
     }
 
+    /*
+     * Each frame is split in numOfSlices horizontal slices, converted in parallel by the
+     * calling thread and numOfSlices - 1 helper threads (requires -pthread): each slice
+     * has its own SwsContext, I.E: 4K -> 1080p downscaling within a frame's time.
+     * The slices' edges are filtered without the neighbouring lines, which can leave
+     * faint seams when scaling. numOfSlices <= 1 disables the slices.
+     */
+    void setSlices(unsigned int numOfSlices)
+    {
+        freeSliceSwscaleContexts();
+        mSliceWorkers.reset();
+        mInputSliceRows.clear();
+        mOutputSliceRows.clear();
+        // At least 2 lines (a chroma line of the subsampled formats) per slice
+        if (numOfSlices > outputHeigth / 2)
+            numOfSlices = outputHeigth / 2;
+        if (numOfSlices <= 1)
+            return;
+
+        AVPixelFormat convFmt = FFMPEGUtils::translatePixelFormat<ConvertedVideoFrameFormat>();
+        AVPixelFormat inFmt   = FFMPEGUtils::translatePixelFormat<InputVideoFrameFormat>();
+        unsigned int n;
+        for (n = 0; n <= numOfSlices; n++)
+        {
+            unsigned int outputRow = (outputHeigth * n / numOfSlices) & ~1u;
+            unsigned int inputRow = ((uint64_t)outputRow * inputHeigth / outputHeigth) & ~1u;
+            if (n == numOfSlices)
+            {
+                outputRow = outputHeigth;
+                inputRow = inputHeigth;
+            }
+            mOutputSliceRows.push_back(outputRow);
+            mInputSliceRows.push_back(inputRow);
+        }
+        if (!mConversionKernel)
+        {
+            for (n = 0; n < numOfSlices; n++)
+            {
+                struct SwsContext* sliceContext =
+                sws_getContext(inputWidth, mInputSliceRows[n + 1] - mInputSliceRows[n], inFmt,
+                               outputWidth, mOutputSliceRows[n + 1] - mOutputSliceRows[n],
+                               convFmt, SWS_BILINEAR, NULL, NULL, NULL);
+                if (!sliceContext)
+                {
+                    freeSliceSwscaleContexts();
+                    printAndThrowUnrecoverableError("sliceContext = sws_getContext(...)");
+                }
+                mSliceSwscaleContexts.push_back(sliceContext);
+            }
+        }
+        mSliceWorkers.reset(new SliceWorkers(numOfSlices - 1));
+    }
+
     ~FFMPEGVideoConverter()
     {
+        mSliceWorkers.reset();
+        freeSliceSwscaleContexts();
         avcodec_free_context(&mInputCodecContext);
         avcodec_free_context(&mOutputCodecContext);
         av_frame_free(&mInputLibAVFrame);
@@ -190,6 +241,29 @@ public:
         return videoReConverter;
     }
 
+    MotionDetector<ConvertedVideoFrameFormat, outputWidth, outputHeigth>&
+    operator >>
+    (MotionDetector<ConvertedVideoFrameFormat, outputWidth, outputHeigth>& motionDetector)
+    {
+        if (mMediaStatusInPipe == MEDIA_READY)
+            motionDetector.mMediaStatusInPipe = MEDIA_READY;
+        else
+        {
+            motionDetector.mMediaStatusInPipe = mMediaStatusInPipe;
+            mMediaStatusInPipe = MEDIA_READY;
+            return motionDetector;
+        }
+        try
+        {
+            motionDetector.analyze(mConvertedVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            motionDetector.mMediaStatusInPipe = mediaException.cause();
+        }
+        return motionDetector;
+    }
+
     template <typename EncodedVideoFrameCodec>
     VideoEncoder<ConvertedVideoFrameFormat,
                  EncodedVideoFrameCodec, outputWidth, outputHeigth>&
@@ -251,10 +325,7 @@ private:
     void specializedConvert(const PackedRawVideoFrame& inputVideoFrame)
     {
         mInputLibAVFrame->data[0] = (uint8_t*)&inputVideoFrame.data()[0];
-        sws_scale(mSwscaleContext, (const uint8_t*const *)mInputLibAVFrame->data,
-                                    mInputLibAVFrame->linesize, 0,
-                                    inputHeigth, mConvertedLibAVFrame->data,
-                                    mConvertedLibAVFrame->linesize);
+        scale();
     }
 
     /*  TODO ?
@@ -269,35 +340,89 @@ private:
         mInputLibAVFrame->data[0] = (uint8_t*)inputVideoFrame.plane<0>();
         mInputLibAVFrame->data[1] = (uint8_t*)inputVideoFrame.plane<1>();
         mInputLibAVFrame->data[2] = (uint8_t*)inputVideoFrame.plane<2>();
+        scale();
+    }
+
+    void scale()
+    {
+        if (mSliceWorkers)
+        {
+            mSliceWorkers->process(mOutputSliceRows.size() - 1,
+                                   [this](unsigned int slice) { scaleSlice(slice); });
+            return;
+        }
+        if (mConversionKernel)
+        {
+            mConversionKernel((const uint8_t*const *)mInputLibAVFrame->data,
+                              mInputLibAVFrame->linesize, mConvertedLibAVFrame->data,
+                              mConvertedLibAVFrame->linesize, inputWidth, inputHeigth);
+            return;
+        }
         sws_scale(mSwscaleContext, (const uint8_t*const *)mInputLibAVFrame->data,
                                     mInputLibAVFrame->linesize, 0,
                                     inputHeigth, mConvertedLibAVFrame->data,
                                     mConvertedLibAVFrame->linesize);
     }
 
-    void mapConvertedFrameToLibAVFrame(Planar3RawVideoFrame& outputVideoFrame)
+    void scaleSlice(unsigned int slice)
     {
-        outputVideoFrame.assignSharedPtrForPlane<0>(mConvertedLibAVFrameData0);
-        outputVideoFrame.assignSharedPtrForPlane<1>(mConvertedLibAVFrameData1);
-        outputVideoFrame.assignSharedPtrForPlane<2>(mConvertedLibAVFrameData2);
+        uint8_t* inputPlanes[4];
+        uint8_t* outputPlanes[4];
+        slicePlanes(FFMPEGUtils::translatePixelFormat<InputVideoFrameFormat>(),
+                    mInputLibAVFrame, mInputSliceRows[slice], inputPlanes);
+        slicePlanes(FFMPEGUtils::translatePixelFormat<ConvertedVideoFrameFormat>(),
+                    mConvertedLibAVFrame, mOutputSliceRows[slice], outputPlanes);
+        unsigned int inputRows = mInputSliceRows[slice + 1] - mInputSliceRows[slice];
+        if (mConversionKernel)
+            mConversionKernel((const uint8_t*const *)inputPlanes, mInputLibAVFrame->linesize,
+                              outputPlanes, mConvertedLibAVFrame->linesize, inputWidth, inputRows);
+        else
+            sws_scale(mSliceSwscaleContexts[slice], (const uint8_t*const *)inputPlanes,
+                      mInputLibAVFrame->linesize, 0, inputRows,
+                      outputPlanes, mConvertedLibAVFrame->linesize);
+    }
+
+    // The planes' pointers at the given (luma) row
+    static void slicePlanes(AVPixelFormat format, const AVFrame* frame, unsigned int row,
+                            uint8_t* planes[4])
+    {
+        const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(format);
+        int numOfPlanes = av_pix_fmt_count_planes(format);
+        int n;
+        for (n = 0; n < 4; n++)
+        {
+            if (n >= numOfPlanes || !frame->data[n])
+            {
+                planes[n] = frame->data[n];
+                continue;
+            }
+            unsigned int planeRow = (n == 1 || n == 2) ? row >> descriptor->log2_chroma_h : row;
+            planes[n] = frame->data[n] + planeRow * frame->linesize[n];
+        }
     }
 
-    void mapConvertedFrameToLibAVFrame(PackedRawVideoFrame& outputVideoFrame)
+    void freeSliceSwscaleContexts()
     {
-        outputVideoFrame.assignDataSharedPtr(mConvertedLibAVFrameData0);
+        unsigned int n;
+        for (n = 0; n < mSliceSwscaleContexts.size(); n++)
+            sws_freeContext(mSliceSwscaleContexts[n]);
+        mSliceSwscaleContexts.clear();
     }
 
     VideoFrame<ConvertedVideoFrameFormat, outputWidth, outputHeigth> mConvertedVideoFrame;
     AVFrame* mInputLibAVFrame;
     AVPicture* mInputLibAVPicture;
-    ShareableVideoFrameData mConvertedLibAVFrameData0; // packed/plane0
-    ShareableVideoFrameData mConvertedLibAVFrameData1; // plane1
-    ShareableVideoFrameData mConvertedLibAVFrameData2; // plane2
-    ShareableVideoFrameData mConvertedLibAVFrameData3; // plane3
+    FFMPEGVideoFramePool<ConvertedVideoFrameFormat, outputWidth, outputHeigth> mConvertedFramesPool;
     AVCodecContext* mInputCodecContext;
     AVCodecContext* mOutputCodecContext;
     AVFrame* mConvertedLibAVFrame;
     struct SwsContext* mSwscaleContext;
+    VideoConversionKernel mConversionKernel;
+    // Slices' boundaries (first row of each slice, plus the frame's height)
+    std::vector<unsigned int> mInputSliceRows;
+    std::vector<unsigned int> mOutputSliceRows;
+    std::vector<struct SwsContext*> mSliceSwscaleContexts;
+    std::unique_ptr<SliceWorkers> mSliceWorkers;
 
 };
 
@@ -7,7 +7,11 @@
 #ifndef FFMPEGVIDEOENCODER_HPP_INCLUDED
 #define FFMPEGVIDEOENCODER_HPP_INCLUDED
 
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include "FFMPEGCommon.hpp"
+#include "LatencyTraceSEI.hpp"
 #include "VideoEncoder.hpp"
 extern "C"
 {
@@ -16,6 +20,9 @@ extern "C"
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
 #include <libavutil/timestamp.h>
+#ifdef LAAV_FFMPEG_DRM_PRIME
+#include <libavutil/hwcontext_drm.h>
+#endif
 }
 
 namespace laav
@@ -25,32 +32,120 @@ template <typename RawVideoFrameFormat,
           typename EncodedVideoFrameCodec,
           unsigned int width,
           unsigned int height>
-class FFMPEGVideoEncoder : public VideoEncoder<RawVideoFrameFormat, H264, width, height>
+class FFMPEGVideoEncoder : public VideoEncoder<RawVideoFrameFormat, EncodedVideoFrameCodec, width, height>
 {
 
 public:
 
     /*!
      *  \exception MediaException(MEDIA_NO_DATA)
+     *  \exception MediaException(MEDIA_BUFFERING) (the encoder's delay, I.E: lookahead)
      */
     void encode(const VideoFrame<RawVideoFrameFormat, width, height>& inputRawVideoFrame)
     {
+        this->mNumOfNewEncodedFrames = 0;
         fillLibAVFrame(inputRawVideoFrame);
-        this->doEncode();
+        this->doEncode(mInputLibAVFrame, inputRawVideoFrame);
     }
 
-    // TODO: implement for packed and planar2
-    // void fillLibAVFrame(const PackedRawVideoFrameBase& inputRawVideoFrame);
+    /*
+     * The following settings can be changed while encoding, by any thread (I.E: an HTTP
+     * command's callback, while a PipeWorker runs the encoder): they are applied to the
+     * next encoded frame, without reopening the encoder (the connected clients aren't
+     * affected).
+     */
+
+    /*
+     * The rate control is reconfigured by libx264 and NVENC (the other encoders keep
+     * the initial one), if the encoder was constructed with a bitrate (x264 ignores the
+     * changes in CRF mode). maxBitrate and vbvBufferSize (bits) set the VBV: x264 can
+     * change it only if it's enabled at the beginning. DEFAULT_BITRATE leaves a value
+     * unchanged. See also BitrateAdapter.
+     */
+    void setBitrate(unsigned int bitrate, unsigned int maxBitrate = DEFAULT_BITRATE,
+                    unsigned int vbvBufferSize = DEFAULT_BITRATE)
+    {
+        std::lock_guard<std::mutex> lock(mRateControlMutex);
+        if (bitrate != DEFAULT_BITRATE)
+            mRequestedBitrate = bitrate;
+        if (maxBitrate != DEFAULT_BITRATE)
+            mRequestedMaxBitrate = maxBitrate;
+        if (vbvBufferSize != DEFAULT_BITRATE)
+            mRequestedVBVBufferSize = vbvBufferSize;
+        mRateControlChanged = true;
+    }
+
+    // The last requested bitrate (or the initial one)
+    unsigned int bitrate() const
+    {
+        std::lock_guard<std::mutex> lock(mRateControlMutex);
+        return mRequestedBitrate;
+    }
+
+    /*
+     * A keyframe is forced each numOfFrames frames, on top of the encoder's own GOP
+     * (so the interval can only be shortened). 0 restores the encoder's GOP.
+     */
+    void setKeyFrameInterval(unsigned int numOfFrames)
+    {
+        mKeyFrameInterval = numOfFrames;
+    }
+
+    // The next frame is encoded as an IDR frame (I.E: for a new viewer)
+    void forceKeyFrame()
+    {
+        mKeyFrameRequested = true;
+    }
+
+    /*
+     * Sent as AV_FRAME_DATA_REGIONS_OF_INTEREST (libx264 needs the adaptive quantization,
+     * enabled by default; VAAPI and NVENC support them too). See also MotionDetector.
+     * Needs FFmpeg >= 4.2: with the older versions the regions are ignored.
+     */
+    void setRegionsOfInterest(const std::vector<VideoRegionOfInterest>& regions)
+    {
+        std::lock_guard<std::mutex> lock(mRateControlMutex);
+        mRegionsOfInterest = regions;
+    }
+
+    /*
+     * Each packet carries a SEI with its frame's LatencyTrace (capture, encoder's input and
+     * output dates), so that the latency of each hop up to the viewer can be measured from
+     * the stream (see LatencyTraceSEI::read() and examples/LatencyProbe.cpp).
+     * Off by default: the SEI costs ~60 bytes per frame.
+     */
+    void setLatencyTracing(bool enabled)
+    {
+        mLatencyTracing = enabled;
+    }
+
+    // TODO: implement for planar2
 
 protected:
 
-    FFMPEGVideoEncoder() :
-        mLatency(0),
-        mInternalPtsBufferOffset(0)
+    // encoderName selects a specific libav encoder (I.E: "h264_vaapi"),
+    // otherwise the default one for EncodedVideoFrameCodec is used
+    FFMPEGVideoEncoder(const char* encoderName = NULL) :
+#ifdef LAAV_FFMPEG_DRM_PRIME
+        mDRMFrameDescriptor(),
+#endif
+        mLastInputPts(AV_NOPTS_VALUE),
+        mDateMinusMonotonicTs(0),
+        mRequestedBitrate(0),
+        mRequestedMaxBitrate(0),
+        mRequestedVBVBufferSize(0),
+        mRateControlChanged(false),
+        mKeyFrameInterval(0),
+        mKeyFrameRequested(false),
+        mFramesSinceKeyFrame(0),
+        mLatencyTracing(false)
     {
-        avcodec_register_all();
+        FFMPEGUtils::registerAll();
 
-        mVideoCodec = avcodec_find_encoder(FFMPEGUtils::translateCodec<EncodedVideoFrameCodec>());
+        if (encoderName)
+            mVideoCodec = avcodec_find_encoder_by_name(encoderName);
+        else
+            mVideoCodec = avcodec_find_encoder(FFMPEGUtils::translateCodec<EncodedVideoFrameCodec>());
         if (!mVideoCodec)
             printAndThrowUnrecoverableError("mVideoCodec = avcodec_find_encoder(...)");
 
@@ -77,58 +172,57 @@ protected:
         mInputLibAVFrame->width  = mVideoEncoderCodecContext->width;
         mInputLibAVFrame->height = mVideoEncoderCodecContext->height;
 
-        int ret = av_image_alloc(mInputLibAVFrame->data,
-                                 mInputLibAVFrame->linesize,
-                                 mVideoEncoderCodecContext->width,
-                                 mVideoEncoderCodecContext->height,
-                                 // TODO: 32 == ??? Should it be a parameter?
-                                 FFMPEGUtils::translatePixelFormat<RawVideoFrameFormat>(), 32);
-        // Need to free the allocated internal picture buffed,
-        // because it will be replaced by the inputVideoFrame's buffer
-        if (ret < 0)
-            printAndThrowUnrecoverableError("int ret = av_image_alloc(mInputLibAVFrame->data,...;");
-
-        av_freep(&mInputLibAVFrame->data[0]);
-
-        unsigned int i;
-        for (i = 0; i < encodedVideoFrameBufferSize; i++)
+#ifdef LAAV_FFMPEG_DRM_PRIME
+        if (mInputLibAVFrame->format == AV_PIX_FMT_DRM_PRIME)
         {
-            AVPacket encodedVideoPkt;
-            encodedVideoPkt.size = 0;
-            mEncodedVideoPktBuffer.push_back(encodedVideoPkt);
-            av_init_packet(&mEncodedVideoPktBuffer[i]);
+            // DMABUF frames are described (not copied) by mDRMFrameDescriptor
+            mInputLibAVFrame->data[0] = (uint8_t* )&mDRMFrameDescriptor;
         }
-
-        for (i = 0; i < encodedVideoFrameBufferSize; i++)
+        else
+#endif
         {
-            mInternalMonotonicPtsBuffer.push_back(AV_NOPTS_VALUE);
-            mInternalDatePtsBuffer.push_back(-1);
+            int ret = av_image_alloc(mInputLibAVFrame->data,
+                                     mInputLibAVFrame->linesize,
+                                     mVideoEncoderCodecContext->width,
+                                     mVideoEncoderCodecContext->height,
+                                     // TODO: 32 == ??? Should it be a parameter?
+                                     FFMPEGUtils::translatePixelFormat<RawVideoFrameFormat>(), 32);
+            // Need to free the allocated internal picture buffed,
+            // because it will be replaced by the inputVideoFrame's buffer
+            if (ret < 0)
+                printAndThrowUnrecoverableError("int ret = av_image_alloc(mInputLibAVFrame->data,...;");
+
+            av_freep(&mInputLibAVFrame->data[0]);
         }
 
+        av_init_packet(&mEncodedVideoPkt);
+        mEncodedVideoPkt.data = NULL;
+        mEncodedVideoPkt.size = 0;
+
     }
 
     void completeEncoderInitialization()
     {
+        // The forced keyframes (forceKeyFrame()) must be IDR frames, so that the new
+        // viewers can start decoding from them (not all the encoders have the option)
+        av_opt_set_int(mVideoEncoderCodecContext->priv_data, "forced-idr", 1, 0);
         if (avcodec_open2(mVideoEncoderCodecContext, mVideoCodec, NULL) < 0)
             printAndThrowUnrecoverableError("avcodec_open2(...)");
+        mRequestedBitrate = mVideoEncoderCodecContext->bit_rate;
+        mRequestedMaxBitrate = mVideoEncoderCodecContext->rc_max_rate;
+        mRequestedVBVBufferSize = mVideoEncoderCodecContext->rc_buffer_size;
     }
 
     ~FFMPEGVideoEncoder()
     {
-        unsigned int q;
-        for (q = 0; q < mEncodedVideoPktBuffer.size(); q++)
-            av_packet_unref(&mEncodedVideoPktBuffer[q]);
+        av_packet_unref(&mEncodedVideoPkt);
         av_frame_free(&mInputLibAVFrame);
         avcodec_free_context(&mVideoEncoderCodecContext);
     }
 
     AVCodecContext* mVideoEncoderCodecContext;
-
-private:
-
-    AVCodec* mVideoCodec;
     AVFrame* mInputLibAVFrame;
-    std::vector<AVPacket> mEncodedVideoPktBuffer;
+
 
     /*!
      *  \exception MediaException(MEDIA_NO_DATA)
@@ -142,83 +236,296 @@ private:
         this->mInputLibAVFrame->data[0] = (uint8_t* )inputRawVideoFrame.plane<0>();
         this->mInputLibAVFrame->data[1] = (uint8_t* )inputRawVideoFrame.plane<1>();
         this->mInputLibAVFrame->data[2] = (uint8_t* )inputRawVideoFrame.plane<2>();
+        // Refcounted planes: libavcodec keeps a reference to them (I.E: in the lookahead)
+        // instead of copying them, and their producer can't reuse them in the meantime
+        // (as long as it gives a fresh buffer to each frame, I.E: FFMPEGVideoConverter)
+        shareWithLibAVFrame(0, inputRawVideoFrame.planeSharedPtr<0>(), inputRawVideoFrame.size<0>());
+        shareWithLibAVFrame(1, inputRawVideoFrame.planeSharedPtr<1>(), inputRawVideoFrame.size<1>());
+        shareWithLibAVFrame(2, inputRawVideoFrame.planeSharedPtr<2>(), inputRawVideoFrame.size<2>());
     }
 
-    void doEncode()
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void fillLibAVFrame(const PackedRawVideoFrame& inputRawVideoFrame)
     {
-        if (this->mEncodingStartTime == 0)
-            this->mEncodingStartTime = av_gettime_relative();
-
-        // "this" is wanted by the compiler
-        AVPacket& currEncodedVideoPkt =
-        this->mEncodedVideoPktBuffer[this->mEncodedVideoFrameBufferOffset];
-
-        VideoFrame<H264, width, height>& currEncodedVideoFrame =
-        this->mEncodedVideoFrameBuffer[this->mEncodedVideoFrameBufferOffset];
+        if (inputRawVideoFrame.size() == 0)
+        {
+            throw MediaException(MEDIA_NO_DATA);
+        }
+        this->mInputLibAVFrame->data[0] = (uint8_t* )inputRawVideoFrame.data();
+        // The grabbers' lines aren't padded (I.E: V4L2's bytesperline == width * 2 for YUYV)
+        this->mInputLibAVFrame->linesize[0] = inputRawVideoFrame.size() / height;
+        shareWithLibAVFrame(0, inputRawVideoFrame.dataSharedPtr(), inputRawVideoFrame.size());
+    }
 
-        av_packet_unref(&currEncodedVideoPkt);
+#ifdef LAAV_FFMPEG_DRM_PRIME
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void fillLibAVFrame(const DMABufRawVideoFrame& inputRawVideoFrame)
+    {
+        if (inputRawVideoFrame.size() == 0)
+        {
+            throw MediaException(MEDIA_NO_DATA);
+        }
+        AVDRMFrameDescriptor& desc = this->mDRMFrameDescriptor;
+        desc.nb_objects = 1;
+        desc.objects[0].fd = inputRawVideoFrame.fd();
+        desc.objects[0].size = inputRawVideoFrame.size();
+        desc.objects[0].format_modifier = DRM_FORMAT_MOD_INVALID;
+        desc.nb_layers = 1;
+        desc.layers[0].format = FFMPEGUtils::translateDRMFormat<RawVideoFrameFormat>();
+        desc.layers[0].nb_planes = inputRawVideoFrame.numOfPlanes();
+        desc.layers[0].planes[0].object_index = 0;
+        desc.layers[0].planes[0].offset = inputRawVideoFrame.offset<0>();
+        desc.layers[0].planes[0].pitch = inputRawVideoFrame.stride<0>();
+        desc.layers[0].planes[1].object_index = 0;
+        desc.layers[0].planes[1].offset = inputRawVideoFrame.offset<1>();
+        desc.layers[0].planes[1].pitch = inputRawVideoFrame.stride<1>();
+        desc.layers[0].planes[2].object_index = 0;
+        desc.layers[0].planes[2].offset = inputRawVideoFrame.offset<2>();
+        desc.layers[0].planes[2].pitch = inputRawVideoFrame.stride<2>();
+
+        // The libav frames created from this one (I.E: mapped surfaces) keep a reference
+        // to the dma-buf, so that its producer can't reuse it while they are alive
+        shareWithLibAVFrame(0, inputRawVideoFrame.dataSharedPtr(), sizeof(desc), (uint8_t* )&desc);
+    }
+#endif
 
-        int64_t nowPts = av_gettime_relative();
-        this->mInputLibAVFrame->pts = nowPts;
+    /*
+     * mInputLibAVFrame->buf[bufIndex] becomes a reference to sharedData (which is released
+     * when libav unrefs the last copy of the buffer). data defaults to sharedData's one.
+     */
+    void shareWithLibAVFrame(unsigned int bufIndex, const ShareableVideoFrameData& sharedData,
+                             unsigned int size, uint8_t* data = NULL)
+    {
+        auto releaseSharedData = [](void* opaque, uint8_t* data)
+        {
+            delete (ShareableVideoFrameData* )opaque;
+        };
+        av_buffer_unref(&this->mInputLibAVFrame->buf[bufIndex]);
+        this->mInputLibAVFrame->buf[bufIndex] =
+        av_buffer_create(data ? data : (uint8_t* )sharedData.get(), size, releaseSharedData,
+                         new ShareableVideoFrameData(sharedData), 0);
+        if (!this->mInputLibAVFrame->buf[bufIndex])
+            printAndThrowUnrecoverableError("mInputLibAVFrame->buf[n] = av_buffer_create(...)");
+    }
 
-        int ret = avcodec_send_frame(this->mVideoEncoderCodecContext, this->mInputLibAVFrame);
+    /*!
+     *  \exception MediaException(MEDIA_BUFFERING) (no packets out of the encoder yet)
+     */
+    void doEncode(AVFrame* libAVFrameToEncode, const Frame& inputRawVideoFrame)
+    {
+        int64_t encodingStartTime = StageMetrics::nowNs();
+        this->mMetrics.countFrameIn();
+
+        // The capture time travels through the encoder's delay (lookahead, frame threads,
+        // hardware queue) as the frame's pts, and comes back as the packet's one
+        int64_t pts = inputRawVideoFrame.monotonicTimestamp();
+        int64_t datePts = inputRawVideoFrame.dateTimestamp();
+        if (pts == AV_NOPTS_VALUE)
+        {
+            pts = av_gettime_relative();
+            datePts = -1;
+        }
+        if (datePts == -1)
+        {
+            struct timespec dateTimeNow;
+            // TODO ifdef linux
+            clock_gettime(CLOCK_REALTIME, &dateTimeNow);
+            datePts = dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec -
+                      (av_gettime_relative() - pts) * 1000;
+        }
+        // The encoders want strictly increasing pts (I.E: the same frame encoded twice)
+        if (mLastInputPts != AV_NOPTS_VALUE && pts <= mLastInputPts)
+            pts = mLastInputPts + 1;
+        mLastInputPts = pts;
+        mDateMinusMonotonicTs = datePts - pts * 1000;
+        libAVFrameToEncode->pts = pts;
+        applyRuntimeSettings(libAVFrameToEncode);
+        if (mLatencyTracing)
+            mEncoderInputTs.push_back(std::make_pair(pts, av_gettime_relative()));
+        else
+            mEncoderInputTs.clear();
+
+        int ret = avcodec_send_frame(this->mVideoEncoderCodecContext, libAVFrameToEncode);
         if (ret == AVERROR(EAGAIN))
         {
-            return;
+            // The encoder's queue is full: its packets must be taken first
+            receiveEncodedPackets();
+            ret = avcodec_send_frame(this->mVideoEncoderCodecContext, libAVFrameToEncode);
         }
-        else if (ret != 0)
+        if (ret != 0)
             printAndThrowUnrecoverableError("avcodec_send_frame(...)");
 
-        ret = avcodec_receive_packet(this->mVideoEncoderCodecContext, &currEncodedVideoPkt);
-        if (ret == AVERROR(EAGAIN))
-            ;
-        else if (ret != 0)
-            printAndThrowUnrecoverableError("avcodec_receive_packet(...)");
-
-        this->mInternalMonotonicPtsBuffer[this->mInternalPtsBufferOffset] = nowPts;
-        struct timespec dateTimeNow;
-        // TODO ifdef linux
-        clock_gettime(CLOCK_REALTIME, &dateTimeNow);
-        this->mInternalDatePtsBuffer[this->mInternalPtsBufferOffset] =
-        dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec;
-
-        if (ret == 0)
+        receiveEncodedPackets();
+        this->mMetrics.addProcessingTime(StageMetrics::nowNs() - encodingStartTime);
+        if (this->mNumOfNewEncodedFrames == 0)
+            throw MediaException(MEDIA_BUFFERING);
+    }
+
+private:
+
+    void applyRuntimeSettings(AVFrame* libAVFrameToEncode)
+    {
+        if (mRateControlChanged)
         {
+            std::lock_guard<std::mutex> lock(mRateControlMutex);
+            // libx264 and NVENC compare these with their current configuration at each frame
+            mVideoEncoderCodecContext->bit_rate = mRequestedBitrate;
+            mVideoEncoderCodecContext->rc_max_rate = mRequestedMaxBitrate;
+            mVideoEncoderCodecContext->rc_buffer_size = mRequestedVBVBufferSize;
+            mRateControlChanged = false;
+        }
+
+        attachRegionsOfInterest(libAVFrameToEncode);
 
-            if (mLatency == 0)
+        unsigned int keyFrameInterval = mKeyFrameInterval;
+        mFramesSinceKeyFrame++;
+        if (mKeyFrameRequested.exchange(false) ||
+            (keyFrameInterval != 0 && mFramesSinceKeyFrame >= keyFrameInterval))
+        {
+            libAVFrameToEncode->pict_type = AV_PICTURE_TYPE_I;
+            mFramesSinceKeyFrame = 0;
+        }
+        else
+            libAVFrameToEncode->pict_type = AV_PICTURE_TYPE_NONE;
+    }
+
+    void attachRegionsOfInterest(AVFrame* libAVFrameToEncode)
+    {
+#ifdef LAAV_FFMPEG_REGIONS_OF_INTEREST
+        av_frame_remove_side_data(libAVFrameToEncode, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+        std::lock_guard<std::mutex> lock(mRateControlMutex);
+        if (mRegionsOfInterest.size() == 0)
+            return;
+        AVFrameSideData* sideData =
+        av_frame_new_side_data(libAVFrameToEncode, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                               mRegionsOfInterest.size() * sizeof(AVRegionOfInterest));
+        if (!sideData)
+            printAndThrowUnrecoverableError("sideData = av_frame_new_side_data(...)");
+        AVRegionOfInterest* regions = (AVRegionOfInterest* )sideData->data;
+        unsigned int n;
+        for (n = 0; n < mRegionsOfInterest.size(); n++)
+        {
+            const VideoRegionOfInterest& region = mRegionsOfInterest[n];
+            regions[n].self_size = sizeof(AVRegionOfInterest);
+            regions[n].left = region.x;
+            regions[n].top = region.y;
+            regions[n].right = region.x + region.width;
+            regions[n].bottom = region.y + region.height;
+            float qualityOffset = region.qualityOffset < -1 ? -1 :
+                                  (region.qualityOffset > 1 ? 1 : region.qualityOffset);
+            regions[n].qoffset = av_make_q((int)(qualityOffset * 1000), 1000);
+        }
+#endif
+    }
+
+    // All the available packets (one frame can produce zero, one or more of them)
+    void receiveEncodedPackets()
+    {
+        while (this->mNumOfNewEncodedFrames < this->mEncodedVideoFrameBuffer.size())
+        {
+            int ret = avcodec_receive_packet(this->mVideoEncoderCodecContext, &mEncodedVideoPkt);
+            if (ret == AVERROR(EAGAIN))
+                return;
+            else if (ret != 0)
+                printAndThrowUnrecoverableError("avcodec_receive_packet(...)");
+
+            // The packet's pts is the capture time of its frame (see doEncode())
+            this->mMetrics.countFrameOut(mEncodedVideoPkt.size);
+            this->mMetrics.recordLatency(av_gettime_relative() - mEncodedVideoPkt.pts);
+            if (mLatencyTracing)
+                insertLatencyTraceSEI();
+
+            /*
+             * The frame takes over the packet (its refcounted buffer and its side data):
+             * the data stays valid as long as someone holds the frame, even after the
+             * frames' ring has been reused
+             */
+            AVPacket* encodedVideoPkt = av_packet_alloc();
+            if (!encodedVideoPkt)
+                printAndThrowUnrecoverableError("encodedVideoPkt = av_packet_alloc()");
+            av_packet_move_ref(encodedVideoPkt, &mEncodedVideoPkt);
+            auto freePacket = [encodedVideoPkt](unsigned char* buffer)
             {
-                mLatency = av_gettime_relative() - this->mEncodingStartTime;
-            }
-
-            auto freeNothing = [](unsigned char* buffer) {  };
-            ShareableVideoFrameData mVideoData =
-            ShareableVideoFrameData(currEncodedVideoPkt.data, freeNothing);
-
-            currEncodedVideoFrame.assignDataSharedPtr(mVideoData);
-            currEncodedVideoFrame.setSize(currEncodedVideoPkt.size);
-            currEncodedVideoFrame.mLibAVFlags = currEncodedVideoPkt.flags;
-            currEncodedVideoFrame.mLibAVSideData = currEncodedVideoPkt.side_data;
-            currEncodedVideoFrame.mLibAVSideDataElems = currEncodedVideoPkt.side_data_elems;
-            int64_t monoPts = this->mInternalMonotonicPtsBuffer[this->mEncodedVideoFrameBufferOffset];
-            int64_t datePts = this->mInternalDatePtsBuffer[this->mEncodedVideoFrameBufferOffset];
-            currEncodedVideoFrame.setMonotonicTimestamp(monoPts);
-            currEncodedVideoFrame.setDateTimestamp(datePts);
+                AVPacket* packetToFree = encodedVideoPkt;
+                av_packet_free(&packetToFree);
+            };
+            ShareableVideoFrameData videoData(encodedVideoPkt->data, freePacket);
+
+            VideoFrame<EncodedVideoFrameCodec, width, height>& currEncodedVideoFrame =
+            this->mEncodedVideoFrameBuffer[this->mEncodedVideoFrameBufferOffset];
+
+            currEncodedVideoFrame.assignDataSharedPtr(videoData);
+            currEncodedVideoFrame.setSize(encodedVideoPkt->size);
+            currEncodedVideoFrame.mLibAVFlags = encodedVideoPkt->flags;
+            currEncodedVideoFrame.mLibAVSideData = encodedVideoPkt->side_data;
+            currEncodedVideoFrame.mLibAVSideDataElems = encodedVideoPkt->side_data_elems;
+            currEncodedVideoFrame.setMonotonicTimestamp(encodedVideoPkt->pts);
+            currEncodedVideoFrame.setDateTimestamp(encodedVideoPkt->pts * 1000 +
+                                                   mDateMinusMonotonicTs);
 
             if (this->mEncodedVideoFrameBufferOffset + 1 == this->mEncodedVideoFrameBuffer.size())
                 this->mFillingEncodedVideoFrameBuffer = false;
 
             this->mEncodedVideoFrameBufferOffset =
             (this->mEncodedVideoFrameBufferOffset + 1) % this->mEncodedVideoFrameBuffer.size();
+            this->mNumOfNewEncodedFrames++;
         }
+    }
 
-        this->mInternalPtsBufferOffset =
-        (this->mInternalPtsBufferOffset + 1) % this->mEncodedVideoFrameBuffer.size();
+    void insertLatencyTraceSEI()
+    {
+        // The inputs of the frames which the encoder dropped (if any) are skipped
+        while (mEncoderInputTs.size() > 0 && mEncoderInputTs.front().first < mEncodedVideoPkt.pts)
+            mEncoderInputTs.pop_front();
+        if (mEncoderInputTs.size() == 0 || mEncoderInputTs.front().first != mEncodedVideoPkt.pts)
+            return;
+        LatencyTrace trace;
+        trace.captureMonotonicTs = mEncodedVideoPkt.pts;
+        trace.captureDateTs = mEncodedVideoPkt.pts * 1000 + mDateMinusMonotonicTs;
+        trace.encoderInputDateTs = mEncoderInputTs.front().second * 1000 + mDateMinusMonotonicTs;
+        trace.encoderOutputDateTs = av_gettime_relative() * 1000 + mDateMinusMonotonicTs;
+        mEncoderInputTs.pop_front();
+
+        LatencyTraceSEI::insert<EncodedVideoFrameCodec>(mEncodedVideoPkt.data, mEncodedVideoPkt.size,
+                                                        trace, mLatencyTraceSEIPacket);
+        AVPacket seiPkt;
+        av_init_packet(&seiPkt);
+        if (av_new_packet(&seiPkt, mLatencyTraceSEIPacket.size()) < 0)
+            printAndThrowUnrecoverableError("av_new_packet(...)");
+        memcpy(seiPkt.data, mLatencyTraceSEIPacket.data(), mLatencyTraceSEIPacket.size());
+        if (av_packet_copy_props(&seiPkt, &mEncodedVideoPkt) < 0)
+            printAndThrowUnrecoverableError("av_packet_copy_props(...)");
+        av_packet_unref(&mEncodedVideoPkt);
+        av_packet_move_ref(&mEncodedVideoPkt, &seiPkt);
     }
 
-    int64_t mLatency;
-    unsigned int mInternalPtsBufferOffset;
-    std::vector<int64_t> mInternalMonotonicPtsBuffer;
-    std::vector<int64_t> mInternalDatePtsBuffer;
+    AVCodec* mVideoCodec;
+    // Receives the encoded packets, which are then taken over by the frames
+    AVPacket mEncodedVideoPkt;
+#ifdef LAAV_FFMPEG_DRM_PRIME
+    AVDRMFrameDescriptor mDRMFrameDescriptor;
+#endif
+    int64_t mLastInputPts;
+    // ns - us * 1000: the date of a packet is computed from its (monotonic) pts
+    int64_t mDateMinusMonotonicTs;
+    // Protects the settings changed while encoding (rate control, regions of interest)
+    mutable std::mutex mRateControlMutex;
+    unsigned int mRequestedBitrate;
+    unsigned int mRequestedMaxBitrate;
+    unsigned int mRequestedVBVBufferSize;
+    std::atomic<bool> mRateControlChanged;
+    std::vector<VideoRegionOfInterest> mRegionsOfInterest;
+    std::atomic<unsigned int> mKeyFrameInterval;
+    std::atomic<bool> mKeyFrameRequested;
+    unsigned int mFramesSinceKeyFrame;
+    std::atomic<bool> mLatencyTracing;
+    // pts, time (us) at which the frame entered the encoder: the frames still inside it
+    std::deque<std::pair<int64_t, int64_t> > mEncoderInputTs;
+    std::vector<unsigned char> mLatencyTraceSEIPacket;
 
 };
 
@@ -0,0 +1,104 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FFMPEGVIDEOFRAMEPOOL_HPP_INCLUDED
+#define FFMPEGVIDEOFRAMEPOOL_HPP_INCLUDED
+
+extern "C"
+{
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+}
+#include "FFMPEGCommon.hpp"
+
+namespace laav
+{
+
+/*
+ * Refcounted (av_buffer_pool) buffers for the raw frames of a producer (I.E: a converter):
+ * each produced frame gets a fresh buffer of the pool, which is given back to the pool
+ * when the last VideoFrame (or libav frame, I.E: inside an encoder's lookahead) sharing
+ * it is gone. So the consumers can keep the frames as long as they want, without copies,
+ * and the producer never overwrites them. The pool can be destroyed before its buffers.
+ */
+template <typename VideoFrameFormat,
+          unsigned int width,
+          unsigned int height>
+class FFMPEGVideoFramePool
+{
+
+public:
+
+    FFMPEGVideoFramePool()
+    {
+        int bufferSize =
+        av_image_get_buffer_size(FFMPEGUtils::translatePixelFormat<VideoFrameFormat>(),
+                                 width, height, 1);
+        if (bufferSize < 0)
+            printAndThrowUnrecoverableError("av_image_get_buffer_size(...)");
+        mPool = av_buffer_pool_init(bufferSize, NULL);
+        if (!mPool)
+            printAndThrowUnrecoverableError("mPool = av_buffer_pool_init(...)");
+    }
+
+    ~FFMPEGVideoFramePool()
+    {
+        av_buffer_pool_uninit(&mPool);
+    }
+
+    /*
+     * Points the planes of libAVFrame to a fresh buffer of the pool, and assigns the same
+     * planes to videoFrame, which owns the buffer from now on (libAVFrame doesn't).
+     */
+    void assignFreshBuffer(AVFrame* libAVFrame, VideoFrame<VideoFrameFormat, width, height>& videoFrame)
+    {
+        AVBufferRef* buffer = av_buffer_pool_get(mPool);
+        if (!buffer)
+            printAndThrowUnrecoverableError("buffer = av_buffer_pool_get(...)");
+        if (av_image_fill_arrays(libAVFrame->data, libAVFrame->linesize, buffer->data,
+                                 FFMPEGUtils::translatePixelFormat<VideoFrameFormat>(),
+                                 width, height, 1) < 0)
+        {
+            av_buffer_unref(&buffer);
+            printAndThrowUnrecoverableError("av_image_fill_arrays(...)");
+        }
+        auto giveBackBuffer = [buffer](unsigned char* data)
+        {
+            AVBufferRef* bufferToUnref = buffer;
+            av_buffer_unref(&bufferToUnref);
+        };
+        ShareableVideoFrameData bufferData(buffer->data, giveBackBuffer);
+        assignPlanes(libAVFrame, bufferData, videoFrame);
+    }
+
+private:
+
+    // The planes share the ownership of the whole buffer
+    void assignPlanes(const AVFrame* libAVFrame, const ShareableVideoFrameData& bufferData,
+                      Planar3RawVideoFrame& videoFrame)
+    {
+        ShareableVideoFrameData plane0(bufferData, libAVFrame->data[0]);
+        ShareableVideoFrameData plane1(bufferData, libAVFrame->data[1]);
+        ShareableVideoFrameData plane2(bufferData, libAVFrame->data[2]);
+        videoFrame.assignSharedPtrForPlane<0>(plane0);
+        videoFrame.assignSharedPtrForPlane<1>(plane1);
+        videoFrame.assignSharedPtrForPlane<2>(plane2);
+    }
+
+    void assignPlanes(const AVFrame* libAVFrame, const ShareableVideoFrameData& bufferData,
+                      PackedRawVideoFrame& videoFrame)
+    {
+        ShareableVideoFrameData data(bufferData, libAVFrame->data[0]);
+        videoFrame.assignDataSharedPtr(data);
+    }
+
+    AVBufferPool* mPool;
+
+};
+
+}
+
+#endif // FFMPEGVIDEOFRAMEPOOL_HPP_INCLUDED
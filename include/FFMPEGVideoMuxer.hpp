@@ -12,6 +12,9 @@
 namespace laav
 {
 
+template <typename Container, typename VideoCodecOrFormat, unsigned int width, unsigned int height>
+class HTTPVideoStreamer;
+
 // DIAMOND pattern
 template <typename Container, typename VideoCodecOrFormat, unsigned int width, unsigned int height>
 class FFMPEGMuxerVideoImpl : public virtual FFMPEGMuxerCommonImpl<Container>
@@ -40,18 +43,7 @@ protected:
         mVideoCodecContext->time_base = AV_TIME_BASE_Q;
         avcodec_parameters_from_context(mVideoStream->codecpar, mVideoCodecContext);
 
-        unsigned int i;
-        for (i = 1; i < encodedVideoFrameBufferSize; i++)
-        {
-            AVPacket videoPkt;
-            this->mVideoAVPktsToMux.push_back(videoPkt);
-        }
-
-        for (i = 1; i < encodedVideoFrameBufferSize; i++)
-        {
-            av_init_packet(&this->mVideoAVPktsToMux[i]);
-            this->mVideoAVPktsToMux[i].pts = AV_NOPTS_VALUE;
-        }
+        this->resetPacketsRing(this->mVideoAVPktsToMux, encodedVideoFrameBufferSize);
 
         if (startMuxingSoon)
             this->startMuxing();
@@ -71,8 +63,6 @@ protected:
         if (isFrameEmpty(videoFrameToMux))
             throw MediaException(MEDIA_NO_DATA);
 
-        FFMPEGMuxerCommonImpl<Container>::mVideoReady = true;
-
         int64_t pts;
         pts = av_rescale_q(videoFrameToMux.monotonicTimestamp(), mVideoCodecContext->time_base,
                            this->mMuxerContext->streams[this->mVideoStreamIndex]->time_base);
@@ -82,11 +72,8 @@ protected:
 
         this->mVideoAVPktsToMux[this->mVideoAVPktsToMuxOffset].stream_index =
         FFMPEGMuxerCommonImpl<Container>::mVideoStreamIndex;
-        //TODO: remove cast ?
-        this->mVideoAVPktsToMux[this->mVideoAVPktsToMuxOffset].data =
-        (uint8_t*)videoFrameToMux.data();
-
-        this->mVideoAVPktsToMux[this->mVideoAVPktsToMuxOffset].size = videoFrameToMux.size();
+        this->referenceFrameData(this->mVideoAVPktsToMux[this->mVideoAVPktsToMuxOffset],
+                                 videoFrameToMux.dataSharedPtr(), videoFrameToMux.size());
         this->mVideoAVPktsToMux[this->mVideoAVPktsToMuxOffset].flags = videoFrameToMux.mLibAVFlags;
         // TODO: is this needed for audio too?
         if (this->mVideoAVPktsToMux[this->mVideoAVPktsToMuxOffset].side_data)
@@ -104,6 +91,8 @@ protected:
         if (this->mDoMux)
         {
             this->mMuxedChunks.newGroupOfChunks = false;
+            this->mMuxedChunks.groupOfChunksId++;
+            this->mMuxedChunks.groupHasKeyFrame = false;
             this->muxNextUsefulFrameFromBuffer(true);
         }
     }
@@ -142,14 +131,6 @@ public:
         this->mMuxVideo = true;
         FFMPEGMuxerCommonImpl<Container>::mVideoStreamIndex = 0;
         FFMPEGMuxerCommonImpl<Container>::completeMuxerInitialization();
-        auto freeNothing = [](unsigned char* buffer) {  };
-        mMuxedVideoChunks.resize(FFMPEGMuxerCommonImpl<Container>::mMuxedChunks.data.size());
-        unsigned int n;
-        for (n = 0; n < mMuxedVideoChunks.size(); n++)
-        {
-            ShareableMuxedData shMuxedData(this->mMuxedChunks.data[n].ptr, freeNothing);
-            mMuxedVideoChunks[n].assignDataSharedPtr(shMuxedData);
-        }
     }
 
     void takeMuxableFrame(const VideoFrame<VideoCodecOrFormat, width, height>& videoFrameToMux)
@@ -166,11 +147,7 @@ public:
     {
         if (this->mMuxedChunks.newGroupOfChunks)
         {
-            unsigned int n;
-            for (n = 0; n < FFMPEGMuxerCommonImpl<Container>::mMuxedChunks.offset; n++)
-            {
-                mMuxedVideoChunks[n].setSize(this->mMuxedChunks.data[n].size);
-            }
+            this->wrapMuxedChunks(mMuxedVideoChunks);
             return mMuxedVideoChunks;
         }
         else
@@ -184,6 +161,15 @@ public:
         return FFMPEGMuxerCommonImpl<Container>::mMuxedChunks.offset;
     }
 
+    // Streams the chunks muxed in this pipe's step through a streamer which shares the muxer
+    HTTPVideoStreamer<Container, VideoCodecOrFormat, width, height>&
+    operator >>
+    (HTTPVideoStreamer<Container, VideoCodecOrFormat, width, height>& httpVideoStreamer)
+    {
+        httpVideoStreamer.streamMuxedData();
+        return httpVideoStreamer;
+    }
+
 private:
 
     std::vector<MuxedVideoData<Container, VideoCodecOrFormat, width, height> > mMuxedVideoChunks;
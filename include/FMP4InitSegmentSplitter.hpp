@@ -0,0 +1,103 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FMP4INITSEGMENTSPLITTER_HPP_INCLUDED
+#define FMP4INITSEGMENTSPLITTER_HPP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include "Common.hpp"
+
+namespace laav
+{
+
+/*
+ * Splits the beginning of a fragmented MP4 stream (as it is flushed by the muxer, in
+ * chunks of any size) into the init segment, made of the top level boxes preceding the
+ * first moof (ftyp + moov), and the fragments (moof + mdat) which follow it.
+ */
+class FMP4InitSegmentSplitter
+{
+
+public:
+
+    FMP4InitSegmentSplitter() :
+        mComplete(false)
+    {
+    }
+
+    /*
+     * Returns true when the init segment is complete: the data taken so far which follows
+     * it (from the first moof onward) is then in fragmentsData()
+     */
+    bool take(const uint8_t* data, size_t size)
+    {
+        if (mComplete)
+            return true;
+        mPendingData.insert(mPendingData.end(), data, data + size);
+        size_t offset = 0;
+        while (offset + 8 <= mPendingData.size())
+        {
+            const uint8_t* box = &mPendingData[offset];
+            uint64_t boxSize = ((uint64_t)box[0] << 24) | (box[1] << 16) | (box[2] << 8) | box[3];
+            if (box[4] == 'm' && box[5] == 'o' && box[6] == 'o' && box[7] == 'f')
+            {
+                mInitSegment.assign(mPendingData.begin(), mPendingData.begin() + offset);
+                mPendingData.erase(mPendingData.begin(), mPendingData.begin() + offset);
+                mComplete = true;
+                return true;
+            }
+            if (boxSize == 1)
+            {
+                // 64 bit size
+                if (offset + 16 > mPendingData.size())
+                    break;
+                boxSize = 0;
+                unsigned int n;
+                for (n = 8; n < 16; n++)
+                    boxSize = (boxSize << 8) | box[n];
+            }
+            if (boxSize < 8)
+                printAndThrowUnrecoverableError("Invalid MP4 box");
+            offset += boxSize;
+        }
+        return false;
+    }
+
+    bool isComplete() const
+    {
+        return mComplete;
+    }
+
+    const std::vector<uint8_t>& initSegment() const
+    {
+        return mInitSegment;
+    }
+
+    const std::vector<uint8_t>& fragmentsData() const
+    {
+        return mPendingData;
+    }
+
+    // The fragments' data is only needed once, when the init segment is completed
+    void releaseFragmentsData()
+    {
+        std::vector<uint8_t>().swap(mPendingData);
+    }
+
+private:
+
+    bool mComplete;
+    std::vector<uint8_t> mInitSegment;
+    std::vector<uint8_t> mPendingData;
+
+};
+
+}
+
+#endif // FMP4INITSEGMENTSPLITTER_HPP_INCLUDED
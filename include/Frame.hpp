@@ -27,6 +27,71 @@ template <typename InputVideoFrameFormat, unsigned int inputWidth, unsigned int
           typename ConvertedVideoFrameFormat, unsigned int outputWidth, unsigned int outputheight>
 class FFMPEGVideoConverter;
 
+/*
+ * The reference of a frame to its (shared) data. Assigning the data which is already
+ * referenced doesn't touch the (atomic) refcount: I.E, a holder which takes the frame
+ * of a converter at every step, while the converter reuses the same buffer.
+ */
+class FrameDataRef
+{
+
+public:
+
+    FrameDataRef()
+    {
+    }
+
+    FrameDataRef(const std::shared_ptr<unsigned char>& data) :
+        mData(data)
+    {
+    }
+
+    FrameDataRef(const FrameDataRef& other) = default;
+    FrameDataRef(FrameDataRef&& other) = default;
+
+    FrameDataRef& operator=(const FrameDataRef& other)
+    {
+        if (!references(other.mData))
+            mData = other.mData;
+        return *this;
+    }
+
+    FrameDataRef& operator=(FrameDataRef&& other)
+    {
+        if (!references(other.mData))
+            mData = std::move(other.mData);
+        return *this;
+    }
+
+    FrameDataRef& operator=(const std::shared_ptr<unsigned char>& data)
+    {
+        if (!references(data))
+            mData = data;
+        return *this;
+    }
+
+    unsigned char* get() const
+    {
+        return mData.get();
+    }
+
+    const std::shared_ptr<unsigned char>& sharedPtr() const
+    {
+        return mData;
+    }
+
+private:
+
+    // The same pointer, owned by the same control block (no atomic operation involved)
+    bool references(const std::shared_ptr<unsigned char>& data) const
+    {
+        return mData.get() == data.get() && !mData.owner_before(data) && !data.owner_before(mData);
+    }
+
+    std::shared_ptr<unsigned char> mData;
+
+};
+
 class Frame
 {
 
@@ -46,6 +111,13 @@ class Frame
               unsigned int audioSampleRate, enum AudioChannels audioChannels>
     friend class FFMPEGAudioEncoder;
 
+    template <typename VideoCodec, unsigned int width, unsigned int height,
+              typename AudioCodec, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+    friend class FFMPEGDemuxerSource;
+
+    template <typename CodecOrFormat, unsigned int width, unsigned int height>
+    friend class V4L2Grabber;
+
 public:
 
     Frame():
@@ -65,6 +137,29 @@ public:
         mDateTs = dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec;
     }
 
+    /*
+     * captureTimestamp: when the device captured the frame, on the av_gettime_relative()
+     * clock (CLOCK_MONOTONIC, microseconds), I.E: the V4L2 buffer's timestamp. The date
+     * is the one of the same instant.
+     */
+    void setCaptureTimestamp(int64_t captureTimestamp)
+    {
+        int64_t monotonicNow = av_gettime_relative();
+        struct timespec dateTimeNow;
+        clock_gettime(CLOCK_REALTIME, &dateTimeNow);
+        mMonotonicTs = captureTimestamp;
+        mDateTs = dateTimeNow.tv_sec * 1000000000 + dateTimeNow.tv_nsec -
+                  (monotonicNow - captureTimestamp) * 1000;
+    }
+
+    // The processed frames (I.E: converted) keep the capture time of their input
+    void copyTimestampsFrom(const Frame& frame)
+    {
+        mTimeBase = frame.mTimeBase;
+        mMonotonicTs = frame.mMonotonicTs;
+        mDateTs = frame.mDateTs;
+    }
+
     void setMonotonicTimeBase(AVRational& timeBase)
     {
         mTimeBase = timeBase;
@@ -90,6 +185,12 @@ public:
         return mDateTs;
     }
 
+    // For the encoded frames: whether the frame can be decoded without the previous ones
+    bool isKeyFrame() const
+    {
+        return mLibAVFlags & AV_PKT_FLAG_KEY;
+    }
+
     void printDate() const
     {
         timespec ts;
@@ -109,7 +210,7 @@ public:
 private:
 
     AVRational mTimeBase;
-    // set by FFMPEGVideoEncoder, accessed by FFMPEGMuxerVideoImpl
+    // set by FFMPEGVideoEncoder (or the H264 sources), accessed by FFMPEGMuxerVideoImpl
     int mLibAVFlags;
     // set by FFMPEGVideoEncoder, accessed by FFMPEGMuxerVideoImpl
     AVPacketSideData* mLibAVSideData;
@@ -126,8 +227,6 @@ class MuxedAudioData
 public:
 
     MuxedAudioData():
-        // DUMMY data that will be replaced by the producer's data.
-        mData(new unsigned char()),
         mSize(0)
     {
     }
@@ -159,7 +258,7 @@ public:
 
 private:
 
-    ShareableMuxedData mData;
+    FrameDataRef mData;
     unsigned int mSize;
 };
 
@@ -170,8 +269,6 @@ class MuxedVideoData
 public:
 
     MuxedVideoData():
-        // DUMMY data that will be replaced by the producer's data.
-        mData(new unsigned char()),
         mSize(0)
     {
     }
@@ -203,7 +300,7 @@ public:
 
 private:
 
-    ShareableMuxedData mData;
+    FrameDataRef mData;
     unsigned int mSize;
 };
 
@@ -214,8 +311,6 @@ class MuxedAudioVideoData
 public:
 
     MuxedAudioVideoData():
-        // DUMMY data that will be replaced by the producer's data.
-        mData(new unsigned char()),
         mSize(0)
     {
     }
@@ -247,7 +342,7 @@ public:
 
 private:
 
-    ShareableMuxedData mData;
+    FrameDataRef mData;
     unsigned int mSize;
 };
 
@@ -257,8 +352,6 @@ class EncodedAudioFrame : public Frame
 public:
 
     EncodedAudioFrame():
-        // DUMMY data that will be replaced by the producer's data.
-        mData(new unsigned char()),
         mSize(0)
     {
     }
@@ -283,6 +376,11 @@ public:
         mData = shareableAudioFrameData;
     }
 
+    const ShareableAudioFrameData& dataSharedPtr() const
+    {
+        return mData.sharedPtr();
+    }
+
     void setSize(unsigned int size)
     {
         mSize = size;
@@ -290,7 +388,7 @@ public:
 
 private:
 
-    ShareableAudioFrameData mData;
+    FrameDataRef mData;
     unsigned int mSize;
 };
 
@@ -318,8 +416,7 @@ public:
 
     EncodedVideoFrame(unsigned int width, unsigned int height)
         :
-        mSize(0),
-        mData(new unsigned char())
+        mSize(0)
     {
     }
 
@@ -336,6 +433,11 @@ public:
         mData = shareableVideoFrameData;
     }
 
+    const ShareableVideoFrameData& dataSharedPtr() const
+    {
+        return mData.sharedPtr();
+    }
+
     const unsigned char* data() const
     {
         return mData.get();
@@ -359,22 +461,17 @@ public:
 private:
 
     unsigned int mSize;
-    ShareableVideoFrameData mData;
+    FrameDataRef mData;
 };
 
 class Planar3RawVideoFrame
 {
 public:
 
-    Planar3RawVideoFrame(unsigned int width, unsigned int height)
+    // The planes are empty until the producer assigns them its data
+    Planar3RawVideoFrame(unsigned int width, unsigned int height) :
+        mSizes{0, 0, 0}
     {
-        // DUMMY data that will be replaced by the producer's data.
-        mPlanes.push_back(ShareableVideoFrameData(new unsigned char));
-        mPlanes.push_back(ShareableVideoFrameData(new unsigned char));
-        mPlanes.push_back(ShareableVideoFrameData(new unsigned char));
-        mSizes.push_back(0);
-        mSizes.push_back(0);
-        mSizes.push_back(0);
     }
 
     template <unsigned int planeNum>
@@ -398,6 +495,14 @@ public:
         mPlanes[planeNum] = shareableVideoFrameData;
     }
 
+    // I.E: for wrapping the plane in a refcounted libav buffer, without copying it
+    template <unsigned int planeNum>
+    const ShareableVideoFrameData& planeSharedPtr() const
+    {
+        static_assert(planeNum <= 2, "Can't get data for plane with index > 2");
+        return mPlanes[planeNum].sharedPtr();
+    }
+
     template <unsigned int planeNum>
     void setSize(unsigned int size)
     {
@@ -414,8 +519,8 @@ public:
 
 private:
 
-    std::vector<unsigned int> mSizes;
-    std::vector<ShareableVideoFrameData> mPlanes;
+    unsigned int mSizes[3];
+    FrameDataRef mPlanes[3];
 
 };
 
@@ -425,8 +530,6 @@ class PackedRawVideoFrame
 public:
 
     PackedRawVideoFrame(unsigned int width, unsigned int height):
-        // DUMMY data that will be replaced by the producer's data.
-        mData(new unsigned char()),
         mSize(0)
     {
     }
@@ -455,15 +558,118 @@ public:
         mData = shareableVideoFrameData;
     }
 
+    const ShareableVideoFrameData& dataSharedPtr() const
+    {
+        return mData.sharedPtr();
+    }
+
+    void setSize(unsigned int size)
+    {
+        mSize = size;
+    }
+
+private:
+
+    FrameDataRef mData;
+    unsigned int mSize;
+
+};
+
+// Raw frame whose pixels live in a dma-buf: downstream devices (hardware encoders,
+// scalers...) can import it through its fd without the CPU touching the pixels.
+// The plane layout (offsets and strides) refers to the same fd.
+class DMABufRawVideoFrame
+{
+
+public:
+
+    DMABufRawVideoFrame(unsigned int width, unsigned int height):
+        mSize(0),
+        mFd(-1),
+        mNumOfPlanes(0),
+        mOffsets{0, 0, 0},
+        mStrides{0, 0, 0}
+    {
+    }
+
+    int fd() const
+    {
+        return mFd;
+    }
+
+    unsigned int numOfPlanes() const
+    {
+        return mNumOfPlanes;
+    }
+
+    template <unsigned int planeNum>
+    unsigned int offset() const
+    {
+        static_assert(planeNum <= 2, "Can't get offset for plane with index > 2");
+        return mOffsets[planeNum];
+    }
+
+    template <unsigned int planeNum>
+    unsigned int stride() const
+    {
+        static_assert(planeNum <= 2, "Can't get stride for plane with index > 2");
+        return mStrides[planeNum];
+    }
+
+    // CPU mapping of the dma-buf (slow on most devices: use it only when unavoidable)
+    const unsigned char* data() const
+    {
+        return mData.get();
+    }
+
+    unsigned int size() const
+    {
+        return mSize;
+    }
+
+    // The shared ptr's deleter gives back the dma-buf to its producer, so
+    // the fd is valid as long as the frame is referenced.
+    void assignDataSharedPtr(ShareableVideoFrameData& shareableVideoFrameData)
+    {
+        mData = shareableVideoFrameData;
+    }
+
+    const ShareableVideoFrameData& dataSharedPtr() const
+    {
+        return mData.sharedPtr();
+    }
+
     void setSize(unsigned int size)
     {
         mSize = size;
     }
 
+    void setFd(int fd)
+    {
+        mFd = fd;
+    }
+
+    void setNumOfPlanes(unsigned int numOfPlanes)
+    {
+        mNumOfPlanes = numOfPlanes;
+    }
+
+    template <unsigned int planeNum>
+    void setPlaneLayout(unsigned int offset, unsigned int stride)
+    {
+        static_assert(planeNum <= 2, "Can't assign layout for plane with index > 2");
+        mOffsets[planeNum] = offset;
+        mStrides[planeNum] = stride;
+    }
+
 private:
 
-    ShareableVideoFrameData mData;
+    FrameDataRef mData;
     unsigned int mSize;
+    int mFd;
+    unsigned int mNumOfPlanes;
+    unsigned int mOffsets[3];
+    unsigned int mStrides[3];
 
 };
 
@@ -491,15 +697,10 @@ class Planar2RawAudioFrame
 {
 public:
 
-    Planar2RawAudioFrame()
+    // The planes are empty until the producer assigns them its data
+    Planar2RawAudioFrame() :
+        mSizes{0, 0}
     {
-        // DUMMY 0-data that will be replaced by the producer's data.
-        mPlanes.push_back(ShareableAudioFrameData(new unsigned char));
-        mPlanes.push_back(ShareableAudioFrameData(new unsigned char));
-        mPlanes.push_back(ShareableAudioFrameData(new unsigned char));
-        mSizes.push_back(0);
-        mSizes.push_back(0);
-        mSizes.push_back(0);
     }
 
     template <unsigned int planeNum>
@@ -544,8 +745,8 @@ public:
 
 private:
 
-    std::vector<unsigned int> mSizes;
-    std::vector<ShareableAudioFrameData> mPlanes;
+    unsigned int mSizes[2];
+    FrameDataRef mPlanes[2];
 
 };
 
@@ -554,7 +755,6 @@ class PackedRawAudioFrame
 public:
 
     PackedRawAudioFrame():
-        mData(new unsigned char()),
         mSize(0)
     {
     }
@@ -579,6 +779,11 @@ public:
         mData = shareableAudioFrameData;
     }
 
+    const ShareableAudioFrameData& dataSharedPtr() const
+    {
+        return mData.sharedPtr();
+    }
+
     void setSize(unsigned int size)
     {
         mSize = size;
@@ -586,7 +791,7 @@ public:
 
 private:
 
-    ShareableAudioFrameData mData;
+    FrameDataRef mData;
     unsigned int mSize;
 
 };
@@ -0,0 +1,238 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef FRAMERING_HPP_INCLUDED
+#define FRAMERING_HPP_INCLUDED
+
+#include <atomic>
+#include "Frame.hpp"
+#include "PipeWorker.hpp"
+#include "EventsShard.hpp"
+#include "StageMetrics.hpp"
+
+namespace laav
+{
+
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameHolder;
+
+template <typename CodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class AudioFrameHolder;
+
+/*
+ * Bounded lock-free ring, with one producer thread and one consumer thread.
+ * The frames are copied as handles (their data is shared, not copied), so the producer
+ * must not reuse a frame's data while the consumer can still access it. I.E:
+ * - V4L2Grabber must work in zero-copy mode for raw formats.
+ * The encoded frames reference their own data (see setEncodedFrameBufferSize()), so their
+ * ring can be deeper than the encoders' ones.
+ */
+template <typename T>
+class SPSCRing
+{
+
+public:
+
+    // stage: see StageMetrics
+    SPSCRing(unsigned int capacity, const std::string& stage = "ring") :
+        // One slot is always empty, in order to tell a full ring from an empty one
+        mSlots(capacity + 1),
+        mEmptyItem(),
+        mHead(0),
+        mTail(0),
+        mDroppedItems(0),
+        mConsumerWorker(NULL),
+        mConsumerShard(NULL),
+        mMetrics(stage)
+    {
+    }
+
+    // Producer side: returns false (and the item is dropped) if the ring is full
+    bool push(const T& item)
+    {
+        unsigned int tail = mTail.load(std::memory_order_relaxed);
+        unsigned int nextTail = (tail + 1) % mSlots.size();
+        unsigned int head = mHead.load(std::memory_order_acquire);
+        mMetrics.countFrameIn();
+        if (nextTail == head)
+        {
+            mDroppedItems.fetch_add(1, std::memory_order_relaxed);
+            mMetrics.countDroppedFrames(1);
+            return false;
+        }
+        mSlots[tail] = item;
+        mTail.store(nextTail, std::memory_order_release);
+        mMetrics.setQueueDepth((nextTail + mSlots.size() - head) % mSlots.size());
+        wakeUpConsumerWorker();
+        return true;
+    }
+
+    // Consumer side: returns false if the ring is empty
+    bool pop(T& item)
+    {
+        unsigned int head = mHead.load(std::memory_order_relaxed);
+        unsigned int tail = mTail.load(std::memory_order_acquire);
+        if (head == tail)
+            return false;
+        item = mSlots[head];
+        // Release the data's reference held by the slot
+        mSlots[head] = mEmptyItem;
+        unsigned int nextHead = (head + 1) % mSlots.size();
+        mHead.store(nextHead, std::memory_order_release);
+        mMetrics.countFrameOut(item.size());
+        mMetrics.setQueueDepth((tail + mSlots.size() - nextHead) % mSlots.size());
+        return true;
+    }
+
+    unsigned int capacity() const
+    {
+        return mSlots.size() - 1;
+    }
+
+    unsigned long droppedItems() const
+    {
+        return mDroppedItems.load(std::memory_order_relaxed);
+    }
+
+    // The latencies are the ones of the popped frames (their capture -> their pop)
+    StageMetrics& metrics()
+    {
+        return mMetrics;
+    }
+
+    // The worker is woken up every time a new item is pushed
+    void wakeUpOnPush(PipeWorker& consumerWorker)
+    {
+        mConsumerWorker = &consumerWorker;
+    }
+
+    // The shard's loop is woken up every time a new item is pushed (I.E: frames handed
+    // from the capture shard to the streaming shard)
+    void wakeUpOnPush(EventsShard& consumerShard)
+    {
+        mConsumerShard = &consumerShard;
+    }
+
+private:
+
+    void wakeUpConsumerWorker()
+    {
+        if (mConsumerWorker)
+            mConsumerWorker->wakeUp();
+        if (mConsumerShard)
+            mConsumerShard->wakeUp();
+    }
+
+    std::vector<T> mSlots;
+    const T mEmptyItem;
+    std::atomic<unsigned int> mHead;
+    std::atomic<unsigned int> mTail;
+    std::atomic<unsigned long> mDroppedItems;
+    PipeWorker* mConsumerWorker;
+    EventsShard* mConsumerShard;
+
+protected:
+
+    // Both threads update it
+    StageMetrics mMetrics;
+
+};
+
+/*
+ * Thread boundary between two pipe segments. I.E:
+ *
+ *   (events thread)   vGrab >> vFh1 >> vRing;
+ *   (worker thread)   vRing >> vFh2 >> vConv >> vEnc >> vFh3 >> vEncodedRing;
+ *   (events thread)   vEncodedRing >> vFh4 >> vStream;
+ */
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameRing : public SPSCRing<VideoFrame<CodecOrFormat, width, height> >
+{
+
+public:
+
+    VideoFrameRing(unsigned int capacity = 8) :
+        SPSCRing<VideoFrame<CodecOrFormat, width, height> >(capacity, "video_frame_ring")
+    {
+    }
+
+    VideoFrameHolder<CodecOrFormat, width, height>&
+    operator >>
+    (VideoFrameHolder<CodecOrFormat, width, height>& videoFrameHolder)
+    {
+        VideoFrame<CodecOrFormat, width, height>* poppedVideoFrame = pollNextFrame();
+        if (poppedVideoFrame)
+        {
+            videoFrameHolder.hold(*poppedVideoFrame);
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        else
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+        return videoFrameHolder;
+    }
+
+    // The popped frame (valid until the next pop), or NULL if the ring is empty (see Pipeline.hpp)
+    VideoFrame<CodecOrFormat, width, height>* pollNextFrame()
+    {
+        if (!this->pop(mPoppedVideoFrame))
+            return NULL;
+        if (mPoppedVideoFrame.monotonicTimestamp() != AV_NOPTS_VALUE)
+            this->mMetrics.recordLatency(av_gettime_relative() - mPoppedVideoFrame.monotonicTimestamp());
+        return &mPoppedVideoFrame;
+    }
+
+private:
+
+    VideoFrame<CodecOrFormat, width, height> mPoppedVideoFrame;
+
+};
+
+template <typename CodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class AudioFrameRing : public SPSCRing<AudioFrame<CodecOrFormat, audioSampleRate, audioChannels> >
+{
+
+public:
+
+    AudioFrameRing(unsigned int capacity = 8) :
+        SPSCRing<AudioFrame<CodecOrFormat, audioSampleRate, audioChannels> >(capacity,
+                                                                             "audio_frame_ring")
+    {
+    }
+
+    AudioFrameHolder<CodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioFrameHolder<CodecOrFormat, audioSampleRate, audioChannels>& audioFrameHolder)
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* poppedAudioFrame = pollNextPeriod();
+        if (poppedAudioFrame)
+        {
+            audioFrameHolder.hold(*poppedAudioFrame);
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        else
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+        return audioFrameHolder;
+    }
+
+    // The popped frame (valid until the next pop), or NULL if the ring is empty (see Pipeline.hpp)
+    AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* pollNextPeriod()
+    {
+        if (!this->pop(mPoppedAudioFrame))
+            return NULL;
+        if (mPoppedAudioFrame.monotonicTimestamp() != AV_NOPTS_VALUE)
+            this->mMetrics.recordLatency(av_gettime_relative() - mPoppedAudioFrame.monotonicTimestamp());
+        return &mPoppedAudioFrame;
+    }
+
+private:
+
+    AudioFrame<CodecOrFormat, audioSampleRate, audioChannels> mPoppedAudioFrame;
+
+};
+
+}
+
+#endif // FRAMERING_HPP_INCLUDED
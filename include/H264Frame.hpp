@@ -7,6 +7,8 @@
 #ifndef H264FRAME_HPP_INCLUDED
 #define H264FRAME_HPP_INCLUDED
 
+#include <vector>
+
 namespace laav
 {
 
@@ -27,6 +29,204 @@ public:
 
 };
 
+/*
+ * Rewrites the H264 packets of a demuxed input in the format of the encoders' packets, which
+ * is the one the muxers expect: Annex B (start codes), with the SPS and PPS in band before
+ * each keyframe. The input's configuration is its codec's extradata: an avcC record
+ * (ISO 14496-15, I.E: MP4 and MATROSKA files, whose NAL units are prefixed by their length)
+ * or Annex B parameter sets (I.E: the sprop-parameter-sets of a RTSP session).
+ */
+class H264AnnexBWriter
+{
+
+public:
+
+    H264AnnexBWriter() :
+        mNALLengthSize(0)
+    {
+    }
+
+    // Returns false if the configuration is neither an avcC record nor Annex B
+    bool configure(const unsigned char* extradata, unsigned int size)
+    {
+        mNALLengthSize = 0;
+        mParameterSets.clear();
+        // No extradata: the parameter sets are in band
+        if (!extradata || size == 0)
+            return true;
+        if (startsWithStartCode(extradata, size))
+        {
+            mParameterSets.assign(extradata, extradata + size);
+            return true;
+        }
+
+        // version, profile, compatibility, level, lengthSizeMinusOne, numOfSequenceParameterSets
+        if (extradata[0] != 1 || size < 7)
+            return false;
+        unsigned int offset = 5;
+        unsigned int numOfSets = extradata[offset++] & 0x1F;
+        unsigned int setsType;
+        for (setsType = 0; setsType < 2; setsType++)
+        {
+            // numOfPictureParameterSets, after the SPSs
+            if (setsType == 1)
+            {
+                if (offset >= size)
+                    return false;
+                numOfSets = extradata[offset++];
+            }
+            unsigned int n;
+            for (n = 0; n < numOfSets; n++)
+            {
+                if (offset + 2 > size)
+                    return false;
+                unsigned int setSize = (extradata[offset] << 8) | extradata[offset + 1];
+                offset += 2;
+                if (offset + setSize > size)
+                    return false;
+                appendNALUnit(extradata + offset, setSize, mParameterSets);
+                offset += setSize;
+            }
+        }
+        mNALLengthSize = (extradata[4] & 0x03) + 1;
+        return true;
+    }
+
+    /*
+     * For the Annex B streams which carry the parameter sets in band (I.E: the ones of the
+     * UVC cameras): the last ones are kept, so that they can be written before the
+     * keyframes which come without them
+     */
+    void updateParameterSets(const unsigned char* data, unsigned int size)
+    {
+        if (mNALLengthSize != 0 || !hasNALUnit(data, size, nalUnitTypeSPS))
+            return;
+        mParameterSets.clear();
+        unsigned int offset = 0;
+        const unsigned char* nALUnit;
+        unsigned int nALUnitSize;
+        while (offset < size && nextNALUnit(data, size, offset, nALUnit, nALUnitSize))
+            if ((nALUnit[0] & 0x1F) == nalUnitTypeSPS || (nALUnit[0] & 0x1F) == nalUnitTypePPS)
+                appendNALUnit(nALUnit, nALUnitSize, mParameterSets);
+    }
+
+    // Whether the packet contains an IDR picture
+    bool isKeyFrame(const unsigned char* data, unsigned int size) const
+    {
+        return hasNALUnit(data, size, nalUnitTypeIDR);
+    }
+
+    // Whether the packet is already in the encoders' format (I.E: most of the RTSP ones)
+    bool isPassthrough(const unsigned char* data, unsigned int size, bool keyFrame) const
+    {
+        return mNALLengthSize == 0 &&
+               (!keyFrame || mParameterSets.empty() || hasNALUnit(data, size, nalUnitTypeSPS));
+    }
+
+    // Returns false if the packet is malformed
+    bool write(const unsigned char* data, unsigned int size, bool keyFrame,
+               std::vector<unsigned char>& annexBPacket) const
+    {
+        annexBPacket.clear();
+        if (keyFrame && !hasNALUnit(data, size, nalUnitTypeSPS))
+            annexBPacket.insert(annexBPacket.end(), mParameterSets.begin(), mParameterSets.end());
+        if (mNALLengthSize == 0)
+        {
+            annexBPacket.insert(annexBPacket.end(), data, data + size);
+            return true;
+        }
+        unsigned int offset = 0;
+        const unsigned char* nALUnit;
+        unsigned int nALUnitSize;
+        while (offset < size)
+        {
+            if (!nextNALUnit(data, size, offset, nALUnit, nALUnitSize))
+                return false;
+            appendNALUnit(nALUnit, nALUnitSize, annexBPacket);
+        }
+        return true;
+    }
+
+private:
+
+    static const unsigned char nalUnitTypeIDR = 5;
+    static const unsigned char nalUnitTypeSPS = 7;
+    static const unsigned char nalUnitTypePPS = 8;
+
+    static bool startsWithStartCode(const unsigned char* data, unsigned int size)
+    {
+        return (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+               (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+    }
+
+    static void appendNALUnit(const unsigned char* nALUnit, unsigned int size,
+                              std::vector<unsigned char>& annexBData)
+    {
+        static const unsigned char startCode[4] = {0, 0, 0, 1};
+        annexBData.insert(annexBData.end(), startCode, startCode + 4);
+        annexBData.insert(annexBData.end(), nALUnit, nALUnit + size);
+    }
+
+    // Returns false at the end of the data (or if it is malformed)
+    bool nextNALUnit(const unsigned char* data, unsigned int size, unsigned int& offset,
+                     const unsigned char*& nALUnit, unsigned int& nALUnitSize) const
+    {
+        if (mNALLengthSize != 0)
+        {
+            if (offset + mNALLengthSize > size)
+                return false;
+            unsigned int n;
+            nALUnitSize = 0;
+            for (n = 0; n < mNALLengthSize; n++)
+                nALUnitSize = (nALUnitSize << 8) | data[offset++];
+            if (nALUnitSize == 0 || nALUnitSize > size - offset)
+                return false;
+            nALUnit = data + offset;
+            offset += nALUnitSize;
+            return true;
+        }
+
+        // After the next start code, up to the following one (without its leading zero, if any)
+        while (offset + 3 <= size &&
+               !(data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1))
+            offset++;
+        if (offset + 3 > size)
+            return false;
+        unsigned int start = offset + 3;
+        offset = start;
+        while (offset + 3 <= size &&
+               !(data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1))
+            offset++;
+        if (offset + 3 > size)
+            offset = size;
+        unsigned int end = offset;
+        if (end < size && end > start && data[end - 1] == 0)
+            end--;
+        if (end <= start)
+            return nextNALUnit(data, size, offset, nALUnit, nALUnitSize);
+        nALUnit = data + start;
+        nALUnitSize = end - start;
+        return true;
+    }
+
+    bool hasNALUnit(const unsigned char* data, unsigned int size, unsigned char nALUnitType) const
+    {
+        unsigned int offset = 0;
+        const unsigned char* nALUnit;
+        unsigned int nALUnitSize;
+        while (offset < size && nextNALUnit(data, size, offset, nALUnit, nALUnitSize))
+            if ((nALUnit[0] & 0x1F) == nALUnitType)
+                return true;
+        return false;
+    }
+
+    // 0: Annex B input
+    unsigned int mNALLengthSize;
+    // Annex B
+    std::vector<unsigned char> mParameterSets;
+
+};
+
 }
 
 #endif // H264FRAME_HPP_INCLUDED
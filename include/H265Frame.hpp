@@ -0,0 +1,33 @@
+/* 
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef H265FRAME_HPP_INCLUDED
+#define H265FRAME_HPP_INCLUDED
+
+namespace laav
+{
+
+// HEVC: the packets are Annex B, with the VPS, SPS and PPS in band before each keyframe
+class H265 {};
+
+template <unsigned int width_, unsigned int height_>
+class VideoFrame<H265, width_, height_> :
+public VideoFrameBase<width_, height_>,
+public EncodedVideoFrame
+{
+
+public:
+
+    VideoFrame<H265, width_, height_>():
+        EncodedVideoFrame(width_, height_)
+    {
+    }
+
+};
+
+}
+
+#endif // H265FRAME_HPP_INCLUDED
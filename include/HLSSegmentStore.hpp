@@ -0,0 +1,196 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef HLSSEGMENTSTORE_HPP_INCLUDED
+#define HLSSEGMENTSTORE_HPP_INCLUDED
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Common.hpp"
+#include "FMP4InitSegmentSplitter.hpp"
+#include "MuxedDataSink.hpp"
+
+namespace laav
+{
+
+typedef std::shared_ptr<const std::vector<uint8_t> > SharedHLSSegment;
+
+/*
+ * In-memory store of the last segments of a live stream, fed by a muxer in contiguous
+ * output mode (see FFMPEGMuxerCommonImpl::setMuxedDataSink()). A segment is closed on the
+ * first keyframe after targetDurationMs; once closed it never changes, so that it can be
+ * served to any number of clients (and cached by a CDN) without copies.
+ * For FMP4 streams, the data preceding the first fragment (ftyp + moov) is kept as the
+ * init segment (#EXT-X-MAP), and the segments contain moof + mdat only.
+ */
+class HLSSegmentStore : public MuxedDataSink
+{
+
+public:
+
+    HLSSegmentStore(bool fragmentedMP4, unsigned int targetDurationMs = 2000,
+                    unsigned int playlistSize = 6) :
+        mFragmentedMP4(fragmentedMP4),
+        mTargetDurationMs(targetDurationMs),
+        mPlaylistSize(playlistSize),
+        mNextSequenceNumber(0),
+        mInitSegmentComplete(!fragmentedMP4),
+        mSegmentStarted(false),
+        mSegmentStartTimestamp(0)
+    {
+        if (targetDurationMs == 0 || playlistSize == 0)
+            printAndThrowUnrecoverableError("targetDurationMs == 0 || playlistSize == 0");
+        mCurrentSegment.reset(new std::vector<uint8_t>());
+    }
+
+    bool cutsOnKeyFrames() const
+    {
+        return true;
+    }
+
+    void keyFrameBoundary(int64_t timestamp)
+    {
+        if (!mSegmentStarted)
+        {
+            // The data preceding the first keyframe isn't decodable
+            mCurrentSegment->clear();
+            mSegmentStarted = true;
+            mSegmentStartTimestamp = timestamp;
+            return;
+        }
+        if (timestamp - mSegmentStartTimestamp < (int64_t)mTargetDurationMs * 1000 ||
+            mCurrentSegment->empty())
+            return;
+
+        Segment segment;
+        segment.sequenceNumber = mNextSequenceNumber++;
+        segment.duration = (timestamp - mSegmentStartTimestamp) / 1000000.0;
+        segment.data = mCurrentSegment;
+        mSegments.push_back(segment);
+        // The segments which have just left the playlist are still requested by the
+        // clients which loaded a previous version of it
+        while (mSegments.size() > mPlaylistSize + RETAINED_SEGMENTS)
+            mSegments.pop_front();
+
+        mCurrentSegment.reset(new std::vector<uint8_t>());
+        mCurrentSegment->reserve(segment.data->size());
+        mSegmentStartTimestamp = timestamp;
+    }
+
+    bool writeMuxedData(const uint8_t* data, size_t size)
+    {
+        if (!mInitSegmentComplete)
+        {
+            takeInitSegmentData(data, size);
+            return true;
+        }
+        mCurrentSegment->insert(mCurrentSegment->end(), data, data + size);
+        return true;
+    }
+
+    // The first segment is available after 1 target duration (plus the GOP's remainder)
+    bool isReady() const
+    {
+        return mSegments.size() != 0 && mInitSegmentComplete;
+    }
+
+    // NULL if the segment has expired (or doesn't exist yet)
+    SharedHLSSegment segment(unsigned long sequenceNumber) const
+    {
+        unsigned int n;
+        for (n = 0; n < mSegments.size(); n++)
+        {
+            if (mSegments[n].sequenceNumber == sequenceNumber)
+                return mSegments[n].data;
+        }
+        return SharedHLSSegment();
+    }
+
+    SharedHLSSegment initSegment() const
+    {
+        return mInitSegment;
+    }
+
+    /*
+     * The media playlist of the last playlistSize segments. The segments' URIs are
+     * segmentsPrefix + sequence number + segmentsExtension, I.E: "segment_42.m4s".
+     */
+    std::string playlist(const std::string& segmentsPrefix, const std::string& segmentsExtension,
+                         const std::string& initSegmentURI) const
+    {
+        unsigned int first = 0;
+        if (mSegments.size() > mPlaylistSize)
+            first = mSegments.size() - mPlaylistSize;
+        double maxDuration = mTargetDurationMs / 1000.0;
+        unsigned int n;
+        for (n = first; n < mSegments.size(); n++)
+            maxDuration = std::max(maxDuration, mSegments[n].duration);
+
+        std::ostringstream playlist;
+        playlist << "#EXTM3U\n";
+        // EXT-X-MAP for non I-frame playlists requires version 6
+        playlist << "#EXT-X-VERSION:" << (mFragmentedMP4 ? 6 : 3) << "\n";
+        // The rounded durations must not exceed the target duration
+        playlist << "#EXT-X-TARGETDURATION:" << (unsigned int)(maxDuration + 0.999) << "\n";
+        playlist << "#EXT-X-MEDIA-SEQUENCE:"
+                 << (first < mSegments.size() ? mSegments[first].sequenceNumber : 0) << "\n";
+        playlist << "#EXT-X-INDEPENDENT-SEGMENTS\n";
+        if (mFragmentedMP4)
+            playlist << "#EXT-X-MAP:URI=\"" << initSegmentURI << "\"\n";
+        playlist.setf(std::ios::fixed);
+        playlist.precision(3);
+        for (n = first; n < mSegments.size(); n++)
+        {
+            playlist << "#EXTINF:" << mSegments[n].duration << ",\n";
+            playlist << segmentsPrefix << mSegments[n].sequenceNumber << segmentsExtension << "\n";
+        }
+        return playlist.str();
+    }
+
+private:
+
+    static const unsigned int RETAINED_SEGMENTS = 2;
+
+    struct Segment
+    {
+        unsigned long sequenceNumber;
+        double duration;
+        SharedHLSSegment data;
+    };
+
+    // The data from the first moof onward goes to the current segment
+    void takeInitSegmentData(const uint8_t* data, size_t size)
+    {
+        if (!mInitSegmentSplitter.take(data, size))
+            return;
+        const std::vector<uint8_t>& fragmentsData = mInitSegmentSplitter.fragmentsData();
+        mCurrentSegment->insert(mCurrentSegment->end(), fragmentsData.begin(), fragmentsData.end());
+        mInitSegment.reset(new std::vector<uint8_t>(mInitSegmentSplitter.initSegment()));
+        mInitSegmentSplitter.releaseFragmentsData();
+        mInitSegmentComplete = true;
+    }
+
+    bool mFragmentedMP4;
+    unsigned int mTargetDurationMs;
+    unsigned int mPlaylistSize;
+    unsigned long mNextSequenceNumber;
+    std::deque<Segment> mSegments;
+    FMP4InitSegmentSplitter mInitSegmentSplitter;
+    SharedHLSSegment mInitSegment;
+    bool mInitSegmentComplete;
+    std::shared_ptr<std::vector<uint8_t> > mCurrentSegment;
+    bool mSegmentStarted;
+    int64_t mSegmentStartTimestamp;
+
+};
+
+}
+
+#endif // HLSSEGMENTSTORE_HPP_INCLUDED
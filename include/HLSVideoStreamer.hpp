@@ -0,0 +1,204 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef HLSVIDEOSTREAMER_HPP_INCLUDED
+#define HLSVIDEOSTREAMER_HPP_INCLUDED
+
+#include <type_traits>
+#include "EventsManager.hpp"
+#include "FFMPEGVideoMuxer.hpp"
+#include "HLSSegmentStore.hpp"
+
+extern "C"
+{
+#include <stdlib.h>
+}
+
+namespace laav
+{
+
+/*
+ * Serves the stream as HLS: unlike HTTPVideoStreamer, which sends one long response to
+ * each client, the stream is cut into immutable segments (MPEGTS or FMP4) which the
+ * clients download with plain GET requests, so that they can be served by HTTP caches
+ * and CDNs. The addresses are:
+ *
+ *   http://address:port/stream.m3u8        (playlist)
+ *   http://address:port/init.mp4           (FMP4 only)
+ *   http://address:port/segment_<n>.ts     (segment_<n>.m4s for FMP4)
+ *
+ * The stream is muxed (and segmented) since the construction, whether there are
+ * clients or not.
+ */
+template <typename Container,
+          typename VideoCodecOrFormat,
+          unsigned int width,
+          unsigned int height>
+class HLSVideoStreamer : public EventsProducer
+{
+
+    static_assert(std::is_same<Container, MPEGTS>::value || std::is_same<Container, FMP4>::value,
+                  "HLS segments can be MPEGTS or FMP4");
+
+public:
+
+    HLSVideoStreamer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port,
+                     unsigned int segmentDurationMs = 2000, unsigned int playlistSize = 6) :
+        EventsProducer::EventsProducer(eventsCatcher),
+        mAddress(address),
+        mPort(port),
+        mStatus(MEDIA_NOT_READY),
+        mErrno(0),
+        mSegmentDurationMs(segmentDurationMs),
+        mSegmentStore(std::is_same<Container, FMP4>::value, segmentDurationMs, playlistSize),
+        mVideoMuxer(false)
+    {
+        mReplyBuffer = evbuffer_new();
+        if (!mReplyBuffer)
+            printAndThrowUnrecoverableError("mReplyBuffer = evbuffer_new()");
+        if (!makeHTTPServerPollable(mAddress, "", mPort))
+        {
+            mErrno = errno;
+            return;
+        }
+        observeHTTPEventsOn(mAddress, mPort);
+        mVideoMuxer.setMuxedDataSink(&mSegmentStore);
+        mVideoMuxer.startMuxing();
+        mStatus = MEDIA_READY;
+    }
+
+    ~HLSVideoStreamer()
+    {
+        dontObserveHTTPEventsOn(mAddress, mPort);
+        evbuffer_free(mReplyBuffer);
+    }
+
+    enum MediaStatus status() const
+    {
+        return mStatus;
+    }
+
+    int getErrno() const
+    {
+        return mErrno;
+    }
+
+    // I.E: to record the same stream
+    FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height>& muxer()
+    {
+        return mVideoMuxer;
+    }
+
+    const HLSSegmentStore& segmentStore() const
+    {
+        return mSegmentStore;
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void takeStreamableFrame(const VideoFrame<VideoCodecOrFormat,
+                             width, height>& videoFrameToStream)
+    {
+        if (mStatus == MEDIA_READY)
+            mVideoMuxer.takeMuxableFrame(videoFrameToStream);
+    }
+
+private:
+
+    void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
+                                struct evhttp_connection* clientConnection)
+    {
+        const char* path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(clientRequest));
+        std::string requestedPath = path ? path : "";
+        struct evkeyvalq* headers = evhttp_request_get_output_headers(clientRequest);
+        evhttp_add_header(headers, "Access-Control-Allow-Origin", "*");
+
+        if (requestedPath == "/stream.m3u8")
+        {
+            if (!mSegmentStore.isReady())
+            {
+                evhttp_add_header(headers, "Retry-After",
+                                  std::to_string((mSegmentDurationMs + 999) / 1000).c_str());
+                evhttp_send_error(clientRequest, 503, "Service Unavailable");
+                return;
+            }
+            std::string playlist = mSegmentStore.playlist("segment_", segmentsExtension(), "init.mp4");
+            evhttp_add_header(headers, "Content-Type", "application/vnd.apple.mpegurl");
+            // The playlist changes at every segment: the caches can keep it for half of it
+            std::string cacheControl = "max-age=" +
+                                       std::to_string(std::max(mSegmentDurationMs / 2000, 1u));
+            evhttp_add_header(headers, "Cache-Control", cacheControl.c_str());
+            evbuffer_add(mReplyBuffer, playlist.c_str(), playlist.size());
+            evhttp_send_reply(clientRequest, HTTP_OK, "OK", mReplyBuffer);
+            return;
+        }
+
+        SharedHLSSegment segment;
+        if (requestedPath == "/init.mp4" && std::is_same<Container, FMP4>::value)
+            segment = mSegmentStore.initSegment();
+        else if (requestedPath.compare(0, 9, "/segment_") == 0 &&
+                 requestedPath.size() > 9 + segmentsExtension().size() &&
+                 requestedPath.compare(requestedPath.size() - segmentsExtension().size(),
+                                       std::string::npos, segmentsExtension()) == 0)
+        {
+            char* end;
+            unsigned long sequenceNumber = strtoul(requestedPath.c_str() + 9, &end, 10);
+            if (std::string(end) == segmentsExtension())
+                segment = mSegmentStore.segment(sequenceNumber);
+        }
+
+        if (!segment || segment->empty())
+        {
+            evhttp_send_error(clientRequest, HTTP_NOTFOUND, "Not Found");
+            return;
+        }
+        evhttp_add_header(headers, "Content-Type", segmentsContentType());
+        // The segments never change: they can be cached for as long as the clients want
+        evhttp_add_header(headers, "Cache-Control", "public, max-age=31536000, immutable");
+        // The segment is sent without copying it, and kept alive until it's sent
+        SharedHLSSegment* sentSegment = new SharedHLSSegment(segment);
+        if (evbuffer_add_reference(mReplyBuffer, &(*segment)[0], segment->size(),
+                                   releaseSentSegment, sentSegment) != 0)
+        {
+            delete sentSegment;
+            printAndThrowUnrecoverableError("evbuffer_add_reference(...)");
+        }
+        evhttp_send_reply(clientRequest, HTTP_OK, "OK", mReplyBuffer);
+        // In case the connection was already closed
+        evbuffer_drain(mReplyBuffer, evbuffer_get_length(mReplyBuffer));
+    }
+
+    static void releaseSentSegment(const void* data, size_t dataLen, void* extra)
+    {
+        delete (SharedHLSSegment* )extra;
+    }
+
+    static std::string segmentsExtension()
+    {
+        return std::is_same<Container, FMP4>::value ? ".m4s" : ".ts";
+    }
+
+    static const char* segmentsContentType()
+    {
+        return std::is_same<Container, FMP4>::value ? "video/mp4" : "video/mp2t";
+    }
+
+    std::string mAddress;
+    unsigned int mPort;
+    enum MediaStatus mStatus;
+    int mErrno;
+    unsigned int mSegmentDurationMs;
+    struct evbuffer* mReplyBuffer;
+    // Declared before the muxer, which writes its trailer into the store when destroyed
+    HLSSegmentStore mSegmentStore;
+    FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height> mVideoMuxer;
+
+};
+
+}
+
+#endif // HLSVIDEOSTREAMER_HPP_INCLUDED
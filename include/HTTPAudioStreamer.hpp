@@ -23,6 +23,8 @@ public:
         HTTPStreamer<Container>(eventsCatcher, address, port),
         mAudioMuxer(false)
     {
+        // The muxer writes straight into the clients' data
+        mAudioMuxer.setMuxedDataSink(this);
     }
 
     /*!
@@ -35,73 +37,26 @@ public:
             mAudioMuxer.takeMuxableFrame(audioFrameToStream);
     }
 
-    // Todo extract common code and move it to
-    // base class (do the same for video and audiovideo streamers)
     void sendMuxedData()
     {
-        if (this->mClientConnectionsAndRequests.size() != 0 && this->mStatus == MEDIA_READY)
-        {
-            try
-            {
-                using Iter3 = std::map<struct evhttp_connection*, struct evhttp_request* >::iterator;
-                for (Iter3 it = this->mClientConnectionsAndRequests.begin();
-                     it != this->mClientConnectionsAndRequests.end(); ++it)
-                {
-
-                    const std::vector<MuxedAudioData<Container, AudioCodecOrFormat,
-                                      audioSampleRate, audioChannels> >& chunksToStream =
-                    mAudioMuxer.muxedAudioChunks();
-
-                    unsigned int n;
-                    struct evbuffer* buf = evbuffer_new();
-                    if (this->mWrittenHeaderFlagAndRequests[it->second] == false)
-                    {
-                        evbuffer_add(buf, mAudioMuxer.header().c_str(), mAudioMuxer.header().size());
-                        this->mWrittenHeaderFlagAndRequests[it->second] = true;
-                    }
-                    for (n = 0; n < mAudioMuxer.muxedAudioChunksOffset(); n++)
-                    {
-                        if (buf == NULL)
-                            printAndThrowUnrecoverableError("buf == NULL");
-                        evbuffer_add(buf, chunksToStream[n].data(), chunksToStream[n].size());
-
-                    }
-                    evhttp_send_reply_chunk(it->second, buf);
-                    evbuffer_free(buf);
-                }
-            }
-            catch (const MediaException& mediaException)
-            {
-                // DO next step
-            }
-        }
+        this->streamPendingChunksGroup(mAudioMuxer.header(), mAudioMuxer.groupOfChunksHasKeyFrame());
     }
 
 private:
 
     void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
     {
-        this->mWrittenHeaderFlagAndRequests.erase(this->mClientConnectionsAndRequests[clientConnection]);
-        evhttp_request_free(this->mClientConnectionsAndRequests[clientConnection]);
-        this->mClientConnectionsAndRequests.erase(clientConnection);
-        if (this->mClientConnectionsAndRequests.size() == 0)
-        {
+        if (this->unregisterClient(clientConnection))
             mAudioMuxer.stopMuxing();
-        }
     }
 
     void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
                                 struct evhttp_connection* clientConnection)
     {
-        this->mClientConnectionsAndRequests[clientConnection] = clientRequest;
-
-        if (mAudioMuxer.isMuxing())
-            this->mWrittenHeaderFlagAndRequests[clientRequest] = false;
-        else
-            this->mWrittenHeaderFlagAndRequests[clientRequest] = true;
-
-        evhttp_send_reply_start(clientRequest, HTTP_OK, "OK");
-        mAudioMuxer.startMuxing();
+        // If the muxer is already muxing, the header has to be sent to the new client
+        if (this->registerClient(clientRequest, clientConnection,
+                                 mAudioMuxer.header(), !mAudioMuxer.isMuxing()))
+            mAudioMuxer.startMuxing();
     }
 
     FFMPEGAudioMuxer<Container, AudioCodecOrFormat, audioSampleRate, audioChannels> mAudioMuxer;
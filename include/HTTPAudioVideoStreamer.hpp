@@ -22,59 +22,78 @@ public:
 
     HTTPAudioVideoStreamer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port) :
         HTTPStreamer<Container>(eventsCatcher, address, port),
-        mAudioVideoMuxer(false)
+        mOwnedAudioVideoMuxer(new FFMPEGAudioVideoMuxer<Container,
+                                                        VideoCodecOrFormat, width, height,
+                                                        AudioCodecOrFormat, audioSampleRate,
+                                                        audioChannels>(false)),
+        mAudioVideoMuxer(*mOwnedAudioVideoMuxer),
+        mLastStreamedGroupOfChunksId(0)
     {
+        // Nobody else consumes the muxed chunks: the muxer writes straight into the clients' data
+        mOwnedAudioVideoMuxer->setMuxedDataSink(this);
+    }
+
+    /*
+     * Streams the chunks of an external muxer, which can be shared with other
+     * consumers (I.E: recording to file) without muxing the same frames twice.
+     * The muxer is fed by its own pipes (I.E: vFh >> avMux >> avStream) and must
+     * outlive the streamer.
+     */
+    HTTPAudioVideoStreamer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port,
+                           FFMPEGAudioVideoMuxer<Container,
+                                                 VideoCodecOrFormat, width, height,
+                                                 AudioCodecOrFormat, audioSampleRate,
+                                                 audioChannels>& audioVideoMuxer) :
+        HTTPStreamer<Container>(eventsCatcher, address, port),
+        mAudioVideoMuxer(audioVideoMuxer),
+        mLastStreamedGroupOfChunksId(0)
+    {
+    }
+
+    ~HTTPAudioVideoStreamer()
+    {
+        if (this->mClientConnectionsAndRequests.size() != 0)
+            mAudioVideoMuxer.stopMuxingForStreamer();
     }
 
     void takeStreamableFrame(const VideoFrame<VideoCodecOrFormat, width, height>& videoFrameToStream)
     {
-        if (this->mStatus == MEDIA_READY)
+        // An external muxer is fed by its own pipes
+        if (this->mStatus == MEDIA_READY && mOwnedAudioVideoMuxer)
             mAudioVideoMuxer.takeMuxableFrame(videoFrameToStream);
     }
 
     void takeStreamableFrame(const AudioFrame<AudioCodecOrFormat, audioSampleRate,
                                               audioChannels>& audioFrameToStream)
     {
-        mAudioVideoMuxer.takeMuxableFrame(audioFrameToStream);
+        if (mOwnedAudioVideoMuxer)
+            mAudioVideoMuxer.takeMuxableFrame(audioFrameToStream);
     }
 
     void streamMuxedData()
     {
-        if (this->mClientConnectionsAndRequests.size() != 0 && this->mStatus == MEDIA_READY)
+        if (mOwnedAudioVideoMuxer)
+        {
+            this->streamPendingChunksGroup(mAudioVideoMuxer.header(),
+                                           mAudioVideoMuxer.groupOfChunksHasKeyFrame());
+            return;
+        }
+
+        if (this->mClientConnectionsAndRequests.size() != 0 && this->mStatus == MEDIA_READY &&
+            mAudioVideoMuxer.groupOfChunksId() != mLastStreamedGroupOfChunksId)
         {
+            mLastStreamedGroupOfChunksId = mAudioVideoMuxer.groupOfChunksId();
             try
             {
-                using Iter3 = std::map<struct evhttp_connection*, struct evhttp_request* >::iterator;
-                for (Iter3 it = this->mClientConnectionsAndRequests.begin();
-                     it != this->mClientConnectionsAndRequests.end(); ++it)
-                {
-
-                    const std::vector<MuxedAudioVideoData<Container, VideoCodecOrFormat,
-                                                          width, height,
-                                                          AudioCodecOrFormat, audioSampleRate,
-                                                          audioChannels> >&
-                    chunksToStream = mAudioVideoMuxer.muxedAudioVideoChunks();
-
-                    unsigned int n;
-                    struct evbuffer* buf = evbuffer_new();
-                    if (this->mWrittenHeaderFlagAndRequests[it->second] == false)
-                    {
-                        evbuffer_add(buf, mAudioVideoMuxer.header().c_str(),
-                                     mAudioVideoMuxer.header().size());
-
-                        this->mWrittenHeaderFlagAndRequests[it->second] = true;
-                    }
-                    for (n = 0; n < mAudioVideoMuxer.muxedAudioVideoChunksOffset(); n++)
-                    {
-
-                        if (buf == NULL)
-                            printAndThrowUnrecoverableError("buf == NULL");
-                        evbuffer_add(buf, chunksToStream[n].data(), chunksToStream[n].size());
-
-                    }
-                    evhttp_send_reply_chunk(it->second, buf);
-                    evbuffer_free(buf);
-                }
+                const std::vector<MuxedAudioVideoData<Container, VideoCodecOrFormat,
+                                                      width, height,
+                                                      AudioCodecOrFormat, audioSampleRate,
+                                                      audioChannels> >&
+                chunksToStream = mAudioVideoMuxer.muxedAudioVideoChunks();
+
+                this->streamToAllClients(mAudioVideoMuxer.header(), chunksToStream,
+                                         mAudioVideoMuxer.muxedAudioVideoChunksOffset(),
+                                         mAudioVideoMuxer.groupOfChunksHasKeyFrame());
             }
             catch (const MediaException& mediaException)
             {
@@ -87,30 +106,27 @@ private:
 
     void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
     {
-        this->mWrittenHeaderFlagAndRequests.erase(this->mClientConnectionsAndRequests[clientConnection]);
-        evhttp_request_free(this->mClientConnectionsAndRequests[clientConnection]);
-        this->mClientConnectionsAndRequests.erase(clientConnection);
-        if (this->mClientConnectionsAndRequests.size() == 0)
-        {
-            mAudioVideoMuxer.stopMuxing();
-        }
+        if (this->unregisterClient(clientConnection))
+            mAudioVideoMuxer.stopMuxingForStreamer();
     }
 
     void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
                                 struct evhttp_connection* clientConnection)
     {
-        this->mClientConnectionsAndRequests[clientConnection] = clientRequest;
-        if (mAudioVideoMuxer.isMuxing())
-            this->mWrittenHeaderFlagAndRequests[clientRequest] = false;
-        else
-            this->mWrittenHeaderFlagAndRequests[clientRequest] = true;
-        evhttp_send_reply_start(clientRequest, HTTP_OK, "OK");
-        mAudioVideoMuxer.startMuxing();
+        // If the muxer is already muxing, the header has to be sent to the new client
+        if (this->registerClient(clientRequest, clientConnection,
+                                 mAudioVideoMuxer.header(), !mAudioVideoMuxer.isMuxing()))
+            mAudioVideoMuxer.startMuxingForStreamer();
     }
 
+    std::unique_ptr<FFMPEGAudioVideoMuxer<Container,
+                                          VideoCodecOrFormat, width, height,
+                                          AudioCodecOrFormat, audioSampleRate,
+                                          audioChannels> > mOwnedAudioVideoMuxer;
     FFMPEGAudioVideoMuxer<Container,
                           VideoCodecOrFormat, width, height,
-                          AudioCodecOrFormat, audioSampleRate, audioChannels> mAudioVideoMuxer;
+                          AudioCodecOrFormat, audioSampleRate, audioChannels>& mAudioVideoMuxer;
+    unsigned long mLastStreamedGroupOfChunksId;
 
 };
 
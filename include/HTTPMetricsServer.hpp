@@ -0,0 +1,93 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef HTTPMETRICSSERVER_HPP_INCLUDED
+#define HTTPMETRICSSERVER_HPP_INCLUDED
+
+#include <string>
+#include "Common.hpp"
+#include "EventsManager.hpp"
+#include "StageMetrics.hpp"
+
+extern "C"
+{
+#include <event2/http.h>
+}
+
+namespace laav
+{
+
+/*
+ * Serves the metrics of all the pipe stages (see StageMetrics), as Prometheus text, at:
+ *
+ *   http://address:port/metrics
+ *
+ * The stages can run on other threads (I.E: PipeWorker, EventsShard): their metrics are
+ * read without stopping them.
+ */
+class HTTPMetricsServer : public EventsProducer
+{
+
+public:
+
+    HTTPMetricsServer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port):
+        EventsProducer::EventsProducer(eventsCatcher),
+        mStatus(MEDIA_NOT_READY),
+        mErrno(0),
+        mAddress(address),
+        mPort(port)
+    {
+        std::string location = "/metrics";
+        if (!makeHTTPServerPollable(mAddress, location, mPort))
+        {
+            mErrno = errno;
+            return;
+        }
+
+        observeHTTPEventsOn(mAddress, mPort);
+        mStatus = MEDIA_READY;
+    }
+
+    enum MediaStatus status() const
+    {
+        return mStatus;
+    }
+
+    int getErrno() const
+    {
+        return mErrno;
+    }
+
+private:
+
+    void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
+    {
+    }
+
+    void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
+                                struct evhttp_connection* clientConnection)
+    {
+        std::string text = MetricsRegistry::instance().prometheusText();
+        struct evbuffer* buf = evbuffer_new();
+        if (buf == NULL)
+            printAndThrowUnrecoverableError("buf == NULL");
+        evbuffer_add(buf, text.c_str(), text.size());
+        evhttp_add_header(evhttp_request_get_output_headers(clientRequest),
+                          "Content-Type", "text/plain; version=0.0.4");
+        evhttp_send_reply(clientRequest, HTTP_OK, "OK", buf);
+        evbuffer_free(buf);
+    }
+
+    enum MediaStatus mStatus;
+    int mErrno;
+    std::string mAddress;
+    unsigned int mPort;
+
+};
+
+}
+
+#endif // HTTPMETRICSSERVER_HPP_INCLUDED
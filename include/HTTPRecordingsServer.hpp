@@ -0,0 +1,246 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef HTTPRECORDINGSSERVER_HPP_INCLUDED
+#define HTTPRECORDINGSSERVER_HPP_INCLUDED
+
+#include <string>
+#include "Common.hpp"
+#include "EventsManager.hpp"
+
+extern "C"
+{
+#include <stdlib.h>
+#include <sys/stat.h>
+}
+
+namespace laav
+{
+
+/*
+ * Serves the recorded files (and segments) of a directory, for playback, I.E:
+ *
+ *   http://address:port/cam1_00042.ts
+ *
+ * The files are sent with evbuffer_add_file(), so that the kernel copies them from the
+ * page cache to the sockets (sendfile) without passing through the process. Single range
+ * requests ("Range: bytes=...") are supported, so that the players can seek.
+ * It runs in the same events loop as the live streamers (on its own port): the files are
+ * opened by the loop's thread, so a slow storage delays the live streams too.
+ */
+class HTTPRecordingsServer : public EventsProducer
+{
+
+public:
+
+    HTTPRecordingsServer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port,
+                         const std::string& recordingsDirectory) :
+        EventsProducer::EventsProducer(eventsCatcher),
+        mStatus(MEDIA_NOT_READY),
+        mErrno(0),
+        mAddress(address),
+        mPort(port),
+        mRecordingsDirectory(recordingsDirectory)
+    {
+        mReplyBuffer = evbuffer_new();
+        if (!mReplyBuffer)
+            printAndThrowUnrecoverableError("mReplyBuffer = evbuffer_new()");
+        if (!makeHTTPServerPollable(mAddress, "", mPort))
+        {
+            mErrno = errno;
+            return;
+        }
+
+        observeHTTPEventsOn(mAddress, mPort);
+        mStatus = MEDIA_READY;
+    }
+
+    ~HTTPRecordingsServer()
+    {
+        dontObserveHTTPEventsOn(mAddress, mPort);
+        evbuffer_free(mReplyBuffer);
+    }
+
+    enum MediaStatus status() const
+    {
+        return mStatus;
+    }
+
+    int getErrno() const
+    {
+        return mErrno;
+    }
+
+private:
+
+    void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
+    {
+    }
+
+    void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
+                                struct evhttp_connection* clientConnection)
+    {
+        enum evhttp_cmd_type method = evhttp_request_get_command(clientRequest);
+        if (method != EVHTTP_REQ_GET && method != EVHTTP_REQ_HEAD)
+        {
+            evhttp_send_error(clientRequest, 405, "Method Not Allowed");
+            return;
+        }
+
+        const char* path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(clientRequest));
+        char* decodedPath = evhttp_uridecode(path ? path : "", 0, NULL);
+        if (!decodedPath)
+        {
+            evhttp_send_error(clientRequest, HTTP_BADREQUEST, "Bad Request");
+            return;
+        }
+        std::string requestedPath = decodedPath;
+        free(decodedPath);
+        // Only the files inside the directory can be served
+        if (requestedPath.size() < 2 || requestedPath[0] != '/' ||
+            requestedPath.find("/..") != std::string::npos ||
+            requestedPath.find('\0') != std::string::npos)
+        {
+            evhttp_send_error(clientRequest, HTTP_NOTFOUND, "Not Found");
+            return;
+        }
+
+        // open() and fstat() block the loop (and the live streamers) on slow storage (I.E: a
+        // network filesystem, a spun down disk): the recordings should be on a local disk
+        int fd = open((mRecordingsDirectory + requestedPath).c_str(), O_RDONLY);
+        struct stat fileStat;
+        if (fd == -1 || fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+        {
+            if (fd != -1)
+                close(fd);
+            evhttp_send_error(clientRequest, HTTP_NOTFOUND, "Not Found");
+            return;
+        }
+
+        struct evkeyvalq* headers = evhttp_request_get_output_headers(clientRequest);
+        off_t fileSize = fileStat.st_size;
+        off_t first = 0;
+        off_t last = fileSize - 1;
+        const char* range = evhttp_find_header(evhttp_request_get_input_headers(clientRequest),
+                                               "Range");
+        bool partial = false;
+        if (range)
+        {
+            int ret = parseRange(range, fileSize, first, last);
+            if (ret < 0)
+            {
+                close(fd);
+                std::string contentRange = "bytes */" + std::to_string((long long)fileSize);
+                evhttp_add_header(headers, "Content-Range", contentRange.c_str());
+                evhttp_send_error(clientRequest, 416, "Range Not Satisfiable");
+                return;
+            }
+            partial = (ret == 1);
+        }
+
+        evhttp_add_header(headers, "Content-Type", contentType(requestedPath));
+        evhttp_add_header(headers, "Accept-Ranges", "bytes");
+        if (partial)
+        {
+            std::string contentRange = "bytes " + std::to_string((long long)first) + "-" +
+                                       std::to_string((long long)last) + "/" +
+                                       std::to_string((long long)fileSize);
+            evhttp_add_header(headers, "Content-Range", contentRange.c_str());
+        }
+
+        if (fileSize == 0)
+            close(fd);
+        // The fd is closed by libevent when the data has been sent
+        else if (evbuffer_add_file(mReplyBuffer, fd, first, last - first + 1) != 0)
+        {
+            // libevent takes the fd only if it succeeds
+            close(fd);
+            evhttp_send_error(clientRequest, HTTP_INTERNAL, "Internal Server Error");
+            return;
+        }
+        if (partial)
+            evhttp_send_reply(clientRequest, 206, "Partial Content", mReplyBuffer);
+        else
+            evhttp_send_reply(clientRequest, HTTP_OK, "OK", mReplyBuffer);
+        // In case the connection was already closed
+        evbuffer_drain(mReplyBuffer, evbuffer_get_length(mReplyBuffer));
+    }
+
+    /*
+     * Parses "bytes=first-last", "bytes=first-" and "bytes=-suffixLength".
+     * Returns 1 for a satisfiable range, 0 if the header must be ignored (I.E: multiple
+     * ranges: the whole file is sent), -1 if the range can't be satisfied.
+     */
+    static int parseRange(const std::string& range, off_t fileSize, off_t& first, off_t& last)
+    {
+        if (range.compare(0, 6, "bytes=") != 0 || range.find(',') != std::string::npos)
+            return 0;
+        std::string::size_type dash = range.find('-', 6);
+        if (dash == std::string::npos)
+            return 0;
+        std::string firstString = range.substr(6, dash - 6);
+        std::string lastString = range.substr(dash + 1);
+        char* end;
+        if (firstString.empty())
+        {
+            // Suffix: the last bytes of the file
+            long long suffixLength = strtoll(lastString.c_str(), &end, 10);
+            if (lastString.empty() || *end != '\0' || suffixLength < 0)
+                return 0;
+            if (suffixLength == 0 || fileSize == 0)
+                return -1;
+            first = suffixLength >= fileSize ? 0 : fileSize - suffixLength;
+            last = fileSize - 1;
+            return 1;
+        }
+        long long firstByte = strtoll(firstString.c_str(), &end, 10);
+        if (*end != '\0' || firstByte < 0)
+            return 0;
+        long long lastByte = fileSize - 1;
+        if (!lastString.empty())
+        {
+            lastByte = strtoll(lastString.c_str(), &end, 10);
+            if (*end != '\0' || lastByte < firstByte)
+                return 0;
+            if (lastByte > fileSize - 1)
+                lastByte = fileSize - 1;
+        }
+        if (firstByte >= fileSize)
+            return -1;
+        first = firstByte;
+        last = lastByte;
+        return 1;
+    }
+
+    static const char* contentType(const std::string& path)
+    {
+        std::string::size_type dot = path.rfind('.');
+        std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+        if (extension == "ts")
+            return "video/mp2t";
+        if (extension == "mkv")
+            return "video/x-matroska";
+        if (extension == "mp4" || extension == "m4s")
+            return "video/mp4";
+        if (extension == "m3u8")
+            return "application/vnd.apple.mpegurl";
+        if (extension == "aac")
+            return "audio/aac";
+        return "application/octet-stream";
+    }
+
+    enum MediaStatus mStatus;
+    int mErrno;
+    std::string mAddress;
+    unsigned int mPort;
+    std::string mRecordingsDirectory;
+    struct evbuffer* mReplyBuffer;
+
+};
+
+}
+
+#endif // HTTPRECORDINGSSERVER_HPP_INCLUDED
@@ -0,0 +1,299 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef HTTPSNAPSHOTSERVER_HPP_INCLUDED
+#define HTTPSNAPSHOTSERVER_HPP_INCLUDED
+
+#include "FFMPEGVideoConverter.hpp"
+#include "EventsManager.hpp"
+
+namespace laav
+{
+
+/*
+ * Serves the latest frame piped into the server as a JPEG snapshot (I.E: the thumbnails
+ * polled by a VMS), at:
+ *
+ *   http://address:port/snapshot.jpg
+ *
+ * I.E:
+ *
+ *   HTTPSnapshotServer <YUV420_PLANAR, WIDTH, HEIGHT> vSnapshot(eventsCatcher, addr, 8083);
+ *   vGrab >> vConv >> vFh;
+ *                     vFh >> vEnc >> vStream;
+ *                     vFh >> vSnapshot;
+ *
+ * Taking a frame only keeps a reference to it: the raw frames are JPEG-encoded (scaled to
+ * snapshotWidth x snapshotHeight, if given) only when they are requested, and the snapshot
+ * is cached for cacheTTLMs, so the pollers share the encodings. The MJPEG frames (I.E: of a
+ * camera grabbing MJPEG) are served as they are, without encoding nor scaling.
+ * Note that holding the latest frame keeps its buffer: with a zeroCopy V4L2Grabber, that
+ * is one more of the driver's buffers held along the pipes.
+ */
+template <typename VideoFrameFormat, unsigned int width, unsigned int height>
+class HTTPSnapshotServer : public EventsProducer
+{
+
+    static_assert(!std::is_base_of<EncodedVideoFrame,
+                                   VideoFrame<VideoFrameFormat, width, height> >::value ||
+                  std::is_same<VideoFrameFormat, MJPEG>::value,
+                  "HTTPSnapshotServer supports the raw frames and the MJPEG ones");
+
+public:
+
+    /*
+     * snapshotWidth, snapshotHeight: 0 keeps the frames' size. quality: the JPEG
+     * quantizer, from 2 (best) to 31.
+     */
+    HTTPSnapshotServer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port,
+                       unsigned int cacheTTLMs = 1000, unsigned int snapshotWidth = 0,
+                       unsigned int snapshotHeight = 0, unsigned int quality = 5):
+        EventsProducer::EventsProducer(eventsCatcher),
+        mStatus(MEDIA_NOT_READY),
+        mErrno(0),
+        mAddress(address),
+        mPort(port),
+        mCacheTTLUs((int64_t)cacheTTLMs * 1000),
+        mSnapshotWidth(snapshotWidth == 0 ? width : snapshotWidth),
+        mSnapshotHeight(snapshotHeight == 0 ? height : snapshotHeight),
+        mQuality(quality),
+        mNumOfEncodings(0),
+        mSnapshotTime(AV_NOPTS_VALUE),
+        mEncoderCodecContext(NULL),
+        mSwscaleContext(NULL),
+        mSnapshotLibAVFrame(NULL)
+    {
+        std::string location = "/snapshot.jpg";
+        if (!makeHTTPServerPollable(mAddress, location, mPort))
+        {
+            mErrno = errno;
+            return;
+        }
+
+        observeHTTPEventsOn(mAddress, mPort);
+        mStatus = MEDIA_READY;
+    }
+
+    ~HTTPSnapshotServer()
+    {
+        sws_freeContext(mSwscaleContext);
+        av_frame_free(&mSnapshotLibAVFrame);
+        avcodec_free_context(&mEncoderCodecContext);
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void take(const VideoFrame<VideoFrameFormat, width, height>& videoFrame)
+    {
+        if (isFrameEmpty(videoFrame))
+            throw MediaException(MEDIA_NO_DATA);
+        mLatestVideoFrame = videoFrame;
+    }
+
+    enum MediaStatus status() const
+    {
+        return mStatus;
+    }
+
+    int getErrno() const
+    {
+        return mErrno;
+    }
+
+    // The JPEG encodings done so far (the other requests were served by the cache)
+    unsigned long numOfEncodings() const
+    {
+        return mNumOfEncodings;
+    }
+
+private:
+
+    void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
+    {
+    }
+
+    void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
+                                struct evhttp_connection* clientConnection)
+    {
+        const unsigned char* snapshot;
+        unsigned int snapshotSize;
+        if (isFrameEmpty(mLatestVideoFrame) ||
+            !prepareSnapshot(mLatestVideoFrame, snapshot, snapshotSize))
+        {
+            evhttp_send_error(clientRequest, HTTP_SERVUNAVAIL, "No frame yet");
+            return;
+        }
+
+        struct evbuffer* buf = evbuffer_new();
+        if (buf == NULL)
+            printAndThrowUnrecoverableError("buf == NULL");
+        evbuffer_add(buf, snapshot, snapshotSize);
+        evhttp_add_header(evhttp_request_get_output_headers(clientRequest),
+                          "Content-Type", "image/jpeg");
+        evhttp_add_header(evhttp_request_get_output_headers(clientRequest),
+                          "Cache-Control", "no-cache");
+        evhttp_send_reply(clientRequest, HTTP_OK, "OK", buf);
+        evbuffer_free(buf);
+    }
+
+    // The MJPEG frames are already JPEG images
+    bool prepareSnapshot(const EncodedVideoFrame& videoFrame,
+                         const unsigned char*& snapshot, unsigned int& snapshotSize)
+    {
+        snapshot = videoFrame.data();
+        snapshotSize = videoFrame.size();
+        return true;
+    }
+
+    bool prepareSnapshot(const Planar3RawVideoFrame& videoFrame,
+                         const unsigned char*& snapshot, unsigned int& snapshotSize)
+    {
+        return prepareEncodedSnapshot(videoFrame, snapshot, snapshotSize);
+    }
+
+    bool prepareSnapshot(const PackedRawVideoFrame& videoFrame,
+                         const unsigned char*& snapshot, unsigned int& snapshotSize)
+    {
+        return prepareEncodedSnapshot(videoFrame, snapshot, snapshotSize);
+    }
+
+    template <typename RawVideoFrame>
+    bool prepareEncodedSnapshot(const RawVideoFrame& videoFrame,
+                                const unsigned char*& snapshot, unsigned int& snapshotSize)
+    {
+        int64_t now = av_gettime_relative();
+        if (mSnapshotTime == AV_NOPTS_VALUE || now - mSnapshotTime >= mCacheTTLUs)
+        {
+            if (!encodeSnapshot(videoFrame))
+                return false;
+            mSnapshotTime = now;
+        }
+        snapshot = &mSnapshot[0];
+        snapshotSize = mSnapshot.size();
+        return true;
+    }
+
+    template <typename RawVideoFrame>
+    bool encodeSnapshot(const RawVideoFrame& videoFrame)
+    {
+        if (!mEncoderCodecContext)
+            initEncoder();
+
+        const uint8_t* inputPlanes[3];
+        int inputStrides[3];
+        inputPlanesOf(videoFrame, inputPlanes);
+        AVPixelFormat inputFormat = FFMPEGUtils::translatePixelFormat<VideoFrameFormat>();
+        unsigned int n;
+        for (n = 0; n < 3; n++)
+            inputStrides[n] = av_image_get_linesize(inputFormat, width, n);
+        if (av_frame_make_writable(mSnapshotLibAVFrame) < 0)
+            printAndThrowUnrecoverableError("av_frame_make_writable(...)");
+        sws_scale(mSwscaleContext, inputPlanes, inputStrides, 0, height,
+                  mSnapshotLibAVFrame->data, mSnapshotLibAVFrame->linesize);
+        mSnapshotLibAVFrame->pts = mNumOfEncodings;
+
+        if (avcodec_send_frame(mEncoderCodecContext, mSnapshotLibAVFrame) < 0)
+            return false;
+        AVPacket snapshotPkt;
+        av_init_packet(&snapshotPkt);
+        snapshotPkt.data = NULL;
+        snapshotPkt.size = 0;
+        if (avcodec_receive_packet(mEncoderCodecContext, &snapshotPkt) != 0)
+            return false;
+        mSnapshot.assign(snapshotPkt.data, snapshotPkt.data + snapshotPkt.size);
+        av_packet_unref(&snapshotPkt);
+        mNumOfEncodings++;
+        return true;
+    }
+
+    // On the first request: an idle server doesn't allocate the encoder
+    void initEncoder()
+    {
+        AVCodec* jpegCodec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+        if (!jpegCodec)
+            printAndThrowUnrecoverableError("jpegCodec = avcodec_find_encoder(...)");
+        mEncoderCodecContext = avcodec_alloc_context3(jpegCodec);
+        if (!mEncoderCodecContext)
+            printAndThrowUnrecoverableError("mEncoderCodecContext = avcodec_alloc_context3(...)");
+        mEncoderCodecContext->width = mSnapshotWidth;
+        mEncoderCodecContext->height = mSnapshotHeight;
+        mEncoderCodecContext->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        mEncoderCodecContext->time_base = av_make_q(1, 25);
+        mEncoderCodecContext->qmin = mQuality;
+        mEncoderCodecContext->qmax = mQuality;
+        if (avcodec_open2(mEncoderCodecContext, jpegCodec, NULL) < 0)
+            printAndThrowUnrecoverableError("avcodec_open2(...)");
+
+        mSnapshotLibAVFrame = av_frame_alloc();
+        if (!mSnapshotLibAVFrame)
+            printAndThrowUnrecoverableError("(mSnapshotLibAVFrame = av_frame_alloc())");
+        mSnapshotLibAVFrame->format = AV_PIX_FMT_YUVJ420P;
+        mSnapshotLibAVFrame->width = mSnapshotWidth;
+        mSnapshotLibAVFrame->height = mSnapshotHeight;
+        if (av_frame_get_buffer(mSnapshotLibAVFrame, 0) < 0)
+            printAndThrowUnrecoverableError("av_frame_get_buffer(mSnapshotLibAVFrame, 0)");
+
+        // The full range of the JPEG images is set by YUVJ420P
+        mSwscaleContext = sws_getContext(width, height,
+                                         FFMPEGUtils::translatePixelFormat<VideoFrameFormat>(),
+                                         mSnapshotWidth, mSnapshotHeight, AV_PIX_FMT_YUVJ420P,
+                                         SWS_BILINEAR, NULL, NULL, NULL);
+        if (!mSwscaleContext)
+            printAndThrowUnrecoverableError("(mSwscaleContext = sws_getContext(...");
+    }
+
+    void inputPlanesOf(const Planar3RawVideoFrame& videoFrame, const uint8_t* planes[3]) const
+    {
+        planes[0] = videoFrame.plane<0>();
+        planes[1] = videoFrame.plane<1>();
+        planes[2] = videoFrame.plane<2>();
+    }
+
+    void inputPlanesOf(const PackedRawVideoFrame& videoFrame, const uint8_t* planes[3]) const
+    {
+        planes[0] = videoFrame.data();
+        planes[1] = NULL;
+        planes[2] = NULL;
+    }
+
+    bool isFrameEmpty(const EncodedVideoFrame& videoFrame) const
+    {
+        return videoFrame.size() == 0;
+    }
+
+    bool isFrameEmpty(const PackedRawVideoFrame& videoFrame) const
+    {
+        return videoFrame.size() == 0;
+    }
+
+    bool isFrameEmpty(const Planar3RawVideoFrame& videoFrame) const
+    {
+        return videoFrame.size<0>() == 0;
+    }
+
+    enum MediaStatus mStatus;
+    int mErrno;
+    std::string mAddress;
+    unsigned int mPort;
+    int64_t mCacheTTLUs;
+    unsigned int mSnapshotWidth;
+    unsigned int mSnapshotHeight;
+    unsigned int mQuality;
+    unsigned long mNumOfEncodings;
+    VideoFrame<VideoFrameFormat, width, height> mLatestVideoFrame;
+    std::vector<unsigned char> mSnapshot;
+    // When mSnapshot was encoded (microseconds), AV_NOPTS_VALUE if never
+    int64_t mSnapshotTime;
+    AVCodecContext* mEncoderCodecContext;
+    struct SwsContext* mSwscaleContext;
+    AVFrame* mSnapshotLibAVFrame;
+
+};
+
+}
+
+#endif // HTTPSNAPSHOTSERVER_HPP_INCLUDED
@@ -9,12 +9,33 @@
 
 #include "EventsManager.hpp"
 #include "FFMPEGAudioVideoMuxer.hpp"
+#include "StageMetrics.hpp"
+#include "WebSocketUtils.hpp"
+
+extern "C"
+{
+#include <event2/bufferevent.h>
+#include <strings.h>
+#include <sys/socket.h>
+}
 
 namespace laav
 {
 
+struct HTTPClientStats
+{
+    std::string address;
+    unsigned int port;
+    // Bytes queued on the client's connection and not sent yet
+    size_t queuedBytes;
+    // Groups of muxed chunks not sent because the client was too slow
+    unsigned long droppedGroupsOfChunks;
+    bool waitingForKeyFrame;
+    bool webSocket;
+};
+
 template <typename Container>
-class HTTPStreamer  : public EventsProducer
+class HTTPStreamer  : public EventsProducer, protected MuxedDataSink
 {
 
 public:
@@ -29,6 +50,80 @@ public:
         return mErrno;
     }
 
+    /*
+     * When more than highWaterMarkBytes are queued on a client's connection, the client
+     * is skipped until the queue drains and the next keyframe is muxed (only MPEGTS and FMP4
+     * streams can be resumed like that: MATROSKA ones are left queuing). A client which stays above the
+     * mark for more than stallTimeoutMs is disconnected. highWaterMarkBytes == 0 disables both.
+     */
+    void setClientsBackpressure(size_t highWaterMarkBytes, unsigned int stallTimeoutMs)
+    {
+        mHighWaterMarkBytes = highWaterMarkBytes;
+        mStallTimeoutMs = stallTimeoutMs;
+    }
+
+    /*
+     * The muxed data from the last keyframe onward is kept (up to maxBytes) and sent to
+     * the new MPEGTS (and FMP4) clients together with the header, so that they can start decoding
+     * immediately. If the GOP is bigger than maxBytes, the new clients wait for the next
+     * keyframe instead. maxBytes == 0 disables the cache.
+     */
+    void setGOPCacheSize(size_t maxBytes)
+    {
+        mGOPCacheMaxBytes = maxBytes;
+        clearGOPCache();
+    }
+
+    size_t gOPCacheBytes() const
+    {
+        return mGOPCacheBytes;
+    }
+
+    /*
+     * Whether some clients (I.E: the new ones, without a cached GOP) wait for a keyframe
+     * before getting the stream: the source can be asked for one (I.E:
+     * FFMPEGVideoEncoder::forceKeyFrame(), V4L2Grabber<H264, ...>::forceKeyFrame())
+     */
+    bool hasClientsWaitingForKeyFrame() const
+    {
+        using Iter = typename std::map<struct evhttp_connection*, struct ClientState>::const_iterator;
+        for (Iter it = mClientsStates.begin(); it != mClientsStates.end(); ++it)
+            if (it->second.waitingForKeyFrame)
+                return true;
+        return false;
+    }
+
+    std::vector<HTTPClientStats> clientsStats() const
+    {
+        std::vector<HTTPClientStats> stats;
+        using Iter = typename std::map<struct evhttp_connection*, struct ClientState>::const_iterator;
+        for (Iter it = mClientsStates.begin(); it != mClientsStates.end(); ++it)
+        {
+            HTTPClientStats clientStats;
+            char* address = NULL;
+            ev_uint16_t port = 0;
+            evhttp_connection_get_peer(it->first, &address, &port);
+            clientStats.address = address ? address : "";
+            clientStats.port = port;
+            clientStats.queuedBytes = queuedBytes(it->first);
+            clientStats.droppedGroupsOfChunks = it->second.droppedGroupsOfChunks;
+            clientStats.waitingForKeyFrame = it->second.waitingForKeyFrame;
+            clientStats.webSocket = it->second.webSocket;
+            stats.push_back(clientStats);
+        }
+        return stats;
+    }
+
+    /*
+     * A frame is a group of muxed chunks: in (muxed), out (sent to a client, once per
+     * client), dropped (skipped for a slow client); the clients' backlog is updated at
+     * each fan-out
+     */
+    StageMetrics& metrics()
+    {
+        return mMetrics;
+    }
+
 protected:
 
     HTTPStreamer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port):
@@ -36,8 +131,18 @@ protected:
         mAddress(address),
         mPort(port),
         mStatus(MEDIA_NOT_READY),
+        mHighWaterMarkBytes(4 * 1024 * 1024),
+        mStallTimeoutMs(10000),
+        mGOPCacheMaxBytes(2 * 1024 * 1024),
+        mGOPCacheBytes(0),
+        mPendingChunksGroup(NULL),
+        mMaxChunksGroupSize(0),
+        mMetrics("http_streamer"),
         mErrno(0)
     {
+        mClientBuffer = evbuffer_new();
+        if (!mClientBuffer)
+            printAndThrowUnrecoverableError("mClientBuffer = evbuffer_new()");
         std::string location = "/stream." + containerExtension<Container>();
         if (!makeHTTPServerPollable(mAddress, location, mPort))
         {
@@ -51,6 +156,118 @@ protected:
     ~HTTPStreamer()
     {
         dontObserveHTTPEventsOn(mAddress, mPort);
+        evbuffer_free(mClientBuffer);
+        clearGOPCache();
+        if (mPendingChunksGroup)
+            releaseSharedChunksGroup(NULL, 0, mPendingChunksGroup);
+    }
+
+    /*
+     * headerAlreadyWritten is false when the muxer is already muxing: the client
+     * gets the header plus the cached GOP, or waits for the next keyframe.
+     * A client which asks for a WebSocket upgrade (I.E: a browser feeding MSE) gets the
+     * same stream, where each group of chunks is a binary message.
+     * Returns true if the client is the first one.
+     */
+    bool registerClient(struct evhttp_request* clientRequest,
+                        struct evhttp_connection* clientConnection,
+                        const std::string& header, bool headerAlreadyWritten)
+    {
+        mClientConnectionsAndRequests[clientConnection] = clientRequest;
+        mWrittenHeaderFlagAndRequests[clientRequest] = headerAlreadyWritten;
+        struct ClientState clientState;
+        clientState.waitingForKeyFrame = false;
+        clientState.disconnecting = false;
+        clientState.stallStartTime = 0;
+        clientState.droppedGroupsOfChunks = 0;
+        clientState.webSocket = acceptWebSocket(clientRequest);
+        if (!clientState.webSocket)
+            evhttp_send_reply_start(clientRequest, HTTP_OK, "OK");
+
+        if (!headerAlreadyWritten && canResumeOnKeyFrame<Container>())
+        {
+            if (mGOPCache.size() != 0)
+            {
+                // Header + cached GOP in one write
+                evbuffer_add(mClientBuffer, header.c_str(), header.size());
+                unsigned int n;
+                for (n = 0; n < mGOPCache.size(); n++)
+                    appendToClientBuffer(mGOPCache[n]);
+                sendClientBuffer(clientRequest, clientConnection, clientState.webSocket);
+                evbuffer_drain(mClientBuffer, evbuffer_get_length(mClientBuffer));
+                mWrittenHeaderFlagAndRequests[clientRequest] = true;
+            }
+            else
+                clientState.waitingForKeyFrame = true;
+        }
+        mClientsStates[clientConnection] = clientState;
+        return mClientConnectionsAndRequests.size() == 1;
+    }
+
+    // Returns true if there are no more clients
+    bool unregisterClient(struct evhttp_connection* clientConnection)
+    {
+        mWrittenHeaderFlagAndRequests.erase(mClientConnectionsAndRequests[clientConnection]);
+        evhttp_request_free(mClientConnectionsAndRequests[clientConnection]);
+        mClientConnectionsAndRequests.erase(clientConnection);
+        mClientsStates.erase(clientConnection);
+        if (mClientConnectionsAndRequests.size() == 0)
+        {
+            // The muxing could be stopped: the next stream will start with a new header
+            clearGOPCache();
+            return true;
+        }
+        return false;
+    }
+
+    /*
+     * Sends a group of muxed chunks to all the clients. The chunks are copied only once,
+     * in a refcounted block which is appended by reference to the output buffer of
+     * each client and released when the last client has sent it.
+     */
+    template <typename MuxedData>
+    void streamToAllClients(const std::string& header,
+                            const std::vector<MuxedData>& chunksToStream, unsigned int numOfChunks,
+                            bool groupHasKeyFrame)
+    {
+        size_t groupSize = 0;
+        unsigned int n;
+        for (n = 0; n < numOfChunks; n++)
+            groupSize += chunksToStream[n].size();
+        if (groupSize == 0)
+            return;
+
+        SharedChunksGroup* chunksGroup = new SharedChunksGroup();
+        // The streamer's reference, released after the fan-out
+        chunksGroup->references = 1;
+        chunksGroup->data.resize(groupSize);
+        size_t groupOffset = 0;
+        for (n = 0; n < numOfChunks; n++)
+        {
+            memcpy(&chunksGroup->data[groupOffset], chunksToStream[n].data(), chunksToStream[n].size());
+            groupOffset += chunksToStream[n].size();
+        }
+        fanOutChunksGroup(header, chunksGroup, groupHasKeyFrame);
+    }
+
+    /*
+     * Contiguous mode (used with the streamer's own muxer, see
+     * FFMPEGMuxerCommonImpl::setMuxedDataSink()): the muxer writes straight into the
+     * refcounted block, which is sent to all the clients by this call.
+     */
+    void streamPendingChunksGroup(const std::string& header, bool groupHasKeyFrame)
+    {
+        if (!mPendingChunksGroup)
+            return;
+        SharedChunksGroup* chunksGroup = mPendingChunksGroup;
+        mPendingChunksGroup = NULL;
+        if (mClientConnectionsAndRequests.size() == 0 || this->mStatus != MEDIA_READY)
+        {
+            // I.E: trailer written after the last client left
+            releaseSharedChunksGroup(NULL, 0, chunksGroup);
+            return;
+        }
+        fanOutChunksGroup(header, chunksGroup, groupHasKeyFrame);
     }
 
     virtual void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
@@ -66,10 +283,290 @@ protected:
 
 private:
 
+    struct SharedChunksGroup
+    {
+        unsigned int references;
+        std::vector<unsigned char> data;
+    };
+
+    static void releaseSharedChunksGroup(const void* data, size_t dataLen, void* extra)
+    {
+        SharedChunksGroup* chunksGroup = (SharedChunksGroup* )extra;
+        chunksGroup->references--;
+        if (chunksGroup->references == 0)
+            delete chunksGroup;
+    }
+
+    bool writeMuxedData(const uint8_t* data, size_t size)
+    {
+        if (!mPendingChunksGroup)
+        {
+            mPendingChunksGroup = new SharedChunksGroup();
+            // The streamer's reference, released after the fan-out
+            mPendingChunksGroup->references = 1;
+            // Avoids reallocations (and copies) while the group grows
+            mPendingChunksGroup->data.reserve(mMaxChunksGroupSize);
+        }
+        std::vector<unsigned char>& groupData = mPendingChunksGroup->data;
+        groupData.insert(groupData.end(), data, data + size);
+        if (groupData.size() > mMaxChunksGroupSize)
+            mMaxChunksGroupSize = groupData.size();
+        return true;
+    }
+
+    void fanOutChunksGroup(const std::string& header, SharedChunksGroup* chunksGroup,
+                           bool groupHasKeyFrame)
+    {
+        cacheGroupOfChunks(chunksGroup, groupHasKeyFrame);
+
+        mMetrics.countFrameIn();
+        size_t backlogBytes = 0;
+        size_t maxClientBacklogBytes = 0;
+        int64_t now = av_gettime_relative();
+        using Iter = std::map<struct evhttp_connection*, struct evhttp_request* >::iterator;
+        for (Iter it = mClientConnectionsAndRequests.begin();
+             it != mClientConnectionsAndRequests.end(); ++it)
+        {
+            size_t clientBacklogBytes = queuedBytes(it->first);
+            backlogBytes += clientBacklogBytes;
+            if (clientBacklogBytes > maxClientBacklogBytes)
+                maxClientBacklogBytes = clientBacklogBytes;
+            if (!canSendTo(it->first, groupHasKeyFrame, now))
+                continue;
+            if (mWrittenHeaderFlagAndRequests[it->second] == false)
+            {
+                evbuffer_add(mClientBuffer, header.c_str(), header.size());
+                mWrittenHeaderFlagAndRequests[it->second] = true;
+            }
+            appendToClientBuffer(chunksGroup);
+            sendClientBuffer(it->second, it->first, mClientsStates[it->first].webSocket);
+            // In case the connection was already closed
+            evbuffer_drain(mClientBuffer, evbuffer_get_length(mClientBuffer));
+            mMetrics.countFrameOut(chunksGroup->data.size());
+        }
+        mMetrics.setClientsBacklog(mClientConnectionsAndRequests.size(), backlogBytes,
+                                   maxClientBacklogBytes);
+
+        releaseSharedChunksGroup(NULL, 0, chunksGroup);
+    }
+
+    struct ClientState
+    {
+        bool waitingForKeyFrame;
+        bool disconnecting;
+        int64_t stallStartTime;
+        unsigned long droppedGroupsOfChunks;
+        bool webSocket;
+    };
+
+    // Replies to the WebSocket opening handshake, if the client asks for it
+    static bool acceptWebSocket(struct evhttp_request* clientRequest)
+    {
+        struct evkeyvalq* inputHeaders = evhttp_request_get_input_headers(clientRequest);
+        const char* upgrade = evhttp_find_header(inputHeaders, "Upgrade");
+        const char* key = evhttp_find_header(inputHeaders, "Sec-WebSocket-Key");
+        if (!upgrade || strcasecmp(upgrade, "websocket") != 0 || !key)
+            return false;
+        struct evkeyvalq* outputHeaders = evhttp_request_get_output_headers(clientRequest);
+        evhttp_add_header(outputHeaders, "Upgrade", "websocket");
+        evhttp_add_header(outputHeaders, "Connection", "Upgrade");
+        evhttp_add_header(outputHeaders, "Sec-WebSocket-Accept",
+                          WebSocketUtils::acceptKey(key).c_str());
+        // A 101 response has no body: libevent won't send the chunks, see sendClientBuffer()
+        evhttp_send_reply_start(clientRequest, 101, "Switching Protocols");
+        return true;
+    }
+
+    // Moves (without copying) the buffer's content to the connection's output buffer
+    void sendClientBuffer(struct evhttp_request* clientRequest,
+                          struct evhttp_connection* clientConnection, bool webSocket)
+    {
+        if (!webSocket)
+        {
+            evhttp_send_reply_chunk(clientRequest, mClientBuffer);
+            return;
+        }
+        struct bufferevent* bufEvent = evhttp_connection_get_bufferevent(clientConnection);
+        if (!bufEvent)
+            return;
+        uint8_t frameHeader[WebSocketUtils::MAX_FRAME_HEADER_SIZE];
+        size_t frameHeaderSize =
+        WebSocketUtils::writeFrameHeader(WebSocketUtils::BINARY_FRAME,
+                                         evbuffer_get_length(mClientBuffer), frameHeader);
+        evbuffer_prepend(mClientBuffer, frameHeader, frameHeaderSize);
+        evbuffer_add_buffer(bufferevent_get_output(bufEvent), mClientBuffer);
+    }
+
+    /*
+     * The WebSocket clients only send control frames (I.E: the pings of some proxies, the
+     * closing handshake), which are read at each fan-out from the connection's input
+     * buffer. Returns false if the client is closing the connection.
+     */
+    bool readWebSocketFrames(struct evhttp_connection* clientConnection,
+                             struct ClientState& clientState)
+    {
+        struct bufferevent* bufEvent = evhttp_connection_get_bufferevent(clientConnection);
+        if (!bufEvent)
+            return true;
+        struct evbuffer* input = bufferevent_get_input(bufEvent);
+        while (evbuffer_get_length(input) != 0)
+        {
+            unsigned int opcode;
+            std::string payload;
+            size_t frameSize = WebSocketUtils::readClientFrame(evbuffer_pullup(input, -1),
+                                                               evbuffer_get_length(input),
+                                                               opcode, payload);
+            if (frameSize == 0)
+            {
+                if (evbuffer_get_length(input) <= MAX_WEBSOCKET_CLIENT_FRAME_SIZE)
+                    return true;
+                disconnect(clientConnection, clientState);
+                return false;
+            }
+            evbuffer_drain(input, frameSize);
+            if (opcode == WebSocketUtils::PING_FRAME)
+                sendWebSocketControlFrame(bufEvent, WebSocketUtils::PONG_FRAME, payload);
+            else if (opcode == WebSocketUtils::CLOSE_FRAME)
+            {
+                // Echoes the status code: then the client closes the connection
+                sendWebSocketControlFrame(bufEvent, WebSocketUtils::CLOSE_FRAME,
+                                          payload.substr(0, 2));
+                clientState.disconnecting = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void sendWebSocketControlFrame(struct bufferevent* bufEvent,
+                                          enum WebSocketUtils::Opcode opcode,
+                                          const std::string& payload)
+    {
+        uint8_t frameHeader[WebSocketUtils::MAX_FRAME_HEADER_SIZE];
+        size_t frameHeaderSize = WebSocketUtils::writeFrameHeader(opcode, payload.size(),
+                                                                  frameHeader);
+        bufferevent_write(bufEvent, frameHeader, frameHeaderSize);
+        bufferevent_write(bufEvent, payload.data(), payload.size());
+    }
+
+    // The disconnection is notified by libevent (-> hTTPDisconnectionCallBack),
+    // as if the client had closed the connection
+    static void disconnect(struct evhttp_connection* clientConnection,
+                           struct ClientState& clientState)
+    {
+        clientState.disconnecting = true;
+        struct bufferevent* bufEvent = evhttp_connection_get_bufferevent(clientConnection);
+        shutdown(bufferevent_getfd(bufEvent), SHUT_RDWR);
+    }
+
+    void appendToClientBuffer(SharedChunksGroup* chunksGroup)
+    {
+        chunksGroup->references++;
+        if (evbuffer_add_reference(mClientBuffer, &chunksGroup->data[0], chunksGroup->data.size(),
+                                   releaseSharedChunksGroup, chunksGroup) != 0)
+        {
+            chunksGroup->references--;
+            printAndThrowUnrecoverableError("evbuffer_add_reference(...)");
+        }
+    }
+
+    void cacheGroupOfChunks(SharedChunksGroup* chunksGroup, bool groupHasKeyFrame)
+    {
+        if (mGOPCacheMaxBytes == 0 || !canResumeOnKeyFrame<Container>())
+            return;
+        if (groupHasKeyFrame)
+            clearGOPCache();
+        else if (mGOPCache.size() == 0)
+            // Waiting for a keyframe
+            return;
+
+        if (mGOPCacheBytes + chunksGroup->data.size() > mGOPCacheMaxBytes)
+        {
+            // GOP too big: wait for the next keyframe
+            clearGOPCache();
+            return;
+        }
+        chunksGroup->references++;
+        mGOPCache.push_back(chunksGroup);
+        mGOPCacheBytes += chunksGroup->data.size();
+    }
+
+    void clearGOPCache()
+    {
+        unsigned int n;
+        for (n = 0; n < mGOPCache.size(); n++)
+            releaseSharedChunksGroup(NULL, 0, mGOPCache[n]);
+        mGOPCache.clear();
+        mGOPCacheBytes = 0;
+    }
+
+    static const size_t MAX_WEBSOCKET_CLIENT_FRAME_SIZE = 64 * 1024;
+
+    static size_t queuedBytes(struct evhttp_connection* clientConnection)
+    {
+        struct bufferevent* bufEvent = evhttp_connection_get_bufferevent(clientConnection);
+        if (!bufEvent)
+            return 0;
+        return evbuffer_get_length(bufferevent_get_output(bufEvent));
+    }
+
+    bool canSendTo(struct evhttp_connection* clientConnection, bool groupHasKeyFrame, int64_t now)
+    {
+        struct ClientState& clientState = mClientsStates[clientConnection];
+        if (clientState.disconnecting)
+            return false;
+        if (clientState.webSocket && !readWebSocketFrames(clientConnection, clientState))
+            return false;
+
+        if (mHighWaterMarkBytes != 0 && queuedBytes(clientConnection) > mHighWaterMarkBytes)
+        {
+            if (clientState.stallStartTime == 0)
+                clientState.stallStartTime = now;
+            else if (now - clientState.stallStartTime > (int64_t)mStallTimeoutMs * 1000)
+            {
+                disconnect(clientConnection, clientState);
+                return false;
+            }
+            if (!canResumeOnKeyFrame<Container>())
+                return true;
+            clientState.waitingForKeyFrame = true;
+            clientState.droppedGroupsOfChunks++;
+            mMetrics.countDroppedFrames(1);
+            return false;
+        }
+
+        clientState.stallStartTime = 0;
+        if (clientState.waitingForKeyFrame)
+        {
+            if (!groupHasKeyFrame)
+            {
+                clientState.droppedGroupsOfChunks++;
+                mMetrics.countDroppedFrames(1);
+                return false;
+            }
+            clientState.waitingForKeyFrame = false;
+        }
+        return true;
+    }
+
+    std::map<struct evhttp_connection*, struct ClientState> mClientsStates;
+    size_t mHighWaterMarkBytes;
+    unsigned int mStallTimeoutMs;
+    std::vector<SharedChunksGroup*> mGOPCache;
+    size_t mGOPCacheMaxBytes;
+    size_t mGOPCacheBytes;
+    SharedChunksGroup* mPendingChunksGroup;
+    size_t mMaxChunksGroupSize;
+    StageMetrics mMetrics;
     int mErrno;
+    struct evbuffer* mClientBuffer;
     template <typename Container_>
     std::string containerExtension();
 
+    // True if a client can skip some muxed data and go on with the next keyframe
+    template <typename Container_>
+    bool canResumeOnKeyFrame();
+
 };
 
 template <>
@@ -86,6 +583,35 @@ std::string HTTPStreamer<MATROSKA>::containerExtension<MATROSKA>()
     return "mkv";
 }
 
+template <>
+template <>
+std::string HTTPStreamer<FMP4>::containerExtension<FMP4>()
+{
+    return "mp4";
+}
+
+template <>
+template <>
+bool HTTPStreamer<MPEGTS>::canResumeOnKeyFrame<MPEGTS>()
+{
+    return true;
+}
+
+template <>
+template <>
+bool HTTPStreamer<MATROSKA>::canResumeOnKeyFrame<MATROSKA>()
+{
+    return false;
+}
+
+// Each fragment carries its own decode time: the skipped ones leave a gap, not a drift
+template <>
+template <>
+bool HTTPStreamer<FMP4>::canResumeOnKeyFrame<FMP4>()
+{
+    return true;
+}
+
 }
 
 #endif // HTTPSTREAMER_HPP_INCLUDED
@@ -12,6 +12,18 @@
 namespace laav
 {
 
+/*
+ * Streams the video as one long HTTP response per client, at:
+ *
+ *   http://address:port/stream.<ts|mkv|mp4>
+ *
+ * The same address accepts WebSocket upgrades (ws://address:port/stream.mp4), so that the
+ * FMP4 streams can be played by the browsers without any proxy: the first message holds
+ * the init segment, the next ones the fragments, which can be appended as they are to a
+ * MSE SourceBuffer (see examples/WebSocketVideoExample.cpp). With its own muxer, an FMP4
+ * streamer cuts a fragment per frame (see FFMPEGMuxerCommonImpl::setFragmentEveryFrame()),
+ * so that each frame is sent as soon as the next one is muxed.
+ */
 template <typename Container,
           typename VideoCodecOrFormat,
           unsigned int width,
@@ -23,10 +35,33 @@ public:
 
     HTTPVideoStreamer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port) :
         HTTPStreamer<Container>(eventsCatcher, address, port),
-        mLatency(0),
-        mVideoStreamingStartTime(0),
-        mVideoMuxer(false)
+        mOwnedVideoMuxer(new FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height>(false)),
+        mVideoMuxer(*mOwnedVideoMuxer),
+        mLastStreamedGroupOfChunksId(0)
+    {
+        // Nobody else consumes the muxed chunks: the muxer writes straight into the clients' data
+        mOwnedVideoMuxer->setMuxedDataSink(this);
+        setLowLatencyFragments(Container());
+    }
+
+    /*
+     * Streams the chunks of an external muxer, which can be shared with other
+     * consumers (I.E: recording to file) without muxing the same frames twice.
+     * The muxer is fed by its own pipe (I.E: vFh >> vMux >> vStream) and must
+     * outlive the streamer.
+     */
+    HTTPVideoStreamer(SharedEventsCatcher eventsCatcher, std::string address, unsigned int port,
+                      FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height>& videoMuxer) :
+        HTTPStreamer<Container>(eventsCatcher, address, port),
+        mVideoMuxer(videoMuxer),
+        mLastStreamedGroupOfChunksId(0)
+    {
+    }
+
+    ~HTTPVideoStreamer()
     {
+        if (this->mClientConnectionsAndRequests.size() != 0)
+            mVideoMuxer.stopMuxingForStreamer();
     }
 
     /*!
@@ -35,45 +70,31 @@ public:
     void takeStreamableFrame(const VideoFrame<VideoCodecOrFormat,
                              width, height>& videoFrameToStream)
     {
-        if (this->mStatus == MEDIA_READY)
+        // An external muxer is fed by its own pipe
+        if (this->mStatus == MEDIA_READY && mOwnedVideoMuxer)
             mVideoMuxer.takeMuxableFrame(videoFrameToStream);
     }
 
     void streamMuxedData()
     {
+        if (mOwnedVideoMuxer)
+        {
+            this->streamPendingChunksGroup(mVideoMuxer.header(), mVideoMuxer.groupOfChunksHasKeyFrame());
+            return;
+        }
 
-        if (this->mClientConnectionsAndRequests.size() != 0 && this->mStatus == MEDIA_READY)
+        if (this->mClientConnectionsAndRequests.size() != 0 && this->mStatus == MEDIA_READY &&
+            mVideoMuxer.groupOfChunksId() != mLastStreamedGroupOfChunksId)
         {
+            mLastStreamedGroupOfChunksId = mVideoMuxer.groupOfChunksId();
             try
             {
-                using Iter3 = std::map<struct evhttp_connection*, struct evhttp_request* >::iterator;
-                for (Iter3 it = this->mClientConnectionsAndRequests.begin();
-                     it != this->mClientConnectionsAndRequests.end(); ++it)
-                {
-                    const std::vector<MuxedVideoData<Container, VideoCodecOrFormat, width, height> >&
-                    chunksToStream = mVideoMuxer.muxedVideoChunks();
-
-                    unsigned int n;
-                    struct evbuffer* buf = evbuffer_new();
-                    if (this->mWrittenHeaderFlagAndRequests[it->second] == false)
-                    {
-                        evbuffer_add(buf, mVideoMuxer.header().c_str(), mVideoMuxer.header().size());
-                        this->mWrittenHeaderFlagAndRequests[it->second] = true;
-                    }
-                    for (n = 0; n < mVideoMuxer.muxedVideoChunksOffset(); n++)
-                    {
-                        if (buf == NULL)
-                            printAndThrowUnrecoverableError("buf == NULL");
-
-                        evbuffer_add(buf, chunksToStream[n].data(), chunksToStream[n].size());
-                    }
-                    if (mLatency == 0)
-                    {
-                        mLatency = av_gettime_relative() - mVideoStreamingStartTime;
-                    }
-                    evhttp_send_reply_chunk(it->second, buf);
-                    evbuffer_free(buf);
-                }
+                const std::vector<MuxedVideoData<Container, VideoCodecOrFormat, width, height> >&
+                chunksToStream = mVideoMuxer.muxedVideoChunks();
+
+                this->streamToAllClients(mVideoMuxer.header(), chunksToStream,
+                                         mVideoMuxer.muxedVideoChunksOffset(),
+                                         mVideoMuxer.groupOfChunksHasKeyFrame());
             }
             catch (const MediaException& mediaException)
             {
@@ -84,34 +105,35 @@ public:
 
 private:
 
-    void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
+    void setLowLatencyFragments(FMP4)
     {
-        this->mWrittenHeaderFlagAndRequests.erase(this->mClientConnectionsAndRequests[clientConnection]);
-        evhttp_request_free(this->mClientConnectionsAndRequests[clientConnection]);
-        this->mClientConnectionsAndRequests.erase(clientConnection);
-        if (this->mClientConnectionsAndRequests.size() == 0)
-        {
-            mVideoMuxer.stopMuxing();
-        }
+        mOwnedVideoMuxer->setFragmentEveryFrame(true);
+    }
+
+    // The other containers aren't fragmented
+    template <typename Container_>
+    void setLowLatencyFragments(Container_)
+    {
+    }
 
+    void hTTPDisconnectionCallBack(struct evhttp_connection* clientConnection)
+    {
+        if (this->unregisterClient(clientConnection))
+            mVideoMuxer.stopMuxingForStreamer();
     }
 
     void hTTPConnectionCallBack(struct evhttp_request* clientRequest,
                                 struct evhttp_connection* clientConnection)
     {
-        this->mClientConnectionsAndRequests[clientConnection] = clientRequest;
-
-        if (mVideoMuxer.isMuxing())
-            this->mWrittenHeaderFlagAndRequests[clientRequest] = false;
-        else
-            this->mWrittenHeaderFlagAndRequests[clientRequest] = true;
-        evhttp_send_reply_start(clientRequest, HTTP_OK, "OK");
-        mVideoMuxer.startMuxing();
+        // If the muxer is already muxing, the header has to be sent to the new client
+        if (this->registerClient(clientRequest, clientConnection,
+                                 mVideoMuxer.header(), !mVideoMuxer.isMuxing()))
+            mVideoMuxer.startMuxingForStreamer();
     }
 
-    int64_t mLatency;
-    int64_t mVideoStreamingStartTime;
-    FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height> mVideoMuxer;
+    std::unique_ptr<FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height> > mOwnedVideoMuxer;
+    FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height>& mVideoMuxer;
+    unsigned long mLastStreamedGroupOfChunksId;
 
 };
 
@@ -0,0 +1,271 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef LATENCYTRACESEI_HPP_INCLUDED
+#define LATENCYTRACESEI_HPP_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+
+namespace laav
+{
+
+class H264;
+class H265;
+
+/*
+ * The timestamps of a frame along the pipe, carried by the stream itself (see
+ * FFMPEGVideoEncoder::setLatencyTracing()). The dates are ns since the epoch (CLOCK_REALTIME),
+ * so that a receiver whose clock is synchronized (I.E: NTP, PTP) can compare them with its
+ * own. captureMonotonicTs is the frame's monotonicTimestamp() (us), meaningful only on the
+ * sender's host.
+ */
+struct LatencyTrace
+{
+    // The grabber's DQBUF (see V4L2Grabber)
+    int64_t captureDateTs;
+    int64_t captureMonotonicTs;
+    // The frame entered the encoder (after the conversions and the queues before it)
+    int64_t encoderInputDateTs;
+    // Its packet came out of the encoder (after the lookahead and the frame threads)
+    int64_t encoderOutputDateTs;
+};
+
+/*
+ * Writes and reads the H264/H265 "user data unregistered" SEI messages which carry a
+ * LatencyTrace, identified by their UUID. The decoders and the players skip them.
+ * The packets are Annex B (the encoders' format).
+ */
+class LatencyTraceSEI
+{
+
+public:
+
+    /*
+     * Copies the packet into seiPacket, with the SEI NAL unit of trace before its first
+     * picture's NAL unit (after the AUD and the parameter sets, as the standards require).
+     */
+    template <typename Codec>
+    static void insert(const unsigned char* data, unsigned int size, const LatencyTrace& trace,
+                       std::vector<unsigned char>& seiPacket)
+    {
+        unsigned int seiOffset = size;
+        unsigned int offset = 0;
+        unsigned int nALUnitStart;
+        unsigned int nALUnitSize;
+        while (nextNALUnit(data, size, offset, nALUnitStart, nALUnitSize))
+            if (isPicture<Codec>(data + nALUnitStart))
+            {
+                // Before the start code
+                seiOffset = nALUnitStart - 3;
+                if (seiOffset > 0 && data[seiOffset - 1] == 0)
+                    seiOffset--;
+                break;
+            }
+
+        seiPacket.clear();
+        seiPacket.insert(seiPacket.end(), data, data + seiOffset);
+        static const unsigned char startCode[4] = {0, 0, 0, 1};
+        seiPacket.insert(seiPacket.end(), startCode, startCode + 4);
+        appendNALUnitHeader<Codec>(seiPacket);
+
+        std::vector<unsigned char> payload;
+        // last_payload_type_byte (user_data_unregistered), last_payload_size_byte
+        payload.push_back(5);
+        payload.push_back(uuidSize + traceSize);
+        payload.insert(payload.end(), uuid, uuid + uuidSize);
+        payload.push_back(traceVersion);
+        appendInt64(trace.captureDateTs, payload);
+        appendInt64(trace.captureMonotonicTs, payload);
+        appendInt64(trace.encoderInputDateTs, payload);
+        appendInt64(trace.encoderOutputDateTs, payload);
+        // rbsp_trailing_bits
+        payload.push_back(0x80);
+
+        // The emulation prevention bytes: no start code (or 00 00 03) can appear in the NAL unit
+        unsigned int zeros = 0;
+        for (unsigned char byte : payload)
+        {
+            if (zeros >= 2 && byte <= 3)
+            {
+                seiPacket.push_back(3);
+                zeros = 0;
+            }
+            seiPacket.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+
+        seiPacket.insert(seiPacket.end(), data + seiOffset, data + size);
+    }
+
+    // Returns false if the packet has no LatencyTrace SEI
+    template <typename Codec>
+    static bool read(const unsigned char* data, unsigned int size, LatencyTrace& trace)
+    {
+        unsigned int offset = 0;
+        unsigned int nALUnitStart;
+        unsigned int nALUnitSize;
+        while (nextNALUnit(data, size, offset, nALUnitStart, nALUnitSize))
+        {
+            if (!isSEI<Codec>(data + nALUnitStart))
+                continue;
+            std::vector<unsigned char> payload;
+            unsigned int zeros = 0;
+            unsigned int n;
+            for (n = nALUnitHeaderSize<Codec>(); n < nALUnitSize; n++)
+            {
+                unsigned char byte = data[nALUnitStart + n];
+                if (zeros >= 2 && byte == 3)
+                {
+                    zeros = 0;
+                    continue;
+                }
+                payload.push_back(byte);
+                zeros = byte == 0 ? zeros + 1 : 0;
+            }
+            if (parsePayload(payload, trace))
+                return true;
+        }
+        return false;
+    }
+
+private:
+
+    static const unsigned int uuidSize = 16;
+    static const unsigned int traceSize = 1 + 4 * 8;
+    static const unsigned int traceVersion = 1;
+    static const unsigned char uuid[uuidSize];
+
+    template <typename Codec>
+    static bool isPicture(const unsigned char* nALUnit);
+
+    template <typename Codec>
+    static bool isSEI(const unsigned char* nALUnit);
+
+    template <typename Codec>
+    static unsigned int nALUnitHeaderSize();
+
+    template <typename Codec>
+    static void appendNALUnitHeader(std::vector<unsigned char>& packet);
+
+    static void appendInt64(int64_t value, std::vector<unsigned char>& payload)
+    {
+        int shift;
+        for (shift = 56; shift >= 0; shift -= 8)
+            payload.push_back((uint64_t)value >> shift);
+    }
+
+    static int64_t parseInt64(const unsigned char* data)
+    {
+        uint64_t value = 0;
+        unsigned int n;
+        for (n = 0; n < 8; n++)
+            value = (value << 8) | data[n];
+        return (int64_t)value;
+    }
+
+    // Only the first SEI message of the NAL unit (the one written by insert()) is checked
+    static bool parsePayload(const std::vector<unsigned char>& payload, LatencyTrace& trace)
+    {
+        if (payload.size() < 2 + uuidSize + traceSize || payload[0] != 5 ||
+            payload[1] != uuidSize + traceSize)
+            return false;
+        unsigned int n;
+        for (n = 0; n < uuidSize; n++)
+            if (payload[2 + n] != uuid[n])
+                return false;
+        const unsigned char* traceData = payload.data() + 2 + uuidSize;
+        if (traceData[0] != traceVersion)
+            return false;
+        trace.captureDateTs = parseInt64(traceData + 1);
+        trace.captureMonotonicTs = parseInt64(traceData + 9);
+        trace.encoderInputDateTs = parseInt64(traceData + 17);
+        trace.encoderOutputDateTs = parseInt64(traceData + 25);
+        return true;
+    }
+
+    // nALUnitStart: after the start code. Returns false at the end of the data
+    static bool nextNALUnit(const unsigned char* data, unsigned int size, unsigned int& offset,
+                            unsigned int& nALUnitStart, unsigned int& nALUnitSize)
+    {
+        while (offset + 3 <= size &&
+               !(data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1))
+            offset++;
+        if (offset + 3 >= size)
+            return false;
+        nALUnitStart = offset + 3;
+        offset = nALUnitStart;
+        while (offset + 3 <= size &&
+               !(data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1))
+            offset++;
+        if (offset + 3 > size)
+            offset = size;
+        unsigned int end = offset;
+        while (end > nALUnitStart && end < size && data[end - 1] == 0)
+            end--;
+        nALUnitSize = end - nALUnitStart;
+        return true;
+    }
+
+};
+
+const unsigned char LatencyTraceSEI::uuid[LatencyTraceSEI::uuidSize] =
+{
+    0x6c, 0x61, 0x61, 0x76, 0x2d, 0x6c, 0x61, 0x74,
+    0x65, 0x6e, 0x63, 0x79, 0x2d, 0x76, 0x30, 0x31
+};
+
+// The coded slices (1-5)
+template <>
+bool LatencyTraceSEI::isPicture<H264>(const unsigned char* nALUnit)
+{
+    unsigned char nALUnitType = nALUnit[0] & 0x1F;
+    return nALUnitType >= 1 && nALUnitType <= 5;
+}
+template <>
+bool LatencyTraceSEI::isSEI<H264>(const unsigned char* nALUnit)
+{
+    return (nALUnit[0] & 0x1F) == 6;
+}
+template <>
+unsigned int LatencyTraceSEI::nALUnitHeaderSize<H264>()
+{
+    return 1;
+}
+template <>
+void LatencyTraceSEI::appendNALUnitHeader<H264>(std::vector<unsigned char>& packet)
+{
+    packet.push_back(6);
+}
+
+// The VCL NAL units (0-31)
+template <>
+bool LatencyTraceSEI::isPicture<H265>(const unsigned char* nALUnit)
+{
+    return ((nALUnit[0] >> 1) & 0x3F) <= 31;
+}
+// PREFIX_SEI_NUT
+template <>
+bool LatencyTraceSEI::isSEI<H265>(const unsigned char* nALUnit)
+{
+    return ((nALUnit[0] >> 1) & 0x3F) == 39;
+}
+template <>
+unsigned int LatencyTraceSEI::nALUnitHeaderSize<H265>()
+{
+    return 2;
+}
+// nuh_layer_id 0, nuh_temporal_id_plus1 1
+template <>
+void LatencyTraceSEI::appendNALUnitHeader<H265>(std::vector<unsigned char>& packet)
+{
+    packet.push_back(39 << 1);
+    packet.push_back(1);
+}
+
+}
+
+#endif // LATENCYTRACESEI_HPP_INCLUDED
@@ -0,0 +1,293 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef MOTIONDETECTOR_HPP_INCLUDED
+#define MOTIONDETECTOR_HPP_INCLUDED
+
+#include <algorithm>
+#include <vector>
+#include "Common.hpp"
+#include "Frame.hpp"
+#include "VideoEncoder.hpp"
+
+namespace laav
+{
+
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameHolder;
+
+/*
+ * Cheap motion detection for the raw planar frames (the luma plane is used): the luma is
+ * downscaled (4x4 pixels -> 1) and compared (SAD) with the previous frame's one, block
+ * by block (16x16 pixels). A block moves if the average difference of its downscaled
+ * pixels is bigger than threshold.
+ * Placed before an encoder, it:
+ *
+ *   - raises the quality of the moving regions, and lowers the background's one, by
+ *     qualityOffset (0..1, see VideoRegionOfInterest; 0 disables the regions)
+ *   - skips the frames without motion, except one every idleFrameInterval ones (I.E: 1 fps
+ *     for a 25 fps camera with idleFrameInterval = 25; 0 disables the skipping)
+ *
+ * I.E:
+ *
+ *   MotionDetector <YUV420_PLANAR, WIDTH, HEIGHT> vMotion(8, 25);
+ *   vGrab >> vConv >> vMotion >> vEnc >> vStream;
+ */
+template <typename RawVideoFrameFormat, unsigned int width, unsigned int height>
+class MotionDetector
+{
+
+    static_assert(std::is_base_of<Planar3RawVideoFrame,
+                                  VideoFrame<RawVideoFrameFormat, width, height> >::value,
+                  "MotionDetector needs a planar format (the luma plane is analyzed)");
+
+public:
+
+    MotionDetector(unsigned int threshold = 8, unsigned int idleFrameInterval = 0,
+                   float qualityOffset = 0.3) :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mThreshold(threshold),
+        mIdleFrameInterval(idleFrameInterval),
+        mQualityOffset(qualityOffset),
+        mHasPreviousLuma(false),
+        mMotion(false),
+        mSkippedFrames(0),
+        mSkipFrame(false)
+    {
+        mDownscaledLuma.resize(cellsPerRow * cellsPerColumn);
+        mPreviousDownscaledLuma.resize(cellsPerRow * cellsPerColumn);
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void analyze(const VideoFrame<RawVideoFrameFormat, width, height>& videoFrame)
+    {
+        if (videoFrame.template size<0>() == 0)
+            throw MediaException(MEDIA_NO_DATA);
+
+        mVideoFrame = videoFrame;
+        downscaleLuma(videoFrame.template plane<0>());
+        findMovingRegions();
+        mDownscaledLuma.swap(mPreviousDownscaledLuma);
+        mHasPreviousLuma = true;
+
+        mSkipFrame = false;
+        if (!mMotion && mIdleFrameInterval != 0)
+        {
+            mSkipFrame = (mSkippedFrames + 1 < mIdleFrameInterval);
+            mSkippedFrames = mSkipFrame ? mSkippedFrames + 1 : 0;
+        }
+        else
+            mSkippedFrames = 0;
+    }
+
+    // Of the last analyzed frame
+    bool motion() const
+    {
+        return mMotion;
+    }
+
+    // The moving regions (quality raised) first, then the whole frame (background)
+    const std::vector<VideoRegionOfInterest>& regionsOfInterest() const
+    {
+        return mRegionsOfInterest;
+    }
+
+    template <typename EncodedVideoFrameCodec>
+    VideoEncoder<RawVideoFrameFormat, EncodedVideoFrameCodec, width, height>&
+    operator >>
+    (VideoEncoder<RawVideoFrameFormat, EncodedVideoFrameCodec, width, height>& videoEncoder)
+    {
+        if (mMediaStatusInPipe == MEDIA_READY && mSkipFrame)
+            mMediaStatusInPipe = MEDIA_NO_DATA;
+        if (mMediaStatusInPipe == MEDIA_READY)
+            videoEncoder.mMediaStatusInPipe = MEDIA_READY;
+        else
+        {
+            videoEncoder.mMediaStatusInPipe = mMediaStatusInPipe;
+            mMediaStatusInPipe = MEDIA_READY;
+            return videoEncoder;
+        }
+        try
+        {
+            videoEncoder.setRegionsOfInterest(mRegionsOfInterest);
+            videoEncoder.encode(mVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoEncoder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoEncoder;
+    }
+
+    // The frames without motion are skipped here too (I.E: for a recording)
+    VideoFrameHolder<RawVideoFrameFormat, width, height>&
+    operator >>
+    (VideoFrameHolder<RawVideoFrameFormat, width, height>& videoFrameHolder)
+    {
+        if (mMediaStatusInPipe == MEDIA_READY && mSkipFrame)
+            mMediaStatusInPipe = MEDIA_NO_DATA;
+        if (mMediaStatusInPipe == MEDIA_READY)
+        {
+            videoFrameHolder.hold(mVideoFrame);
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        else
+        {
+            videoFrameHolder.mMediaStatusInPipe = mMediaStatusInPipe;
+            mMediaStatusInPipe = MEDIA_READY;
+        }
+        return videoFrameHolder;
+    }
+
+    // TODO: private with friend framer, decoder
+    enum MediaStatus mMediaStatusInPipe;
+
+private:
+
+    static const unsigned int cellSize = 4;
+    static const unsigned int cellsPerBlock = 4;
+    static const unsigned int cellsPerRow = width / cellSize;
+    static const unsigned int cellsPerColumn = height / cellSize;
+    static const unsigned int blocksPerRow = (cellsPerRow + cellsPerBlock - 1) / cellsPerBlock;
+    static const unsigned int blocksPerColumn =
+    (cellsPerColumn + cellsPerBlock - 1) / cellsPerBlock;
+
+    // The luma plane's stride is width (see FFMPEGVideoConverter, V4L2Grabber)
+    void downscaleLuma(const unsigned char* luma)
+    {
+        unsigned int cellRow, cellColumn, y, x;
+        for (cellRow = 0; cellRow < cellsPerColumn; cellRow++)
+        {
+            const unsigned char* rows = luma + cellRow * cellSize * width;
+            unsigned char* cells = &mDownscaledLuma[cellRow * cellsPerRow];
+            for (cellColumn = 0; cellColumn < cellsPerRow; cellColumn++)
+            {
+                unsigned int sum = 0;
+                for (y = 0; y < cellSize; y++)
+                    for (x = 0; x < cellSize; x++)
+                        sum += rows[y * width + cellColumn * cellSize + x];
+                cells[cellColumn] = sum / (cellSize * cellSize);
+            }
+        }
+    }
+
+    bool blockMoves(unsigned int blockRow, unsigned int blockColumn) const
+    {
+        unsigned int firstRow = blockRow * cellsPerBlock;
+        unsigned int firstColumn = blockColumn * cellsPerBlock;
+        unsigned int lastRow = firstRow + cellsPerBlock;
+        unsigned int lastColumn = firstColumn + cellsPerBlock;
+        if (lastRow > cellsPerColumn)
+            lastRow = cellsPerColumn;
+        if (lastColumn > cellsPerRow)
+            lastColumn = cellsPerRow;
+        unsigned int sad = 0;
+        unsigned int row, column;
+        for (row = firstRow; row < lastRow; row++)
+            for (column = firstColumn; column < lastColumn; column++)
+            {
+                int difference = (int)mDownscaledLuma[row * cellsPerRow + column] -
+                                 (int)mPreviousDownscaledLuma[row * cellsPerRow + column];
+                sad += difference < 0 ? -difference : difference;
+            }
+        return sad > mThreshold * (lastRow - firstRow) * (lastColumn - firstColumn);
+    }
+
+    /*
+     * The runs of moving blocks of each row of blocks become rectangles, which are
+     * extended downwards while the next rows have the same runs.
+     */
+    void findMovingRegions()
+    {
+        mRegionsOfInterest.clear();
+        mMotion = !mHasPreviousLuma;
+        std::vector<unsigned int> openRegions;
+        std::vector<unsigned int> nextOpenRegions;
+        unsigned int blockRow, blockColumn;
+        for (blockRow = 0; mHasPreviousLuma && blockRow < blocksPerColumn; blockRow++)
+        {
+            nextOpenRegions.clear();
+            bool inRun = false;
+            unsigned int runStart = 0;
+            for (blockColumn = 0; blockColumn <= blocksPerRow; blockColumn++)
+            {
+                if (blockColumn < blocksPerRow && blockMoves(blockRow, blockColumn))
+                {
+                    if (!inRun)
+                        runStart = blockColumn;
+                    inRun = true;
+                    continue;
+                }
+                if (!inRun)
+                    continue;
+                inRun = false;
+                mMotion = true;
+                addRun(blockRow, runStart, blockColumn, openRegions, nextOpenRegions);
+            }
+            openRegions.swap(nextOpenRegions);
+        }
+
+        if (mQualityOffset == 0)
+        {
+            mRegionsOfInterest.clear();
+            return;
+        }
+        VideoRegionOfInterest background;
+        background.x = 0;
+        background.y = 0;
+        background.width = width;
+        background.height = height;
+        background.qualityOffset = mMotion && mRegionsOfInterest.size() == 0 ? 0 : mQualityOffset;
+        mRegionsOfInterest.push_back(background);
+    }
+
+    static const unsigned int blockSize = cellSize * cellsPerBlock;
+
+    // blocks [firstColumn, lastColumn) of blockRow
+    void addRun(unsigned int blockRow, unsigned int firstColumn, unsigned int lastColumn,
+                const std::vector<unsigned int>& openRegions,
+                std::vector<unsigned int>& nextOpenRegions)
+    {
+        VideoRegionOfInterest region;
+        region.x = firstColumn * blockSize;
+        region.y = blockRow * blockSize;
+        region.width = std::min(lastColumn * blockSize, width) - region.x;
+        region.height = std::min((blockRow + 1) * blockSize, height) - region.y;
+        region.qualityOffset = -mQualityOffset;
+        unsigned int n;
+        for (n = 0; n < openRegions.size(); n++)
+        {
+            VideoRegionOfInterest& openRegion = mRegionsOfInterest[openRegions[n]];
+            if (openRegion.x == region.x && openRegion.width == region.width)
+            {
+                openRegion.height = region.y + region.height - openRegion.y;
+                nextOpenRegions.push_back(openRegions[n]);
+                return;
+            }
+        }
+        nextOpenRegions.push_back(mRegionsOfInterest.size());
+        mRegionsOfInterest.push_back(region);
+    }
+
+    unsigned int mThreshold;
+    unsigned int mIdleFrameInterval;
+    float mQualityOffset;
+    VideoFrame<RawVideoFrameFormat, width, height> mVideoFrame;
+    std::vector<unsigned char> mDownscaledLuma;
+    std::vector<unsigned char> mPreviousDownscaledLuma;
+    bool mHasPreviousLuma;
+    bool mMotion;
+    std::vector<VideoRegionOfInterest> mRegionsOfInterest;
+    unsigned int mSkippedFrames;
+    bool mSkipFrame;
+
+};
+
+}
+
+#endif // MOTIONDETECTOR_HPP_INCLUDED
@@ -0,0 +1,118 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef MUXEDCHUNKSPOOL_HPP_INCLUDED
+#define MUXEDCHUNKSPOOL_HPP_INCLUDED
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Common.hpp"
+
+extern "C"
+{
+#include <libavutil/mem.h>
+}
+
+namespace laav
+{
+
+/*
+ * Pool of fixed size blocks, where the muxers store the chunks written by their AVIO
+ * contexts. The blocks are allocated in slabs, only when a muxer needs more chunks than
+ * the ones it already owns, and they are given back to the pool when the muxer is
+ * destroyed. All the muxers with the same AVIO buffer size share the same pool (see
+ * sharedPool()), I.E: a muxer destroyed by a shard can give its blocks to a muxer created
+ * by another one.
+ */
+class MuxedChunksPool
+{
+
+public:
+
+    MuxedChunksPool(size_t blockSize, unsigned int blocksPerSlab = 32) :
+        mBlockSize(blockSize),
+        mBlocksPerSlab(blocksPerSlab)
+    {
+        if (blockSize == 0 || blocksPerSlab == 0)
+            printAndThrowUnrecoverableError("blockSize == 0 || blocksPerSlab == 0");
+    }
+
+    ~MuxedChunksPool()
+    {
+        using Iter = std::vector<uint8_t* >::iterator;
+        for (Iter it = mSlabs.begin(); it != mSlabs.end(); ++it)
+            av_free(*it);
+    }
+
+    /*!
+     *  \exception If a new slab can't be allocated
+     */
+    uint8_t* takeBlock()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mFreeBlocks.empty())
+        {
+            uint8_t* slab = (uint8_t* )av_malloc(mBlockSize * mBlocksPerSlab);
+            if (!slab)
+                printAndThrowUnrecoverableError("(uint8_t* )av_malloc(...)");
+            mSlabs.push_back(slab);
+            unsigned int n;
+            for (n = 0; n < mBlocksPerSlab; n++)
+                mFreeBlocks.push_back(slab + n * mBlockSize);
+        }
+        uint8_t* block = mFreeBlocks.back();
+        mFreeBlocks.pop_back();
+        return block;
+    }
+
+    void giveBackBlock(uint8_t* block)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFreeBlocks.push_back(block);
+    }
+
+    size_t blockSize() const
+    {
+        return mBlockSize;
+    }
+
+    // Memory currently allocated by the pool, used + free
+    size_t allocatedBytes()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mSlabs.size() * mBlocksPerSlab * mBlockSize;
+    }
+
+    // The process-wide pool for the given block size
+    static std::shared_ptr<MuxedChunksPool> sharedPool(size_t blockSize)
+    {
+        static std::mutex poolsMutex;
+        static std::map<size_t, std::weak_ptr<MuxedChunksPool> > pools;
+        std::lock_guard<std::mutex> lock(poolsMutex);
+        std::shared_ptr<MuxedChunksPool> pool = pools[blockSize].lock();
+        if (!pool)
+        {
+            pool = std::make_shared<MuxedChunksPool>(blockSize);
+            pools[blockSize] = pool;
+        }
+        return pool;
+    }
+
+private:
+
+    size_t mBlockSize;
+    unsigned int mBlocksPerSlab;
+    std::vector<uint8_t* > mSlabs;
+    std::vector<uint8_t* > mFreeBlocks;
+    std::mutex mMutex;
+
+};
+
+}
+
+#endif // MUXEDCHUNKSPOOL_HPP_INCLUDED
@@ -0,0 +1,82 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef MUXEDDATASINK_HPP_INCLUDED
+#define MUXEDDATASINK_HPP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C"
+{
+#include <event2/buffer.h>
+}
+
+namespace laav
+{
+
+/*
+ * Destination of a muxer in contiguous output mode (see
+ * FFMPEGMuxerCommonImpl::setMuxedDataSink()): the data flushed by the muxer's AVIO
+ * context is passed straight to the sink, without being copied into the muxed chunks.
+ */
+class MuxedDataSink
+{
+
+public:
+
+    virtual ~MuxedDataSink()
+    {
+    }
+
+    /*
+     * data is valid only during the call. Returning false makes the muxing fail
+     * (I.E: av_write_frame(...) returns an error).
+     */
+    virtual bool writeMuxedData(const uint8_t* data, size_t size) = 0;
+
+    /*
+     * A sink which cuts the stream (I.E: in segments) gets keyFrameBoundary() before each
+     * video keyframe is muxed: all the data preceding the keyframe has already been passed
+     * to writeMuxedData(), and the data following it can be decoded on its own.
+     */
+    virtual bool cutsOnKeyFrames() const
+    {
+        return false;
+    }
+
+    // timestamp: the keyframe's presentation time, in microseconds
+    virtual void keyFrameBoundary(int64_t timestamp)
+    {
+    }
+
+};
+
+// Appends the muxed data to a caller-provided evbuffer
+class EvbufferMuxedDataSink : public MuxedDataSink
+{
+
+public:
+
+    EvbufferMuxedDataSink(struct evbuffer* buffer) :
+        mBuffer(buffer)
+    {
+    }
+
+    bool writeMuxedData(const uint8_t* data, size_t size)
+    {
+        return evbuffer_add(mBuffer, data, size) == 0;
+    }
+
+private:
+
+    struct evbuffer* mBuffer;
+
+};
+
+}
+
+#endif // MUXEDDATASINK_HPP_INCLUDED
@@ -14,6 +14,7 @@ class NV_12_PLANAR {};
 
 template <unsigned int width_, unsigned int height_>
 class VideoFrame<NV_12_PLANAR, width_, height_> :
+public VideoFrameBase<width_, height_>,
 public Planar3RawVideoFrame,
 public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
 {
@@ -30,7 +31,12 @@ public:
      */    
     const Pixel<unsigned char, unsigned char, unsigned char>& pixelAt(uint16_t x, uint16_t y) const
     {
-        printAndThrowUnrecoverableError("NOT IMPLEMENTED YET! TODO!");
+        if (x > width_ - 1 || y > height_ - 1)
+            throw OutOfBounds();
+
+        mCurrPixel.set(this->plane<0>()[lumaOffset(x, y)],
+                       this->plane<1>()[chromaOffset(x, y) + 0],
+                       this->plane<1>()[chromaOffset(x, y) + 1]);
         return mCurrPixel;
     }
 
@@ -40,7 +46,27 @@ public:
     void setPixelAt(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
                     uint16_t x, uint16_t y)
     {
-        printAndThrowUnrecoverableError("NOT IMPLEMENTED YET! TODO!");
+        if (x > width_ - 1 || y > height_ - 1)
+            throw OutOfBounds();
+
+        this->plane<0>()[lumaOffset(x, y)] = pixel.component<0>();
+        this->plane<1>()[chromaOffset(x, y) + 0] = pixel.component<1>();
+        this->plane<1>()[chromaOffset(x, y) + 1] = pixel.component<2>();
+    }
+
+private:
+
+    // Plane 1 holds the interleaved U and V samples (UVUV...) of each pair of columns
+    static const unsigned int chromaStride = 2 * ((width_ + 1) / 2);
+
+    static constexpr unsigned int lumaOffset(unsigned int x, unsigned int y)
+    {
+        return y * width_ + x;
+    }
+
+    static constexpr unsigned int chromaOffset(unsigned int x, unsigned int y)
+    {
+        return (y / 2) * chromaStride + (x / 2) * 2;
     }
 
 };
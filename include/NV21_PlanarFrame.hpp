@@ -14,7 +14,9 @@ class NV_21_PLANAR {};
 
 template <unsigned int width_, unsigned int height_>
 class VideoFrame<NV_21_PLANAR, width_, height_> :
-public Planar3RawVideoFrame, public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
+public VideoFrameBase<width_, height_>,
+public Planar3RawVideoFrame,
+public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
 {
 
 public:
@@ -29,17 +31,42 @@ public:
      */    
     const Pixel<unsigned char, unsigned char, unsigned char>& pixelAt(uint16_t x, uint16_t y) const
     {
-        printAndThrowUnrecoverableError("NOT IMPLEMENTED YET! TODO!");
+        if (x > width_ - 1 || y > height_ - 1)
+            throw OutOfBounds();
+
+        mCurrPixel.set(this->plane<0>()[lumaOffset(x, y)],
+                       this->plane<1>()[chromaOffset(x, y) + 1],
+                       this->plane<1>()[chromaOffset(x, y) + 0]);
         return mCurrPixel;
     }
 
     /*!
      *  \exception OutOfBounds
-     */    
+     */
     void setPixelAt(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
                     uint16_t x, uint16_t y)
     {
-        printAndThrowUnrecoverableError("NOT IMPLEMENTED YET! TODO!");
+        if (x > width_ - 1 || y > height_ - 1)
+            throw OutOfBounds();
+
+        this->plane<0>()[lumaOffset(x, y)] = pixel.component<0>();
+        this->plane<1>()[chromaOffset(x, y) + 1] = pixel.component<1>();
+        this->plane<1>()[chromaOffset(x, y) + 0] = pixel.component<2>();
+    }
+
+private:
+
+    // Plane 1 holds the interleaved V and U samples (VUVU...) of each pair of columns
+    static const unsigned int chromaStride = 2 * ((width_ + 1) / 2);
+
+    static constexpr unsigned int lumaOffset(unsigned int x, unsigned int y)
+    {
+        return y * width_ + x;
+    }
+
+    static constexpr unsigned int chromaOffset(unsigned int x, unsigned int y)
+    {
+        return (y / 2) * chromaStride + (x / 2) * 2;
     }
 
 };
@@ -0,0 +1,116 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef PIPEWORKER_HPP_INCLUDED
+#define PIPEWORKER_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "Common.hpp"
+
+namespace laav
+{
+
+/*
+ * Runs a pipe segment on its own thread (requires -pthread). The segment is executed
+ * every time one of its input rings (see FrameRing.hpp) is pushed, I.E:
+ *
+ *   VideoFrameRing<YUYV422_PACKED, WIDTH, HEIGHT> vRing;
+ *   PipeWorker vWorker([&]()
+ *   {
+ *       vRing >> vFh2 >> vConv >> vEnc >> vFh3 >> vEncodedRing;
+ *   });
+ *   vRing.wakeUpOnPush(vWorker);
+ *
+ * All the nodes of the segment must be accessed only by the worker's thread; the
+ * events catcher and the nodes which observe events (grabbers, streamers...) must stay
+ * on the main loop's thread.
+ */
+class PipeWorker
+{
+
+public:
+
+    PipeWorker(const std::function<void()>& pipeSegment) :
+        mPipeSegment(pipeSegment),
+        mPendingWakeUps(0),
+        mStop(false),
+        mThread(&PipeWorker::run, this)
+    {
+    }
+
+    ~PipeWorker()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCondition.notify_one();
+        if (mThread.joinable())
+            mThread.join();
+    }
+
+    // Thread safe: the segment will be executed once more for each call
+    void wakeUp()
+    {
+        // Don't lock if the worker has already been woken up
+        if (mPendingWakeUps.fetch_add(1) != 0)
+            return;
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCondition.notify_one();
+    }
+
+private:
+
+    void run()
+    {
+        while (1)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                // Periodic timeout: the segment also runs without inputs (I.E: to flush)
+                mCondition.wait_for(lock, std::chrono::milliseconds(100),
+                                    [this] { return mPendingWakeUps.load() != 0 || mStop; });
+                if (mStop)
+                    return;
+                if (mPendingWakeUps.load() == 0)
+                {
+                    lock.unlock();
+                    mPipeSegment();
+                    continue;
+                }
+            }
+            // I.E: N frames pushed while the segment was running -> N executions
+            while (mPendingWakeUps.load() != 0 && !mStop)
+            {
+                mPipeSegment();
+                mPendingWakeUps--;
+            }
+        }
+    }
+
+    std::function<void()> mPipeSegment;
+    std::atomic<unsigned int> mPendingWakeUps;
+    std::atomic<bool> mStop;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    // Last member: the thread must start when everything else is initialized
+    std::thread mThread;
+
+};
+
+}
+
+#endif // PIPEWORKER_HPP_INCLUDED
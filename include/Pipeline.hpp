@@ -0,0 +1,428 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef PIPELINE_HPP_INCLUDED
+#define PIPELINE_HPP_INCLUDED
+
+#include <type_traits>
+#include <utility>
+#include "Common.hpp"
+
+namespace laav
+{
+
+/*
+ * A pipe fused at compile time: the frame output by each stage is passed by reference
+ * to the next one, without holders (and their copies) and without the status checks of
+ * the >> operators along the pipe: the pipe stops at the first stage which has nothing
+ * to output (no new frame, an encoder which is buffering...). I.E:
+ *
+ *   auto vPipe = makePipeline(vGrab, vConv, vEnc, makeFanOut(vMux, vStream));
+ *   while (1)
+ *   {
+ *       vPipe.run();
+ *       eventsCatcher->catchNextEvent();
+ *   }
+ *
+ * is equivalent to:
+ *
+ *   vGrab >> vConv >> vEnc >> vFh;
+ *                             vFh >> vMux;
+ *                             vFh >> vStream;
+ *
+ * The stages are taken by reference (they must outlive the pipe), and they are used
+ * through their methods:
+ * - source (the first stage): pollNextFrame() or pollNextPeriod() (the grabbers, the
+ *   frame rings);
+ * - converters and decoders: convert(frame) or decode(frame), whose output frame goes on
+ *   along the pipe;
+ * - encoders: encode(frame), whose new encoded frames (see numOfNewEncodedFrames()) go
+ *   on along the pipe, one after the other;
+ * - sinks (the last stage): takeStreamableFrame(frame), takeMuxableFrame(frame),
+ *   analyze(frame), push(frame) (the frame rings); after each frame taken from the
+ *   source, the HTTP streamers send their muxed data (streamMuxedData(), sendMuxedData()).
+ * A stage which can't take the frames of the previous one (I.E: a different format or
+ * size) is a compile time error, as it is for the >> operators.
+ *
+ * makeFanOut(...) is a sink which feeds several branches with the same frames: each branch
+ * is a sink or a chain of stages, see makeBranch(...), I.E:
+ *
+ *   makePipeline(vGrab, vConv, makeFanOut(makeBranch(vEnc1, vStream1),
+ *                                         makeBranch(vConv2, vEnc2, vStream2)));
+ *
+ * An exception of a branch doesn't stop the other branches (like the >> operators, which
+ * ignore the exceptions of the end of the pipe).
+ */
+
+template <typename... Stages>
+class PipelineChain;
+
+template <typename... Branches>
+class PipelineFanOut;
+
+template <typename Stage>
+struct IsPipelineComposite : std::false_type
+{
+};
+
+template <typename... Stages>
+struct IsPipelineComposite<PipelineChain<Stages...> > : std::true_type
+{
+};
+
+template <typename... Branches>
+struct IsPipelineComposite<PipelineFanOut<Branches...> > : std::true_type
+{
+};
+
+// The user's stages are referenced, the chains and the fan-outs are held by value
+template <typename Stage>
+struct PipelineStorage
+{
+    typedef typename std::remove_reference<Stage>::type Type;
+    typedef typename std::conditional<IsPipelineComposite<Type>::value, Type, Type&>::type type;
+};
+
+// The overloads with a higher rank are preferred
+template <unsigned int rank>
+struct PipelineRank : PipelineRank<rank - 1>
+{
+};
+
+template <>
+struct PipelineRank<0>
+{
+};
+
+/*
+ * Keeps the forwarding constructors of the chains and of the fan-outs from being chosen
+ * instead of the copy constructor, when copying a non const one
+ */
+template <typename Composite, typename Arg>
+struct PipelineNotCopy :
+std::enable_if<!std::is_same<typename std::decay<Arg>::type, Composite>::value>
+{
+};
+
+template <typename Stage>
+struct PipelineAlwaysFalse : std::false_type
+{
+};
+
+struct PipelineStage
+{
+    template <typename Source>
+    static auto poll(Source& source, PipelineRank<2>) -> decltype(source.pollNextFrame())
+    {
+        return source.pollNextFrame();
+    }
+
+    template <typename Source>
+    static auto poll(Source& source, PipelineRank<1>) -> decltype(source.pollNextPeriod())
+    {
+        return source.pollNextPeriod();
+    }
+
+    template <typename Source>
+    static void* poll(Source& source, PipelineRank<0>)
+    {
+        static_assert(PipelineAlwaysFalse<Source>::value,
+                      "The first stage of a pipeline must be a source (pollNextFrame/Period())");
+        return NULL;
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<8>)
+    -> decltype(nextStages.push(stage.convert(frame)))
+    {
+        nextStages.push(stage.convert(frame));
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<7>)
+    -> decltype(nextStages.push(stage.decode(frame)))
+    {
+        nextStages.push(stage.decode(frame));
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<6>)
+    -> decltype(stage.encode(frame), nextStages.push(stage.newEncodedFrame(0)))
+    {
+        stage.encode(frame);
+        unsigned int n;
+        for (n = 0; n < stage.numOfNewEncodedFrames(); n++)
+            nextStages.push(stage.newEncodedFrame(n));
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<5>)
+    -> decltype(stage.takeStreamableFrame(frame), void())
+    {
+        static_assert(NextStages::isEmpty, "A streamer must be the last stage of its chain");
+        stage.takeStreamableFrame(frame);
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<4>)
+    -> decltype(stage.takeMuxableFrame(frame), void())
+    {
+        static_assert(NextStages::isEmpty, "A muxer must be the last stage of its chain");
+        stage.takeMuxableFrame(frame);
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<3>)
+    -> decltype(stage.analyze(frame), void())
+    {
+        static_assert(NextStages::isEmpty, "A motion detector must be the last stage of its chain");
+        stage.analyze(frame);
+    }
+
+    // Frame rings, fan-outs and branches
+    template <typename Stage, typename Frame, typename NextStages>
+    static auto push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<2>)
+    -> decltype(stage.push(frame), void())
+    {
+        static_assert(NextStages::isEmpty, "A ring or a fan-out must be the last stage of its chain");
+        stage.push(frame);
+    }
+
+    template <typename Stage, typename Frame, typename NextStages>
+    static void push(Stage& stage, Frame& frame, NextStages& nextStages, PipelineRank<0>)
+    {
+        static_assert(PipelineAlwaysFalse<Stage>::value,
+                      "A stage of the pipeline can't take the frames output by the previous one");
+    }
+
+    template <typename Stage>
+    static auto finish(Stage& stage, PipelineRank<3>)
+    -> typename std::enable_if<IsPipelineComposite<Stage>::value>::type
+    {
+        stage.finish();
+    }
+
+    template <typename Stage>
+    static auto finish(Stage& stage, PipelineRank<2>) -> decltype(stage.streamMuxedData(), void())
+    {
+        stage.streamMuxedData();
+    }
+
+    template <typename Stage>
+    static auto finish(Stage& stage, PipelineRank<1>) -> decltype(stage.sendMuxedData(), void())
+    {
+        stage.sendMuxedData();
+    }
+
+    template <typename Stage>
+    static void finish(Stage& stage, PipelineRank<0>)
+    {
+    }
+};
+
+template <>
+class PipelineChain<>
+{
+
+public:
+
+    static const bool isEmpty = true;
+
+    template <typename Frame>
+    void push(Frame& frame)
+    {
+    }
+
+    void finish()
+    {
+    }
+
+};
+
+template <typename Stage, typename... Stages>
+class PipelineChain<Stage, Stages...>
+{
+
+public:
+
+    static const bool isEmpty = false;
+
+    // Not a copy constructor (see PipelineNotCopy)
+    template <typename StageArg, typename... StageArgs,
+              typename = typename PipelineNotCopy<PipelineChain, StageArg>::type>
+    explicit PipelineChain(StageArg&& stage, StageArgs&&... stages) :
+        mStage(std::forward<StageArg>(stage)),
+        mNextStages(std::forward<StageArgs>(stages)...)
+    {
+    }
+
+    /*!
+     *  \exception MediaException(cause) the cause of the stage which had nothing to output
+     */
+    template <typename Frame>
+    void push(Frame& frame)
+    {
+        PipelineStage::push(mStage, frame, mNextStages, PipelineRank<8>());
+    }
+
+    // Called once the source's frame has gone through the chain
+    void finish()
+    {
+        PipelineStage::finish(mStage, PipelineRank<3>());
+        mNextStages.finish();
+    }
+
+private:
+
+    typename PipelineStorage<Stage>::type mStage;
+    PipelineChain<Stages...> mNextStages;
+
+};
+
+template <>
+class PipelineFanOut<>
+{
+
+public:
+
+    template <typename Frame>
+    void push(Frame& frame)
+    {
+    }
+
+    void finish()
+    {
+    }
+
+};
+
+template <typename Branch, typename... Branches>
+class PipelineFanOut<Branch, Branches...>
+{
+
+public:
+
+    template <typename BranchArg, typename... BranchArgs,
+              typename = typename PipelineNotCopy<PipelineFanOut, BranchArg>::type>
+    explicit PipelineFanOut(BranchArg&& branch, BranchArgs&&... branches) :
+        mBranch(std::forward<BranchArg>(branch)),
+        mOtherBranches(std::forward<BranchArgs>(branches)...)
+    {
+    }
+
+    template <typename Frame>
+    void push(Frame& frame)
+    {
+        try
+        {
+            mBranch.push(frame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing: the other branches must be fed anyway
+        }
+        mOtherBranches.push(frame);
+    }
+
+    void finish()
+    {
+        try
+        {
+            mBranch.finish();
+        }
+        catch (const MediaException& mediaException)
+        {
+        }
+        mOtherBranches.finish();
+    }
+
+private:
+
+    // A single sink is a chain of one stage
+    PipelineChain<Branch> mBranch;
+    PipelineFanOut<Branches...> mOtherBranches;
+
+};
+
+template <typename Source, typename... Stages>
+class Pipeline
+{
+
+public:
+
+    template <typename... StageArgs>
+    explicit Pipeline(Source& source, StageArgs&&... stages) :
+        mSource(source),
+        mStages(std::forward<StageArgs>(stages)...),
+        mStatus(MEDIA_NOT_READY)
+    {
+    }
+
+    /*
+     * Takes the source's next frame (if any) through the pipe: returns true if the frame
+     * reached the end, otherwise status() is the cause of its stop.
+     */
+    bool run()
+    {
+        auto frame = PipelineStage::poll(mSource, PipelineRank<2>());
+        if (!frame)
+        {
+            mStatus = MEDIA_NO_DATA;
+            return false;
+        }
+        try
+        {
+            mStages.push(*frame);
+            mStages.finish();
+            mStatus = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            mStatus = mediaException.cause();
+        }
+        return mStatus == MEDIA_READY;
+    }
+
+    enum MediaStatus status() const
+    {
+        return mStatus;
+    }
+
+private:
+
+    Source& mSource;
+    PipelineChain<Stages...> mStages;
+    enum MediaStatus mStatus;
+
+};
+
+template <typename Source, typename... Stages>
+Pipeline<Source, typename std::decay<Stages>::type...>
+makePipeline(Source& source, Stages&&... stages)
+{
+    return Pipeline<Source, typename std::decay<Stages>::type...>
+           (source, std::forward<Stages>(stages)...);
+}
+
+template <typename... Branches>
+PipelineFanOut<typename std::decay<Branches>::type...>
+makeFanOut(Branches&&... branches)
+{
+    return PipelineFanOut<typename std::decay<Branches>::type...>
+           (std::forward<Branches>(branches)...);
+}
+
+template <typename... Stages>
+PipelineChain<typename std::decay<Stages>::type...>
+makeBranch(Stages&&... stages)
+{
+    return PipelineChain<typename std::decay<Stages>::type...>
+           (std::forward<Stages>(stages)...);
+}
+
+}
+
+#endif // PIPELINE_HPP_INCLUDED
@@ -0,0 +1,290 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef REPLAYAUDIOGRABBER_HPP_INCLUDED
+#define REPLAYAUDIOGRABBER_HPP_INCLUDED
+
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "AllAudioCodecsAndFormats.hpp"
+#include "Common.hpp"
+#include "EventsManager.hpp"
+#include "AudioFrameHolder.hpp"
+#include "AudioMixer.hpp"
+
+namespace laav
+{
+
+/*
+ * Stand-in for AlsaGrabber without a sound card (I.E: benchmarks, tests): it grabs, in a
+ * loop, periods of the samples added with addSamples() or loadSamplesFromFile() (raw
+ * interleaved PCM, I.E: arecord -t raw), or of a 440 Hz tone if no sample is added.
+ * The periods are timestamped and grabbed as ReplayVideoGrabber's frames (see realTime).
+ * I.E:
+ *
+ *   ReplayAudioGrabber <S16_LE, SAMPLE_RATE, STEREO> aGrab(eventsCatcher, 1024);
+ *   ...
+ *   aGrab >> aConv >> aEnc >> aStream;
+ */
+template <typename CodecOrFormat, unsigned int audioSampleRate, enum AudioChannels audioChannels>
+class ReplayAudioGrabber : public EventsProducer
+{
+
+    static_assert(std::is_base_of<PackedRawAudioFrame,
+                                  AudioFrame<CodecOrFormat, audioSampleRate, audioChannels> >::value,
+                  "ReplayAudioGrabber replays the packed (interleaved) formats only");
+
+    typedef typename PCMSample<CodecOrFormat>::Type Sample;
+
+public:
+
+    ReplayAudioGrabber(SharedEventsCatcher eventsCatcher, unsigned int samplesPerPeriod = 1024,
+                       bool realTime = false) :
+        EventsProducer::EventsProducer(eventsCatcher),
+        mSamplesPerPeriod(samplesPerPeriod != 0 ? samplesPerPeriod : 1024),
+        mRealTime(realTime),
+        mStartTime(0),
+        mNumOfGrabbedPeriods(0)
+    {
+    }
+
+    // numOfSamples per channel; the samples are copied
+    void addSamples(const unsigned char* samples, unsigned int numOfSamples)
+    {
+        mSamples.insert(mSamples.end(), samples, samples + numOfSamples * bytesPerSample);
+        mPeriodsData.clear();
+    }
+
+    // Returns the number of loaded samples (per channel)
+    unsigned int loadSamplesFromFile(const std::string& fileName)
+    {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        if (!file)
+            return 0;
+        std::vector<unsigned char> fileData((std::istreambuf_iterator<char>(file)),
+                                            std::istreambuf_iterator<char>());
+        unsigned int numOfSamples = fileData.size() / bytesPerSample;
+        if (numOfSamples != 0)
+            addSamples(&fileData[0], numOfSamples);
+        return numOfSamples;
+    }
+
+    unsigned int samplesPerPeriod() const
+    {
+        return mSamplesPerPeriod;
+    }
+
+    unsigned long long numOfGrabbedPeriods() const
+    {
+        return mNumOfGrabbedPeriods;
+    }
+
+    AudioFrameHolder<CodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioFrameHolder<CodecOrFormat, audioSampleRate, audioChannels>& audioFrameHolder)
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioFrameHolder;
+        }
+        try
+        {
+            audioFrameHolder.hold(*grabbedAudioFrame);
+            audioFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioFrameHolder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioFrameHolder;
+    }
+
+    template <typename AudioCodec>
+    FFMPEGAudioEncoder<CodecOrFormat, AudioCodec, audioSampleRate, audioChannels>&
+    operator >>
+    (FFMPEGAudioEncoder<CodecOrFormat, AudioCodec, audioSampleRate, audioChannels>& audioEncoder)
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioEncoder;
+        }
+        try
+        {
+            audioEncoder.encode(*grabbedAudioFrame);
+            audioEncoder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioEncoder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioEncoder;
+    }
+
+    template <typename ConvertedPCMSoundFormat,
+              unsigned int convertedAudioSampleRate,
+              enum AudioChannels convertedAudioChannels>
+    FFMPEGAudioConverter<CodecOrFormat, audioSampleRate, audioChannels,
+                         ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
+    operator >>
+    (FFMPEGAudioConverter<CodecOrFormat, audioSampleRate, audioChannels,
+                          ConvertedPCMSoundFormat, convertedAudioSampleRate, convertedAudioChannels>&
+                          audioConverter)
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioConverter;
+        }
+        try
+        {
+            audioConverter.convert(*grabbedAudioFrame);
+            audioConverter.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioConverter.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioConverter;
+    }
+
+    AudioMixerInput<CodecOrFormat, audioSampleRate, audioChannels>&
+    operator >>
+    (AudioMixerInput<CodecOrFormat, audioSampleRate, audioChannels>& audioMixerInput)
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+        {
+            audioMixerInput.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioMixerInput;
+        }
+        try
+        {
+            audioMixerInput.take(*grabbedAudioFrame);
+            audioMixerInput.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            audioMixerInput.mMediaStatusInPipe = mediaException.cause();
+        }
+        return audioMixerInput;
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>& grabNextPeriod()
+    {
+        AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* grabbedAudioFrame =
+        pollNextPeriod();
+        if (!grabbedAudioFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *grabbedAudioFrame;
+    }
+
+    // As grabNextPeriod(), but returns NULL instead of throwing (see V4L2Grabber)
+    AudioFrame<CodecOrFormat, audioSampleRate, audioChannels>* pollNextPeriod()
+    {
+        if (mSamples.size() == 0)
+            addTone();
+        if (mPeriodsData.size() == 0)
+            splitPeriods();
+
+        if (mStartTime == 0)
+            mStartTime = av_gettime_relative();
+        int64_t captureTimestamp = mStartTime + (int64_t)(mNumOfGrabbedPeriods * mSamplesPerPeriod *
+                                                          1000000 / audioSampleRate);
+        if (mRealTime)
+        {
+            int64_t now = av_gettime_relative();
+            if (captureTimestamp > now)
+            {
+                if (!thereIsTimeoutPending())
+                    observeTimeout((captureTimestamp - now + 999) / 1000);
+                return NULL;
+            }
+        }
+
+        mGrabbedAudioFrame.assignDataSharedPtr(mPeriodsData[mNumOfGrabbedPeriods % mPeriodsData.size()]);
+        mGrabbedAudioFrame.setSize(mSamplesPerPeriod * bytesPerSample);
+        mGrabbedAudioFrame.setCaptureTimestamp(captureTimestamp);
+        mNumOfGrabbedPeriods++;
+        return &mGrabbedAudioFrame;
+    }
+
+private:
+
+    // Of all the channels
+    static const unsigned int bytesPerSample = sizeof(Sample) * (audioChannels + 1);
+
+    // One second
+    void addTone()
+    {
+        std::vector<Sample> tone(audioSampleRate * (audioChannels + 1));
+        unsigned int n;
+        for (n = 0; n < tone.size(); n++)
+            toSample(0.5 * sin(2 * M_PI * 440 * (n / (audioChannels + 1)) / audioSampleRate), tone[n]);
+        addSamples((const unsigned char* )&tone[0], audioSampleRate);
+    }
+
+    static void toSample(double value, int16_t& sample)
+    {
+        sample = lrint(value * 32767);
+    }
+
+    static void toSample(double value, float& sample)
+    {
+        sample = value;
+    }
+
+    // The periods are copied once (the last one wraps around), so that grabbing doesn't copy
+    void splitPeriods()
+    {
+        auto freePeriodData = [](unsigned char* periodData)
+        {
+            delete[] periodData;
+        };
+        unsigned int periodSize = mSamplesPerPeriod * bytesPerSample;
+        size_t offset;
+        for (offset = 0; offset < mSamples.size(); offset += periodSize)
+        {
+            ShareableAudioFrameData periodData(new unsigned char[periodSize], freePeriodData);
+            unsigned int copied = 0;
+            while (copied < periodSize)
+            {
+                size_t from = (offset + copied) % mSamples.size();
+                unsigned int size = std::min((size_t)(periodSize - copied), mSamples.size() - from);
+                memcpy(periodData.get() + copied, &mSamples[from], size);
+                copied += size;
+            }
+            mPeriodsData.push_back(periodData);
+        }
+    }
+
+    unsigned int mSamplesPerPeriod;
+    bool mRealTime;
+    int64_t mStartTime;
+    unsigned long long mNumOfGrabbedPeriods;
+    std::vector<unsigned char> mSamples;
+    std::vector<ShareableAudioFrameData> mPeriodsData;
+    AudioFrame<CodecOrFormat, audioSampleRate, audioChannels> mGrabbedAudioFrame;
+
+};
+
+}
+
+#endif // REPLAYAUDIOGRABBER_HPP_INCLUDED
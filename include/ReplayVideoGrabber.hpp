@@ -0,0 +1,339 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef REPLAYVIDEOGRABBER_HPP_INCLUDED
+#define REPLAYVIDEOGRABBER_HPP_INCLUDED
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "AllVideoCodecsAndFormats.hpp"
+#include "Common.hpp"
+#include "EventsManager.hpp"
+#include "VideoFrameHolder.hpp"
+
+namespace laav
+{
+
+/*
+ * Stand-in for V4L2Grabber without a camera (I.E: benchmarks, tests): it grabs, in a
+ * loop, the frames added with addFrame() or loadFramesFromFile(). The raw formats get a
+ * synthetic pattern (moving stripes) if no frame is added.
+ * The frames are timestamped as captured at fps; with realTime they are also grabbed at
+ * fps (grabNextFrame() throws MediaException(MEDIA_NO_DATA) until the next one is due,
+ * and the events catcher is woken up then), otherwise as fast as the pipe asks for them.
+ * I.E:
+ *
+ *   ReplayVideoGrabber <MJPEG, WIDTH, HEIGHT> vGrab(eventsCatcher, 30);
+ *   vGrab.loadFramesFromFile("capture.mjpeg");
+ *   ...
+ *   vGrab >> vDec >> vConv >> vEnc >> vStream;
+ */
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class ReplayVideoGrabber : public EventsProducer
+{
+
+    static_assert(std::is_base_of<PackedRawVideoFrame,
+                                  VideoFrame<CodecOrFormat, width, height> >::value ||
+                  std::is_same<CodecOrFormat, MJPEG>::value,
+                  "ReplayVideoGrabber replays the packed raw formats and MJPEG only");
+
+public:
+
+    ReplayVideoGrabber(SharedEventsCatcher eventsCatcher, unsigned int fps = 25,
+                       bool realTime = false) :
+        EventsProducer::EventsProducer(eventsCatcher),
+        mFrameDuration(1000000 / (fps != 0 ? fps : 25)),
+        mRealTime(realTime),
+        mStartTime(0),
+        mNumOfGrabbedFrames(0)
+    {
+    }
+
+    // The data is copied
+    void addFrame(const unsigned char* data, unsigned int size)
+    {
+        auto freeFrameData = [](unsigned char* frameData)
+        {
+            delete[] frameData;
+        };
+        ShareableVideoFrameData frameData(new unsigned char[size], freeFrameData);
+        memcpy(frameData.get(), data, size);
+        mFramesData.push_back(frameData);
+        mFramesSizes.push_back(size);
+    }
+
+    /*
+     * The raw file is a sequence of frames, the MJPEG one a sequence of JPEG images
+     * (I.E: ffmpeg -i in.mp4 -c:v mjpeg -f mjpeg out.mjpeg).
+     * Returns the number of loaded frames.
+     */
+    unsigned int loadFramesFromFile(const std::string& fileName)
+    {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        if (!file)
+            return 0;
+        std::vector<unsigned char> fileData((std::istreambuf_iterator<char>(file)),
+                                            std::istreambuf_iterator<char>());
+        unsigned int numOfFrames = mFramesData.size();
+        splitFrames(fileData, mGrabbedVideoFrame);
+        return mFramesData.size() - numOfFrames;
+    }
+
+    unsigned int numOfFrames() const
+    {
+        return mFramesData.size();
+    }
+
+    unsigned long long numOfGrabbedFrames() const
+    {
+        return mNumOfGrabbedFrames;
+    }
+
+    VideoFrameHolder<CodecOrFormat, width, height>&
+    operator >>
+    (VideoFrameHolder<CodecOrFormat, width, height>& videoFrameHolder)
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoFrameHolder;
+        }
+        try
+        {
+            videoFrameHolder.hold(*grabbedVideoFrame);
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoFrameHolder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoFrameHolder;
+    }
+
+    template <unsigned int scaleDenominator>
+    FFMPEGMJPEGDecoder<width, height, scaleDenominator>&
+    operator >>
+    (FFMPEGMJPEGDecoder<width, height, scaleDenominator>& videoDecoder)
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoDecoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoDecoder;
+        }
+        try
+        {
+            videoDecoder.decode(*grabbedVideoFrame);
+            videoDecoder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoDecoder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoDecoder;
+    }
+
+    template <typename EncodedVideoFrameCodec>
+    VideoEncoder<CodecOrFormat, EncodedVideoFrameCodec, width, height>&
+    operator >>
+    (VideoEncoder<CodecOrFormat, EncodedVideoFrameCodec, width, height>& videoEncoder)
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoEncoder;
+        }
+        try
+        {
+            videoEncoder.encode(*grabbedVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoEncoder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoEncoder;
+    }
+
+    template <typename ConvertedVideoFrameFormat, unsigned int outputWidth, unsigned int outputHeigth>
+    FFMPEGVideoConverter<CodecOrFormat, width, height,
+                         ConvertedVideoFrameFormat, outputWidth, outputHeigth>&
+    operator >>
+    (FFMPEGVideoConverter<CodecOrFormat, width, height,
+                          ConvertedVideoFrameFormat, outputWidth, outputHeigth>& videoConverter)
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoConverter;
+        }
+        try
+        {
+            videoConverter.convert(*grabbedVideoFrame);
+            videoConverter.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoConverter.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoConverter;
+    }
+
+    template <typename Container>
+    HTTPVideoStreamer<Container, CodecOrFormat, width, height>&
+    operator >>
+    (HTTPVideoStreamer<Container, CodecOrFormat, width, height>& httpVideoStreamer)
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+            return httpVideoStreamer;
+        try
+        {
+            httpVideoStreamer.takeStreamableFrame(*grabbedVideoFrame);
+            httpVideoStreamer.streamMuxedData();
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the streamer is at the end of the pipe
+        }
+        return httpVideoStreamer;
+    }
+
+    template <typename Container>
+    FFMPEGVideoMuxer<Container, CodecOrFormat, width, height>&
+    operator >>
+    (FFMPEGVideoMuxer<Container, CodecOrFormat, width, height>& videoMuxer)
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoMuxer.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoMuxer;
+        }
+        try
+        {
+            videoMuxer.takeMuxableFrame(*grabbedVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoMuxer.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoMuxer;
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    VideoFrame<CodecOrFormat, width, height>& grabNextFrame()
+    {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *grabbedVideoFrame;
+    }
+
+    // As grabNextFrame(), but returns NULL instead of throwing (see V4L2Grabber)
+    VideoFrame<CodecOrFormat, width, height>* pollNextFrame()
+    {
+        if (mFramesData.size() == 0)
+            addSyntheticFrames(mGrabbedVideoFrame);
+        if (mFramesData.size() == 0)
+            return NULL;
+
+        if (mStartTime == 0)
+            mStartTime = av_gettime_relative();
+        int64_t captureTimestamp = mStartTime + (int64_t)mNumOfGrabbedFrames * mFrameDuration;
+        if (mRealTime)
+        {
+            int64_t now = av_gettime_relative();
+            if (captureTimestamp > now)
+            {
+                if (!thereIsTimeoutPending())
+                    observeTimeout((captureTimestamp - now + 999) / 1000);
+                return NULL;
+            }
+        }
+
+        unsigned int n = mNumOfGrabbedFrames % mFramesData.size();
+        mGrabbedVideoFrame.assignDataSharedPtr(mFramesData[n]);
+        mGrabbedVideoFrame.setSize(mFramesSizes[n]);
+        mGrabbedVideoFrame.setCaptureTimestamp(captureTimestamp);
+        mNumOfGrabbedFrames++;
+        return &mGrabbedVideoFrame;
+    }
+
+private:
+
+    static const unsigned int numOfSyntheticFrames = 25;
+
+    void splitFrames(const std::vector<unsigned char>& fileData, const PackedRawVideoFrame&)
+    {
+        unsigned int frameSize = rawFrameSize();
+        size_t offset;
+        for (offset = 0; frameSize != 0 && offset + frameSize <= fileData.size(); offset += frameSize)
+            addFrame(&fileData[offset], frameSize);
+    }
+
+    // Each JPEG image starts with a SOI marker (FF D8 FF)
+    void splitFrames(const std::vector<unsigned char>& fileData, const EncodedVideoFrame&)
+    {
+        std::vector<size_t> imagesStarts;
+        size_t offset;
+        for (offset = 0; offset + 3 <= fileData.size(); offset++)
+            if (fileData[offset] == 0xFF && fileData[offset + 1] == 0xD8 &&
+                fileData[offset + 2] == 0xFF)
+                imagesStarts.push_back(offset);
+        imagesStarts.push_back(fileData.size());
+        unsigned int n;
+        for (n = 0; n + 1 < imagesStarts.size(); n++)
+            addFrame(&fileData[imagesStarts[n]], imagesStarts[n + 1] - imagesStarts[n]);
+    }
+
+    unsigned int rawFrameSize() const
+    {
+        int frameSize = av_image_get_buffer_size(FFMPEGUtils::translatePixelFormat<CodecOrFormat>(),
+                                                 width, height, 1);
+        return frameSize > 0 ? frameSize : 0;
+    }
+
+    // Diagonal stripes moving by 16 bytes (I.E: 8 YUYV pixels) per frame
+    void addSyntheticFrames(const PackedRawVideoFrame&)
+    {
+        unsigned int frameSize = rawFrameSize();
+        std::vector<unsigned char> frameData(frameSize);
+        unsigned int bytesPerRow = frameSize / height;
+        unsigned int n, y, x;
+        for (n = 0; n < numOfSyntheticFrames; n++)
+        {
+            for (y = 0; y < height; y++)
+                for (x = 0; x < bytesPerRow; x++)
+                    frameData[y * bytesPerRow + x] = (((x + n * 16) / 32 + y / 32) % 8) * 32;
+            addFrame(&frameData[0], frameSize);
+        }
+    }
+
+    // The encoded frames can't be made up
+    void addSyntheticFrames(const EncodedVideoFrame&)
+    {
+    }
+
+    int64_t mFrameDuration;
+    bool mRealTime;
+    int64_t mStartTime;
+    unsigned long long mNumOfGrabbedFrames;
+    std::vector<ShareableVideoFrameData> mFramesData;
+    std::vector<unsigned int> mFramesSizes;
+    VideoFrame<CodecOrFormat, width, height> mGrabbedVideoFrame;
+
+};
+
+}
+
+#endif // REPLAYVIDEOGRABBER_HPP_INCLUDED
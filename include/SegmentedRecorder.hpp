@@ -0,0 +1,262 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef SEGMENTEDRECORDER_HPP_INCLUDED
+#define SEGMENTEDRECORDER_HPP_INCLUDED
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "AsyncFileWriter.hpp"
+
+extern "C"
+{
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <libavutil/time.h>
+}
+
+namespace laav
+{
+
+/*
+ * Muxed data cut on the keyframes (see FFMPEGMuxerCommonImpl::startSegmentedRecording()):
+ * - the recording is split in rolling files, rotated on the first keyframe after the
+ *   segment's duration (or size) is reached;
+ * - the last preRollMs of data (from a keyframe onward) are kept in memory, and written at
+ *   the beginning of the next recording.
+ * Each GOP begins with the stream's tables, so that the files are decodable without any
+ * header/trailer.
+ */
+class SegmentedRecorder
+{
+
+public:
+
+    SegmentedRecorder() :
+        mPreRollMs(0),
+        mPreRollBytes(0),
+        mRecording(false),
+        mWaitingForKeyFrame(false),
+        mSegmentDurationMs(0),
+        mMaxSegmentBytes(0),
+        mSegmentIndex(0),
+        mSegmentStartTime(0),
+        mSegmentBytes(0)
+    {
+    }
+
+    void setPreRoll(unsigned int preRollMs)
+    {
+        mPreRollMs = preRollMs;
+        if (preRollMs == 0)
+        {
+            mPreRollGOPs.clear();
+            mPreRollBytes = 0;
+        }
+    }
+
+    unsigned int preRollMs() const
+    {
+        return mPreRollMs;
+    }
+
+    size_t preRollBytes() const
+    {
+        return mPreRollBytes;
+    }
+
+    /*
+     * fileNamePattern contains the segment's index as exactly one integer conversion
+     * (d, i, u, x, X or o, with flags, width and precision), I.E: "/rec/cam1_%05d.ts";
+     * other patterns are refused. The existing files are never overwritten: the numbering
+     * goes on from the first free index (also across the recordings with the same pattern).
+     * maxSegmentBytes == 0: only the duration is checked.
+     */
+    bool start(const std::string& fileNamePattern, unsigned int segmentDurationMs,
+               size_t maxSegmentBytes)
+    {
+        if (mRecording || !isValidPattern(fileNamePattern))
+            return false;
+        if (fileNamePattern != mFileNamePattern)
+        {
+            mFileNamePattern = fileNamePattern;
+            mSegmentIndex = 0;
+        }
+        mSegmentDurationMs = segmentDurationMs;
+        mMaxSegmentBytes = maxSegmentBytes;
+        skipExistingSegments();
+        if (!mFile.switchTo(segmentFileName()))
+            return false;
+        mRecording = true;
+        mSegmentStartTime = av_gettime_relative();
+        mSegmentBytes = 0;
+        // Without pre-roll, the first segment begins with the next GOP (the data before it
+        // isn't decodable)
+        mWaitingForKeyFrame = mPreRollGOPs.empty();
+        // The footage preceding the start
+        unsigned int n;
+        for (n = 0; n < mPreRollGOPs.size(); n++)
+        {
+            writeToSegment(mPreRollGOPs[n].data.data(), mPreRollGOPs[n].data.size());
+        }
+        return true;
+    }
+
+    // The last segment is synced and closed by the writer's thread (the call doesn't wait)
+    void stop()
+    {
+        if (!mRecording)
+            return;
+        mFile.closeLater();
+        mRecording = false;
+    }
+
+    bool isRecording() const
+    {
+        return mRecording;
+    }
+
+    bool isActive() const
+    {
+        return mRecording || mPreRollMs != 0;
+    }
+
+    AsyncFileWriter& file()
+    {
+        return mFile;
+    }
+
+    // Called by the muxer before writing a keyframe (the muxed data is flushed)
+    void keyFrameBoundary()
+    {
+        int64_t now = av_gettime_relative();
+        if (mWaitingForKeyFrame)
+        {
+            mWaitingForKeyFrame = false;
+            mSegmentStartTime = now;
+        }
+        else if (mRecording &&
+            (now - mSegmentStartTime >= (int64_t)mSegmentDurationMs * 1000 ||
+             (mMaxSegmentBytes != 0 && mSegmentBytes >= mMaxSegmentBytes)))
+        {
+            mSegmentIndex++;
+            skipExistingSegments();
+            mFile.switchTo(segmentFileName());
+            mSegmentStartTime = now;
+            mSegmentBytes = 0;
+        }
+
+        if (mPreRollMs == 0)
+            return;
+        // The oldest GOP is dropped when the next one alone covers the pre-roll
+        while (mPreRollGOPs.size() > 1 &&
+               now - mPreRollGOPs[1].startTime >= (int64_t)mPreRollMs * 1000)
+        {
+            mPreRollBytes -= mPreRollGOPs.front().data.size();
+            mPreRollGOPs.pop_front();
+        }
+        GOP gop;
+        gop.startTime = now;
+        mPreRollGOPs.push_back(gop);
+    }
+
+    void write(const uint8_t* data, size_t size)
+    {
+        if (mRecording && !mWaitingForKeyFrame)
+            writeToSegment(data, size);
+        // The data preceding the first keyframe isn't decodable
+        if (mPreRollMs != 0 && !mPreRollGOPs.empty())
+        {
+            std::vector<uint8_t>& gopData = mPreRollGOPs.back().data;
+            gopData.insert(gopData.end(), data, data + size);
+            mPreRollBytes += size;
+        }
+    }
+
+private:
+
+    typedef char FileName[4096];
+
+    struct GOP
+    {
+        int64_t startTime;
+        std::vector<uint8_t> data;
+    };
+
+    // Like av_get_frame_filename(): the pattern is a format string, so it's checked first
+    static bool isValidPattern(const std::string& pattern)
+    {
+        unsigned int conversions = 0;
+        size_t n = 0;
+        while (n < pattern.size())
+        {
+            if (pattern[n++] != '%')
+                continue;
+            if (n < pattern.size() && pattern[n] == '%')
+            {
+                n++;
+                continue;
+            }
+            while (n < pattern.size() && strchr("-+ #0", pattern[n]) != NULL)
+                n++;
+            while (n < pattern.size() && isdigit((unsigned char)pattern[n]))
+                n++;
+            if (n < pattern.size() && pattern[n] == '.')
+            {
+                n++;
+                while (n < pattern.size() && isdigit((unsigned char)pattern[n]))
+                    n++;
+            }
+            // No length modifiers: the index is an unsigned int
+            if (n == pattern.size() || strchr("diuxXo", pattern[n]) == NULL)
+                return false;
+            n++;
+            conversions++;
+        }
+        return conversions == 1 && pattern.size() < sizeof(FileName);
+    }
+
+    std::string segmentFileName() const
+    {
+        FileName fileName;
+        snprintf(fileName, sizeof(fileName), mFileNamePattern.c_str(), mSegmentIndex);
+        return fileName;
+    }
+
+    void skipExistingSegments()
+    {
+        struct stat fileStat;
+        while (stat(segmentFileName().c_str(), &fileStat) == 0)
+            mSegmentIndex++;
+    }
+
+    void writeToSegment(const uint8_t* data, size_t size)
+    {
+        mFile.write((const char* )data, size);
+        mSegmentBytes += size;
+    }
+
+    unsigned int mPreRollMs;
+    std::deque<GOP> mPreRollGOPs;
+    size_t mPreRollBytes;
+    bool mRecording;
+    bool mWaitingForKeyFrame;
+    std::string mFileNamePattern;
+    unsigned int mSegmentDurationMs;
+    size_t mMaxSegmentBytes;
+    unsigned int mSegmentIndex;
+    int64_t mSegmentStartTime;
+    size_t mSegmentBytes;
+    AsyncFileWriter mFile;
+
+};
+
+}
+
+#endif // SEGMENTEDRECORDER_HPP_INCLUDED
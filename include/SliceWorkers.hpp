@@ -0,0 +1,125 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef SLICEWORKERS_HPP_INCLUDED
+#define SLICEWORKERS_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Common.hpp"
+
+namespace laav
+{
+
+/*
+ * Helper threads (requires -pthread) which process the slices of a frame together with
+ * the calling thread: run() returns when all the slices have been processed. The caller
+ * can be the main loop's thread or a PipeWorker's one (I.E: a converter inside a worker's
+ * pipe segment).
+ */
+class SliceWorkers
+{
+
+public:
+
+    SliceWorkers(unsigned int numOfHelperThreads) :
+        mNumOfSlices(0),
+        mNextSlice(NO_SLICES),
+        mProcessedSlices(0),
+        mGeneration(0),
+        mStop(false)
+    {
+        unsigned int n;
+        for (n = 0; n < numOfHelperThreads; n++)
+            mThreads.push_back(std::thread(&SliceWorkers::run, this));
+    }
+
+    ~SliceWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mSlicesAvailable.notify_all();
+        unsigned int n;
+        for (n = 0; n < mThreads.size(); n++)
+            mThreads[n].join();
+    }
+
+    // sliceJob(sliceIndex) is called once for each slice, by any of the threads
+    void process(unsigned int numOfSlices, const std::function<void(unsigned int)>& sliceJob)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mSliceJob = sliceJob;
+            mNumOfSlices = numOfSlices;
+            mProcessedSlices = 0;
+            // Last: the helpers can take the slices from now on
+            mNextSlice = 0;
+            mGeneration++;
+        }
+        mSlicesAvailable.notify_all();
+        processSlices();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mSlicesProcessed.wait(lock, [this] { return mProcessedSlices.load() == mNumOfSlices; });
+        // The helpers which are still looping must not take the slices of the next frame
+        mNextSlice = NO_SLICES;
+    }
+
+private:
+
+    static const unsigned int NO_SLICES = 0x80000000;
+
+    void processSlices()
+    {
+        unsigned int slice;
+        while ((slice = mNextSlice.fetch_add(1)) < mNumOfSlices)
+        {
+            mSliceJob(slice);
+            if (mProcessedSlices.fetch_add(1) + 1 == mNumOfSlices)
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mSlicesProcessed.notify_one();
+            }
+        }
+    }
+
+    void run()
+    {
+        unsigned long lastGeneration = 0;
+        while (1)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mSlicesAvailable.wait(lock, [&] { return mGeneration != lastGeneration || mStop; });
+                if (mStop)
+                    return;
+                lastGeneration = mGeneration;
+            }
+            processSlices();
+        }
+    }
+
+    std::function<void(unsigned int)> mSliceJob;
+    std::atomic<unsigned int> mNumOfSlices;
+    std::atomic<unsigned int> mNextSlice;
+    std::atomic<unsigned int> mProcessedSlices;
+    unsigned long mGeneration;
+    bool mStop;
+    std::mutex mMutex;
+    std::condition_variable mSlicesAvailable;
+    std::condition_variable mSlicesProcessed;
+    std::vector<std::thread> mThreads;
+
+};
+
+}
+
+#endif // SLICEWORKERS_HPP_INCLUDED
@@ -0,0 +1,333 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef STAGEMETRICS_HPP_INCLUDED
+#define STAGEMETRICS_HPP_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace laav
+{
+
+class StageMetrics;
+
+/*
+ * All the live StageMetrics, exported as Prometheus text (see HTTPMetricsServer).
+ * The stages don't lock anything when they update their metrics: only their
+ * construction, destruction and the export do.
+ */
+class MetricsRegistry
+{
+
+    friend class StageMetrics;
+
+public:
+
+    static MetricsRegistry& instance()
+    {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    std::string prometheusText();
+
+private:
+
+    MetricsRegistry()
+    {
+    }
+
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    // Returns the instance number (of the stage's kind)
+    unsigned int add(StageMetrics* stageMetrics);
+    void remove(StageMetrics* stageMetrics);
+
+    std::mutex mMutex;
+    std::vector<StageMetrics*> mStagesMetrics;
+    std::vector<std::pair<std::string, unsigned int> > mNumOfInstances;
+
+};
+
+/*
+ * Counters of a pipe stage, which can be updated by the stage's thread while another
+ * one exports them. The latencies (microseconds) are the ones of the frames leaving
+ * the stage since their capture (see Frame::setCaptureTimestamp()).
+ */
+class StageMetrics
+{
+
+    friend class MetricsRegistry;
+
+public:
+
+    static const unsigned int numOfLatencyBuckets = 12;
+
+    // stage: the kind of stage, I.E: "video_encoder"
+    StageMetrics(const std::string& stage) :
+        mStage(stage),
+        mFramesIn(0),
+        mFramesOut(0),
+        mDroppedFrames(0),
+        mBytesOut(0),
+        mProcessingNs(0),
+        mQueueDepth(0),
+        mClients(0),
+        mClientsBacklogBytes(0),
+        mMaxClientBacklogBytes(0),
+        mLatencySumUs(0),
+        mLatencyCount(0)
+    {
+        unsigned int n;
+        for (n = 0; n < numOfLatencyBuckets; n++)
+            mLatencyBuckets[n] = 0;
+        std::ostringstream instance;
+        instance << MetricsRegistry::instance().add(this);
+        mInstance = instance.str();
+    }
+
+    ~StageMetrics()
+    {
+        MetricsRegistry::instance().remove(this);
+    }
+
+    StageMetrics(const StageMetrics&) = delete;
+    StageMetrics& operator=(const StageMetrics&) = delete;
+
+    // For addProcessingTime()
+    static int64_t nowNs()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+
+    // The "instance" label (default: 0, 1... for each kind of stage), I.E: "camera1"
+    void setInstanceName(const std::string& instance)
+    {
+        std::lock_guard<std::mutex> lock(MetricsRegistry::instance().mMutex);
+        mInstance = instance;
+    }
+
+    void countFrameIn()
+    {
+        mFramesIn.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countFrameOut(uint64_t bytes)
+    {
+        mFramesOut.fetch_add(1, std::memory_order_relaxed);
+        mBytesOut.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void countDroppedFrames(uint64_t numOfFrames)
+    {
+        mDroppedFrames.fetch_add(numOfFrames, std::memory_order_relaxed);
+    }
+
+    void addProcessingTime(int64_t ns)
+    {
+        mProcessingNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    void recordLatency(int64_t latencyUs)
+    {
+        if (latencyUs < 0)
+            latencyUs = 0;
+        unsigned int n;
+        for (n = 0; n < numOfLatencyBuckets && latencyUs > latencyBucketBound(n); n++);
+        // The last bucket is +Inf
+        if (n == numOfLatencyBuckets)
+            n--;
+        mLatencyBuckets[n].fetch_add(1, std::memory_order_relaxed);
+        mLatencySumUs.fetch_add(latencyUs, std::memory_order_relaxed);
+        mLatencyCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void setQueueDepth(uint64_t depth)
+    {
+        mQueueDepth.store(depth, std::memory_order_relaxed);
+    }
+
+    // The bytes queued on the clients' connections, and not sent yet
+    void setClientsBacklog(uint64_t numOfClients, uint64_t backlogBytes, uint64_t maxClientBacklogBytes)
+    {
+        mClients.store(numOfClients, std::memory_order_relaxed);
+        mClientsBacklogBytes.store(backlogBytes, std::memory_order_relaxed);
+        mMaxClientBacklogBytes.store(maxClientBacklogBytes, std::memory_order_relaxed);
+    }
+
+    uint64_t framesIn() const
+    {
+        return mFramesIn.load(std::memory_order_relaxed);
+    }
+
+    uint64_t framesOut() const
+    {
+        return mFramesOut.load(std::memory_order_relaxed);
+    }
+
+    uint64_t droppedFrames() const
+    {
+        return mDroppedFrames.load(std::memory_order_relaxed);
+    }
+
+    // Microseconds, 0 if no frame has left the stage yet
+    int64_t averageLatency() const
+    {
+        uint64_t count = mLatencyCount.load(std::memory_order_relaxed);
+        return count == 0 ? 0 : mLatencySumUs.load(std::memory_order_relaxed) / count;
+    }
+
+private:
+
+    // Microseconds: 250 us .. 1 s, then +Inf
+    static int64_t latencyBucketBound(unsigned int n)
+    {
+        static const int64_t bounds[numOfLatencyBuckets - 1] =
+        {250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000};
+        return n < numOfLatencyBuckets - 1 ? bounds[n] : INT64_MAX;
+    }
+
+    std::string labels() const
+    {
+        return "stage=\"" + mStage + "\",instance=\"" + mInstance + "\"";
+    }
+
+    std::string mStage;
+    std::string mInstance;
+    std::atomic<uint64_t> mFramesIn;
+    std::atomic<uint64_t> mFramesOut;
+    std::atomic<uint64_t> mDroppedFrames;
+    std::atomic<uint64_t> mBytesOut;
+    std::atomic<uint64_t> mProcessingNs;
+    std::atomic<uint64_t> mQueueDepth;
+    std::atomic<uint64_t> mClients;
+    std::atomic<uint64_t> mClientsBacklogBytes;
+    std::atomic<uint64_t> mMaxClientBacklogBytes;
+    std::atomic<uint64_t> mLatencyBuckets[numOfLatencyBuckets];
+    std::atomic<uint64_t> mLatencySumUs;
+    std::atomic<uint64_t> mLatencyCount;
+
+};
+
+inline unsigned int MetricsRegistry::add(StageMetrics* stageMetrics)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStagesMetrics.push_back(stageMetrics);
+    unsigned int n;
+    for (n = 0; n < mNumOfInstances.size(); n++)
+        if (mNumOfInstances[n].first == stageMetrics->mStage)
+            return mNumOfInstances[n].second++;
+    mNumOfInstances.push_back(std::make_pair(stageMetrics->mStage, 1u));
+    return 0;
+}
+
+inline void MetricsRegistry::remove(StageMetrics* stageMetrics)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    unsigned int n;
+    for (n = 0; n < mStagesMetrics.size(); n++)
+        if (mStagesMetrics[n] == stageMetrics)
+        {
+            mStagesMetrics.erase(mStagesMetrics.begin() + n);
+            return;
+        }
+}
+
+/*
+ * Prometheus text format (version 0.0.4): the samples of a metric are grouped, I.E:
+ *
+ *   # TYPE laav_frames_out_total counter
+ *   laav_frames_out_total{stage="video_encoder",instance="0"} 1500
+ *   laav_frames_out_total{stage="http_streamer",instance="0"} 1498
+ */
+inline std::string MetricsRegistry::prometheusText()
+{
+    struct Counter
+    {
+        const char* name;
+        const char* type;
+        const char* help;
+        std::atomic<uint64_t> StageMetrics::* value;
+        double scale;
+    };
+    static const Counter counters[] =
+    {
+        {"laav_frames_in_total", "counter", "Frames taken by the stage",
+         &StageMetrics::mFramesIn, 1},
+        {"laav_frames_out_total", "counter", "Frames output by the stage",
+         &StageMetrics::mFramesOut, 1},
+        {"laav_dropped_frames_total", "counter",
+         "Frames lost (device overruns, full rings, groups of chunks skipped by slow clients)",
+         &StageMetrics::mDroppedFrames, 1},
+        {"laav_bytes_out_total", "counter", "Bytes output by the stage",
+         &StageMetrics::mBytesOut, 1},
+        {"laav_processing_seconds_total", "counter", "Time spent processing the frames",
+         &StageMetrics::mProcessingNs, 1e-9},
+        {"laav_queue_depth", "gauge", "Frames queued by the stage",
+         &StageMetrics::mQueueDepth, 1},
+        {"laav_clients", "gauge", "Connected clients",
+         &StageMetrics::mClients, 1},
+        {"laav_clients_backlog_bytes", "gauge", "Bytes queued for all the clients",
+         &StageMetrics::mClientsBacklogBytes, 1},
+        {"laav_client_max_backlog_bytes", "gauge", "Bytes queued for the slowest client",
+         &StageMetrics::mMaxClientBacklogBytes, 1}
+    };
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::ostringstream text;
+    unsigned int n, m, bucket;
+    for (n = 0; n < sizeof(counters) / sizeof(counters[0]); n++)
+    {
+        text << "# HELP " << counters[n].name << " " << counters[n].help << "\n";
+        text << "# TYPE " << counters[n].name << " " << counters[n].type << "\n";
+        for (m = 0; m < mStagesMetrics.size(); m++)
+        {
+            uint64_t value = (mStagesMetrics[m]->*counters[n].value).load(std::memory_order_relaxed);
+            text << counters[n].name << "{" << mStagesMetrics[m]->labels() << "} ";
+            if (counters[n].scale == 1)
+                text << value << "\n";
+            else
+                text << value * counters[n].scale << "\n";
+        }
+    }
+
+    text << "# HELP laav_latency_seconds Time since the capture of the frames output by the stage\n";
+    text << "# TYPE laav_latency_seconds histogram\n";
+    for (m = 0; m < mStagesMetrics.size(); m++)
+    {
+        StageMetrics& stageMetrics = *mStagesMetrics[m];
+        uint64_t cumulativeCount = 0;
+        for (bucket = 0; bucket < StageMetrics::numOfLatencyBuckets; bucket++)
+        {
+            cumulativeCount += stageMetrics.mLatencyBuckets[bucket].load(std::memory_order_relaxed);
+            text << "laav_latency_seconds_bucket{" << stageMetrics.labels() << ",le=\"";
+            if (bucket < StageMetrics::numOfLatencyBuckets - 1)
+                text << StageMetrics::latencyBucketBound(bucket) * 1e-6;
+            else
+                text << "+Inf";
+            text << "\"} " << cumulativeCount << "\n";
+        }
+        text << "laav_latency_seconds_sum{" << stageMetrics.labels() << "} "
+             << stageMetrics.mLatencySumUs.load(std::memory_order_relaxed) * 1e-6 << "\n";
+        // The buckets are read one by one: the count is the +Inf one, so that they agree
+        text << "laav_latency_seconds_count{" << stageMetrics.labels() << "} "
+             << cumulativeCount << "\n";
+    }
+    return text.str();
+}
+
+}
+
+#endif // STAGEMETRICS_HPP_INCLUDED
@@ -0,0 +1,363 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef UDPSTREAMER_HPP_INCLUDED
+#define UDPSTREAMER_HPP_INCLUDED
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Common.hpp"
+#include "MuxedDataSink.hpp"
+#include "StageMetrics.hpp"
+
+extern "C"
+{
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <libavutil/time.h>
+}
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace laav
+{
+
+/*
+ * Sends the stream to a UDP address, usually a multicast group (I.E: a LAN where many
+ * viewers watch the same cameras: the stream is sent once, whatever the number of
+ * viewers). The MPEGTS packets are sent 7 per datagram (1316 bytes, which fit any
+ * Ethernet MTU), optionally wrapped in RTP (RFC 2250, payload type 33), as players
+ * expect for udp:// and rtp:// addresses. The muxed data is written straight into the
+ * streamer (see FFMPEGMuxerCommonImpl::setMuxedDataSink()), and the datagrams of each
+ * frame are sent at once, with a single sendmmsg() call, or with a single UDP GSO
+ * send (see setSegmentationOffload()) where the kernel supports it.
+ * A datagram which doesn't fit the socket's buffer is dropped, as any UDP loss.
+ */
+template <typename Container>
+class UDPStreamer : protected MuxedDataSink
+{
+
+    static_assert(std::is_same<Container, MPEGTS>::value,
+                  "UDP streams are MPEGTS");
+
+public:
+
+    enum MediaStatus status() const
+    {
+        return mStatus;
+    }
+
+    int getErrno() const
+    {
+        return mErrno;
+    }
+
+    /*
+     * With UDP GSO (Linux >= 4.18) the datagrams of a frame are passed to the kernel as one
+     * buffer, which is cut in datagrams by the kernel (or by the NIC): one send for up to
+     * MAX_GSO_SEGMENTS datagrams. If the kernel (or the route's device) doesn't support it,
+     * the streamer falls back to sendmmsg().
+     */
+    void setSegmentationOffload(bool segmentationOffload)
+    {
+        mSegmentationOffload = segmentationOffload;
+    }
+
+    bool segmentationOffload() const
+    {
+        return mSegmentationOffload;
+    }
+
+    unsigned long sentDatagrams() const
+    {
+        return mSentDatagrams;
+    }
+
+    unsigned long droppedDatagrams() const
+    {
+        return mDroppedDatagrams;
+    }
+
+    /*
+     * A frame is the group of datagrams muxed for it: in (muxed), out (sent), dropped
+     * (some of its datagrams didn't fit the socket's buffer)
+     */
+    StageMetrics& metrics()
+    {
+        return mMetrics;
+    }
+
+protected:
+
+    static const unsigned int TS_PACKET_SIZE = 188;
+    static const unsigned int TS_PACKETS_PER_DATAGRAM = 7;
+    static const unsigned int RTP_HEADER_SIZE = 12;
+    // The kernel's limit (UDP_MAX_SEGMENTS)
+    static const unsigned int MAX_GSO_SEGMENTS = 64;
+
+    /*
+     * ttl: the multicast hops (1: the LAN only). interfaceAddress: the address of the
+     * local interface which sends the multicast datagrams ("": the routing table's choice).
+     */
+    UDPStreamer(const std::string& address, unsigned int port, bool rtp, unsigned int ttl,
+                const std::string& interfaceAddress) :
+        mStatus(MEDIA_NOT_READY),
+        mErrno(0),
+        mSocket(-1),
+        mRTP(rtp),
+        mSegmentationOffload(false),
+        mRTPSequenceNumber(0),
+        mRTPSSRC(0),
+        mSentDatagrams(0),
+        mDroppedDatagrams(0),
+        mMetrics("udp_streamer")
+    {
+        std::random_device randomDevice;
+        mRTPSSRC = randomDevice();
+        mRTPSequenceNumber = randomDevice() & 0xFFFF;
+
+        struct sockaddr_in destination;
+        memset(&destination, 0, sizeof(destination));
+        destination.sin_family = AF_INET;
+        destination.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &destination.sin_addr) != 1)
+        {
+            mErrno = EINVAL;
+            return;
+        }
+        mSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (mSocket < 0)
+        {
+            mErrno = errno;
+            return;
+        }
+        if (IN_MULTICAST(ntohl(destination.sin_addr.s_addr)))
+        {
+            unsigned char multicastTTL = ttl;
+            setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_TTL, &multicastTTL, sizeof(multicastTTL));
+            if (!interfaceAddress.empty())
+            {
+                struct in_addr interface;
+                if (inet_pton(AF_INET, interfaceAddress.c_str(), &interface) != 1 ||
+                    setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_IF,
+                               &interface, sizeof(interface)) != 0)
+                {
+                    mErrno = errno != 0 ? errno : EINVAL;
+                    return;
+                }
+            }
+        }
+        // Room for a few keyframes' bursts
+        int sendBufferSize = 1024 * 1024;
+        setsockopt(mSocket, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize));
+        // Connected: the datagrams don't carry the address
+        if (connect(mSocket, (struct sockaddr* )&destination, sizeof(destination)) != 0)
+        {
+            mErrno = errno;
+            return;
+        }
+        mStatus = MEDIA_READY;
+    }
+
+    ~UDPStreamer()
+    {
+        if (mSocket >= 0)
+            close(mSocket);
+    }
+
+    // Sends the whole TS packets muxed so far, the remainder waits for the next frame
+    void sendPendingPackets()
+    {
+        size_t numOfTSPackets = mPendingData.size() / TS_PACKET_SIZE;
+        if (numOfTSPackets == 0 || mStatus != MEDIA_READY)
+            return;
+        mMetrics.countFrameIn();
+
+        size_t numOfDatagrams = (numOfTSPackets + TS_PACKETS_PER_DATAGRAM - 1) / TS_PACKETS_PER_DATAGRAM;
+        prepareDatagrams(numOfTSPackets, numOfDatagrams);
+        size_t sentDatagrams = 0;
+        if (mSegmentationOffload)
+            sentDatagrams = sendWithSegmentationOffload(numOfDatagrams);
+        if (sentDatagrams < numOfDatagrams)
+            sentDatagrams += sendWithSendmmsg(sentDatagrams, numOfDatagrams);
+
+        mSentDatagrams += sentDatagrams;
+        if (sentDatagrams < numOfDatagrams)
+        {
+            mDroppedDatagrams += numOfDatagrams - sentDatagrams;
+            mMetrics.countDroppedFrames(1);
+        }
+        else
+            mMetrics.countFrameOut(numOfTSPackets * TS_PACKET_SIZE);
+
+        mPendingData.erase(mPendingData.begin(),
+                           mPendingData.begin() + numOfTSPackets * TS_PACKET_SIZE);
+    }
+
+    enum MediaStatus mStatus;
+    int mErrno;
+
+private:
+
+    bool writeMuxedData(const uint8_t* data, size_t size)
+    {
+        mPendingData.insert(mPendingData.end(), data, data + size);
+        return true;
+    }
+
+    // One (RTP header +) payload iovec pair per datagram, pointing into mPendingData
+    void prepareDatagrams(size_t numOfTSPackets, size_t numOfDatagrams)
+    {
+        mIovecs.resize(2 * numOfDatagrams);
+        if (mRTP)
+            mRTPHeaders.resize(RTP_HEADER_SIZE * numOfDatagrams);
+        // 90 kHz, the same for all the datagrams of the frame
+        uint32_t rtpTimestamp = (uint32_t)(av_gettime_relative() * 9 / 100);
+        size_t n;
+        for (n = 0; n < numOfDatagrams; n++)
+        {
+            size_t firstTSPacket = n * TS_PACKETS_PER_DATAGRAM;
+            size_t datagramTSPackets = std::min((size_t)TS_PACKETS_PER_DATAGRAM,
+                                                numOfTSPackets - firstTSPacket);
+            struct iovec& rtpHeader = mIovecs[2 * n];
+            struct iovec& payload = mIovecs[2 * n + 1];
+            rtpHeader.iov_base = NULL;
+            rtpHeader.iov_len = 0;
+            if (mRTP)
+            {
+                uint8_t* header = &mRTPHeaders[RTP_HEADER_SIZE * n];
+                writeRTPHeader(header, rtpTimestamp);
+                rtpHeader.iov_base = header;
+                rtpHeader.iov_len = RTP_HEADER_SIZE;
+            }
+            payload.iov_base = &mPendingData[firstTSPacket * TS_PACKET_SIZE];
+            payload.iov_len = datagramTSPackets * TS_PACKET_SIZE;
+        }
+    }
+
+    void writeRTPHeader(uint8_t header[RTP_HEADER_SIZE], uint32_t rtpTimestamp)
+    {
+        // Version 2, no padding, no extension, no CSRC; no marker, MP2T
+        header[0] = 0x80;
+        header[1] = 33;
+        header[2] = mRTPSequenceNumber >> 8;
+        header[3] = mRTPSequenceNumber & 0xFF;
+        mRTPSequenceNumber++;
+        unsigned int n;
+        for (n = 0; n < 4; n++)
+        {
+            header[4 + n] = (rtpTimestamp >> (24 - 8 * n)) & 0xFF;
+            header[8 + n] = (mRTPSSRC >> (24 - 8 * n)) & 0xFF;
+        }
+    }
+
+    /*
+     * The segments are the datagrams, which have all the same size except the last one:
+     * the iovecs of several datagrams are a single buffer for the kernel. Returns the sent
+     * datagrams; the offload is disabled if it isn't supported.
+     */
+    size_t sendWithSegmentationOffload(size_t numOfDatagrams)
+    {
+        size_t datagramSize = mIovecs[0].iov_len + mIovecs[1].iov_len;
+        size_t maxSegments = std::min((size_t)MAX_GSO_SEGMENTS, (size_t)65507 / datagramSize);
+        size_t sentDatagrams = 0;
+        while (sentDatagrams < numOfDatagrams)
+        {
+            size_t numOfSegments = std::min(maxSegments, numOfDatagrams - sentDatagrams);
+            if (numOfSegments == 1)
+                // Nothing to segment
+                return sentDatagrams;
+
+            char control[CMSG_SPACE(sizeof(uint16_t))];
+            memset(control, 0, sizeof(control));
+            struct msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &mIovecs[2 * sentDatagrams];
+            message.msg_iovlen = 2 * numOfSegments;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            struct cmsghdr* controlMessage = CMSG_FIRSTHDR(&message);
+            controlMessage->cmsg_level = SOL_UDP;
+            controlMessage->cmsg_type = UDP_SEGMENT;
+            controlMessage->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segmentSize = datagramSize;
+            memcpy(CMSG_DATA(controlMessage), &segmentSize, sizeof(segmentSize));
+
+            if (sendmsg(mSocket, &message, 0) < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS &&
+                    errno != ECONNREFUSED)
+                    // I.E: EIO, EINVAL (no GSO)
+                    mSegmentationOffload = false;
+                return sentDatagrams;
+            }
+            sentDatagrams += numOfSegments;
+        }
+        return sentDatagrams;
+    }
+
+    // Returns the sent datagrams, from the firstDatagram-th one
+    size_t sendWithSendmmsg(size_t firstDatagram, size_t numOfDatagrams)
+    {
+        mMessages.resize(numOfDatagrams - firstDatagram);
+        memset(&mMessages[0], 0, mMessages.size() * sizeof(struct mmsghdr));
+        size_t n;
+        for (n = 0; n < mMessages.size(); n++)
+        {
+            size_t iovec = 2 * (firstDatagram + n);
+            mMessages[n].msg_hdr.msg_iov = &mIovecs[mRTP ? iovec : iovec + 1];
+            mMessages[n].msg_hdr.msg_iovlen = mRTP ? 2 : 1;
+        }
+        size_t sentDatagrams = 0;
+        while (sentDatagrams < mMessages.size())
+        {
+            int sent = sendmmsg(mSocket, &mMessages[sentDatagrams],
+                                mMessages.size() - sentDatagrams, 0);
+            if (sent <= 0)
+            {
+                // I.E: the ICMP error of a unicast destination without listeners:
+                // the next datagrams can be sent
+                if (sent < 0 && errno == ECONNREFUSED)
+                    continue;
+                // The socket's buffer is full: the frame's remainder is dropped
+                break;
+            }
+            sentDatagrams += sent;
+        }
+        return sentDatagrams;
+    }
+
+    int mSocket;
+    bool mRTP;
+    bool mSegmentationOffload;
+    uint16_t mRTPSequenceNumber;
+    uint32_t mRTPSSRC;
+    unsigned long mSentDatagrams;
+    unsigned long mDroppedDatagrams;
+    StageMetrics mMetrics;
+    // The muxed data which hasn't been sent yet
+    std::vector<uint8_t> mPendingData;
+    std::vector<uint8_t> mRTPHeaders;
+    std::vector<struct iovec> mIovecs;
+    std::vector<struct mmsghdr> mMessages;
+
+};
+
+}
+
+#endif // UDPSTREAMER_HPP_INCLUDED
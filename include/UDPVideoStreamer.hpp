@@ -0,0 +1,76 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef UDPVIDEOSTREAMER_HPP_INCLUDED
+#define UDPVIDEOSTREAMER_HPP_INCLUDED
+
+#include "FFMPEGVideoMuxer.hpp"
+#include "UDPStreamer.hpp"
+
+namespace laav
+{
+
+/*
+ * Streams the video to a UDP (multicast) address, I.E:
+ *
+ *   UDPVideoStreamer <MPEGTS, H264, WIDTH, HEIGHT> vStream("239.0.0.1", 5004, true);
+ *   vGrab >> vConv >> vEnc >> vStream;
+ *
+ * which is played by:
+ *
+ *   ffplay rtp://239.0.0.1:5004      (udp://239.0.0.1:5004 without RTP)
+ *
+ * The stream is muxed since the construction: the viewers can join at any time, and start
+ * decoding at the next keyframe.
+ */
+template <typename Container,
+          typename VideoCodecOrFormat,
+          unsigned int width,
+          unsigned int height>
+class UDPVideoStreamer : public UDPStreamer<Container>
+{
+
+public:
+
+    UDPVideoStreamer(const std::string& address, unsigned int port, bool rtp = false,
+                     unsigned int ttl = 1, const std::string& interfaceAddress = "") :
+        UDPStreamer<Container>(address, port, rtp, ttl, interfaceAddress),
+        mVideoMuxer(false)
+    {
+        if (this->mStatus != MEDIA_READY)
+            return;
+        mVideoMuxer.setMuxedDataSink(this);
+        mVideoMuxer.startMuxing();
+    }
+
+    // I.E: to record the same stream
+    FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height>& muxer()
+    {
+        return mVideoMuxer;
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    void takeStreamableFrame(const VideoFrame<VideoCodecOrFormat,
+                             width, height>& videoFrameToStream)
+    {
+        if (this->mStatus != MEDIA_READY)
+            return;
+        mVideoMuxer.takeMuxableFrame(videoFrameToStream);
+        this->sendPendingPackets();
+    }
+
+private:
+
+    // Declared after the streamer (the base class), which gets the trailer when the muxer is destroyed
+    FFMPEGVideoMuxer<Container, VideoCodecOrFormat, width, height> mVideoMuxer;
+
+};
+
+}
+
+#endif // UDPVIDEOSTREAMER_HPP_INCLUDED
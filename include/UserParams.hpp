@@ -57,6 +57,32 @@ enum H264Presets
     H264_PLACEBO
 };
 
+// The presets of libx265 are the ones of libx264 (H264Presets)
+enum H265Profiles
+{
+    H265_DEFAULT_PROFILE,
+    H265_MAIN,
+    H265_MAIN_10,
+    H265_MAIN_STILL_PICTURE,
+    H265_REXT
+};
+
+enum VideoDecoderThreading
+{
+    // Each thread decodes a whole frame (the frames come out with some delay)
+    DECODER_FRAME_THREADS,
+    // The threads decode the slices of the same frame, if the codec supports it
+    DECODER_SLICE_THREADS
+};
+
+enum AlsaAccessMode
+{
+    // The captured samples are copied (snd_pcm_readi) into the grabber's buffer
+    ALSA_RW_ACCESS,
+    // The captured frames point directly to the device's ring buffer (no copies)
+    ALSA_MMAP_ACCESS
+};
+
 }
 
 #endif // USERPARAMS_HPP_INCLUDED
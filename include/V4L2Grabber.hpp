@@ -9,12 +9,16 @@
 
 #ifdef LINUX
 
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <vector>
 #include "AllVideoCodecsAndFormats.hpp"
 #include "Common.hpp"
+#include "DeviceBringUp.hpp"
 #include "EventsManager.hpp"
+#include "StageMetrics.hpp"
 #include "VideoFrameHolder.hpp"
 
 extern "C"
@@ -31,6 +35,8 @@ extern "C"
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <linux/videodev2.h>
+#include <linux/uvcvideo.h>
+#include <linux/usb/video.h>
 #include <event.h>
 }
 
@@ -58,7 +64,8 @@ enum V4LDeviceError
     NO_DEVICE_ERROR,
     NO_RESOURCE_ERROR,
     CONFIG_IMG_TO_CAPTURE_ERROR,
-    VIDIOC_STREAMOFF_ERROR
+    VIDIOC_STREAMOFF_ERROR,
+    VIDIOC_EXPBUF_ERROR
 };
 
 struct V4LUtils
@@ -66,6 +73,11 @@ struct V4LUtils
     template <typename T>
     static __u32 translatePixelFormat();
 
+    // Fills the planes' layout of a single-planar (V4L2_BUF_TYPE_VIDEO_CAPTURE) buffer
+    template <typename T>
+    static void fillPlanesLayout(DMABufRawVideoFrame& videoFrame,
+                                 unsigned int bytesPerLine, unsigned int height);
+
     static int xioctl(int fh, unsigned long int request, void *arg)
     {
         int r;
@@ -89,6 +101,55 @@ __u32 V4LUtils::translatePixelFormat<MJPEG>()
 {
     return V4L2_PIX_FMT_MJPEG;
 }
+template <>
+__u32 V4LUtils::translatePixelFormat<H264>()
+{
+    return V4L2_PIX_FMT_H264;
+}
+template <>
+__u32 V4LUtils::translatePixelFormat<DMABUF<YUYV422_PACKED> >()
+{
+    return V4L2_PIX_FMT_YUYV;
+}
+template <>
+__u32 V4LUtils::translatePixelFormat<DMABUF<NV_12_PLANAR> >()
+{
+    return V4L2_PIX_FMT_NV12;
+}
+template <>
+__u32 V4LUtils::translatePixelFormat<DMABUF<YUV420_PLANAR> >()
+{
+    return V4L2_PIX_FMT_YUV420;
+}
+
+template <>
+void V4LUtils::fillPlanesLayout<DMABUF<YUYV422_PACKED> >(DMABufRawVideoFrame& videoFrame,
+                                                         unsigned int bytesPerLine,
+                                                         unsigned int height)
+{
+    videoFrame.setNumOfPlanes(1);
+    videoFrame.setPlaneLayout<0>(0, bytesPerLine);
+}
+template <>
+void V4LUtils::fillPlanesLayout<DMABUF<NV_12_PLANAR> >(DMABufRawVideoFrame& videoFrame,
+                                                       unsigned int bytesPerLine,
+                                                       unsigned int height)
+{
+    videoFrame.setNumOfPlanes(2);
+    videoFrame.setPlaneLayout<0>(0, bytesPerLine);
+    videoFrame.setPlaneLayout<1>(bytesPerLine * height, bytesPerLine);
+}
+template <>
+void V4LUtils::fillPlanesLayout<DMABUF<YUV420_PLANAR> >(DMABufRawVideoFrame& videoFrame,
+                                                        unsigned int bytesPerLine,
+                                                        unsigned int height)
+{
+    videoFrame.setNumOfPlanes(3);
+    videoFrame.setPlaneLayout<0>(0, bytesPerLine);
+    videoFrame.setPlaneLayout<1>(bytesPerLine * height, bytesPerLine / 2);
+    videoFrame.setPlaneLayout<2>(bytesPerLine * height + (bytesPerLine / 2) * (height / 2),
+                                 bytesPerLine / 2);
+}
 
 template <typename CodecOrFormat, unsigned int width, unsigned int height>
 class V4L2Grabber : public EventsProducer
@@ -96,63 +157,75 @@ class V4L2Grabber : public EventsProducer
 
 public:
 
-    V4L2Grabber(SharedEventsCatcher eventsCatcher, const std::string& devName, unsigned int fps = 0):
+    /*
+     * zeroCopy: the grabbed frames wrap the driver's mmap'd buffers, which are given back
+     * to the driver (VIDIOC_QBUF) only when the last frame referencing them is released.
+     * numOfDriverBuffers: number of buffers requested to the driver (VIDIOC_REQBUFS); in
+     * zeroCopy mode it must be greater than the number of frames held along the pipes
+     * (holders, grabber), otherwise the driver runs out of buffers and the grabbing stalls.
+     * The frames can be released by any thread (I.E: after crossing a VideoFrameRing).
+     * The device is opened, configured and started by a thread (see DeviceBringUp.hpp),
+     * so the constructor returns immediately and the status is DEV_INITIALIZING until
+     * the first frames can be grabbed (or the bring-up fails); the reconnections too
+     * happen in the background, with a backoff (see setReconnectionInterval()).
+     */
+    V4L2Grabber(SharedEventsCatcher eventsCatcher, const std::string& devName, unsigned int fps = 0,
+                bool zeroCopy = false, unsigned int numOfDriverBuffers = 4):
         EventsProducer::EventsProducer(eventsCatcher),
         mFps(fps),
+        mZeroCopy(zeroCopy),
+        mNumOfDriverBuffers(numOfDriverBuffers),
+        mReconnectionInterval(250),
+        mMaxReconnectionInterval(8000),
+        mReconnectionDelay(250),
         mV4LError(V4L_NO_ERROR),
         mStatus(DEV_INITIALIZING),
         mErrno(0),
         mUnrecoverableState(false),
-        mLatency(0),
-        mGrabbingStartTime(0),
+        mCaptureTimestamp(AV_NOPTS_VALUE),
+        mLastSequence(-1),
+        mMetrics("v4l2_grabber"),
         mDevName(devName),
+        mBytesPerLine(0),
         mFd(-1),
         mNewVideoFrameAvailable(false),
-        mEncodedFramesBufferOffset(0),        
-        mStreamOn(false)
+        mEncodedFramesBufferOffset(0),
+        mEncodedFramesBufferSize(0),
+        mStreamOn(false),
+        mUVCH264ExtensionUnit(0),
+        mLastKeyFrameRequestTime(AV_NOPTS_VALUE),
+        mKeyFrameRequestDelivered(false)
     {
         mEncodedFramesBuffer.resize(10);
-        unsigned int i;
-        for (i = 0; i < mEncodedFramesBuffer.size(); i++ )
-        {
-            mEncodedFramesBuffer[i] = new unsigned char[500000];
-        }
+        mDriverBuffersQueue = std::make_shared<DriverBuffersQueue>();
+        mDriverBuffersQueue->fd = -1;
+        mDriverBuffersQueue->generation = 0;
+        mDriverBuffersQueue->qBufErrno = 0;
 
-        if (openDevice())
-        {
-            configureDevice();
-            if (!mUnrecoverableState)
-            {
-                configureImageToCapture();
-                if (mFd == -1)
-                    return;
-            }
-            if (!mUnrecoverableState)
-                initMmap();
-            if (!mUnrecoverableState)
-                startCapturing();
-        }
+        makePollable(mBringUp.notificationFd());
+        bringUpDevice();
     }
 
     ~V4L2Grabber()
     {
+        mBringUp.waitForCompletion();
         stopCapture();
         closeDeviceAndReleaseMmap();
-        unsigned int i;
-
-        for (i = 0; i < mEncodedFramesBuffer.size(); i++ )
-        {
-            delete[] mEncodedFramesBuffer[i];
-        }
     }
 
     VideoFrameHolder<CodecOrFormat, width, height>&
     operator >>
     (VideoFrameHolder<CodecOrFormat, width, height>& videoFrameHolder)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoFrameHolder;
+        }
         try
         {
-            videoFrameHolder.hold(grabNextFrame());
+            videoFrameHolder.hold(*grabbedVideoFrame);
             videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -162,13 +235,20 @@ public:
         return videoFrameHolder;
     }
 
-    FFMPEGMJPEGDecoder<width, height>&
+    template <unsigned int scaleDenominator>
+    FFMPEGMJPEGDecoder<width, height, scaleDenominator>&
     operator >>
-    (FFMPEGMJPEGDecoder<width, height>& videoDecoder)
+    (FFMPEGMJPEGDecoder<width, height, scaleDenominator>& videoDecoder)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoDecoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoDecoder;
+        }
         try
         {
-            videoDecoder.decode(grabNextFrame());
+            videoDecoder.decode(*grabbedVideoFrame);
             videoDecoder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -183,9 +263,15 @@ public:
     operator >>
     (VideoEncoder<CodecOrFormat, EncodedVideoFrameCodec, width, height>& videoEncoder)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoEncoder;
+        }
         try
         {
-            videoEncoder.encode(grabNextFrame());
+            videoEncoder.encode(*grabbedVideoFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -201,9 +287,15 @@ public:
      (FFMPEGVideoConverter<CodecOrFormat, width, height,
                            ConvertedVideoFrameFormat, outputWidth, outputHeigth>& videoConverter)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoConverter;
+        }
         try
         {
-            videoConverter.convert(grabNextFrame());
+            videoConverter.convert(*grabbedVideoFrame);
             videoConverter.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -218,9 +310,12 @@ public:
     operator >>
     (HTTPVideoStreamer<Container, CodecOrFormat, width, height>& httpVideoStreamer)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+            return httpVideoStreamer;
         try
         {
-            httpVideoStreamer.takeStreamableFrame(grabNextFrame());
+            httpVideoStreamer.takeStreamableFrame(*grabbedVideoFrame);
             httpVideoStreamer.sendMuxedData();
         }
         catch (const MediaException& mediaException)
@@ -240,9 +335,12 @@ public:
                             CodecOrFormat, width, height,
                             AudioCodec, audioSampleRate, audioChannels>& httpAudioVideoStreamer)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+            return httpAudioVideoStreamer;
         try
         {
-            httpAudioVideoStreamer.takeStreamableFrame(grabNextFrame());
+            httpAudioVideoStreamer.takeStreamableFrame(*grabbedVideoFrame);
             httpAudioVideoStreamer.streamMuxedData();
         }
         catch (const MediaException& mediaException)
@@ -257,9 +355,15 @@ public:
     operator >>
     (FFMPEGVideoMuxer<Container, CodecOrFormat, width, height>& videoMuxer)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            videoMuxer.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoMuxer;
+        }
         try
         {
-            videoMuxer.takeMuxableFrame(grabNextFrame());
+            videoMuxer.takeMuxableFrame(*grabbedVideoFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -278,9 +382,15 @@ public:
                            CodecOrFormat, width, height,
                            AudioCodec, audioSampleRate, audioChannels>& audioVideoMuxer)
     {
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
+        {
+            audioVideoMuxer.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return audioVideoMuxer;
+        }
         try
         {
-            audioVideoMuxer.takeMuxableFrame(grabNextFrame());
+            audioVideoMuxer.takeMuxableFrame(*grabbedVideoFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -295,28 +405,31 @@ public:
      */
     VideoFrame<CodecOrFormat, width, height>& grabNextFrame()
     {
-        // TODO: it should throw another exception, but ok...
-        if (mUnrecoverableState)
+        VideoFrame<CodecOrFormat, width, height>* grabbedVideoFrame = pollNextFrame();
+        if (!grabbedVideoFrame)
             throw MediaException(MEDIA_NO_DATA);
+        return *grabbedVideoFrame;
+    }
+
+    /*
+     * As grabNextFrame(), but returns NULL instead of throwing when there is no new frame
+     * (which is the case of most of the loop's steps): the operators use it.
+     */
+    VideoFrame<CodecOrFormat, width, height>* pollNextFrame()
+    {
+        // The bring-up's thread owns the device
+        if (mBringUp.inProgress())
+            return NULL;
+
+        // TODO: it should report another status, but ok...
+        if (mUnrecoverableState)
+            return NULL;
 
         if (mFd == -1)
         {
-            if (openDevice())
-            {
-                configureDevice();
-                if (!mUnrecoverableState)
-                {
-                    configureImageToCapture();
-                    if (mFd == -1)
-                        throw MediaException(MEDIA_NO_DATA);
-                }
-                if (!mUnrecoverableState)
-                    initMmap();
-                if (!mUnrecoverableState)
-                    startCapturing();
-            }
-            else
-                throw MediaException(MEDIA_NO_DATA);
+            // The device is reopened by timeoutCallBack()
+            reconnectLater();
+            return NULL;
         }
 
         if (!mNewVideoFrameAvailable)
@@ -325,15 +438,28 @@ public:
             {
                 observeEventsOn(mFd);
             }
-            throw MediaException(MEDIA_NO_DATA);
+            return NULL;
         }
-        else
+
+        if (mDriverBuffersQueue->qBufErrno != 0)
         {
-            fillVideoFrameAndAskDriverToBufferData(mGrabbedVideoFrame);
-            setPts(mGrabbedVideoFrame);
-            mNewVideoFrameAvailable = false;
-            return mGrabbedVideoFrame;
+            mV4LError = VIDIOC_QBUF_ERROR;
+            mErrno = mDriverBuffersQueue->qBufErrno;
+            mUnrecoverableState = true;
+            return NULL;
         }
+        mNewVideoFrameAvailable = false;
+        if (!fillVideoFrameAndAskDriverToBufferData(mGrabbedVideoFrame))
+            return NULL;
+        parseEncodedFrame(mGrabbedVideoFrame);
+        setPts(mGrabbedVideoFrame);
+        return &mGrabbedVideoFrame;
+    }
+
+    // Frames out, frames dropped by the driver, latency since the capture
+    StageMetrics& metrics()
+    {
+        return mMetrics;
     }
 
     enum V4LDeviceError getV4LError() const
@@ -405,6 +531,9 @@ public:
         case VIDIOC_STREAMOFF_ERROR:
             ret = "VIDIOC_STREAMOFF_ERROR";
             break;
+        case VIDIOC_EXPBUF_ERROR:
+            ret = "VIDIOC_EXPBUF_ERROR";
+            break;
         }
         return ret;
     }
@@ -419,8 +548,123 @@ public:
         return mUnrecoverableState;
     }
 
+    /*
+     * Interval between two attempts to reopen a missing/disconnected device: it doubles
+     * after each failed attempt, up to maxMilliseconds, and it is restored as soon as the
+     * device can grab again.
+     */
+    void setReconnectionInterval(unsigned int milliseconds, unsigned int maxMilliseconds = 8000)
+    {
+        mReconnectionInterval = milliseconds;
+        mMaxReconnectionInterval = maxMilliseconds < milliseconds ? milliseconds : maxMilliseconds;
+        mReconnectionDelay = milliseconds;
+    }
+
+    /*
+     * Asks a H264 camera for an IDR frame (I.E: for the new viewers, see
+     * HTTPStreamer::hasClientsWaitingForKeyFrame()), through the V4L2 control, or the picture
+     * type control of the UVC H264 extension unit (see setUVCH264ExtensionUnit()) if the
+     * driver doesn't have it. The requests within a second from the delivered one are
+     * ignored, because the camera is already sending the IDR. Returns false if the camera
+     * can't be asked for it.
+     */
+    bool forceKeyFrame()
+    {
+        static_assert(std::is_same<CodecOrFormat, H264>::value,
+                      "Only the H264 cameras can be asked for a keyframe");
+        if (mBringUp.inProgress() || mFd == -1)
+            return false;
+        int64_t now = av_gettime_relative();
+        if (mKeyFrameRequestDelivered && now - mLastKeyFrameRequestTime < 1000000)
+            return true;
+        mLastKeyFrameRequestTime = now;
+
+        struct v4l2_control control;
+        CLEAR(control);
+        control.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+        mKeyFrameRequestDelivered = V4LUtils::xioctl(mFd, VIDIOC_S_CTRL, &control) == 0;
+        if (mKeyFrameRequestDelivered || mUVCH264ExtensionUnit == 0)
+            return mKeyFrameRequestDelivered;
+
+        // uvcx_picture_type_control_t: wLayerID, wPicType (little endian)
+        __u8 pictureType[4] = {0, 0, uvcH264PictureTypeIDR, 0};
+        struct uvc_xu_control_query query;
+        CLEAR(query);
+        query.unit = mUVCH264ExtensionUnit;
+        query.selector = uvcxPictureTypeControl;
+        query.query = UVC_SET_CUR;
+        query.size = sizeof(pictureType);
+        query.data = pictureType;
+        mKeyFrameRequestDelivered = V4LUtils::xioctl(mFd, UVCIOC_CTRL_QUERY, &query) == 0;
+        return mKeyFrameRequestDelivered;
+    }
+
+    /*
+     * bUnitID of the camera's H264 extension unit (the VideoControl interface's extension
+     * unit whose guidExtensionCode is {a29e7641-de04-47e3-8b2b-f4341aff003b}, see lsusb -v),
+     * I.E: of the UVC 1.1 cameras which mux H264 in their MJPEG stream or offer it as a format.
+     */
+    void setUVCH264ExtensionUnit(unsigned int unitId)
+    {
+        mUVCH264ExtensionUnit = unitId;
+    }
+
 private:
 
+    bool openAndStartDevice()
+    {
+        if (!openDevice())
+            return false;
+        configureDevice();
+        if (!mUnrecoverableState)
+        {
+            configureImageToCapture();
+            if (mFd == -1)
+                return false;
+        }
+        if (!mUnrecoverableState)
+            initMmap();
+        if (!mUnrecoverableState)
+            startCapturing();
+        return !mUnrecoverableState;
+    }
+
+    // The blocking calls of openAndStartDevice() are made by the bring-up's thread
+    void bringUpDevice()
+    {
+        mBringUp.start([this]() { return openAndStartDevice(); });
+        observeEventsOn(mBringUp.notificationFd());
+    }
+
+    // Called from the loop's thread, when the bring-up's thread is over
+    void deviceBroughtUp(bool deviceCanGrab)
+    {
+        if (!deviceCanGrab)
+        {
+            reconnectLater();
+            return;
+        }
+        mReconnectionDelay = mReconnectionInterval;
+        makePollable(mFd);
+        observeEventsOn(mFd);
+    }
+
+    void reconnectLater()
+    {
+        if (mUnrecoverableState || mBringUp.inProgress() || thereIsTimeoutPending())
+            return;
+        observeTimeout(mReconnectionDelay);
+        mReconnectionDelay = mReconnectionDelay * 2 > mMaxReconnectionInterval ?
+                             mMaxReconnectionInterval : mReconnectionDelay * 2;
+    }
+
+    void timeoutCallBack()
+    {
+        if (mFd != -1 || mUnrecoverableState || mBringUp.inProgress())
+            return;
+        bringUpDevice();
+    }
+
     /*
         TODO: implement for v4l2_plane?
         void fillVideoFrameAndAskDriverToBufferData(Planar3RawVideoFrameBase& videoFrame)
@@ -428,15 +672,66 @@ private:
         }
     */
 
-    void setPts(VideoFrameBase<width, height>& videoFrame)
+    // The drivers with monotonic buffer timestamps tell when the frame was captured
+    void storeCaptureTimestamp(const struct v4l2_buffer& buf)
     {
-        videoFrame.setTimestampsToNow();
+        if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+            (buf.timestamp.tv_sec != 0 || buf.timestamp.tv_usec != 0))
+            mCaptureTimestamp = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+        else
+            mCaptureTimestamp = AV_NOPTS_VALUE;
     }
 
-    /*!
-     *  \exception MediaException(MEDIA_NO_DATA)
+    // The gaps in the buffers' sequence numbers are the frames dropped by the driver
+    void countDequeuedBuffer(const struct v4l2_buffer& buf)
+    {
+        if (mLastSequence != -1 && buf.sequence > mLastSequence + 1)
+            mMetrics.countDroppedFrames(buf.sequence - mLastSequence - 1);
+        mLastSequence = buf.sequence;
+        mMetrics.countFrameOut(buf.bytesused);
+        if (mCaptureTimestamp != AV_NOPTS_VALUE)
+            mMetrics.recordLatency(av_gettime_relative() - mCaptureTimestamp);
+    }
+
+    // UVCX_PICTURE_TYPE_CONTROL, and its value for the IDR frames
+    static const __u8 uvcxPictureTypeControl = 0x09;
+    static const __u8 uvcH264PictureTypeIDR = 0x01;
+
+    void parseEncodedFrame(VideoFrameBase<width, height>& videoFrame)
+    {
+    }
+
+    /*
+     * The driver doesn't flag the keyframes: they are found in the stream, and the SPS and
+     * PPS are written before them if the camera sent them only once (as the encoders' ones)
      */
-    void fillVideoFrameAndAskDriverToBufferData(EncodedVideoFrame& videoFrame)
+    void parseEncodedFrame(VideoFrame<H264, width, height>& videoFrame)
+    {
+        const unsigned char* data = videoFrame.data();
+        unsigned int size = videoFrame.size();
+        bool keyFrame = mAnnexBWriter.isKeyFrame(data, size);
+        videoFrame.mLibAVFlags = keyFrame ? AV_PKT_FLAG_KEY : 0;
+        mAnnexBWriter.updateParameterSets(data, size);
+        if (mAnnexBWriter.isPassthrough(data, size, keyFrame))
+            return;
+        std::shared_ptr<std::vector<unsigned char> > annexBFrame =
+        std::make_shared<std::vector<unsigned char> >();
+        mAnnexBWriter.write(data, size, keyFrame, *annexBFrame);
+        ShareableVideoFrameData frameData(annexBFrame, &(*annexBFrame)[0]);
+        videoFrame.assignDataSharedPtr(frameData);
+        videoFrame.setSize(annexBFrame->size());
+    }
+
+    void setPts(VideoFrameBase<width, height>& videoFrame)
+    {
+        if (mCaptureTimestamp != AV_NOPTS_VALUE)
+            videoFrame.setCaptureTimestamp(mCaptureTimestamp);
+        else
+            videoFrame.setTimestampsToNow();
+    }
+
+    // Returns false if no frame was dequeued
+    bool fillVideoFrameAndAskDriverToBufferData(EncodedVideoFrame& videoFrame)
     {
         struct v4l2_buffer buf;
         CLEAR(buf);
@@ -450,7 +745,7 @@ private:
                 case EAGAIN:
                     // Should not happen (because already catched
                     // by the events manager)... anyway...
-                    throw MediaException(MEDIA_NO_DATA);
+                    return false;
                 case EIO:
                 // Could ignore EIO, see spec
                 // fall through
@@ -460,32 +755,45 @@ private:
                     mErrno = errno;
                     stopCapture();
                     closeDeviceAndReleaseMmap();
-                    return;
+                    reconnectLater();
+                    return false;
             }
         }
 
-        if (mLatency == 0)
-        {
-            mLatency = av_gettime_relative() - mGrabbingStartTime;
-            AVRational timeBase = AV_TIME_BASE_Q;
-            timeBase = {1, 1000000000};
-            struct timespec monotimeNow;
-            clock_gettime(CLOCK_MONOTONIC, &monotimeNow);
-
-            mLatency = (monotimeNow.tv_sec * 1000000000 + monotimeNow.tv_nsec) -
-            (buf.timestamp.tv_sec * 1000000000 + buf.timestamp.tv_usec * 1000);
-        }
-
         mV4LError = V4L_NO_ERROR;
         mErrno = 0;
         mStatus = DEV_CAN_GRAB;
+        storeCaptureTimestamp(buf);
+        countDequeuedBuffer(buf);
 
-        memcpy(mEncodedFramesBuffer[mEncodedFramesBufferOffset],
-               mBuffersFormVideoFrame[buf.index].get(), buf.bytesused);
+        if (mZeroCopy)
+        {
+            ShareableVideoFrameData shData = shareDequeuedBuffer(buf);
+            videoFrame.assignDataSharedPtr(shData);
+            videoFrame.setSize(buf.bytesused);
+            if (!thereAreEventsPendingOn(mFd))
+            {
+                observeEventsOn(mFd);
+            }
+            return true;
+        }
+
+        // The slots are sized as the biggest driver buffer, so that a frame can't overflow them
+        ShareableVideoFrameData& shData = mEncodedFramesBuffer[mEncodedFramesBufferOffset];
+        if (!shData || shData.use_count() > 1 || mEncodedFramesBufferSize < buf.bytesused)
+        {
+            // The slot is still referenced downstream (or too small): don't overwrite it
+            auto freeFrameBuffer = [](unsigned char* buffer)
+            {
+                delete[] buffer;
+            };
+            if (mEncodedFramesBufferSize < buf.bytesused)
+                mEncodedFramesBufferSize = buf.bytesused;
+            shData = ShareableVideoFrameData(new unsigned char[mEncodedFramesBufferSize],
+                                             freeFrameBuffer);
+        }
 
-        auto freeNothing = [](unsigned char* buffer){};
-        ShareableVideoFrameData shData =
-        ShareableAudioFrameData(mEncodedFramesBuffer[mEncodedFramesBufferOffset], freeNothing);
+        memcpy(shData.get(), mBuffersFormVideoFrame[buf.index].get(), buf.bytesused);
 
         mEncodedFramesBufferOffset =
         (mEncodedFramesBufferOffset + 1) % mEncodedFramesBuffer.size();
@@ -502,14 +810,12 @@ private:
             mV4LError = VIDIOC_QBUF_ERROR;
             mErrno = errno;
             mUnrecoverableState = true;
-            return;
         }
+        return true;
     }
 
-    /*!
-     *  \exception MediaException(MEDIA_NO_DATA)
-     */
-    void fillVideoFrameAndAskDriverToBufferData(PackedRawVideoFrame& videoFrame)
+    // Returns false if no frame was dequeued
+    bool fillVideoFrameAndAskDriverToBufferData(PackedRawVideoFrame& videoFrame)
     {
         struct v4l2_buffer buf;
         CLEAR(buf);
@@ -523,7 +829,7 @@ private:
             case EAGAIN:
                 // Should not happen (because
                 // already caught by the events manager)... anyway...
-                throw MediaException(MEDIA_NO_DATA);
+                return false;
             case EIO:
             // Could ignore EIO, see spec
             // fall through
@@ -533,40 +839,165 @@ private:
                 mStatus = DEV_DISCONNECTED;
                 stopCapture();
                 closeDeviceAndReleaseMmap();
-                return;
+                reconnectLater();
+                return false;
             }
         }
 
-        if (mLatency == 0)
+        mV4LError = V4L_NO_ERROR;
+        mErrno = 0;
+        mStatus = DEV_CAN_GRAB;
+        storeCaptureTimestamp(buf);
+        countDequeuedBuffer(buf);
+        if (mZeroCopy)
+        {
+            ShareableVideoFrameData shData = shareDequeuedBuffer(buf);
+            videoFrame.assignDataSharedPtr(shData);
+        }
+        else
+            videoFrame.assignDataSharedPtr(mBuffersFormVideoFrame[buf.index]);
+        videoFrame.setSize(buf.bytesused);
+        if (!thereAreEventsPendingOn(mFd))
         {
-            mLatency = av_gettime_relative() - mGrabbingStartTime;
-            AVRational timeBase = AV_TIME_BASE_Q;
-            // TODO: improve
-            timeBase = {1, 1000000000};
-            struct timespec monotimeNow;
-            clock_gettime(CLOCK_MONOTONIC, &monotimeNow);
+            observeEventsOn(mFd);
+        }
 
-            mLatency = (monotimeNow.tv_sec * 1000000000 + monotimeNow.tv_nsec) -
-            (buf.timestamp.tv_sec * 1000000000 + buf.timestamp.tv_usec * 1000);
+        if (mZeroCopy)
+            return true;
+
+        if (-1 == V4LUtils::xioctl(mFd, VIDIOC_QBUF, &buf))
+        {
+            mV4LError = VIDIOC_QBUF_ERROR;
+            mErrno = errno;
+            mUnrecoverableState = true;
+        }
+        return true;
+    }
+
+    // Returns false if no frame was dequeued
+    bool fillVideoFrameAndAskDriverToBufferData(DMABufRawVideoFrame& videoFrame)
+    {
+        struct v4l2_buffer buf;
+        CLEAR(buf);
+
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (-1 == V4LUtils::xioctl(mFd, VIDIOC_DQBUF, &buf))
+        {
+            switch (errno)
+            {
+            case EAGAIN:
+                return false;
+            default:
+                mV4LError = VIDIOC_DQBUF_ERROR;
+                mErrno = errno;
+                mStatus = DEV_DISCONNECTED;
+                stopCapture();
+                closeDeviceAndReleaseMmap();
+                reconnectLater();
+                return false;
+            }
         }
 
         mV4LError = V4L_NO_ERROR;
         mErrno = 0;
         mStatus = DEV_CAN_GRAB;
-        videoFrame.assignDataSharedPtr(mBuffersFormVideoFrame[buf.index]);
+        storeCaptureTimestamp(buf);
+        countDequeuedBuffer(buf);
+
+        // A dma-buf can't be given back to the driver while someone is still
+        // accessing it, so DMABUF frames are always zero-copy
+        ShareableVideoFrameData shData = shareDequeuedBuffer(buf);
+        videoFrame.assignDataSharedPtr(shData);
         videoFrame.setSize(buf.bytesused);
+        videoFrame.setFd(mExportedDMABufFds[buf.index]);
+        V4LUtils::fillPlanesLayout<CodecOrFormat>(videoFrame, mBytesPerLine, height);
         if (!thereAreEventsPendingOn(mFd))
         {
             observeEventsOn(mFd);
         }
+        return true;
+    }
 
-        if (-1 == V4LUtils::xioctl(mFd, VIDIOC_QBUF, &buf))
+    int exportDriverBuffer(const EncodedVideoFrame& videoFrame, unsigned int index)
+    {
+        return -1;
+    }
+
+    int exportDriverBuffer(const PackedRawVideoFrame& videoFrame, unsigned int index)
+    {
+        return -1;
+    }
+
+    int exportDriverBuffer(const DMABufRawVideoFrame& videoFrame, unsigned int index)
+    {
+        struct v4l2_exportbuffer expbuf;
+        CLEAR(expbuf);
+        expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        expbuf.index = index;
+        expbuf.flags = O_CLOEXEC | O_RDONLY;
+        if (-1 == V4LUtils::xioctl(mFd, VIDIOC_EXPBUF, &expbuf))
         {
-            mV4LError = VIDIOC_QBUF_ERROR;
+            mV4LError = VIDIOC_EXPBUF_ERROR;
             mErrno = errno;
             mUnrecoverableState = true;
+            return -1;
+        }
+        return expbuf.fd;
+    }
+
+    /*
+     * Shared between the grabber and the deleters of the zero-copy frames, which can
+     * outlive the capture (and the grabber). Each capture (STREAMON) has its generation:
+     * a frame released after the capture was stopped (I.E: a device reconnection) doesn't
+     * give back its buffer, which belongs to a STREAMOFF'd (or closed, or reused) fd.
+     * The mutex serializes the deleters' QBUFs with the stop of the capture. The deleters
+     * run on the thread which releases the last reference (I.E: a PipeWorker's one).
+     */
+    struct DriverBuffersQueue
+    {
+        std::mutex mutex;
+        // -1 when no capture is running
+        std::atomic<int> fd;
+        unsigned int generation;
+        // Written by the deleters, checked by the loop's thread (without locking)
+        std::atomic<int> qBufErrno;
+    };
+
+    static void giveBackBufferToDriver(DriverBuffersQueue& queue, unsigned int generation,
+                                       struct v4l2_buffer buf)
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.fd == -1 || queue.generation != generation)
             return;
+        if (-1 == V4LUtils::xioctl(queue.fd, VIDIOC_QBUF, &buf))
+            queue.qBufErrno = errno;
+    }
+
+    ShareableVideoFrameData shareDequeuedBuffer(const struct v4l2_buffer& buf)
+    {
+        // The copy of the mmap'd ptr delays munmap() until the frame is released
+        ShareableVideoFrameData mmapData = mBuffersFormVideoFrame[buf.index];
+        std::shared_ptr<DriverBuffersQueue> queue = mDriverBuffersQueue;
+        unsigned int generation;
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            generation = queue->generation;
         }
+        struct v4l2_buffer dequeuedBuf = buf;
+        auto giveBackBuffer = [mmapData, queue, generation, dequeuedBuf](unsigned char* buffer)
+        {
+            giveBackBufferToDriver(*queue, generation, dequeuedBuf);
+        };
+        return ShareableVideoFrameData(mmapData.get(), giveBackBuffer);
+    }
+
+    // Waits for the deleters which are giving back their buffers
+    void invalidateDriverBuffersQueue()
+    {
+        std::lock_guard<std::mutex> lock(mDriverBuffersQueue->mutex);
+        mDriverBuffersQueue->fd = -1;
+        mDriverBuffersQueue->generation++;
     }
 
     bool startCapturing()
@@ -574,8 +1005,8 @@ private:
         unsigned int i;
         enum v4l2_buf_type type;
         type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        if (mGrabbingStartTime == 0)
-            mGrabbingStartTime = av_gettime_relative();
+        // The sequence numbers restart
+        mLastSequence = -1;
 
         for (i = 0; i < mNumOfBuffers; ++i)
         {
@@ -602,6 +1033,13 @@ private:
             return false;
         }
 
+        {
+            std::lock_guard<std::mutex> lock(mDriverBuffersQueue->mutex);
+            mDriverBuffersQueue->fd = mFd;
+            mDriverBuffersQueue->generation++;
+            mDriverBuffersQueue->qBufErrno = 0;
+        }
+
         mStreamOn = true;
         mV4LError = V4L_NO_ERROR;
         mErrno = 0;
@@ -613,7 +1051,7 @@ private:
     {
         struct v4l2_requestbuffers req;
         CLEAR(req);
-        req.count = 4;
+        req.count = mNumOfDriverBuffers;
         req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         req.memory = V4L2_MEMORY_MMAP;
 
@@ -661,6 +1099,8 @@ private:
                 return false;
             }
             mBuffers[mNumOfBuffers].length = buf.length;
+            if (buf.length > mEncodedFramesBufferSize)
+                mEncodedFramesBufferSize = buf.length;
             mBuffers[mNumOfBuffers].start =
                 mmap(NULL, // start anywhere
                      buf.length,
@@ -676,11 +1116,23 @@ private:
                 return false;
             }
 
+            int dmaBufFd = exportDriverBuffer(mGrabbedVideoFrame, mNumOfBuffers);
+            if (mUnrecoverableState)
+            {
+                munmap(mBuffers[mNumOfBuffers].start, buf.length);
+                return false;
+            }
+            mExportedDMABufFds.push_back(dmaBufFd);
+
             unsigned char* videoFrameDataPtr = (unsigned char* )mBuffers[mNumOfBuffers].start;
             int mmapLength = buf.length;
-            auto releaseMmap = [mmapLength] (unsigned char* videoFrameDataPtr_)
+            // The exported dma-buf is closed together with its mapping, when
+            // the last frame referencing it is released
+            auto releaseMmap = [mmapLength, dmaBufFd] (unsigned char* videoFrameDataPtr_)
             {
                 munmap((void* )videoFrameDataPtr_, mmapLength);
+                if (dmaBufFd != -1)
+                    close(dmaBufFd);
             };
             mBuffersFormVideoFrame.push_back(ShareableVideoFrameData(videoFrameDataPtr, releaseMmap));
         }
@@ -715,6 +1167,8 @@ private:
             return false;
         }
 
+        mBytesPerLine = fmt.fmt.pix.bytesperline;
+
         if (fmt.fmt.pix.width != width || fmt.fmt.pix.height != height)
         {
             mV4LError = CONFIG_IMG_TO_CAPTURE_ERROR;
@@ -821,8 +1275,8 @@ private:
             return false;
         }
 
+        // Made pollable by deviceBroughtUp(), from the loop's thread
         mFd = open(mDevName.c_str(), O_RDWR | O_NONBLOCK, 0);
-        makePollable(mFd);
 
         if (-1 == mFd)
         {
@@ -837,6 +1291,8 @@ private:
 
     void stopCapture()
     {
+        // STREAMOFF gives back all the buffers: the frames still held can't requeue theirs
+        invalidateDriverBuffersQueue();
         if (mUnrecoverableState)
             return;
         enum v4l2_buf_type type;
@@ -856,6 +1312,8 @@ private:
     {
         if (mFd == -1)
             return;
+        // Before close(): the fd number can be reused by the next open()
+        invalidateDriverBuffersQueue();
         if (-1 == close(mFd))
         {
             mStatus = CLOSE_DEV_ERROR;
@@ -864,10 +1322,17 @@ private:
         mFd = -1;
         while (mBuffersFormVideoFrame.size() > 0)
             mBuffersFormVideoFrame.pop_back();
+        mExportedDMABufFds.clear();
     }
 
     void eventCallBack(int fd, enum EventType eventType)
     {
+        if (fd == mBringUp.notificationFd())
+        {
+            dontObserveEventsOn(fd);
+            deviceBroughtUp(mBringUp.complete());
+            return;
+        }
         mNewVideoFrameAvailable = true;
         dontObserveEventsOn(mFd);
     }
@@ -880,22 +1345,41 @@ private:
     };
 
     unsigned int mFps;
-    enum V4LDeviceError mV4LError;
-    enum DeviceStatus mStatus;
-    int mErrno;
-    bool mUnrecoverableState;
-    int64_t mLatency;
-    int64_t mGrabbingStartTime;
+    bool mZeroCopy;
+    unsigned int mNumOfDriverBuffers;
+    unsigned int mReconnectionInterval;
+    unsigned int mMaxReconnectionInterval;
+    unsigned int mReconnectionDelay;
+    // Also written by the bring-up's thread, while the loop can read them
+    std::atomic<enum V4LDeviceError> mV4LError;
+    std::atomic<enum DeviceStatus> mStatus;
+    std::atomic<int> mErrno;
+    std::atomic<bool> mUnrecoverableState;
+    // Of the last dequeued buffer (microseconds, av_gettime_relative() clock)
+    int64_t mCaptureTimestamp;
+    int64_t mLastSequence;
+    StageMetrics mMetrics;
     std::vector<ShareableVideoFrameData> mBuffersFormVideoFrame;
     std::vector<Buffer> mBuffers;
+    std::vector<int> mExportedDMABufFds;
     unsigned int mNumOfBuffers;
     std::string mDevName;
+    unsigned int mBytesPerLine;
     int mFd;
     bool mNewVideoFrameAvailable;
     VideoFrame<CodecOrFormat, width, height> mGrabbedVideoFrame;
-    std::vector<unsigned char* > mEncodedFramesBuffer;
+    std::vector<ShareableVideoFrameData> mEncodedFramesBuffer;
     unsigned int mEncodedFramesBufferOffset;
+    unsigned int mEncodedFramesBufferSize;
+    std::shared_ptr<DriverBuffersQueue> mDriverBuffersQueue;
     bool mStreamOn;
+    // H264 only
+    H264AnnexBWriter mAnnexBWriter;
+    unsigned int mUVCH264ExtensionUnit;
+    int64_t mLastKeyFrameRequestTime;
+    bool mKeyFrameRequestDelivered;
+    // Last member: its thread is joined before the others are destroyed
+    DeviceBringUp mBringUp;
 
 };
 
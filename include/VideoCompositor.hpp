@@ -0,0 +1,355 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef VIDEOCOMPOSITOR_HPP_INCLUDED
+#define VIDEOCOMPOSITOR_HPP_INCLUDED
+
+#include "FFMPEGVideoConverter.hpp"
+
+namespace laav
+{
+
+/*
+ * A layout of VideoCompositor: columns x rows tiles of the same size, numbered by rows
+ * from the top left one. The tiles' coordinates and sizes are even (the chroma samples
+ * of the subsampled formats aren't split between tiles).
+ * Other layouts can be given with the same members.
+ */
+template <unsigned int columns, unsigned int rows>
+struct VideoGridLayout
+{
+
+    static_assert(columns >= 1 && rows >= 1, "VideoGridLayout needs at least a tile");
+
+    static const unsigned int numOfTiles = columns * rows;
+
+    static void tileRectangle(unsigned int tileNum, unsigned int width, unsigned int height,
+                              unsigned int& x, unsigned int& y,
+                              unsigned int& tileWidth, unsigned int& tileHeight)
+    {
+        unsigned int column = tileNum % columns;
+        unsigned int row = tileNum / columns;
+        x = (width * column / columns) & ~1u;
+        y = (height * row / rows) & ~1u;
+        tileWidth = ((width * (column + 1) / columns) & ~1u) - x;
+        tileHeight = ((height * (row + 1) / rows) & ~1u) - y;
+    }
+
+};
+
+template <typename VideoFrameFormat, unsigned int width, unsigned int height, typename Layout>
+class VideoCompositor;
+
+/*
+ * A tile of a VideoCompositor: the frames piped into it (of any size) are scaled into
+ * the tile's rectangle of the composed frame.
+ */
+template <typename VideoFrameFormat, unsigned int width, unsigned int height, typename Layout>
+class VideoCompositorTile
+{
+
+    friend class VideoCompositor<VideoFrameFormat, width, height, Layout>;
+
+public:
+
+    VideoCompositorTile() :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mCompositor(NULL),
+        mTileNum(0),
+        mSwscaleContext(NULL),
+        mSourceWidth(0),
+        mSourceHeight(0)
+    {
+    }
+
+    ~VideoCompositorTile()
+    {
+        sws_freeContext(mSwscaleContext);
+    }
+
+    VideoCompositorTile(const VideoCompositorTile&) = delete;
+    VideoCompositorTile& operator=(const VideoCompositorTile&) = delete;
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    template <unsigned int sourceWidth, unsigned int sourceHeight>
+    void take(const VideoFrame<VideoFrameFormat, sourceWidth, sourceHeight>& videoFrame)
+    {
+        if (videoFrame.template size<0>() == 0)
+            throw MediaException(MEDIA_NO_DATA);
+        mCompositor->drawTile(*this, sourceWidth, sourceHeight,
+                              videoFrame.template plane<0>(), videoFrame.template plane<1>(),
+                              videoFrame.template plane<2>());
+    }
+
+    // TODO: private with friend holder
+    enum MediaStatus mMediaStatusInPipe;
+
+private:
+
+    VideoCompositor<VideoFrameFormat, width, height, Layout>* mCompositor;
+    unsigned int mTileNum;
+    // The scaling of the last source's size into the tile
+    struct SwsContext* mSwscaleContext;
+    unsigned int mSourceWidth;
+    unsigned int mSourceHeight;
+
+};
+
+/*
+ * Composes the frames of several cameras into a mosaic (I.E: a 3x3 overview of a
+ * monitoring wall), which is encoded and streamed once, I.E:
+ *
+ *   VideoCompositor <YUV420_PLANAR, 1920, 1080, VideoGridLayout<3, 3> > vMosaic(25);
+ *   ...
+ *   vFh1 >> vMosaic.tile(0);
+ *   vFh2 >> vMosaic.tile(1);
+ *   ...
+ *   vMosaic >> vEnc >> vStream;
+ *
+ * The inputs can have any size, in the compositor's format: each new frame is scaled
+ * (by libswscale's SIMD kernels) straight into its tile of the composed frame, and a
+ * tile without a new frame keeps the last one (black before the first one). A frame is
+ * composed when some tiles have changed, at fps at most. The composed frames are pooled
+ * (see FFMPEGVideoFramePool): the unchanged tiles are copied from the previous frame
+ * only while someone (I.E: an encoder's lookahead) still shares it.
+ */
+template <typename VideoFrameFormat, unsigned int width, unsigned int height, typename Layout>
+class VideoCompositor
+{
+
+    static_assert(std::is_base_of<Planar3RawVideoFrame,
+                                  VideoFrame<VideoFrameFormat, width, height> >::value,
+                  "VideoCompositor supports only the planar formats");
+
+    friend class VideoCompositorTile<VideoFrameFormat, width, height, Layout>;
+
+    typedef VideoCompositorTile<VideoFrameFormat, width, height, Layout> Tile;
+
+public:
+
+    VideoCompositor(unsigned int fps = 25) :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mFramePeriodUs(fps == 0 ? 0 : 1000000 / fps),
+        mLastComposedFrameTime(AV_NOPTS_VALUE),
+        mCanvasIsDrawable(false),
+        mCanvasHasChanged(false)
+    {
+        const AVPixFmtDescriptor* pixelFormatDescriptor =
+        av_pix_fmt_desc_get(FFMPEGUtils::translatePixelFormat<VideoFrameFormat>());
+        if (!pixelFormatDescriptor)
+            printAndThrowUnrecoverableError("pixelFormatDescriptor = av_pix_fmt_desc_get(...)");
+        mChromaWidthShift = pixelFormatDescriptor->log2_chroma_w;
+        mChromaHeightShift = pixelFormatDescriptor->log2_chroma_h;
+
+        mCanvasLibAVFrame = av_frame_alloc();
+        if (!mCanvasLibAVFrame)
+            printAndThrowUnrecoverableError("(mCanvasLibAVFrame = av_frame_alloc())");
+        unsigned int n;
+        for (n = 0; n < Layout::numOfTiles; n++)
+        {
+            mTiles[n].mCompositor = this;
+            mTiles[n].mTileNum = n;
+        }
+    }
+
+    ~VideoCompositor()
+    {
+        av_frame_free(&mCanvasLibAVFrame);
+    }
+
+    Tile& tile(unsigned int n)
+    {
+        if (n >= Layout::numOfTiles)
+            printAndThrowUnrecoverableError("tile(n): n >= Layout::numOfTiles");
+        return mTiles[n];
+    }
+
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    VideoFrame<VideoFrameFormat, width, height>& compose()
+    {
+        VideoFrame<VideoFrameFormat, width, height>* composedVideoFrame = pollComposedFrame();
+        if (!composedVideoFrame)
+            throw MediaException(MEDIA_NO_DATA);
+        return *composedVideoFrame;
+    }
+
+    // As compose(), but returns NULL instead of throwing when no frame is due
+    VideoFrame<VideoFrameFormat, width, height>* pollComposedFrame()
+    {
+        if (!mCanvasHasChanged)
+            return NULL;
+        int64_t now = av_gettime_relative();
+        if (mLastComposedFrameTime != AV_NOPTS_VALUE &&
+            now - mLastComposedFrameTime < mFramePeriodUs)
+            return NULL;
+        mLastComposedFrameTime = now;
+        mComposedVideoFrame.setTimestampsToNow();
+        // The next tiles are drawn on the next composed frame
+        mCanvasIsDrawable = false;
+        mCanvasHasChanged = false;
+        return &mComposedVideoFrame;
+    }
+
+    template <typename EncodedVideoFrameCodec>
+    VideoEncoder<VideoFrameFormat, EncodedVideoFrameCodec, width, height>&
+    operator >>
+    (VideoEncoder<VideoFrameFormat, EncodedVideoFrameCodec, width, height>& videoEncoder)
+    {
+        VideoFrame<VideoFrameFormat, width, height>* composedVideoFrame = pollComposedFrame();
+        if (!composedVideoFrame)
+        {
+            videoEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoEncoder;
+        }
+        try
+        {
+            videoEncoder.encode(*composedVideoFrame);
+            videoEncoder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            videoEncoder.mMediaStatusInPipe = mediaException.cause();
+        }
+        return videoEncoder;
+    }
+
+    VideoFrameHolder<VideoFrameFormat, width, height>&
+    operator >>
+    (VideoFrameHolder<VideoFrameFormat, width, height>& videoFrameHolder)
+    {
+        VideoFrame<VideoFrameFormat, width, height>* composedVideoFrame = pollComposedFrame();
+        if (!composedVideoFrame)
+        {
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoFrameHolder;
+        }
+        videoFrameHolder.hold(*composedVideoFrame);
+        videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        return videoFrameHolder;
+    }
+
+    // TODO: private with friend encoder
+    enum MediaStatus mMediaStatusInPipe;
+
+private:
+
+    unsigned int planeWidth(unsigned int planeNum, unsigned int lumaWidth) const
+    {
+        return planeNum == 0 ? lumaWidth :
+               (lumaWidth + (1 << mChromaWidthShift) - 1) >> mChromaWidthShift;
+    }
+
+    unsigned int planeHeight(unsigned int planeNum, unsigned int lumaHeight) const
+    {
+        return planeNum == 0 ? lumaHeight :
+               (lumaHeight + (1 << mChromaHeightShift) - 1) >> mChromaHeightShift;
+    }
+
+    /*
+     * After a frame has been composed, the next tiles are drawn on a fresh buffer (with
+     * the previous tiles), unless nobody else shares the composed frame anymore
+     */
+    void prepareCanvas()
+    {
+        if (mCanvasIsDrawable)
+            return;
+        mCanvasIsDrawable = true;
+        // The 3 planes of mComposedVideoFrame share the buffer
+        if (mComposedVideoFrame.template size<0>() != 0 &&
+            mComposedVideoFrame.template planeSharedPtr<0>().use_count() == 3)
+            return;
+
+        VideoFrame<VideoFrameFormat, width, height> previousVideoFrame = mComposedVideoFrame;
+        mCanvasPool.assignFreshBuffer(mCanvasLibAVFrame, mComposedVideoFrame);
+        unsigned int n;
+        for (n = 0; n < 3; n++)
+            mCanvasSizes[n] = planeWidth(n, width) * planeHeight(n, height);
+        mComposedVideoFrame.template setSize<0>(mCanvasSizes[0]);
+        mComposedVideoFrame.template setSize<1>(mCanvasSizes[1]);
+        mComposedVideoFrame.template setSize<2>(mCanvasSizes[2]);
+        if (previousVideoFrame.template size<0>() == 0)
+        {
+            YUVPixel black;
+            black.set(16, 128, 128);
+            mComposedVideoFrame.fillRectangle(black, 0, 0, width, height);
+            return;
+        }
+        memcpy(mComposedVideoFrame.template plane<0>(), previousVideoFrame.template plane<0>(),
+               mCanvasSizes[0]);
+        memcpy(mComposedVideoFrame.template plane<1>(), previousVideoFrame.template plane<1>(),
+               mCanvasSizes[1]);
+        memcpy(mComposedVideoFrame.template plane<2>(), previousVideoFrame.template plane<2>(),
+               mCanvasSizes[2]);
+    }
+
+    void drawTile(Tile& tile, unsigned int sourceWidth, unsigned int sourceHeight,
+                  const unsigned char* plane0, const unsigned char* plane1,
+                  const unsigned char* plane2)
+    {
+        unsigned int x, y, tileWidth, tileHeight;
+        Layout::tileRectangle(tile.mTileNum, width, height, x, y, tileWidth, tileHeight);
+        if (tileWidth == 0 || tileHeight == 0)
+            return;
+
+        if (!tile.mSwscaleContext || tile.mSourceWidth != sourceWidth ||
+            tile.mSourceHeight != sourceHeight)
+        {
+            AVPixelFormat pixelFormat = FFMPEGUtils::translatePixelFormat<VideoFrameFormat>();
+            sws_freeContext(tile.mSwscaleContext);
+            tile.mSwscaleContext = sws_getContext(sourceWidth, sourceHeight, pixelFormat,
+                                                  tileWidth, tileHeight, pixelFormat,
+                                                  SWS_BILINEAR, NULL, NULL, NULL);
+            if (!tile.mSwscaleContext)
+                printAndThrowUnrecoverableError("tile.mSwscaleContext = sws_getContext(...)");
+            tile.mSourceWidth = sourceWidth;
+            tile.mSourceHeight = sourceHeight;
+        }
+
+        prepareCanvas();
+        const uint8_t* sourcePlanes[3] = {plane0, plane1, plane2};
+        int sourceStrides[3];
+        uint8_t* tilePlanes[3];
+        int tileStrides[3];
+        unsigned char* canvasPlanes[3] = {mComposedVideoFrame.template plane<0>(),
+                                          mComposedVideoFrame.template plane<1>(),
+                                          mComposedVideoFrame.template plane<2>()};
+        unsigned int n;
+        for (n = 0; n < 3; n++)
+        {
+            sourceStrides[n] = planeWidth(n, sourceWidth);
+            tileStrides[n] = planeWidth(n, width);
+            tilePlanes[n] = canvasPlanes[n] +
+                            (n == 0 ? y : y >> mChromaHeightShift) * tileStrides[n] +
+                            (n == 0 ? x : x >> mChromaWidthShift);
+        }
+        sws_scale(tile.mSwscaleContext, sourcePlanes, sourceStrides, 0, sourceHeight,
+                  tilePlanes, tileStrides);
+        mCanvasHasChanged = true;
+    }
+
+    Tile mTiles[Layout::numOfTiles];
+    int64_t mFramePeriodUs;
+    // microseconds, AV_NOPTS_VALUE before the first composed frame
+    int64_t mLastComposedFrameTime;
+    unsigned int mChromaWidthShift;
+    unsigned int mChromaHeightShift;
+    // Whether the tiles can be drawn on mComposedVideoFrame (not composed yet)
+    bool mCanvasIsDrawable;
+    bool mCanvasHasChanged;
+    unsigned int mCanvasSizes[3];
+    AVFrame* mCanvasLibAVFrame;
+    FFMPEGVideoFramePool<VideoFrameFormat, width, height> mCanvasPool;
+    VideoFrame<VideoFrameFormat, width, height> mComposedVideoFrame;
+
+};
+
+}
+
+#endif // VIDEOCOMPOSITOR_HPP_INCLUDED
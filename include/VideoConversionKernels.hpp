@@ -0,0 +1,372 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef VIDEOCONVERSIONKERNELS_HPP_INCLUDED
+#define VIDEOCONVERSIONKERNELS_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LAAV_X86_KERNELS
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LAAV_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+namespace laav
+{
+
+class YUYV422_PACKED;
+class YUV420_PLANAR;
+class NV_12_PLANAR;
+class NV_21_PLANAR;
+
+/*
+ * Same-size conversion: the input's and output's planes and line sizes, as in sws_scale()
+ */
+typedef void (*VideoConversionKernel)(const uint8_t* const src[3], const int srcStride[3],
+                                      uint8_t* const dst[3], const int dstStride[3],
+                                      unsigned int width, unsigned int height);
+
+/*
+ * Hand-written kernels for the conversions which don't need any scaling (pure shuffles
+ * plus the vertical chroma average), used by FFMPEGVideoConverter instead of sws_scale().
+ * The SIMD version is chosen at runtime, once (AVX2 or SSE2 on x86, NEON on ARM); the
+ * scalar one handles the remaining pixels of each line.
+ */
+struct VideoConversionKernels
+{
+
+    // NULL if there's no kernel for the formats: sws_scale() must be used
+    template <typename InputFormat, typename OutputFormat>
+    static VideoConversionKernel select()
+    {
+        return NULL;
+    }
+
+    static void yUYVToI420(const uint8_t* const src[3], const int srcStride[3],
+                           uint8_t* const dst[3], const int dstStride[3],
+                           unsigned int width, unsigned int height)
+    {
+        static const YUYVLinesKernel linesKernel = selectYUYVLinesKernel();
+        unsigned int y;
+        for (y = 0; y < height; y += 2)
+        {
+            const uint8_t* line0 = src[0] + y * srcStride[0];
+            // Odd height: the last chroma line is taken from one line only
+            const uint8_t* line1 = y + 1 < height ? line0 + srcStride[0] : line0;
+            uint8_t* lumaLine1 = y + 1 < height ? dst[0] + (y + 1) * dstStride[0] : NULL;
+            linesKernel(line0, line1, dst[0] + y * dstStride[0], lumaLine1,
+                        dst[1] + (y / 2) * dstStride[1], dst[2] + (y / 2) * dstStride[2], width);
+        }
+    }
+
+    static void nV12ToI420(const uint8_t* const src[3], const int srcStride[3],
+                           uint8_t* const dst[3], const int dstStride[3],
+                           unsigned int width, unsigned int height)
+    {
+        copyLuma(src, srcStride, dst, dstStride, width, height);
+        deinterleaveChroma(src[1], srcStride[1], dst[1], dstStride[1], dst[2], dstStride[2],
+                           (width + 1) / 2, (height + 1) / 2);
+    }
+
+    static void nV21ToI420(const uint8_t* const src[3], const int srcStride[3],
+                           uint8_t* const dst[3], const int dstStride[3],
+                           unsigned int width, unsigned int height)
+    {
+        copyLuma(src, srcStride, dst, dstStride, width, height);
+        // VU pairs
+        deinterleaveChroma(src[1], srcStride[1], dst[2], dstStride[2], dst[1], dstStride[1],
+                           (width + 1) / 2, (height + 1) / 2);
+    }
+
+private:
+
+    /*
+     * Converts 2 YUYV lines (line1 == line0 for the last line of an odd height).
+     * lumaLine1 == NULL: the second luma line is not written.
+     */
+    typedef void (*YUYVLinesKernel)(const uint8_t* line0, const uint8_t* line1,
+                                    uint8_t* lumaLine0, uint8_t* lumaLine1,
+                                    uint8_t* uLine, uint8_t* vLine, unsigned int width);
+
+    typedef void (*ChromaLineKernel)(const uint8_t* uVLine, uint8_t* uLine, uint8_t* vLine,
+                                     unsigned int chromaWidth);
+
+    static YUYVLinesKernel selectYUYVLinesKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &yUYVLinesAVX2;
+        return &yUYVLinesSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &yUYVLinesNEON;
+#else
+        return &yUYVLinesScalar;
+#endif
+    }
+
+    static ChromaLineKernel selectChromaLineKernel()
+    {
+#ifdef LAAV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &chromaLineAVX2;
+        return &chromaLineSSE2;
+#elif defined(LAAV_NEON_KERNELS)
+        return &chromaLineNEON;
+#else
+        return &chromaLineScalar;
+#endif
+    }
+
+    // Pixels [fromX, width)
+    static void yUYVLinesTail(const uint8_t* line0, const uint8_t* line1,
+                              uint8_t* lumaLine0, uint8_t* lumaLine1,
+                              uint8_t* uLine, uint8_t* vLine, unsigned int fromX, unsigned int width)
+    {
+        unsigned int x;
+        for (x = fromX; x + 1 < width; x += 2)
+        {
+            lumaLine0[x] = line0[2 * x];
+            lumaLine0[x + 1] = line0[2 * x + 2];
+            if (lumaLine1)
+            {
+                lumaLine1[x] = line1[2 * x];
+                lumaLine1[x + 1] = line1[2 * x + 2];
+            }
+            uLine[x / 2] = (line0[2 * x + 1] + line1[2 * x + 1] + 1) >> 1;
+            vLine[x / 2] = (line0[2 * x + 3] + line1[2 * x + 3] + 1) >> 1;
+        }
+    }
+
+    static void yUYVLinesScalar(const uint8_t* line0, const uint8_t* line1,
+                                uint8_t* lumaLine0, uint8_t* lumaLine1,
+                                uint8_t* uLine, uint8_t* vLine, unsigned int width)
+    {
+        yUYVLinesTail(line0, line1, lumaLine0, lumaLine1, uLine, vLine, 0, width);
+    }
+
+    static void chromaLineTail(const uint8_t* uVLine, uint8_t* uLine, uint8_t* vLine,
+                               unsigned int fromX, unsigned int chromaWidth)
+    {
+        unsigned int x;
+        for (x = fromX; x < chromaWidth; x++)
+        {
+            uLine[x] = uVLine[2 * x];
+            vLine[x] = uVLine[2 * x + 1];
+        }
+    }
+
+    static void chromaLineScalar(const uint8_t* uVLine, uint8_t* uLine, uint8_t* vLine,
+                                 unsigned int chromaWidth)
+    {
+        chromaLineTail(uVLine, uLine, vLine, 0, chromaWidth);
+    }
+
+#ifdef LAAV_X86_KERNELS
+
+    // 16 pixels per iteration
+    __attribute__((target("sse2")))
+    static void yUYVLinesSSE2(const uint8_t* line0, const uint8_t* line1,
+                              uint8_t* lumaLine0, uint8_t* lumaLine1,
+                              uint8_t* uLine, uint8_t* vLine, unsigned int width)
+    {
+        const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+        unsigned int x;
+        for (x = 0; x + 16 <= width; x += 16)
+        {
+            __m128i a0 = _mm_loadu_si128((const __m128i* )(line0 + 2 * x));
+            __m128i a1 = _mm_loadu_si128((const __m128i* )(line0 + 2 * x + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i* )(line1 + 2 * x));
+            __m128i b1 = _mm_loadu_si128((const __m128i* )(line1 + 2 * x + 16));
+            _mm_storeu_si128((__m128i* )(lumaLine0 + x),
+                             _mm_packus_epi16(_mm_and_si128(a0, lowBytes),
+                                              _mm_and_si128(a1, lowBytes)));
+            if (lumaLine1)
+                _mm_storeu_si128((__m128i* )(lumaLine1 + x),
+                                 _mm_packus_epi16(_mm_and_si128(b0, lowBytes),
+                                                  _mm_and_si128(b1, lowBytes)));
+            // UVUV... of both lines, then their average
+            __m128i uV0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+            __m128i uV1 = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+            __m128i uV = _mm_avg_epu8(uV0, uV1);
+            __m128i u = _mm_packus_epi16(_mm_and_si128(uV, lowBytes), _mm_setzero_si128());
+            __m128i v = _mm_packus_epi16(_mm_srli_epi16(uV, 8), _mm_setzero_si128());
+            _mm_storel_epi64((__m128i* )(uLine + x / 2), u);
+            _mm_storel_epi64((__m128i* )(vLine + x / 2), v);
+        }
+        yUYVLinesTail(line0, line1, lumaLine0, lumaLine1, uLine, vLine, x, width);
+    }
+
+    // 32 pixels per iteration; the 128 bit lanes mixed by the packs are reordered by permute4x64
+    __attribute__((target("avx2")))
+    static void yUYVLinesAVX2(const uint8_t* line0, const uint8_t* line1,
+                              uint8_t* lumaLine0, uint8_t* lumaLine1,
+                              uint8_t* uLine, uint8_t* vLine, unsigned int width)
+    {
+        const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+        unsigned int x;
+        for (x = 0; x + 32 <= width; x += 32)
+        {
+            __m256i a0 = _mm256_loadu_si256((const __m256i* )(line0 + 2 * x));
+            __m256i a1 = _mm256_loadu_si256((const __m256i* )(line0 + 2 * x + 32));
+            __m256i b0 = _mm256_loadu_si256((const __m256i* )(line1 + 2 * x));
+            __m256i b1 = _mm256_loadu_si256((const __m256i* )(line1 + 2 * x + 32));
+            __m256i luma0 = _mm256_packus_epi16(_mm256_and_si256(a0, lowBytes),
+                                                _mm256_and_si256(a1, lowBytes));
+            _mm256_storeu_si256((__m256i* )(lumaLine0 + x), _mm256_permute4x64_epi64(luma0, 0xD8));
+            if (lumaLine1)
+            {
+                __m256i luma1 = _mm256_packus_epi16(_mm256_and_si256(b0, lowBytes),
+                                                    _mm256_and_si256(b1, lowBytes));
+                _mm256_storeu_si256((__m256i* )(lumaLine1 + x),
+                                    _mm256_permute4x64_epi64(luma1, 0xD8));
+            }
+            __m256i uV0 = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+            __m256i uV1 = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+            // Same lanes' order for both lines: the average doesn't need the permutation
+            __m256i uV = _mm256_permute4x64_epi64(_mm256_avg_epu8(uV0, uV1), 0xD8);
+            __m256i uAndV = _mm256_packus_epi16(_mm256_and_si256(uV, lowBytes),
+                                                _mm256_srli_epi16(uV, 8));
+            // [U (16 bytes) | V (16 bytes)]
+            uAndV = _mm256_permute4x64_epi64(uAndV, 0xD8);
+            _mm_storeu_si128((__m128i* )(uLine + x / 2), _mm256_castsi256_si128(uAndV));
+            _mm_storeu_si128((__m128i* )(vLine + x / 2), _mm256_extracti128_si256(uAndV, 1));
+        }
+        yUYVLinesTail(line0, line1, lumaLine0, lumaLine1, uLine, vLine, x, width);
+    }
+
+    __attribute__((target("sse2")))
+    static void chromaLineSSE2(const uint8_t* uVLine, uint8_t* uLine, uint8_t* vLine,
+                               unsigned int chromaWidth)
+    {
+        const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+        unsigned int x;
+        for (x = 0; x + 16 <= chromaWidth; x += 16)
+        {
+            __m128i uV0 = _mm_loadu_si128((const __m128i* )(uVLine + 2 * x));
+            __m128i uV1 = _mm_loadu_si128((const __m128i* )(uVLine + 2 * x + 16));
+            _mm_storeu_si128((__m128i* )(uLine + x),
+                             _mm_packus_epi16(_mm_and_si128(uV0, lowBytes),
+                                              _mm_and_si128(uV1, lowBytes)));
+            _mm_storeu_si128((__m128i* )(vLine + x),
+                             _mm_packus_epi16(_mm_srli_epi16(uV0, 8), _mm_srli_epi16(uV1, 8)));
+        }
+        chromaLineTail(uVLine, uLine, vLine, x, chromaWidth);
+    }
+
+    __attribute__((target("avx2")))
+    static void chromaLineAVX2(const uint8_t* uVLine, uint8_t* uLine, uint8_t* vLine,
+                               unsigned int chromaWidth)
+    {
+        const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+        unsigned int x;
+        for (x = 0; x + 32 <= chromaWidth; x += 32)
+        {
+            __m256i uV0 = _mm256_loadu_si256((const __m256i* )(uVLine + 2 * x));
+            __m256i uV1 = _mm256_loadu_si256((const __m256i* )(uVLine + 2 * x + 32));
+            __m256i u = _mm256_packus_epi16(_mm256_and_si256(uV0, lowBytes),
+                                            _mm256_and_si256(uV1, lowBytes));
+            __m256i v = _mm256_packus_epi16(_mm256_srli_epi16(uV0, 8), _mm256_srli_epi16(uV1, 8));
+            _mm256_storeu_si256((__m256i* )(uLine + x), _mm256_permute4x64_epi64(u, 0xD8));
+            _mm256_storeu_si256((__m256i* )(vLine + x), _mm256_permute4x64_epi64(v, 0xD8));
+        }
+        chromaLineTail(uVLine, uLine, vLine, x, chromaWidth);
+    }
+
+#endif // LAAV_X86_KERNELS
+
+#ifdef LAAV_NEON_KERNELS
+
+    // 32 pixels per iteration: vld4 splits Y0, U, Y1, V
+    static void yUYVLinesNEON(const uint8_t* line0, const uint8_t* line1,
+                              uint8_t* lumaLine0, uint8_t* lumaLine1,
+                              uint8_t* uLine, uint8_t* vLine, unsigned int width)
+    {
+        unsigned int x;
+        for (x = 0; x + 32 <= width; x += 32)
+        {
+            uint8x16x4_t a = vld4q_u8(line0 + 2 * x);
+            uint8x16x4_t b = vld4q_u8(line1 + 2 * x);
+            uint8x16x2_t luma0 = {{a.val[0], a.val[2]}};
+            vst2q_u8(lumaLine0 + x, luma0);
+            if (lumaLine1)
+            {
+                uint8x16x2_t luma1 = {{b.val[0], b.val[2]}};
+                vst2q_u8(lumaLine1 + x, luma1);
+            }
+            vst1q_u8(uLine + x / 2, vrhaddq_u8(a.val[1], b.val[1]));
+            vst1q_u8(vLine + x / 2, vrhaddq_u8(a.val[3], b.val[3]));
+        }
+        yUYVLinesTail(line0, line1, lumaLine0, lumaLine1, uLine, vLine, x, width);
+    }
+
+    static void chromaLineNEON(const uint8_t* uVLine, uint8_t* uLine, uint8_t* vLine,
+                               unsigned int chromaWidth)
+    {
+        unsigned int x;
+        for (x = 0; x + 16 <= chromaWidth; x += 16)
+        {
+            uint8x16x2_t uV = vld2q_u8(uVLine + 2 * x);
+            vst1q_u8(uLine + x, uV.val[0]);
+            vst1q_u8(vLine + x, uV.val[1]);
+        }
+        chromaLineTail(uVLine, uLine, vLine, x, chromaWidth);
+    }
+
+#endif // LAAV_NEON_KERNELS
+
+    static void copyLuma(const uint8_t* const src[3], const int srcStride[3],
+                         uint8_t* const dst[3], const int dstStride[3],
+                         unsigned int width, unsigned int height)
+    {
+        if (srcStride[0] == dstStride[0])
+        {
+            memcpy(dst[0], src[0], (size_t)srcStride[0] * height);
+            return;
+        }
+        unsigned int y;
+        for (y = 0; y < height; y++)
+            memcpy(dst[0] + y * dstStride[0], src[0] + y * srcStride[0], width);
+    }
+
+    static void deinterleaveChroma(const uint8_t* uV, int uVStride,
+                                   uint8_t* u, int uStride, uint8_t* v, int vStride,
+                                   unsigned int chromaWidth, unsigned int chromaHeight)
+    {
+        static const ChromaLineKernel lineKernel = selectChromaLineKernel();
+        unsigned int y;
+        for (y = 0; y < chromaHeight; y++)
+            lineKernel(uV + y * uVStride, u + y * uStride, v + y * vStride, chromaWidth);
+    }
+
+};
+
+template <>
+VideoConversionKernel VideoConversionKernels::select<YUYV422_PACKED, YUV420_PLANAR>()
+{
+    return &yUYVToI420;
+}
+
+template <>
+VideoConversionKernel VideoConversionKernels::select<NV_12_PLANAR, YUV420_PLANAR>()
+{
+    return &nV12ToI420;
+}
+
+template <>
+VideoConversionKernel VideoConversionKernels::select<NV_21_PLANAR, YUV420_PLANAR>()
+{
+    return &nV21ToI420;
+}
+
+}
+
+#endif // VIDEOCONVERSIONKERNELS_HPP_INCLUDED
@@ -9,6 +9,9 @@
 
 #include "HTTPAudioVideoStreamer.hpp"
 #include "HTTPVideoStreamer.hpp"
+#include "HLSVideoStreamer.hpp"
+#include "UDPVideoStreamer.hpp"
+#include "StageMetrics.hpp"
 
 namespace laav
 {
@@ -18,6 +21,20 @@ template <typename EncodedVideoFrameCodec,
           unsigned int height>
 class VideoFrameHolder;
 
+/*
+ * A rectangle (pixels) whose quality is changed by qualityOffset, from -1 (best quality)
+ * to +1 (worst), like libav's AVRegionOfInterest. When the regions overlap, the first
+ * one takes precedence.
+ */
+struct VideoRegionOfInterest
+{
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+    float qualityOffset;
+};
+
 template <typename RawVideoFrameFormat,
           typename EncodedVideoFrameCodec,
           unsigned int width,
@@ -29,17 +46,15 @@ public:
 
     VideoEncoder():
         mMediaStatusInPipe(MEDIA_NOT_READY),
-        mEncodingStartTime(0),
+        mMetrics("video_encoder"),
         mFillingEncodedVideoFrameBuffer(true),
-        mEncodedVideoFrameBufferOffset(0)
+        mEncodedVideoFrameBufferOffset(0),
+        mNumOfNewEncodedFrames(0)
     {
-        unsigned int i;
-        for (i = 0; i < encodedVideoFrameBufferSize; i++)
-        {
-            mEncodedVideoFrameBuffer.push_back(VideoFrame<EncodedVideoFrameCodec, width, height>());
-        }
+        setEncodedFrameBufferSize(encodedVideoFrameBufferSize);
     }
 
+    // The holder takes the last frame only (see numOfNewEncodedFrames())
     VideoFrameHolder<EncodedVideoFrameCodec, width, height>&
     operator >>
     (VideoFrameHolder<EncodedVideoFrameCodec, width, height>& videoFrameHolder)
@@ -85,7 +100,9 @@ public:
 
         try
         {
-            audioVideoMuxer.takeMuxableFrame(lastEncodedFrame());
+            unsigned int n;
+            for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                audioVideoMuxer.takeMuxableFrame(newEncodedFrame(n));
         }
         catch (const MediaException& mediaException)
         {
@@ -99,9 +116,16 @@ public:
     operator >>
     (FFMPEGVideoMuxer<Container, EncodedVideoFrameCodec, width, height>& videoMuxer)
     {
+        if (mMediaStatusInPipe != MEDIA_READY)
+        {
+            mMediaStatusInPipe = MEDIA_READY;
+            return videoMuxer;
+        }
         try
         {
-            videoMuxer.takeMuxableFrame(lastEncodedFrame());
+            unsigned int n;
+            for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                videoMuxer.takeMuxableFrame(newEncodedFrame(n));
         }
         catch (const MediaException& mediaException)
         {
@@ -129,7 +153,9 @@ public:
         {
             try
             {
-                httpAudioVideoStreamer.takeStreamableFrame(lastEncodedFrame());
+                unsigned int n;
+                for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                    httpAudioVideoStreamer.takeStreamableFrame(newEncodedFrame(n));
                 httpAudioVideoStreamer.streamMuxedData();
             }
             catch (const MediaException& mediaException)
@@ -155,7 +181,9 @@ public:
         {
             try
             {
-                httpVideoStreamer.takeStreamableFrame(lastEncodedFrame());
+                unsigned int n;
+                for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                    httpVideoStreamer.takeStreamableFrame(newEncodedFrame(n));
                 httpVideoStreamer.streamMuxedData();
             }
             catch (const MediaException& mediaException)
@@ -167,6 +195,54 @@ public:
         return httpVideoStreamer;
     }
 
+    template <typename Container>
+    HLSVideoStreamer<Container, EncodedVideoFrameCodec, width, height>&
+    operator >>
+    (HLSVideoStreamer<Container, EncodedVideoFrameCodec, width, height>& hLSVideoStreamer)
+    {
+        if (mMediaStatusInPipe != MEDIA_READY)
+        {
+            mMediaStatusInPipe = MEDIA_READY;
+            return hLSVideoStreamer;
+        }
+        try
+        {
+            unsigned int n;
+            for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                hLSVideoStreamer.takeStreamableFrame(newEncodedFrame(n));
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the streamer is at the end of the pipe
+        }
+
+        return hLSVideoStreamer;
+    }
+
+    template <typename Container>
+    UDPVideoStreamer<Container, EncodedVideoFrameCodec, width, height>&
+    operator >>
+    (UDPVideoStreamer<Container, EncodedVideoFrameCodec, width, height>& uDPVideoStreamer)
+    {
+        if (mMediaStatusInPipe != MEDIA_READY)
+        {
+            mMediaStatusInPipe = MEDIA_READY;
+            return uDPVideoStreamer;
+        }
+        try
+        {
+            unsigned int n;
+            for (n = 0; n < mNumOfNewEncodedFrames; n++)
+                uDPVideoStreamer.takeStreamableFrame(newEncodedFrame(n));
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the streamer is at the end of the pipe
+        }
+
+        return uDPVideoStreamer;
+    }
+
     /*!
      *  \exception MediaException(MEDIA_NO_DATA)
      */
@@ -192,6 +268,29 @@ public:
         return encodedFrame(pos);
     }
 
+    /*
+     * The frames output by the last encode() call: an encoder with delay (lookahead,
+     * threads, hardware queue) can output none of them or more than one. The muxers and
+     * the streamers take all of them.
+     */
+    unsigned int numOfNewEncodedFrames() const
+    {
+        return mNumOfNewEncodedFrames;
+    }
+
+    // n = 0: the oldest of the new frames
+    /*!
+     *  \exception MediaException(MEDIA_NO_DATA)
+     */
+    VideoFrame<EncodedVideoFrameCodec, width, height>& newEncodedFrame(unsigned int n)
+    {
+        if (n >= mNumOfNewEncodedFrames)
+            throw MediaException(MEDIA_NO_DATA);
+        unsigned int pos = (mEncodedVideoFrameBuffer.size() + mEncodedVideoFrameBufferOffset -
+                            mNumOfNewEncodedFrames + n) % mEncodedVideoFrameBuffer.size();
+        return mEncodedVideoFrameBuffer[pos];
+    }
+
     unsigned int encodedFrameBufferIndex() const
     {
         return mEncodedVideoFrameBufferOffset;
@@ -202,17 +301,45 @@ public:
         return mEncodedVideoFrameBuffer.size();
     }
 
+    /*
+     * The number of the last encoded frames kept by this encoder (see encodedFrame()), which
+     * also bounds the frames output by one encode() call. Default: encodedVideoFrameBufferSize.
+     * The frames reference the encoded data, which is freed as soon as nobody (this buffer,
+     * the muxers' queues, the frame rings...) holds it anymore. It resets the buffer.
+     */
+    void setEncodedFrameBufferSize(unsigned int size)
+    {
+        if (size == 0)
+            printAndThrowUnrecoverableError("size == 0");
+        mEncodedVideoFrameBuffer.assign(size, VideoFrame<EncodedVideoFrameCodec, width, height>());
+        mFillingEncodedVideoFrameBuffer = true;
+        mEncodedVideoFrameBufferOffset = 0;
+        mNumOfNewEncodedFrames = 0;
+    }
+
+    // Frames in (raw) and out (encoded), encoding time, latency since the capture
+    StageMetrics& metrics()
+    {
+        return mMetrics;
+    }
+
     // TODO: private with friends...
     enum MediaStatus mMediaStatusInPipe;
 
     virtual void encode(const VideoFrame<RawVideoFrameFormat, width, height>& rawVideoFrame) = 0;
 
+    // Applied to the next encoded frames (until changed). Ignored by default
+    virtual void setRegionsOfInterest(const std::vector<VideoRegionOfInterest>& regions)
+    {
+    }
+
 protected:
 
-    int64_t mEncodingStartTime;
+    StageMetrics mMetrics;
     bool mFillingEncodedVideoFrameBuffer;
     std::vector<VideoFrame<EncodedVideoFrameCodec, width, height> > mEncodedVideoFrameBuffer;
     unsigned int mEncodedVideoFrameBufferOffset;
+    unsigned int mNumOfNewEncodedFrames;
 
 };
 
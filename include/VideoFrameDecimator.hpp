@@ -0,0 +1,129 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef VIDEOFRAMEDECIMATOR_HPP_INCLUDED
+#define VIDEOFRAMEDECIMATOR_HPP_INCLUDED
+
+#include "Frame.hpp"
+
+namespace laav
+{
+
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameHolder;
+
+/*
+ * Lets only some of the frames go on along the pipe, so that the next stages (I.E: a
+ * converter and an encoder) don't spend anything on the frames which nobody uses:
+ *
+ *   - one every keepOneEvery frames;
+ *   - at maxFps at most, by the frames' capture time (0: no limit);
+ *   - only the keyframes, for the encoded frames (see setKeyFramesOnly()).
+ *
+ * I.E, the 5 fps analytics and the keyframes-only archive of a 30 fps camera:
+ *
+ *   VideoFrameDecimator <YUYV422_PACKED, WIDTH, HEIGHT> vDecim(1, 5);
+ *   vGrab >> vFh1 >> vDecim >> vFh2;
+ *                              vFh2 >> vConv >> vAnalytics;
+ *
+ *   VideoFrameDecimator <H264, WIDTH, HEIGHT> vKeyFrames;
+ *   vKeyFrames.setKeyFramesOnly(true);
+ *   vEnc >> vFh3 >> vKeyFrames >> vFh4;
+ *                                 vFh4 >> vArchiveMux;
+ *
+ * The dropped frames are propagated as MEDIA_NO_DATA (without exceptions).
+ */
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameDecimator
+{
+
+public:
+
+    VideoFrameDecimator(unsigned int keepOneEvery = 1, unsigned int maxFps = 0) :
+        mMediaStatusInPipe(MEDIA_NOT_READY),
+        mKeepOneEvery(keepOneEvery == 0 ? 1 : keepOneEvery),
+        mFramePeriodUs(maxFps == 0 ? 0 : 1000000 / maxFps),
+        mKeyFramesOnly(false),
+        mNumOfFrames(0),
+        mNextFrameTime(AV_NOPTS_VALUE)
+    {
+    }
+
+    // Only for the encoded frames: the others aren't keyframes
+    void setKeyFramesOnly(bool keyFramesOnly)
+    {
+        static_assert(std::is_base_of<EncodedVideoFrame,
+                                      VideoFrame<CodecOrFormat, width, height> >::value,
+                      "Only the encoded frames can be filtered by keyframe");
+        mKeyFramesOnly = keyFramesOnly;
+    }
+
+    // Returns false if the frame is dropped
+    bool take(const VideoFrame<CodecOrFormat, width, height>& videoFrame)
+    {
+        if (mKeyFramesOnly && !videoFrame.isKeyFrame())
+            return false;
+        if (mNumOfFrames++ % mKeepOneEvery != 0)
+            return false;
+        if (mFramePeriodUs != 0 && !isFrameDue(videoFrame.monotonicTimestamp()))
+            return false;
+        mVideoFrame = videoFrame;
+        return true;
+    }
+
+    VideoFrameHolder<CodecOrFormat, width, height>&
+    operator >>
+    (VideoFrameHolder<CodecOrFormat, width, height>& videoFrameHolder)
+    {
+        if (mMediaStatusInPipe == MEDIA_READY)
+        {
+            videoFrameHolder.hold(mVideoFrame);
+            videoFrameHolder.mMediaStatusInPipe = MEDIA_READY;
+        }
+        else
+            videoFrameHolder.mMediaStatusInPipe = mMediaStatusInPipe;
+        return videoFrameHolder;
+    }
+
+    // TODO: private with friend holder
+    enum MediaStatus mMediaStatusInPipe;
+
+private:
+
+    /*
+     * The frames are kept on a grid of mFramePeriodUs, with a quarter of period of
+     * tolerance (I.E: a frame captured a bit early because of the jitter), so that the
+     * output rate doesn't drift below maxFps. The grid restarts after a gap
+     * (or a jump back of the timestamps).
+     */
+    bool isFrameDue(int64_t frameTime)
+    {
+        if (mNextFrameTime == AV_NOPTS_VALUE ||
+            frameTime >= mNextFrameTime + mFramePeriodUs ||
+            frameTime < mNextFrameTime - 2 * mFramePeriodUs)
+        {
+            mNextFrameTime = frameTime + mFramePeriodUs;
+            return true;
+        }
+        if (frameTime < mNextFrameTime - mFramePeriodUs / 4)
+            return false;
+        mNextFrameTime += mFramePeriodUs;
+        return true;
+    }
+
+    unsigned int mKeepOneEvery;
+    int64_t mFramePeriodUs;
+    bool mKeyFramesOnly;
+    unsigned long mNumOfFrames;
+    // microseconds, AV_NOPTS_VALUE before the first frame
+    int64_t mNextFrameTime;
+    VideoFrame<CodecOrFormat, width, height> mVideoFrame;
+
+};
+
+}
+
+#endif // VIDEOFRAMEDECIMATOR_HPP_INCLUDED
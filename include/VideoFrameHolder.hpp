@@ -10,6 +10,25 @@
 namespace laav
 {
 
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameRing;
+
+template <typename RawVideoFrameFormat, unsigned int width, unsigned int height>
+class MotionDetector;
+
+template <typename InputVideoFrameFormat, unsigned int inputWidth, unsigned int inputHeigth,
+          typename ConvertedVideoFrameFormat, typename... OutputResolutions>
+class FFMPEGMultiVideoConverter;
+
+template <typename VideoFrameFormat, unsigned int width, unsigned int height, typename Layout>
+class VideoCompositorTile;
+
+template <typename VideoFrameFormat, unsigned int width, unsigned int height>
+class HTTPSnapshotServer;
+
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrameDecimator;
+
 template <typename CodecOrFormat, unsigned int width, unsigned int height>
 class VideoFrameHolder
 {
@@ -30,11 +49,20 @@ public:
      */
     VideoFrame<CodecOrFormat, width, height>& get()
     {
-        if (mMediaStatusInPipe != MEDIA_READY || isFrameEmpty(mVideoFrame))
+        if (!hasFrameInPipe())
             throw MediaException(MEDIA_NO_DATA);
         return mVideoFrame;
     }
 
+    /*
+     * Whether get() would return the frame: the operators check it before going on, so
+     * that the steps of the loop without a new frame don't throw (and unwind) anything
+     */
+    bool hasFrameInPipe() const
+    {
+        return mMediaStatusInPipe == MEDIA_READY && !isFrameEmpty(mVideoFrame);
+    }
+
     template <typename ConvertedVideoFrameFormat, unsigned int outputWidth, unsigned int outputHeigth>
     FFMPEGVideoConverter<CodecOrFormat, width, height,
                          ConvertedVideoFrameFormat, outputWidth, outputHeigth>&
@@ -42,9 +70,14 @@ public:
     (FFMPEGVideoConverter<CodecOrFormat, width, height,
                           ConvertedVideoFrameFormat, outputWidth, outputHeigth>& videoConverter)
     {
+        if (!hasFrameInPipe())
+        {
+            videoConverter.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoConverter;
+        }
         try
         {
-            videoConverter.convert(get());
+            videoConverter.convert(mVideoFrame);
             videoConverter.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -54,6 +87,29 @@ public:
         return videoConverter;
     }
 
+    template <typename ConvertedVideoFrameFormat, typename... OutputResolutions>
+    FFMPEGMultiVideoConverter<CodecOrFormat, width, height,
+                              ConvertedVideoFrameFormat, OutputResolutions...>&
+    operator >>
+    (FFMPEGMultiVideoConverter<CodecOrFormat, width, height,
+                               ConvertedVideoFrameFormat, OutputResolutions...>& multiVideoConverter)
+    {
+        if (!hasFrameInPipe())
+        {
+            multiVideoConverter.setMediaStatusInPipe(MEDIA_NO_DATA);
+            return multiVideoConverter;
+        }
+        try
+        {
+            multiVideoConverter.convert(mVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            multiVideoConverter.setMediaStatusInPipe(mediaException.cause());
+        }
+        return multiVideoConverter;
+    }
+
     template <typename Container, typename AudioCodec,
               unsigned int audioSampleRate, enum AudioChannels audioChannels>
     FFMPEGAudioVideoMuxer<Container,
@@ -64,9 +120,11 @@ public:
                            CodecOrFormat, width, height,
                            AudioCodec, audioSampleRate, audioChannels>& audioVideoMuxer)
     {
+        if (!hasFrameInPipe())
+            return audioVideoMuxer;
         try
         {
-            audioVideoMuxer.takeMuxableFrame(get());
+            audioVideoMuxer.takeMuxableFrame(mVideoFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -80,9 +138,11 @@ public:
     operator >>
     (FFMPEGVideoMuxer<Container, CodecOrFormat, width, height>& videoMuxer)
     {
+        if (!hasFrameInPipe())
+            return videoMuxer;
         try
         {
-            videoMuxer.takeMuxableFrame(get());
+            videoMuxer.takeMuxableFrame(mVideoFrame);
         }
         catch (const MediaException& mediaException)
         {
@@ -96,9 +156,14 @@ public:
     operator >>
     (VideoEncoder<CodecOrFormat, EncodedVideoFrameCodec, width, height>& videoEncoder)
     {
+        if (!hasFrameInPipe())
+        {
+            videoEncoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoEncoder;
+        }
         try
         {
-            videoEncoder.encode(get());
+            videoEncoder.encode(mVideoFrame);
             videoEncoder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -119,9 +184,11 @@ public:
                             AudioCodec, audioSampleRate, audioChannels>&
      httpAudioVideoStreamer)
     {
+        if (!hasFrameInPipe())
+            return httpAudioVideoStreamer;
         try
         {
-            httpAudioVideoStreamer.takeStreamableFrame(get());
+            httpAudioVideoStreamer.takeStreamableFrame(mVideoFrame);
             httpAudioVideoStreamer.streamMuxedData();
         }
         catch (const MediaException& mediaException)
@@ -136,9 +203,11 @@ public:
     operator >>
     (HTTPVideoStreamer<Container, CodecOrFormat, width, height>& httpVideoStreamer)
     {
+        if (!hasFrameInPipe())
+            return httpVideoStreamer;
         try
         {
-            httpVideoStreamer.takeStreamableFrame(get());
+            httpVideoStreamer.takeStreamableFrame(mVideoFrame);
             httpVideoStreamer.streamMuxedData();
         }
         catch (const MediaException& mediaException)
@@ -149,13 +218,57 @@ public:
         return httpVideoStreamer;
     }
 
-    FFMPEGMJPEGDecoder<width, height>&
+    template <typename Container>
+    HLSVideoStreamer<Container, CodecOrFormat, width, height>&
+    operator >>
+    (HLSVideoStreamer<Container, CodecOrFormat, width, height>& hLSVideoStreamer)
+    {
+        if (!hasFrameInPipe())
+            return hLSVideoStreamer;
+        try
+        {
+            hLSVideoStreamer.takeStreamableFrame(mVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the streamer is at the end of the pipe
+        }
+
+        return hLSVideoStreamer;
+    }
+
+    template <typename Container>
+    UDPVideoStreamer<Container, CodecOrFormat, width, height>&
     operator >>
-    (FFMPEGMJPEGDecoder<width, height>& videoDecoder)
+    (UDPVideoStreamer<Container, CodecOrFormat, width, height>& uDPVideoStreamer)
     {
+        if (!hasFrameInPipe())
+            return uDPVideoStreamer;
+        try
+        {
+            uDPVideoStreamer.takeStreamableFrame(mVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the streamer is at the end of the pipe
+        }
+
+        return uDPVideoStreamer;
+    }
+
+    template <unsigned int scaleDenominator>
+    FFMPEGMJPEGDecoder<width, height, scaleDenominator>&
+    operator >>
+    (FFMPEGMJPEGDecoder<width, height, scaleDenominator>& videoDecoder)
+    {
+        if (!hasFrameInPipe())
+        {
+            videoDecoder.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoDecoder;
+        }
         try
         {
-            videoDecoder.decode(get());
+            videoDecoder.decode(mVideoFrame);
             videoDecoder.mMediaStatusInPipe = MEDIA_READY;
         }
         catch (const MediaException& mediaException)
@@ -165,6 +278,101 @@ public:
         return videoDecoder;
     }
 
+    MotionDetector<CodecOrFormat, width, height>&
+    operator >>
+    (MotionDetector<CodecOrFormat, width, height>& motionDetector)
+    {
+        if (!hasFrameInPipe())
+        {
+            motionDetector.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return motionDetector;
+        }
+        try
+        {
+            motionDetector.analyze(mVideoFrame);
+            motionDetector.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            motionDetector.mMediaStatusInPipe = mediaException.cause();
+        }
+        return motionDetector;
+    }
+
+    // The decimator's own status tells whether the frame goes on or is dropped
+    VideoFrameDecimator<CodecOrFormat, width, height>&
+    operator >>
+    (VideoFrameDecimator<CodecOrFormat, width, height>& videoFrameDecimator)
+    {
+        if (!hasFrameInPipe())
+        {
+            videoFrameDecimator.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return videoFrameDecimator;
+        }
+        videoFrameDecimator.mMediaStatusInPipe =
+        videoFrameDecimator.take(mVideoFrame) ? MEDIA_READY : MEDIA_NO_DATA;
+        return videoFrameDecimator;
+    }
+
+    // The frame is scaled into the tile of a mosaic (see VideoCompositor)
+    template <unsigned int compositorWidth, unsigned int compositorHeight, typename Layout>
+    VideoCompositorTile<CodecOrFormat, compositorWidth, compositorHeight, Layout>&
+    operator >>
+    (VideoCompositorTile<CodecOrFormat, compositorWidth, compositorHeight, Layout>& tile)
+    {
+        if (!hasFrameInPipe())
+        {
+            tile.mMediaStatusInPipe = MEDIA_NO_DATA;
+            return tile;
+        }
+        try
+        {
+            tile.take(mVideoFrame);
+            tile.mMediaStatusInPipe = MEDIA_READY;
+        }
+        catch (const MediaException& mediaException)
+        {
+            tile.mMediaStatusInPipe = mediaException.cause();
+        }
+        return tile;
+    }
+
+    // The frame is kept for the next snapshots (see HTTPSnapshotServer)
+    HTTPSnapshotServer<CodecOrFormat, width, height>&
+    operator >>
+    (HTTPSnapshotServer<CodecOrFormat, width, height>& hTTPSnapshotServer)
+    {
+        if (!hasFrameInPipe())
+            return hTTPSnapshotServer;
+        try
+        {
+            hTTPSnapshotServer.take(mVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the server is at the end of the pipe
+        }
+        return hTTPSnapshotServer;
+    }
+
+    // End of a pipe segment: the frame will be taken by another thread's segment
+    VideoFrameRing<CodecOrFormat, width, height>&
+    operator >>
+    (VideoFrameRing<CodecOrFormat, width, height>& videoFrameRing)
+    {
+        if (!hasFrameInPipe())
+            return videoFrameRing;
+        try
+        {
+            videoFrameRing.push(mVideoFrame);
+        }
+        catch (const MediaException& mediaException)
+        {
+            // Do nothing, because the ring is at the end of the pipe segment
+        }
+        return videoFrameRing;
+    }
+
     enum MediaStatus mMediaStatusInPipe;
 
 private:
@@ -184,6 +392,11 @@ private:
         return videoFrame.size<0>() == 0;
     }
 
+    bool isFrameEmpty(const DMABufRawVideoFrame& videoFrame) const
+    {
+        return videoFrame.size() == 0;
+    }
+
     VideoFrame<CodecOrFormat, width, height> mVideoFrame;
 };
 
@@ -0,0 +1,644 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef VIDEOPLANESPAN_HPP_INCLUDED
+#define VIDEOPLANESPAN_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "Pixel.hpp"
+
+#if defined(__SSE2__)
+#define LAAV_SSE2_PLANE_KERNELS
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LAAV_NEON_PLANE_KERNELS
+#include <arm_neon.h>
+#endif
+
+namespace laav
+{
+
+template <typename CodecOrFormat, unsigned int width, unsigned int height>
+class VideoFrame;
+
+/*
+ * Row kernels of the bulk operations. A pattern holds 4 bytes which are repeated along
+ * the row, starting from its first byte (a single value for the planes, a YUYV pair of
+ * pixels for the packed frames). The weights go from 1 to 255 (0 and 256 are handled by
+ * the callers, as a no-op and a plain copy).
+ */
+struct VideoPlaneKernels
+{
+
+    static uint32_t replicate(unsigned char value)
+    {
+        return value * 0x01010101u;
+    }
+
+    // I.E: alpha 255 -> weight 256 (the source replaces the destination)
+    static unsigned int weight(unsigned char alpha)
+    {
+        return alpha + (alpha >> 7);
+    }
+
+    static void fillRow(uint8_t* dst, unsigned int n, uint32_t pattern)
+    {
+        unsigned int i = 0;
+#if defined(LAAV_SSE2_PLANE_KERNELS)
+        const __m128i p = _mm_set1_epi32((int)pattern);
+        for (; i + 16 <= n; i += 16)
+            _mm_storeu_si128((__m128i*)(dst + i), p);
+#elif defined(LAAV_NEON_PLANE_KERNELS)
+        const uint8x16_t p = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+        for (; i + 16 <= n; i += 16)
+            vst1q_u8(dst + i, p);
+#endif
+        for (; i < n; i++)
+            dst[i] = patternByte(pattern, i);
+    }
+
+    // dst = (pattern * weight + dst * (256 - weight)) / 256
+    static void blendRowWithPattern(uint8_t* dst, unsigned int n, uint32_t pattern,
+                                    unsigned int weight)
+    {
+        unsigned int i = 0;
+#if defined(LAAV_SSE2_PLANE_KERNELS)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i p = _mm_set1_epi32((int)pattern);
+        const __m128i w = _mm_set1_epi16((short)weight);
+        const __m128i inverseW = _mm_set1_epi16((short)(256 - weight));
+        const __m128i rounding = _mm_set1_epi16(128);
+        const __m128i pLo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), w), rounding);
+        const __m128i pHi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), w), rounding);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverseW), pLo);
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverseW), pHi);
+            _mm_storeu_si128((__m128i*)(dst + i),
+                             _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+        }
+#elif defined(LAAV_NEON_PLANE_KERNELS)
+        const uint8x16_t p = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+        const uint8x8_t w = vdup_n_u8(weight);
+        const uint8x8_t inverseW = vdup_n_u8(256 - weight);
+        const uint16x8_t pLo = vmull_u8(vget_low_u8(p), w);
+        const uint16x8_t pHi = vmull_u8(vget_high_u8(p), w);
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t d = vld1q_u8(dst + i);
+            uint16x8_t lo = vmlal_u8(pLo, vget_low_u8(d), inverseW);
+            uint16x8_t hi = vmlal_u8(pHi, vget_high_u8(d), inverseW);
+            vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+        }
+#endif
+        for (; i < n; i++)
+            dst[i] = (patternByte(pattern, i) * weight + dst[i] * (256 - weight) + 128) >> 8;
+    }
+
+    // dst = (src * weight + dst * (256 - weight)) / 256
+    static void blendRows(uint8_t* dst, const uint8_t* src, unsigned int n, unsigned int weight)
+    {
+        unsigned int i = 0;
+#if defined(LAAV_SSE2_PLANE_KERNELS)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i w = _mm_set1_epi16((short)weight);
+        const __m128i inverseW = _mm_set1_epi16((short)(256 - weight));
+        const __m128i rounding = _mm_set1_epi16(128);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), w),
+                                       _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverseW));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), w),
+                                       _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverseW));
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, rounding), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, rounding), 8);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+#elif defined(LAAV_NEON_PLANE_KERNELS)
+        const uint8x8_t w = vdup_n_u8(weight);
+        const uint8x8_t inverseW = vdup_n_u8(256 - weight);
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t s = vld1q_u8(src + i);
+            uint8x16_t d = vld1q_u8(dst + i);
+            uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(s), w), vget_low_u8(d), inverseW);
+            uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(s), w), vget_high_u8(d), inverseW);
+            vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+        }
+#endif
+        for (; i < n; i++)
+            dst[i] = (src[i] * weight + dst[i] * (256 - weight) + 128) >> 8;
+    }
+
+    /*
+     * Replaces the bytes whose mask value is not 0 with the pattern's ones.
+     * The mask's byte of dst[i] is:
+     *   MASK_SAME:        mask[i]
+     *   MASK_SUBSAMPLED:  mask[2 * i]   (I.E: a luma-sized mask applied to a chroma plane)
+     *   MASK_UPSAMPLED:   mask[i / 2]   (I.E: a luma-sized mask applied to YUYV bytes)
+     * maskLength is the length of the mask's row.
+     */
+    enum MaskSampling
+    {
+        MASK_SAME,
+        MASK_SUBSAMPLED,
+        MASK_UPSAMPLED
+    };
+
+    template <enum MaskSampling maskSampling>
+    static void maskRow(uint8_t* dst, unsigned int n, const uint8_t* mask, unsigned int maskLength,
+                        uint32_t pattern)
+    {
+        unsigned int i = 0;
+#if defined(LAAV_SSE2_PLANE_KERNELS)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i p = _mm_set1_epi32((int)pattern);
+        const __m128i evenBytes = _mm_set1_epi16(0x00FF);
+        for (; i + 16 <= n && maskIndex<maskSampling>(i + 16) <= maskLength; i += 16)
+        {
+            __m128i m;
+            if (maskSampling == MASK_SAME)
+                m = _mm_loadu_si128((const __m128i*)(mask + i));
+            else if (maskSampling == MASK_SUBSAMPLED)
+                m = _mm_packus_epi16(
+                        _mm_and_si128(_mm_loadu_si128((const __m128i*)(mask + 2 * i)), evenBytes),
+                        _mm_and_si128(_mm_loadu_si128((const __m128i*)(mask + 2 * i + 16)), evenBytes));
+            else
+            {
+                m = _mm_loadl_epi64((const __m128i*)(mask + i / 2));
+                m = _mm_unpacklo_epi8(m, m);
+            }
+            __m128i keep = _mm_cmpeq_epi8(m, zero);
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            _mm_storeu_si128((__m128i*)(dst + i),
+                             _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, p)));
+        }
+#elif defined(LAAV_NEON_PLANE_KERNELS)
+        const uint8x16_t p = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+        for (; i + 16 <= n && maskIndex<maskSampling>(i + 16) <= maskLength; i += 16)
+        {
+            uint8x16_t m;
+            if (maskSampling == MASK_SAME)
+                m = vld1q_u8(mask + i);
+            else if (maskSampling == MASK_SUBSAMPLED)
+                m = vld2q_u8(mask + 2 * i).val[0];
+            else
+            {
+                uint8x8x2_t halves = vzip_u8(vld1_u8(mask + i / 2), vld1_u8(mask + i / 2));
+                m = vcombine_u8(halves.val[0], halves.val[1]);
+            }
+            uint8x16_t keep = vceqq_u8(m, vdupq_n_u8(0));
+            vst1q_u8(dst + i, vbslq_u8(keep, vld1q_u8(dst + i), p));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (mask[maskIndex<maskSampling>(i)])
+                dst[i] = patternByte(pattern, i);
+        }
+    }
+
+private:
+
+    static uint8_t patternByte(uint32_t pattern, unsigned int i)
+    {
+        return (pattern >> ((i & 3) * 8)) & 0xFF;
+    }
+
+    template <enum MaskSampling maskSampling>
+    static unsigned int maskIndex(unsigned int i)
+    {
+        if (maskSampling == MASK_SUBSAMPLED)
+            return 2 * i;
+        if (maskSampling == MASK_UPSAMPLED)
+            return i / 2;
+        return i;
+    }
+
+};
+
+/*
+ * A view on a plane of a raw frame: pointer, stride and compile-time size. Unlike
+ * pixelAt()/setPixelAt() there are no virtual calls and no exceptions: at() and row()
+ * don't check the bounds, while the bulk operations clip their regions to the plane.
+ * Sample is "unsigned char" or "const unsigned char" (read-only view).
+ */
+template <typename Sample, unsigned int width_, unsigned int height_>
+class VideoPlaneSpan
+{
+
+public:
+
+    static const unsigned int width = width_;
+    static const unsigned int height = height_;
+
+    explicit VideoPlaneSpan(Sample* data, unsigned int stride = width_) :
+        mData(data),
+        mStride(stride)
+    {
+    }
+
+    // I.E: a read-only view from a mutable one
+    template <typename OtherSample>
+    VideoPlaneSpan(const VideoPlaneSpan<OtherSample, width_, height_>& otherSpan) :
+        mData(otherSpan.data()),
+        mStride(otherSpan.stride())
+    {
+    }
+
+    Sample* data() const
+    {
+        return mData;
+    }
+
+    unsigned int stride() const
+    {
+        return mStride;
+    }
+
+    Sample* row(unsigned int y) const
+    {
+        return mData + y * mStride;
+    }
+
+    Sample& at(unsigned int x, unsigned int y) const
+    {
+        return mData[y * mStride + x];
+    }
+
+    // Returns false if the region is outside the plane
+    static bool clipRegion(unsigned int& x, unsigned int& y,
+                           unsigned int& regionWidth, unsigned int& regionHeight)
+    {
+        if (x >= width_ || y >= height_)
+            return false;
+        regionWidth = std::min(regionWidth, width_ - x);
+        regionHeight = std::min(regionHeight, height_ - y);
+        return regionWidth != 0 && regionHeight != 0;
+    }
+
+    void fill(unsigned char value, unsigned int x, unsigned int y,
+              unsigned int regionWidth, unsigned int regionHeight) const
+    {
+        if (!clipRegion(x, y, regionWidth, regionHeight))
+            return;
+        unsigned int r;
+        for (r = 0; r < regionHeight; r++)
+            memset(row(y + r) + x, value, regionWidth);
+    }
+
+    // alpha: 0 (transparent) ... 255 (opaque)
+    void blend(unsigned char value, unsigned char alpha, unsigned int x, unsigned int y,
+               unsigned int regionWidth, unsigned int regionHeight) const
+    {
+        unsigned int weight = VideoPlaneKernels::weight(alpha);
+        if (weight == 256)
+            fill(value, x, y, regionWidth, regionHeight);
+        if (weight == 0 || weight == 256 || !clipRegion(x, y, regionWidth, regionHeight))
+            return;
+        unsigned int r;
+        for (r = 0; r < regionHeight; r++)
+            VideoPlaneKernels::blendRowWithPattern(row(y + r) + x, regionWidth,
+                                                   VideoPlaneKernels::replicate(value), weight);
+    }
+
+    // The regions must not overlap
+    template <typename SourceSample, unsigned int sourceWidth, unsigned int sourceHeight>
+    void copyFrom(const VideoPlaneSpan<SourceSample, sourceWidth, sourceHeight>& sourceSpan,
+                  unsigned int sourceX, unsigned int sourceY,
+                  unsigned int regionWidth, unsigned int regionHeight,
+                  unsigned int x, unsigned int y) const
+    {
+        if (!VideoPlaneSpan<SourceSample, sourceWidth, sourceHeight>::
+                clipRegion(sourceX, sourceY, regionWidth, regionHeight) ||
+            !clipRegion(x, y, regionWidth, regionHeight))
+            return;
+        unsigned int r;
+        for (r = 0; r < regionHeight; r++)
+            memcpy(row(y + r) + x, sourceSpan.row(sourceY + r) + sourceX, regionWidth);
+    }
+
+    // Blends the whole source plane at (x, y). alpha: 0 (transparent) ... 255 (opaque)
+    template <typename SourceSample, unsigned int sourceWidth, unsigned int sourceHeight>
+    void overlay(const VideoPlaneSpan<SourceSample, sourceWidth, sourceHeight>& sourceSpan,
+                 unsigned int x, unsigned int y, unsigned char alpha = 255) const
+    {
+        unsigned int weight = VideoPlaneKernels::weight(alpha);
+        unsigned int regionWidth = sourceWidth;
+        unsigned int regionHeight = sourceHeight;
+        if (weight == 0 || !clipRegion(x, y, regionWidth, regionHeight))
+            return;
+        unsigned int r;
+        for (r = 0; r < regionHeight; r++)
+        {
+            if (weight == 256)
+                memcpy(row(y + r) + x, sourceSpan.row(r), regionWidth);
+            else
+                VideoPlaneKernels::blendRows(row(y + r) + x, sourceSpan.row(r), regionWidth, weight);
+        }
+    }
+
+    /*
+     * Sets the samples whose mask value is not 0. The mask has the size of the plane or
+     * twice it (I.E: a luma-sized mask applied to a chroma plane).
+     */
+    template <typename MaskSample, unsigned int maskWidth, unsigned int maskHeight>
+    void applyMask(const VideoPlaneSpan<MaskSample, maskWidth, maskHeight>& maskSpan,
+                   unsigned char value) const
+    {
+        static_assert(maskWidth == width_ || (maskWidth + 1) / 2 == width_,
+                      "The mask's width must be the plane's one or twice it");
+        static_assert(maskHeight == height_ || (maskHeight + 1) / 2 == height_,
+                      "The mask's height must be the plane's one or twice it");
+        const unsigned int maskRowStep = maskHeight == height_ ? 1 : 2;
+        unsigned int y;
+        for (y = 0; y < height_; y++)
+        {
+            if (maskWidth == width_)
+                VideoPlaneKernels::maskRow<VideoPlaneKernels::MASK_SAME>(
+                    row(y), width_, maskSpan.row(y * maskRowStep), maskWidth,
+                    VideoPlaneKernels::replicate(value));
+            else
+                VideoPlaneKernels::maskRow<VideoPlaneKernels::MASK_SUBSAMPLED>(
+                    row(y), width_, maskSpan.row(y * maskRowStep), maskWidth,
+                    VideoPlaneKernels::replicate(value));
+        }
+    }
+
+private:
+
+    Sample* mData;
+    unsigned int mStride;
+
+};
+
+/*
+ * Spans and bulk operations of the planar YUV frames, whose chroma planes are subsampled
+ * by 2^chromaWidthShift and 2^chromaHeightShift (I.E: 1, 1 for YUV420_PLANAR). The
+ * regions are given in luma coordinates: with subsampled chroma, odd coordinates and
+ * sizes are extended to the covering chroma samples. Masks have the luma plane's size.
+ */
+template <typename VideoFrameFormat, unsigned int width_, unsigned int height_,
+          unsigned int chromaWidthShift, unsigned int chromaHeightShift>
+class Planar3VideoFrameRegions
+{
+
+    typedef VideoFrame<VideoFrameFormat, width_, height_> RegionsVideoFrame;
+
+public:
+
+    template <unsigned int planeNum>
+    struct PlaneSize
+    {
+        static const unsigned int width =
+            planeNum == 0 ? width_ : (width_ + (1 << chromaWidthShift) - 1) >> chromaWidthShift;
+        static const unsigned int height =
+            planeNum == 0 ? height_ : (height_ + (1 << chromaHeightShift) - 1) >> chromaHeightShift;
+    };
+
+    // Offset of the sample of the pixel (x, y) in the plane
+    template <unsigned int planeNum>
+    static constexpr unsigned int sampleOffset(unsigned int x, unsigned int y)
+    {
+        return planeNum == 0 ? y * width_ + x :
+               (y >> chromaHeightShift) * PlaneSize<planeNum>::width + (x >> chromaWidthShift);
+    }
+
+    template <unsigned int planeNum>
+    VideoPlaneSpan<unsigned char, PlaneSize<planeNum>::width, PlaneSize<planeNum>::height>
+    planeSpan()
+    {
+        return VideoPlaneSpan<unsigned char, PlaneSize<planeNum>::width, PlaneSize<planeNum>::height>
+               (frame().template plane<planeNum>());
+    }
+
+    template <unsigned int planeNum>
+    VideoPlaneSpan<const unsigned char, PlaneSize<planeNum>::width, PlaneSize<planeNum>::height>
+    planeSpan() const
+    {
+        return VideoPlaneSpan<const unsigned char, PlaneSize<planeNum>::width,
+                              PlaneSize<planeNum>::height>(frame().template plane<planeNum>());
+    }
+
+    void fillRectangle(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
+                       unsigned int x, unsigned int y,
+                       unsigned int rectangleWidth, unsigned int rectangleHeight)
+    {
+        if (!VideoPlaneSpan<unsigned char, width_, height_>::
+                clipRegion(x, y, rectangleWidth, rectangleHeight))
+            return;
+        planeSpan<0>().fill(pixel.component<0>(), x, y, rectangleWidth, rectangleHeight);
+        chromaRegion(x, y, rectangleWidth, rectangleHeight);
+        planeSpan<1>().fill(pixel.component<1>(), x, y, rectangleWidth, rectangleHeight);
+        planeSpan<2>().fill(pixel.component<2>(), x, y, rectangleWidth, rectangleHeight);
+    }
+
+    // alpha: 0 (transparent) ... 255 (opaque)
+    void blendRectangle(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
+                        unsigned char alpha, unsigned int x, unsigned int y,
+                        unsigned int rectangleWidth, unsigned int rectangleHeight)
+    {
+        if (!VideoPlaneSpan<unsigned char, width_, height_>::
+                clipRegion(x, y, rectangleWidth, rectangleHeight))
+            return;
+        planeSpan<0>().blend(pixel.component<0>(), alpha, x, y, rectangleWidth, rectangleHeight);
+        chromaRegion(x, y, rectangleWidth, rectangleHeight);
+        planeSpan<1>().blend(pixel.component<1>(), alpha, x, y, rectangleWidth, rectangleHeight);
+        planeSpan<2>().blend(pixel.component<2>(), alpha, x, y, rectangleWidth, rectangleHeight);
+    }
+
+    // The regions must not overlap
+    template <unsigned int sourceWidth, unsigned int sourceHeight>
+    void copyRegion(const VideoFrame<VideoFrameFormat, sourceWidth, sourceHeight>& sourceVideoFrame,
+                    unsigned int sourceX, unsigned int sourceY,
+                    unsigned int regionWidth, unsigned int regionHeight,
+                    unsigned int x, unsigned int y)
+    {
+        if (!VideoPlaneSpan<unsigned char, sourceWidth, sourceHeight>::
+                clipRegion(sourceX, sourceY, regionWidth, regionHeight) ||
+            !VideoPlaneSpan<unsigned char, width_, height_>::
+                clipRegion(x, y, regionWidth, regionHeight))
+            return;
+        planeSpan<0>().copyFrom(sourceVideoFrame.template planeSpan<0>(),
+                                sourceX, sourceY, regionWidth, regionHeight, x, y);
+        chromaRegion(sourceX, sourceY, regionWidth, regionHeight);
+        x >>= chromaWidthShift;
+        y >>= chromaHeightShift;
+        planeSpan<1>().copyFrom(sourceVideoFrame.template planeSpan<1>(),
+                                sourceX, sourceY, regionWidth, regionHeight, x, y);
+        planeSpan<2>().copyFrom(sourceVideoFrame.template planeSpan<2>(),
+                                sourceX, sourceY, regionWidth, regionHeight, x, y);
+    }
+
+    // Blends the whole source frame at (x, y). alpha: 0 (transparent) ... 255 (opaque)
+    template <unsigned int sourceWidth, unsigned int sourceHeight>
+    void overlay(const VideoFrame<VideoFrameFormat, sourceWidth, sourceHeight>& sourceVideoFrame,
+                 unsigned int x, unsigned int y, unsigned char alpha = 255)
+    {
+        planeSpan<0>().overlay(sourceVideoFrame.template planeSpan<0>(), x, y, alpha);
+        planeSpan<1>().overlay(sourceVideoFrame.template planeSpan<1>(),
+                               x >> chromaWidthShift, y >> chromaHeightShift, alpha);
+        planeSpan<2>().overlay(sourceVideoFrame.template planeSpan<2>(),
+                               x >> chromaWidthShift, y >> chromaHeightShift, alpha);
+    }
+
+    // I.E: a privacy mask. The pixels whose mask value is not 0 are replaced
+    template <typename MaskSample>
+    void applyMask(const VideoPlaneSpan<MaskSample, width_, height_>& maskSpan,
+                   const Pixel<unsigned char, unsigned char, unsigned char>& pixel)
+    {
+        planeSpan<0>().applyMask(maskSpan, pixel.component<0>());
+        planeSpan<1>().applyMask(maskSpan, pixel.component<1>());
+        planeSpan<2>().applyMask(maskSpan, pixel.component<2>());
+    }
+
+private:
+
+    // From the (clipped) luma region to the chroma samples which cover it
+    static void chromaRegion(unsigned int& x, unsigned int& y,
+                             unsigned int& regionWidth, unsigned int& regionHeight)
+    {
+        unsigned int lastX = (x + regionWidth - 1) >> chromaWidthShift;
+        unsigned int lastY = (y + regionHeight - 1) >> chromaHeightShift;
+        x >>= chromaWidthShift;
+        y >>= chromaHeightShift;
+        regionWidth = lastX - x + 1;
+        regionHeight = lastY - y + 1;
+    }
+
+    RegionsVideoFrame& frame()
+    {
+        return static_cast<RegionsVideoFrame&>(*this);
+    }
+
+    const RegionsVideoFrame& frame() const
+    {
+        return static_cast<const RegionsVideoFrame&>(*this);
+    }
+
+};
+
+/*
+ * Span and bulk operations of the YUYV frames. The regions are given in pixels, and
+ * extended to the covering pairs of pixels (which share U and V).
+ */
+template <typename VideoFrameFormat, unsigned int width_, unsigned int height_>
+class PackedYUYVVideoFrameRegions
+{
+
+    typedef VideoFrame<VideoFrameFormat, width_, height_> RegionsVideoFrame;
+
+public:
+
+    // 2 bytes per pixel: Y0 U Y1 V ...
+    VideoPlaneSpan<unsigned char, width_ * 2, height_> packedSpan()
+    {
+        return VideoPlaneSpan<unsigned char, width_ * 2, height_>(frame().data());
+    }
+
+    VideoPlaneSpan<const unsigned char, width_ * 2, height_> packedSpan() const
+    {
+        return VideoPlaneSpan<const unsigned char, width_ * 2, height_>(frame().data());
+    }
+
+    void fillRectangle(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
+                       unsigned int x, unsigned int y,
+                       unsigned int rectangleWidth, unsigned int rectangleHeight)
+    {
+        if (!pairsRegion(x, y, rectangleWidth, rectangleHeight))
+            return;
+        unsigned int r;
+        for (r = 0; r < rectangleHeight; r++)
+            VideoPlaneKernels::fillRow(packedSpan().row(y + r) + 2 * x, 2 * rectangleWidth,
+                                       pattern(pixel));
+    }
+
+    // alpha: 0 (transparent) ... 255 (opaque)
+    void blendRectangle(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
+                        unsigned char alpha, unsigned int x, unsigned int y,
+                        unsigned int rectangleWidth, unsigned int rectangleHeight)
+    {
+        unsigned int weight = VideoPlaneKernels::weight(alpha);
+        if (weight == 256)
+            fillRectangle(pixel, x, y, rectangleWidth, rectangleHeight);
+        if (weight == 0 || weight == 256 || !pairsRegion(x, y, rectangleWidth, rectangleHeight))
+            return;
+        unsigned int r;
+        for (r = 0; r < rectangleHeight; r++)
+            VideoPlaneKernels::blendRowWithPattern(packedSpan().row(y + r) + 2 * x,
+                                                   2 * rectangleWidth, pattern(pixel), weight);
+    }
+
+    // The regions must not overlap
+    template <unsigned int sourceWidth, unsigned int sourceHeight>
+    void copyRegion(const VideoFrame<VideoFrameFormat, sourceWidth, sourceHeight>& sourceVideoFrame,
+                    unsigned int sourceX, unsigned int sourceY,
+                    unsigned int regionWidth, unsigned int regionHeight,
+                    unsigned int x, unsigned int y)
+    {
+        packedSpan().copyFrom(sourceVideoFrame.packedSpan(), 2 * (sourceX & ~1u), sourceY,
+                              2 * regionWidth, regionHeight, 2 * (x & ~1u), y);
+    }
+
+    // Blends the whole source frame at (x, y). alpha: 0 (transparent) ... 255 (opaque)
+    template <unsigned int sourceWidth, unsigned int sourceHeight>
+    void overlay(const VideoFrame<VideoFrameFormat, sourceWidth, sourceHeight>& sourceVideoFrame,
+                 unsigned int x, unsigned int y, unsigned char alpha = 255)
+    {
+        packedSpan().overlay(sourceVideoFrame.packedSpan(), 2 * (x & ~1u), y, alpha);
+    }
+
+    // I.E: a privacy mask. The pixels whose mask value is not 0 are replaced
+    template <typename MaskSample>
+    void applyMask(const VideoPlaneSpan<MaskSample, width_, height_>& maskSpan,
+                   const Pixel<unsigned char, unsigned char, unsigned char>& pixel)
+    {
+        unsigned int y;
+        for (y = 0; y < height_; y++)
+            VideoPlaneKernels::maskRow<VideoPlaneKernels::MASK_UPSAMPLED>(
+                packedSpan().row(y), 2 * width_, maskSpan.row(y), width_, pattern(pixel));
+    }
+
+private:
+
+    static uint32_t pattern(const Pixel<unsigned char, unsigned char, unsigned char>& pixel)
+    {
+        return pixel.component<0>() | (pixel.component<1>() << 8) |
+               (pixel.component<0>() << 16) | ((uint32_t)pixel.component<2>() << 24);
+    }
+
+    // Clips the region and extends it to pairs of pixels
+    static bool pairsRegion(unsigned int& x, unsigned int& y,
+                            unsigned int& regionWidth, unsigned int& regionHeight)
+    {
+        if (!VideoPlaneSpan<unsigned char, width_, height_>::clipRegion(x, y, regionWidth, regionHeight))
+            return false;
+        unsigned int lastX = std::min((x + regionWidth + 1) & ~1u, width_);
+        x &= ~1u;
+        regionWidth = lastX - x;
+        return true;
+    }
+
+    RegionsVideoFrame& frame()
+    {
+        return static_cast<RegionsVideoFrame&>(*this);
+    }
+
+    const RegionsVideoFrame& frame() const
+    {
+        return static_cast<const RegionsVideoFrame&>(*this);
+    }
+
+};
+
+}
+
+#endif // VIDEOPLANESPAN_HPP_INCLUDED
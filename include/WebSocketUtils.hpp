@@ -0,0 +1,206 @@
+/*
+ * Created (25/04/2017) by Paolo-Pr.
+ * For conditions of distribution and use, see the accompanying LICENSE file.
+ *
+ */
+
+#ifndef WEBSOCKETUTILS_HPP_INCLUDED
+#define WEBSOCKETUTILS_HPP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace laav
+{
+
+/*
+ * The server side of the WebSocket protocol (RFC 6455) needed by the streamers: the opening
+ * handshake's key and the framing. The server's frames are never masked nor fragmented;
+ * the clients' ones are always masked.
+ */
+struct WebSocketUtils
+{
+    enum Opcode
+    {
+        CONTINUATION_FRAME = 0x0,
+        TEXT_FRAME = 0x1,
+        BINARY_FRAME = 0x2,
+        CLOSE_FRAME = 0x8,
+        PING_FRAME = 0x9,
+        PONG_FRAME = 0xA
+    };
+
+    static const size_t MAX_FRAME_HEADER_SIZE = 10;
+
+    // The Sec-WebSocket-Accept value for the client's Sec-WebSocket-Key
+    static std::string acceptKey(const std::string& clientKey)
+    {
+        uint8_t digest[20];
+        sha1(clientKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+        return base64(digest, sizeof(digest));
+    }
+
+    // Returns the header's size
+    static size_t writeFrameHeader(enum Opcode opcode, uint64_t payloadSize,
+                                   uint8_t header[MAX_FRAME_HEADER_SIZE])
+    {
+        // FIN
+        header[0] = 0x80 | opcode;
+        if (payloadSize < 126)
+        {
+            header[1] = payloadSize;
+            return 2;
+        }
+        if (payloadSize <= 0xFFFF)
+        {
+            header[1] = 126;
+            header[2] = payloadSize >> 8;
+            header[3] = payloadSize & 0xFF;
+            return 4;
+        }
+        header[1] = 127;
+        unsigned int n;
+        for (n = 0; n < 8; n++)
+            header[2 + n] = (payloadSize >> (56 - 8 * n)) & 0xFF;
+        return 10;
+    }
+
+    /*
+     * Parses the client's frame at the beginning of data and unmasks its payload.
+     * Returns the frame's size, 0 if the frame isn't complete yet.
+     */
+    static size_t readClientFrame(const uint8_t* data, size_t size,
+                                  unsigned int& opcode, std::string& payload)
+    {
+        if (size < 2)
+            return 0;
+        opcode = data[0] & 0x0F;
+        bool masked = (data[1] & 0x80) != 0;
+        uint64_t payloadSize = data[1] & 0x7F;
+        size_t offset = 2;
+        if (payloadSize == 126 || payloadSize == 127)
+        {
+            size_t sizeBytes = payloadSize == 126 ? 2 : 8;
+            if (size < offset + sizeBytes)
+                return 0;
+            payloadSize = 0;
+            unsigned int n;
+            for (n = 0; n < sizeBytes; n++)
+                payloadSize = (payloadSize << 8) | data[offset + n];
+            offset += sizeBytes;
+        }
+        const uint8_t* mask = data + offset;
+        if (masked)
+            offset += 4;
+        if (size < offset || size - offset < payloadSize)
+            return 0;
+        payload.assign((const char* )data + offset, payloadSize);
+        if (masked)
+        {
+            size_t n;
+            for (n = 0; n < payload.size(); n++)
+                payload[n] ^= mask[n % 4];
+        }
+        return offset + payloadSize;
+    }
+
+private:
+
+    static uint32_t rotateLeft(uint32_t value, unsigned int bits)
+    {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    // Only used for the handshake's keys, which are a few bytes long
+    static void sha1(const std::string& message, uint8_t digest[20])
+    {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        std::string padded = message;
+        padded += (char)0x80;
+        while (padded.size() % 64 != 56)
+            padded += (char)0x00;
+        uint64_t messageBits = (uint64_t)message.size() * 8;
+        int n;
+        for (n = 7; n >= 0; n--)
+            padded += (char)((messageBits >> (8 * n)) & 0xFF);
+
+        size_t block;
+        for (block = 0; block < padded.size(); block += 64)
+        {
+            uint32_t w[80];
+            for (n = 0; n < 16; n++)
+                w[n] = ((uint32_t)(uint8_t)padded[block + 4 * n] << 24) |
+                       ((uint32_t)(uint8_t)padded[block + 4 * n + 1] << 16) |
+                       ((uint32_t)(uint8_t)padded[block + 4 * n + 2] << 8) |
+                       (uint32_t)(uint8_t)padded[block + 4 * n + 3];
+            for (n = 16; n < 80; n++)
+                w[n] = rotateLeft(w[n - 3] ^ w[n - 8] ^ w[n - 14] ^ w[n - 16], 1);
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (n = 0; n < 80; n++)
+            {
+                uint32_t f, k;
+                if (n < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if (n < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if (n < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t temp = rotateLeft(a, 5) + f + e + k + w[n];
+                e = d;
+                d = c;
+                c = rotateLeft(b, 30);
+                b = a;
+                a = temp;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+        for (n = 0; n < 20; n++)
+            digest[n] = (h[n / 4] >> (24 - 8 * (n % 4))) & 0xFF;
+    }
+
+    static std::string base64(const uint8_t* data, size_t size)
+    {
+        static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string encoded;
+        size_t n;
+        for (n = 0; n < size; n += 3)
+        {
+            uint32_t triple = (uint32_t)data[n] << 16;
+            if (n + 1 < size)
+                triple |= (uint32_t)data[n + 1] << 8;
+            if (n + 2 < size)
+                triple |= data[n + 2];
+            encoded += alphabet[(triple >> 18) & 0x3F];
+            encoded += alphabet[(triple >> 12) & 0x3F];
+            encoded += n + 1 < size ? alphabet[(triple >> 6) & 0x3F] : '=';
+            encoded += n + 2 < size ? alphabet[triple & 0x3F] : '=';
+        }
+        return encoded;
+    }
+
+};
+
+}
+
+#endif // WEBSOCKETUTILS_HPP_INCLUDED
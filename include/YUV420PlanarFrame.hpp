@@ -8,6 +8,7 @@
 #define YUV420PLANARFRAME_HPP_INCLUDED
 
 #include "Frame.hpp"
+#include "VideoPlaneSpan.hpp"
 
 namespace laav
 {
@@ -18,7 +19,8 @@ template <unsigned int width_, unsigned int height_>
 class VideoFrame<YUV420_PLANAR, width_, height_> :
 public VideoFrameBase<width_, height_>,
 public Planar3RawVideoFrame,
-public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
+public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>,
+public Planar3VideoFrameRegions<YUV420_PLANAR, width_, height_, 1, 1>
 {
 
 public:
@@ -37,11 +39,9 @@ public:
         if (x > width_ - 1 || y > height_ - 1)
             throw OutOfBounds();
 
-        uint16_t x1 = x / 2;
-        mCurrPixel.set(this->plane<0>()[y * width_ + x],
-                       this->plane<1>()[y * width_ / 4 + x1],
-                       this->plane<1>()[y * width_ / 4 + x1]);
-
+        mCurrPixel.set(this->plane<0>()[this->template sampleOffset<0>(x, y)],
+                       this->plane<1>()[this->template sampleOffset<1>(x, y)],
+                       this->plane<2>()[this->template sampleOffset<2>(x, y)]);
         return mCurrPixel;
     }
 
@@ -53,11 +53,10 @@ public:
     {
         if (x > width_ - 1 || y > height_ - 1)
             throw OutOfBounds();
-        
-        this->plane<0>()[y * width_ + x] = pixel.component<0>();
-        uint16_t x1 = x / 2;
-        this->plane<1>()[y * width_ / 4 + x1] = pixel.component<1>();
-        this->plane<2>()[y * width_ / 4 + x1] = pixel.component<2>();
+
+        this->plane<0>()[this->template sampleOffset<0>(x, y)] = pixel.component<0>();
+        this->plane<1>()[this->template sampleOffset<1>(x, y)] = pixel.component<1>();
+        this->plane<2>()[this->template sampleOffset<2>(x, y)] = pixel.component<2>();
     }
 
 };
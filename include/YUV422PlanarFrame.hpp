@@ -8,6 +8,7 @@
 #define YUV422PLANARFRAME_HPP_INCLUDED
 
 #include "Frame.hpp"
+#include "VideoPlaneSpan.hpp"
 
 namespace laav
 {
@@ -18,7 +19,8 @@ template <unsigned int width_, unsigned int height_>
 class VideoFrame<YUV422_PLANAR, width_, height_> :
 public VideoFrameBase<width_, height_>,
 public Planar3RawVideoFrame,
-public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
+public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>,
+public Planar3VideoFrameRegions<YUV422_PLANAR, width_, height_, 1, 0>
 {
 
 public:
@@ -31,9 +33,15 @@ public:
     /*!
      *  \exception OutOfBounds
      */    
-    const Pixel<unsigned char, unsigned char, unsigned char>& pixelAt(uint16_t x, uint16_t y) const
+    const Pixel<unsigned char, unsigned char, unsigned char>&
+    pixelAt(uint16_t x, uint16_t y) const
     {
-        printAndThrowUnrecoverableError("NOT IMPLEMENTED YET! TODO!");
+        if (x > width_ - 1 || y > height_ - 1)
+            throw OutOfBounds();
+
+        mCurrPixel.set(this->plane<0>()[this->template sampleOffset<0>(x, y)],
+                       this->plane<1>()[this->template sampleOffset<1>(x, y)],
+                       this->plane<2>()[this->template sampleOffset<2>(x, y)]);
         return mCurrPixel;
     }
 
@@ -43,7 +51,12 @@ public:
     void setPixelAt(const Pixel<unsigned char, unsigned char, unsigned char>& pixel,
                     uint16_t x, uint16_t y)
     {
-        printAndThrowUnrecoverableError("NOT IMPLEMENTED YET! TODO!");
+        if (x > width_ - 1 || y > height_ - 1)
+            throw OutOfBounds();
+
+        this->plane<0>()[this->template sampleOffset<0>(x, y)] = pixel.component<0>();
+        this->plane<1>()[this->template sampleOffset<1>(x, y)] = pixel.component<1>();
+        this->plane<2>()[this->template sampleOffset<2>(x, y)] = pixel.component<2>();
     }
 
 };
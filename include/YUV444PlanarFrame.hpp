@@ -7,6 +7,8 @@
 #ifndef YUV444PLANARFRAME_HPP_INCLUDED
 #define YUV444PLANARFRAME_HPP_INCLUDED
 
+#include "VideoPlaneSpan.hpp"
+
 namespace laav
 {
 
@@ -16,7 +18,8 @@ template <unsigned int width_, unsigned int height_>
 class VideoFrame<YUV444_PLANAR, width_, height_> :
 public VideoFrameBase<width_, height_>,
 public Planar3RawVideoFrame,
-public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
+public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>,
+public Planar3VideoFrameRegions<YUV444_PLANAR, width_, height_, 0, 0>
 {
 
 public:
@@ -29,14 +32,15 @@ public:
     /*!
      *  \exception OutOfBounds
      */    
-    const Pixel<unsigned char, unsigned char, unsigned char>& pixelAt(uint16_t x, uint16_t y) const
+    const Pixel<unsigned char, unsigned char, unsigned char>&
+    pixelAt(uint16_t x, uint16_t y) const
     {
         if (x > width_ - 1 || y > height_ - 1)
             throw OutOfBounds();
-        
-        mCurrPixel.set(this->plane<0>()[y * width_ + x],
-                       this->plane<1>()[y * width_ + x],
-                       this->plane<1>()[y * width_ + x]);
+
+        mCurrPixel.set(this->plane<0>()[this->template sampleOffset<0>(x, y)],
+                       this->plane<1>()[this->template sampleOffset<1>(x, y)],
+                       this->plane<2>()[this->template sampleOffset<2>(x, y)]);
         return mCurrPixel;
     }
 
@@ -48,10 +52,10 @@ public:
     {
         if (x > width_ - 1 || y > height_ - 1)
             throw OutOfBounds();
-        
-        this->plane<0>()[y * width_ + x] = pixel.component<0>();
-        this->plane<1>()[y * width_ + x] = pixel.component<1>();
-        this->plane<2>()[y * width_ + x] = pixel.component<2>();
+
+        this->plane<0>()[this->template sampleOffset<0>(x, y)] = pixel.component<0>();
+        this->plane<1>()[this->template sampleOffset<1>(x, y)] = pixel.component<1>();
+        this->plane<2>()[this->template sampleOffset<2>(x, y)] = pixel.component<2>();
     }
 
 };
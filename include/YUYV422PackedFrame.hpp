@@ -7,6 +7,8 @@
 #ifndef YUYV422PACKEDFRAME_HPP_INCLUDED
 #define YUYV422PACKEDFRAME_HPP_INCLUDED
 
+#include "VideoPlaneSpan.hpp"
+
 namespace laav
 {
 
@@ -16,7 +18,8 @@ template <unsigned int width_, unsigned int height_>
 class VideoFrame<YUYV422_PACKED, width_, height_> :
 public VideoFrameBase<width_, height_>,
 public PackedRawVideoFrame,
-public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>
+public FormattedRawVideoFrame<unsigned char, unsigned char, unsigned char>,
+public PackedYUYVVideoFrameRegions<YUYV422_PACKED, width_, height_>
 {
 
 public: